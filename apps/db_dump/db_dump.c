@@ -228,7 +228,6 @@ static int dump__msg_store_chunk_process(FILE *db_fptr, uint32_t length)
 {
 	struct P_msg_store chunk;
 	struct mosquitto_msg_store *stored = NULL;
-	struct mosquitto_msg_store_load *load;
 	int64_t message_expiry_interval64;
 	uint32_t message_expiry_interval;
 	int rc = 0;
@@ -248,17 +247,6 @@ static int dump__msg_store_chunk_process(FILE *db_fptr, uint32_t length)
 		return rc;
 	}
 
-	load = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store_load));
-	if(!load){
-		fclose(db_fptr);
-		mosquitto__free(chunk.source.id);
-		mosquitto__free(chunk.source.username);
-		mosquitto__free(chunk.topic);
-		mosquitto__free(chunk.payload);
-		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
-		return MOSQ_ERR_NOMEM;
-	}
-
 	if(chunk.F.expiry_time > 0){
 		message_expiry_interval64 = chunk.F.expiry_time - time(NULL);
 		if(message_expiry_interval64 < 0 || message_expiry_interval64 > UINT32_MAX){
@@ -272,7 +260,6 @@ static int dump__msg_store_chunk_process(FILE *db_fptr, uint32_t length)
 
 	stored = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
 	if(stored == NULL){
-		mosquitto__free(load);
 		fclose(db_fptr);
 		mosquitto__free(chunk.source.id);
 		mosquitto__free(chunk.source.username);
@@ -296,14 +283,10 @@ static int dump__msg_store_chunk_process(FILE *db_fptr, uint32_t length)
 	chunk.source.id = NULL;
 	chunk.source.username = NULL;
 
-	if(rc == MOSQ_ERR_SUCCESS){
-		stored->source_listener = chunk.source.listener;
-		load->db_id = stored->db_id;
-		load->store = stored;
-
-		HASH_ADD(hh, db.msg_store_load, db_id, sizeof(dbid_t), load);
-	}else{
-		mosquitto__free(load);
+	/* Nothing looks the message up again, and the topic, payload and
+	 * properties are freed with the chunk. */
+	mosquitto__free(stored);
+	if(rc){
 		fclose(db_fptr);
 		return rc;
 	}
@@ -3,12 +3,34 @@
 
 #include "mosquitto_broker_internal.h"
 #include "mosquitto_internal.h"
+#include "net_mosq.h"
+#include "persist.h"
 
 struct mosquitto *context__init(mosq_sock_t sock)
 {
 	return NULL;
 }
 
+void context__cleanup(struct mosquitto *context, bool force_free)
+{
+}
+
+void db__message_add_to_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+}
+
+void db__message_add_to_queued(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+}
+
+void db__message_remove_from_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+}
+
+void db__message_remove_from_queued(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+}
+
 int db__message_store(const struct mosquitto *source, struct mosquitto_msg_store *stored, uint32_t message_expiry_interval, dbid_t store_id, enum mosquitto_msg_origin origin)
 {
     return 0;
@@ -18,6 +40,18 @@ void db__msg_store_ref_inc(struct mosquitto_msg_store *store)
 {
 }
 
+void db__msg_store_ref_dec(struct mosquitto_msg_store **store)
+{
+}
+
+void db__msg_store_compact(void)
+{
+}
+
+void do_disconnect(struct mosquitto *context, int reason)
+{
+}
+
 int handle__packet(struct mosquitto *context)
 {
 	return 0;
@@ -58,6 +92,25 @@ ssize_t net__write(struct mosquitto *mosq, const void *buf, size_t count)
 	return 0;
 }
 
+ssize_t net__writev(struct mosquitto *mosq, const struct iovec *iov, int iovcnt)
+{
+	return 0;
+}
+
+char *persist__journal_filename(const char *suffix)
+{
+	return NULL;
+}
+
+int persist__journal_open(uint64_t generation, long valid_length, bool save_needed)
+{
+	return 0;
+}
+
+void persist__journal_sync(void)
+{
+}
+
 int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **split_topics)
 {
 	return 0;
@@ -68,6 +121,11 @@ int sub__add(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t i
 	return 0;
 }
 
+int sub__remove(struct mosquitto *context, const char *sub, struct mosquitto__subhier *root, uint8_t *reason)
+{
+	return 0;
+}
+
 int sub__messages_queue(const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store **stored)
 {
 	return 0;
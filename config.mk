@@ -111,6 +111,10 @@ WITH_CJSON:=yes
 # Build mosquitto with support for the $CONTROL topics.
 WITH_CONTROL:=yes
 
+# Build the broker with support for checking passwords on worker threads, set
+# with the auth_worker_threads option. Requires WITH_TLS=yes.
+WITH_AUTH_THREADS:=yes
+
 # Build the broker with the jemalloc allocator
 WITH_JEMALLOC:=no
 
@@ -243,6 +247,13 @@ ifeq ($(WITH_TLS),yes)
 	endif
 endif
 
+ifeq ($(WITH_AUTH_THREADS),yes)
+	ifeq ($(WITH_TLS),yes)
+		BROKER_CPPFLAGS:=$(BROKER_CPPFLAGS) -DWITH_AUTH_THREADS
+		BROKER_LDADD:=$(BROKER_LDADD) -lpthread
+	endif
+endif
+
 ifeq ($(WITH_THREADING),yes)
 	LIB_LIBADD:=$(LIB_LIBADD) -lpthread
 	LIB_CPPFLAGS:=$(LIB_CPPFLAGS) -DWITH_THREADING
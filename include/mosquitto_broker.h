@@ -197,6 +197,13 @@ typedef struct mosquitto_plugin_id_t mosquitto_plugin_id_t;
  *  cb_func - the callback function
  *  event_data - event specific data
  *
+ * The results of MOSQ_EVT_ACL_CHECK callbacks are cached for each client if
+ * the acl_cache_size option is set, so a callback is not called again for the
+ * same client, topic, access, QoS and retain flag until the cache is
+ * invalidated. Call <mosquitto_acl_cache_disable> after registering if this
+ * isn't appropriate, or call <mosquitto_acl_cache_invalidate> when your access
+ * control changes.
+ *
  * Returns:
  *	MOSQ_ERR_SUCCESS - on success
  *	MOSQ_ERR_INVAL - if cb_func is NULL
@@ -461,6 +468,106 @@ mosq_EXPORT int mosquitto_kick_client_by_clientid(const char *clientid, bool wit
  */
 mosq_EXPORT int mosquitto_kick_client_by_username(const char *username, bool with_will);
 
+/* Function: mosquitto_acl_cache_invalidate
+ *
+ * Discard cached ACL check results, so the next check for each topic is made
+ * in full. Call this when the access granted by your plugin changes.
+ *
+ * If clientid != NULL, then only the results for the client with the matching
+ *   client id are discarded.
+ * If clientid == NULL, then the results for all clients are discarded.
+ *
+ * Returns:
+ *   MOSQ_ERR_SUCCESS - on success
+ *   MOSQ_ERR_NOT_FOUND - if clientid != NULL and no client has that id
+ */
+mosq_EXPORT int mosquitto_acl_cache_invalidate(const char *clientid);
+
+/* Function: mosquitto_acl_cache_disable
+ *
+ * Stop the results of a MOSQ_EVT_ACL_CHECK callback being cached. Call this
+ * after registering the callback if its result depends on more than the
+ * client, topic, access, QoS and retain flag, for example on the payload.
+ *
+ * Parameters:
+ *  identifier - the plugin identifier, as provided by <mosquitto_plugin_init>.
+ *  cb_func - the callback function, already registered for MOSQ_EVT_ACL_CHECK
+ *
+ * Returns:
+ *   MOSQ_ERR_SUCCESS - on success
+ *   MOSQ_ERR_INVAL - if cb_func is NULL
+ *   MOSQ_ERR_NOT_FOUND - if cb_func isn't registered for MOSQ_EVT_ACL_CHECK
+ */
+mosq_EXPORT int mosquitto_acl_cache_disable(mosquitto_plugin_id_t *identifier, MOSQ_FUNC_generic_callback cb_func);
+
+
+/* =========================================================================
+ *
+ * Section: Password checking
+ *
+ * ========================================================================= */
+
+/* Function: mosquitto_basic_auth_pbkdf2_check
+ *
+ * Check a client's password against a PBKDF2-SHA512 hash, for use in a
+ * MOSQ_EVT_BASIC_AUTH callback.
+ *
+ * If the broker has auth_worker_threads set and the client is connecting, the
+ * hash is computed on a worker thread so the broker isn't held up.
+ * MOSQ_ERR_AUTH_DELAYED is returned, and the callback must return this
+ * value. The CONNECT is completed once the check is done, as though the
+ * callback had returned the result of the check. Otherwise the check is made
+ * straight away. If max_pending_auth checks are already waiting, the check
+ * isn't made and MOSQ_ERR_AUTH is returned. The client is then refused with
+ * "server busy".
+ *
+ * If the broker has auth_cache_ttl set, a password that has recently been
+ * checked successfully against the same hash is accepted without computing
+ * the hash again. Call <mosquitto_auth_cache_invalidate> when a client's
+ * password changes.
+ *
+ * Parameters:
+ *   client - the client being authenticated
+ *   password - the password the client sent
+ *   salt - the salt used for the hash
+ *   salt_len - the length of salt
+ *   iterations - the number of PBKDF2 iterations used for the hash
+ *   hash - the hash to compare against
+ *   hash_len - the length of hash
+ *
+ * Returns:
+ *   MOSQ_ERR_SUCCESS - if the password matches
+ *   MOSQ_ERR_AUTH - if the password does not match, or the broker is too busy
+ *   MOSQ_ERR_AUTH_DELAYED - if the check is being made on a worker thread
+ *   MOSQ_ERR_INVAL - if an argument is invalid
+ *   MOSQ_ERR_NOMEM - on out of memory
+ *   MOSQ_ERR_NOT_SUPPORTED - if the broker was built without TLS support
+ */
+mosq_EXPORT int mosquitto_basic_auth_pbkdf2_check(
+		struct mosquitto *client,
+		const char *password,
+		const unsigned char *salt,
+		int salt_len,
+		int iterations,
+		const unsigned char *hash,
+		int hash_len);
+
+/* Function: mosquitto_auth_cache_invalidate
+ *
+ * Discard the record of successful checks made by
+ * <mosquitto_basic_auth_pbkdf2_check>, so the next check for each client is
+ * made in full. Call this when a password known to your plugin changes or is
+ * removed.
+ *
+ * If username != NULL, then only the checks for clients with that username
+ *   are discarded.
+ * If username == NULL, then the checks for all clients are discarded.
+ *
+ * Returns:
+ *   MOSQ_ERR_SUCCESS - on success
+ */
+mosq_EXPORT int mosquitto_auth_cache_invalidate(const char *username);
+
 
 /* =========================================================================
  *
@@ -18,9 +18,11 @@ Contributors:
 
 #include "config.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "mosquitto.h"
 #include "memory_mosq.h"
 
 #ifdef REAL_WITH_MEMORY_TRACKING
@@ -162,3 +164,128 @@ char *mosquitto__strdup(const char *s)
 
 	return str;
 }
+
+#ifdef WITH_BROKER
+/* Fixed size object pools.
+ *
+ * Objects are carved out of slabs of MEMORY_POOL_SLAB_SIZE bytes and returned
+ * to a per-pool free list when released, so frequently allocated objects
+ * don't go through malloc each time. Slabs are only freed when the pools are
+ * cleaned up, so the memory used by each pool stays at its high water mark.
+ */
+#define MEMORY_POOL_SLAB_SIZE 16384
+
+struct memory__pool {
+	void *free_list;
+	void **slabs;
+	size_t obj_size;
+	unsigned long used;
+	unsigned long free;
+	int slab_count;
+};
+
+static struct memory__pool pools[mosq_pool_count];
+static bool pools_enabled = false;
+
+void memory__pool_enable(bool enable)
+{
+	pools_enabled = enable;
+}
+
+bool memory__pool_enabled(void)
+{
+	return pools_enabled;
+}
+
+static int memory__pool_grow(struct memory__pool *pool)
+{
+	void **slabs;
+	uint8_t *slab;
+	size_t count, i;
+
+	slabs = mosquitto__realloc(pool->slabs, sizeof(void *)*(size_t)(pool->slab_count+1));
+	if(!slabs) return MOSQ_ERR_NOMEM;
+	pool->slabs = slabs;
+
+	slab = mosquitto__malloc(MEMORY_POOL_SLAB_SIZE);
+	if(!slab) return MOSQ_ERR_NOMEM;
+	pool->slabs[pool->slab_count] = slab;
+	pool->slab_count++;
+
+	count = MEMORY_POOL_SLAB_SIZE / pool->obj_size;
+	for(i=0; i<count; i++){
+		*(void **)&slab[i*pool->obj_size] = pool->free_list;
+		pool->free_list = &slab[i*pool->obj_size];
+	}
+	pool->free += count;
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+void memory__pool_cleanup(void)
+{
+	int i, j;
+
+	for(i=0; i<mosq_pool_count; i++){
+		for(j=0; j<pools[i].slab_count; j++){
+			mosquitto__free(pools[i].slabs[j]);
+		}
+		mosquitto__free(pools[i].slabs);
+		memset(&pools[i], 0, sizeof(struct memory__pool));
+	}
+}
+
+void memory__pool_stats(enum mosquitto__pool_type type, unsigned long *used, unsigned long *free_count)
+{
+	*used = pools[type].used;
+	*free_count = pools[type].free;
+}
+#endif
+
+void *mosquitto__pool_calloc(enum mosquitto__pool_type type, size_t size)
+{
+#ifdef WITH_BROKER
+	struct memory__pool *pool;
+	void *mem;
+
+	if(pools_enabled){
+		pool = &pools[type];
+		if(pool->obj_size == 0){
+			/* Keep every object pointer aligned */
+			pool->obj_size = (size + sizeof(void *)*2 - 1) & ~(sizeof(void *)*2 - 1);
+		}
+		if(!pool->free_list && memory__pool_grow(pool)){
+			return NULL;
+		}
+		mem = pool->free_list;
+		pool->free_list = *(void **)mem;
+		pool->free--;
+		pool->used++;
+		memset(mem, 0, size);
+		return mem;
+	}
+#else
+	UNUSED(type);
+#endif
+	return mosquitto__calloc(1, size);
+}
+
+void mosquitto__pool_free(enum mosquitto__pool_type type, void *mem)
+{
+#ifdef WITH_BROKER
+	struct memory__pool *pool;
+
+	if(pools_enabled){
+		if(!mem) return;
+		pool = &pools[type];
+		*(void **)mem = pool->free_list;
+		pool->free_list = mem;
+		pool->free++;
+		pool->used--;
+		return;
+	}
+#else
+	UNUSED(type);
+#endif
+	mosquitto__free(mem);
+}
@@ -19,6 +19,7 @@ Contributors:
 #ifndef MEMORY_MOSQ_H
 #define MEMORY_MOSQ_H
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <sys/types.h>
 
@@ -36,8 +37,24 @@ unsigned long mosquitto__max_memory_used(void);
 void *mosquitto__realloc(void *ptr, size_t size);
 char *mosquitto__strdup(const char *s);
 
+/* Objects that can be allocated from a fixed size pool in the broker. In the
+ * library, and when pools aren't enabled, these use calloc/free. */
+enum mosquitto__pool_type {
+	mosq_pool_client_msg = 0,
+	mosq_pool_msg_store = 1,
+	mosq_pool_packet = 2,
+	mosq_pool_count = 3
+};
+
+void *mosquitto__pool_calloc(enum mosquitto__pool_type type, size_t size);
+void mosquitto__pool_free(enum mosquitto__pool_type type, void *mem);
+
 #ifdef WITH_BROKER
 void memory__set_limit(size_t lim);
+void memory__pool_enable(bool enable);
+bool memory__pool_enabled(void);
+void memory__pool_cleanup(void);
+void memory__pool_stats(enum mosquitto__pool_type type, unsigned long *used, unsigned long *free_count);
 #endif
 
 #endif
@@ -64,6 +64,7 @@ Contributors:
 #  endif
 #  include "uthash.h"
 struct mosquitto_client_msg;
+struct mosquitto_msg_store;
 #endif
 
 #ifdef WIN32
@@ -114,6 +115,7 @@ enum mosquitto_client_state {
 	mosq_cs_disused = 19, /* client that has been added to the disused list to be freed */
 	mosq_cs_authenticating = 20, /* Client has sent CONNECT but is still undergoing extended authentication */
 	mosq_cs_reauthenticating = 21, /* Client is undergoing reauthentication and shouldn't do anything else until complete */
+	mosq_cs_auth_pending = 22, /* Client has sent CONNECT and is waiting for its password to be checked */
 };
 
 enum mosquitto__protocol {
@@ -143,10 +145,13 @@ struct mosquitto__alias{
 	uint16_t alias;
 };
 
-struct session_expiry_list {
+/* An entry in one of the broker's timer heaps, see src/timer_heap.c. index is
+ * the position in the heap, starting at 1, or 0 if not in a heap. */
+struct mosquitto__timer{
 	struct mosquitto *context;
-	struct session_expiry_list *prev;
-	struct session_expiry_list *next;
+	time_t time;
+	uint64_t seq;
+	size_t index;
 };
 
 struct mosquitto__packet{
@@ -160,6 +165,13 @@ struct mosquitto__packet{
 	uint16_t mid;
 	uint8_t command;
 	int8_t remaining_count;
+#ifdef WITH_BROKER
+	/* If set, the packet body ends with the payload of this stored message,
+	 * which is written directly from the store rather than being copied into
+	 * payload. The packet holds a reference to the store. Kept last so the
+	 * rest of the layout is the same for code built without WITH_BROKER. */
+	struct mosquitto_msg_store *store;
+#endif
 };
 
 struct mosquitto_message_all{
@@ -180,20 +192,17 @@ enum mosquitto__keyform {
 };
 #endif
 
-struct will_delay_list {
-	struct mosquitto *context;
-	struct will_delay_list *prev;
-	struct will_delay_list *next;
-};
-
 struct mosquitto_msg_data{
 #ifdef WITH_BROKER
 	struct mosquitto_client_msg *inflight;
 	struct mosquitto_client_msg *queued;
+	struct mosquitto_client_msg *inflight_by_mid; /* Indexes of the lists above, by mid */
+	struct mosquitto_client_msg *queued_by_mid;
 	unsigned long msg_bytes;
 	unsigned long msg_bytes12;
 	int msg_count;
 	int msg_count12;
+	int inflight_count;
 #else
 	struct mosquitto_message_all *inflight;
 	int queue_len;
@@ -235,7 +244,6 @@ struct mosquitto {
 	struct mosquitto__packet *out_packet;
 	struct mosquitto_message_all *will;
 	struct mosquitto__alias *aliases;
-	struct will_delay_list *will_delay_entry;
 	int alias_count;
 	uint32_t will_delay_interval;
 	time_t will_delay_time;
@@ -284,13 +292,25 @@ struct mosquitto {
 	struct mosquitto_msg_data msgs_in;
 	struct mosquitto_msg_data msgs_out;
 	struct mosquitto__acl_user *acl_list;
+	struct mosquitto__acl_cache_entry *acl_cache; /* Most recently used first */
+	int acl_cache_size;
+	int acl_cache_count;
+	unsigned int acl_cache_epoch;
 	struct mosquitto__listener *listener;
 	struct mosquitto__packet *out_packet_last;
 	struct mosquitto__subhier **subs;
 	struct mosquitto__subshared_ref **shared_subs;
 	char *auth_method;
+	uint64_t last_out_db_id; /* db_id of the last message queued, to suppress duplicates */
+	struct mosquitto *keepalive_next;
+	struct mosquitto *keepalive_prev;
+	int keepalive_slot;
 	int sub_count;
 	int shared_sub_count;
+	struct auth_worker__job *auth_job; /* Password check in progress for the CONNECT */
+	bool auth_busy; /* Password check refused because of max_pending_auth */
+	uint8_t *in_held; /* Data read after a CONNECT held for a password check */
+	size_t in_held_len;
 #  ifndef WITH_EPOLL
 	int pollfd_index;
 #  endif
@@ -347,7 +367,11 @@ struct mosquitto {
 	UT_hash_handle hh_id;
 	UT_hash_handle hh_sock;
 	struct mosquitto *for_free_next;
-	struct session_expiry_list *expiry_list_item;
+	struct mosquitto *for_write_next;
+	struct mosquitto *for_write_prev;
+	bool for_write;
+	struct mosquitto__timer expiry_timer;
+	struct mosquitto__timer will_delay_timer;
 	uint16_t remote_port;
 #endif
 	uint32_t events;
@@ -74,6 +74,7 @@ Contributors:
 #include "memory_mosq.h"
 #include "mqtt_protocol.h"
 #include "net_mosq.h"
+#include "packet_mosq.h"
 #include "time_mosq.h"
 #include "util_mosq.h"
 
@@ -210,6 +211,11 @@ int net__socket_close(struct mosquitto *mosq)
 #endif
 
 	assert(mosq);
+#ifdef WITH_BROKER
+	/* The socket may already have been removed from the mux, so this
+	 * final write must not register for write events. */
+	packet__write_closing(mosq);
+#endif
 #ifdef WITH_TLS
 #ifdef WITH_WEBSOCKETS
 	if(!mosq->wsi)
@@ -1040,6 +1046,49 @@ ssize_t net__write(struct mosquitto *mosq, const void *buf, size_t count)
 }
 
 
+#ifdef WITH_BROKER
+/* Write as many of the buffers in iov as possible with a single call. */
+ssize_t net__writev(struct mosquitto *mosq, const struct iovec *iov, int iovcnt)
+{
+#ifdef WITH_TLS
+	static uint8_t tls_buf[16384];
+	size_t len, count;
+	int i;
+
+	if(mosq->ssl){
+		/* There is no SSL_writev(), so copy the buffers into one TLS record
+		 * instead. If a write has to be retried, OpenSSL requires that the
+		 * same buffer is passed again with at least the same length. That
+		 * holds here because the choice of which buffer to use depends only
+		 * on the first iovec, which is unchanged until something has been
+		 * written. */
+		if(iov[0].iov_len >= sizeof(tls_buf)){
+			return net__write(mosq, iov[0].iov_base, iov[0].iov_len);
+		}
+		len = 0;
+		for(i=0; i<iovcnt && len < sizeof(tls_buf); i++){
+			count = iov[i].iov_len;
+			if(count > sizeof(tls_buf) - len){
+				count = sizeof(tls_buf) - len;
+			}
+			memcpy(&tls_buf[len], iov[i].iov_base, count);
+			len += count;
+		}
+		return net__write(mosq, tls_buf, len);
+	}
+#endif
+
+#ifndef WIN32
+	errno = 0;
+	return writev(mosq->sock, iov, iovcnt);
+#else
+	UNUSED(iovcnt);
+	return net__write(mosq, iov[0].iov_base, iov[0].iov_len);
+#endif
+}
+#endif
+
+
 int net__socket_nonblock(mosq_sock_t *sock)
 {
 #ifndef WIN32
@@ -19,6 +19,7 @@ Contributors:
 #define NET_MOSQ_H
 
 #ifndef WIN32
+#  include <sys/uio.h>
 #  include <unistd.h>
 #else
 #  include <winsock2.h>
@@ -26,6 +27,10 @@ Contributors:
 typedef SSIZE_T ssize_t;
 #    define _SSIZE_T_DEFINED
 #  endif
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
 #endif
 
 #include "mosquitto_internal.h"
@@ -70,6 +75,9 @@ int net__socketpair(mosq_sock_t *sp1, mosq_sock_t *sp2);
 
 ssize_t net__read(struct mosquitto *mosq, void *buf, size_t count);
 ssize_t net__write(struct mosquitto *mosq, const void *buf, size_t count);
+#ifdef WITH_BROKER
+ssize_t net__writev(struct mosquitto *mosq, const struct iovec *iov, int iovcnt);
+#endif
 
 #ifdef WITH_TLS
 void net__print_ssl_error(struct mosquitto *mosq);
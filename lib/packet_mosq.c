@@ -20,6 +20,7 @@ Contributors:
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 
 #ifdef WITH_BROKER
@@ -40,17 +41,17 @@ Contributors:
 #ifdef WITH_BROKER
 #  include "sys_tree.h"
 #  include "send_mosq.h"
-#else
-#  define G_BYTES_RECEIVED_INC(A)
-#  define G_BYTES_SENT_INC(A)
-#  define G_MSGS_SENT_INC(A)
-#  define G_PUB_MSGS_SENT_INC(A)
+#  include "utlist.h"
+#  ifndef IOV_MAX
+#    define IOV_MAX 1024
+#  endif
 #endif
 
 int packet__alloc(struct mosquitto__packet *packet)
 {
 	uint8_t remaining_bytes[5], byte;
 	uint32_t remaining_length;
+	uint32_t alloc_length;
 	int i;
 
 	assert(packet);
@@ -70,10 +71,17 @@ int packet__alloc(struct mosquitto__packet *packet)
 	}while(remaining_length > 0 && packet->remaining_count < 5);
 	if(packet->remaining_count == 5) return MOSQ_ERR_PAYLOAD_SIZE;
 	packet->packet_length = packet->remaining_length + 1 + (uint8_t)packet->remaining_count;
+	alloc_length = packet->packet_length;
+#ifdef WITH_BROKER
+	if(packet->store){
+		/* The payload is written straight from the store. */
+		alloc_length -= packet->store->payloadlen;
+	}
+#endif
 #ifdef WITH_WEBSOCKETS
-	packet->payload = mosquitto__malloc(sizeof(uint8_t)*packet->packet_length + LWS_PRE);
+	packet->payload = mosquitto__malloc(sizeof(uint8_t)*alloc_length + LWS_PRE);
 #else
-	packet->payload = mosquitto__malloc(sizeof(uint8_t)*packet->packet_length);
+	packet->payload = mosquitto__malloc(sizeof(uint8_t)*alloc_length);
 #endif
 	if(!packet->payload) return MOSQ_ERR_NOMEM;
 
@@ -97,6 +105,12 @@ void packet__cleanup(struct mosquitto__packet *packet)
 	packet->remaining_length = 0;
 	mosquitto__free(packet->payload);
 	packet->payload = NULL;
+#ifdef WITH_BROKER
+	if(packet->store){
+		db__msg_store_ref_dec(&packet->store);
+		packet->store = NULL;
+	}
+#endif
 	packet->to_process = 0;
 	packet->pos = 0;
 }
@@ -120,7 +134,7 @@ void packet__cleanup_all_no_locks(struct mosquitto *mosq)
 		}
 
 		packet__cleanup(packet);
-		mosquitto__free(packet);
+		mosquitto__pool_free(mosq_pool_packet, packet);
 	}
 
 	packet__cleanup(&mosq->in_packet);
@@ -163,12 +177,16 @@ int packet__queue(struct mosquitto *mosq, struct mosquitto__packet *packet)
 	if(mosq->wsi){
 		lws_callback_on_writable(mosq->wsi);
 		return MOSQ_ERR_SUCCESS;
-	}else{
-		return packet__write(mosq);
 	}
-#  else
-	return packet__write(mosq);
 #  endif
+	/* Writing is deferred until packet__write_all() is called from the main
+	 * loop, so that everything queued for this client in the meantime can be
+	 * written with a single call. */
+	if(!mosq->for_write && mosq->sock != INVALID_SOCKET){
+		DL_APPEND2(db.ll_for_write, mosq, for_write_prev, for_write_next);
+		mosq->for_write = true;
+	}
+	return MOSQ_ERR_SUCCESS;
 #else
 
 	/* Write a single byte to sockpairW (connected to sockpairR) to break out
@@ -206,18 +224,196 @@ int packet__check_oversize(struct mosquitto *mosq, uint32_t remaining_length)
 }
 
 
-int packet__write(struct mosquitto *mosq)
+#ifdef WITH_BROKER
+/* Write any packets that have been queued for this client, but are waiting
+ * for packet__write_all(). */
+int packet__write_pending(struct mosquitto *mosq)
 {
+	if(!mosq->for_write){
+		return MOSQ_ERR_SUCCESS;
+	}
+	DL_DELETE2(db.ll_for_write, mosq, for_write_prev, for_write_next);
+	mosq->for_write = false;
+
+	return packet__write(mosq);
+}
+
+
+void packet__write_all(void)
+{
+	struct mosquitto *context;
+	int rc;
+
+	while(db.ll_for_write){
+		context = db.ll_for_write;
+		rc = packet__write_pending(context);
+		if(rc){
+			do_disconnect(context, rc);
+		}
+	}
+}
+
+
+/* Add the unwritten part of a packet to an iovec array. This needs at most two
+ * entries, one for the packet itself and one for a payload that is shared with
+ * the message store. Returns the new number of entries. */
+static int packet__iov_add(struct iovec *iov, int iovcnt, struct mosquitto__packet *packet)
+{
+	uint32_t header_length;
+
+	header_length = packet->packet_length;
+	if(packet->store){
+		header_length -= packet->store->payloadlen;
+	}
+
+	if(packet->pos < header_length){
+		iov[iovcnt].iov_base = &(packet->payload[packet->pos]);
+		iov[iovcnt].iov_len = header_length - packet->pos;
+		iovcnt++;
+	}
+	if(packet->store && packet->store->payloadlen > 0){
+		if(packet->pos > header_length){
+			iov[iovcnt].iov_base = &(((uint8_t *)packet->store->payload)[packet->pos - header_length]);
+			iov[iovcnt].iov_len = packet->packet_length - packet->pos;
+		}else{
+			iov[iovcnt].iov_base = packet->store->payload;
+			iov[iovcnt].iov_len = packet->store->payloadlen;
+		}
+		iovcnt++;
+	}
+	return iovcnt;
+}
+
+
+/* Write as much as possible of the packets queued for a client. If closing is
+ * true the socket is about to be closed and may already have been removed
+ * from the mux, so write events are left alone. */
+static int packet__write_iov(struct mosquitto *mosq, bool closing)
+{
+	static struct iovec iov[IOV_MAX];
+	int iovcnt;
 	ssize_t write_length;
+	size_t written;
 	struct mosquitto__packet *packet;
-	enum mosquitto_client_state state;
 
 	if(!mosq) return MOSQ_ERR_INVAL;
 	if(mosq->sock == INVALID_SOCKET) return MOSQ_ERR_NO_CONN;
 
-#ifdef WITH_BROKER
-	mux__add_out(mosq);
+	if(mosq->out_packet && !mosq->current_out_packet){
+		mosq->current_out_packet = mosq->out_packet;
+		mosq->out_packet = mosq->out_packet->next;
+		if(!mosq->out_packet){
+			mosq->out_packet_last = NULL;
+		}
+	}
+
+	if(mosquitto__get_state(mosq) == mosq_cs_connect_pending){
+		if(!closing){
+			mux__add_out(mosq);
+		}
+		return MOSQ_ERR_SUCCESS;
+	}
+
+#ifdef WITH_PERSISTENCE
+	/* Nothing may be acknowledged until it is in the journal. */
+	persist__journal_sync();
+#endif
+
+	while(mosq->current_out_packet){
+		/* Gather as many of the queued packets as possible into one write. */
+		iovcnt = packet__iov_add(iov, 0, mosq->current_out_packet);
+		for(packet = mosq->out_packet; packet && iovcnt < IOV_MAX-1; packet = packet->next){
+			iovcnt = packet__iov_add(iov, iovcnt, packet);
+		}
+
+		write_length = net__writev(mosq, iov, iovcnt);
+		G_WRITE_CALLS_INC(1);
+		if(write_length <= 0){
+#ifdef WIN32
+			errno = WSAGetLastError();
+#endif
+			if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK || errno == COMPAT_EINTR
+#ifdef WIN32
+					|| errno == WSAENOTCONN
 #endif
+					){
+				if(!closing){
+					mux__add_out(mosq);
+				}
+				return MOSQ_ERR_SUCCESS;
+			}else if(errno == COMPAT_ECONNRESET){
+				return MOSQ_ERR_CONN_LOST;
+			}else{
+				return MOSQ_ERR_ERRNO;
+			}
+		}
+		G_BYTES_SENT_INC(write_length);
+
+		/* Free every packet that has been completely written, and note how far
+		 * through the first incomplete packet we have got. */
+		written = (size_t)write_length;
+		while(written > 0){
+			packet = mosq->current_out_packet;
+			if(written < packet->to_process){
+				packet->to_process -= (uint32_t)written;
+				packet->pos += (uint32_t)written;
+				break;
+			}
+			written -= packet->to_process;
+
+			G_MSGS_SENT_INC(1);
+			if(((packet->command)&0xF0) == CMD_PUBLISH){
+				G_PUB_MSGS_SENT_INC(1);
+			}
+
+			mosq->current_out_packet = mosq->out_packet;
+			if(mosq->out_packet){
+				mosq->out_packet = mosq->out_packet->next;
+				if(!mosq->out_packet){
+					mosq->out_packet_last = NULL;
+				}
+			}
+
+			packet__cleanup(packet);
+			mosquitto__pool_free(mosq_pool_packet, packet);
+
+			mosq->next_msg_out = db.now_s + mosq->keepalive;
+		}
+	}
+	if(!closing){
+		mux__remove_out(mosq);
+	}
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int packet__write(struct mosquitto *mosq)
+{
+	return packet__write_iov(mosq, false);
+}
+
+
+/* Make a last attempt at writing anything still queued for a client whose
+ * socket is being closed, such as a CONNACK or DISCONNECT giving the reason
+ * for the close. Anything that can't be written immediately is dropped. */
+void packet__write_closing(struct mosquitto *mosq)
+{
+	if(mosq->for_write){
+		DL_DELETE2(db.ll_for_write, mosq, for_write_prev, for_write_next);
+		mosq->for_write = false;
+	}
+	packet__write_iov(mosq, true);
+}
+#else
+int packet__write(struct mosquitto *mosq)
+{
+	ssize_t write_length;
+	struct mosquitto__packet *packet;
+	enum mosquitto_client_state state;
+
+	if(!mosq) return MOSQ_ERR_INVAL;
+	if(mosq->sock == INVALID_SOCKET) return MOSQ_ERR_NO_CONN;
 
 	pthread_mutex_lock(&mosq->current_out_packet_mutex);
 	pthread_mutex_lock(&mosq->out_packet_mutex);
@@ -231,7 +427,7 @@ int packet__write(struct mosquitto *mosq)
 	pthread_mutex_unlock(&mosq->out_packet_mutex);
 
 	state = mosquitto__get_state(mosq);
-#if defined(WITH_TLS) && !defined(WITH_BROKER)
+#ifdef WITH_TLS
 	if(state == mosq_cs_connect_pending || mosq->want_connect){
 #else
 	if(state == mosq_cs_connect_pending){
@@ -246,7 +442,6 @@ int packet__write(struct mosquitto *mosq)
 		while(packet->to_process > 0){
 			write_length = net__write(mosq, &(packet->payload[packet->pos]), packet->to_process);
 			if(write_length > 0){
-				G_BYTES_SENT_INC(write_length);
 				packet->to_process -= (uint32_t)write_length;
 				packet->pos += (uint32_t)write_length;
 			}else{
@@ -274,10 +469,7 @@ int packet__write(struct mosquitto *mosq)
 			}
 		}
 
-		G_MSGS_SENT_INC(1);
 		if(((packet->command)&0xF6) == CMD_PUBLISH){
-			G_PUB_MSGS_SENT_INC(1);
-#ifndef WITH_BROKER
 			pthread_mutex_lock(&mosq->callback_mutex);
 			if(mosq->on_publish){
 				/* This is a QoS=0 message */
@@ -295,11 +487,8 @@ int packet__write(struct mosquitto *mosq)
 		}else if(((packet->command)&0xF0) == CMD_DISCONNECT){
 			do_client_disconnect(mosq, MOSQ_ERR_SUCCESS, NULL);
 			packet__cleanup(packet);
-			mosquitto__free(packet);
+			mosquitto__pool_free(mosq_pool_packet, packet);
 			return MOSQ_ERR_SUCCESS;
-#endif
-		}else if(((packet->command)&0xF0) == CMD_PUBLISH){
-			G_PUB_MSGS_SENT_INC(1);
 		}
 
 		/* Free data and reset values */
@@ -314,24 +503,344 @@ int packet__write(struct mosquitto *mosq)
 		pthread_mutex_unlock(&mosq->out_packet_mutex);
 
 		packet__cleanup(packet);
-		mosquitto__free(packet);
+		mosquitto__pool_free(mosq_pool_packet, packet);
 
-#ifdef WITH_BROKER
-		mosq->next_msg_out = db.now_s + mosq->keepalive;
-		if(mosq->current_out_packet == NULL){
-			mux__remove_out(mosq);
-		}
-#else
 		pthread_mutex_lock(&mosq->msgtime_mutex);
 		mosq->next_msg_out = mosquitto_time() + mosq->keepalive;
 		pthread_mutex_unlock(&mosq->msgtime_mutex);
-#endif
 	}
 	pthread_mutex_unlock(&mosq->current_out_packet_mutex);
 	return MOSQ_ERR_SUCCESS;
 }
+#endif
+
+
+#ifdef WITH_BROKER
+static int packet__read_error(ssize_t read_length)
+{
+	if(read_length == 0){
+		return MOSQ_ERR_CONN_LOST; /* EOF */
+	}
+#ifdef WIN32
+	errno = WSAGetLastError();
+#endif
+	if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK){
+		return MOSQ_ERR_SUCCESS;
+	}else{
+		switch(errno){
+			case COMPAT_ECONNRESET:
+				return MOSQ_ERR_CONN_LOST;
+			case COMPAT_EINTR:
+				return MOSQ_ERR_SUCCESS;
+			default:
+				return MOSQ_ERR_ERRNO;
+		}
+	}
+}
+
+
+/* Called once the remaining length of the incoming packet is known, to
+ * check it and allocate space for the payload. */
+static int packet__read_header_complete(struct mosquitto *mosq)
+{
+	/* We have finished reading remaining_length, so make remaining_count
+	 * positive. */
+	mosq->in_packet.remaining_count = (int8_t)(mosq->in_packet.remaining_count * -1);
+
+	if(db.config->max_packet_size > 0 && mosq->in_packet.remaining_length+1 > db.config->max_packet_size){
+		if(mosq->protocol == mosq_p_mqtt5){
+			send__disconnect(mosq, MQTT_RC_PACKET_TOO_LARGE, NULL);
+		}
+		return MOSQ_ERR_OVERSIZE_PACKET;
+	}
+	if(mosq->in_packet.remaining_length > 0){
+		/* The extra byte lets the broker zero terminate a PUBLISH payload in
+		 * place, so it can keep the packet buffer as the message payload. */
+		mosq->in_packet.payload = mosquitto__malloc((mosq->in_packet.remaining_length+1)*sizeof(uint8_t));
+		if(!mosq->in_packet.payload){
+			return MOSQ_ERR_NOMEM;
+		}
+		mosq->in_packet.to_process = mosq->in_packet.remaining_length;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
 
+/* Read the rest of a partially received payload directly from the socket.
+ * This avoids copying large payloads through the packet buffer. */
+static int packet__read_payload(struct mosquitto *mosq)
+{
+	ssize_t read_length;
+	int rc;
 
+	while(mosq->in_packet.to_process>0){
+		read_length = net__read(mosq, &(mosq->in_packet.payload[mosq->in_packet.pos]), mosq->in_packet.to_process);
+		G_READ_CALLS_INC(1);
+		if(read_length > 0){
+			G_BYTES_RECEIVED_INC(read_length);
+			mosq->in_packet.to_process -= (uint32_t)read_length;
+			mosq->in_packet.pos += (uint32_t)read_length;
+		}else{
+			rc = packet__read_error(read_length);
+			if(rc == MOSQ_ERR_SUCCESS && mosq->in_packet.to_process > 1000){
+				/* Update last_msg_in time if more than 1000 bytes left to
+				 * receive. Helps when receiving large messages.
+				 * This is an arbitrary limit, but with some consideration.
+				 * If a client can't send 1000 bytes in a second it
+				 * probably shouldn't be using a 1 second keep alive. */
+				keepalive__update(mosq);
+			}
+			return rc;
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int packet__read_complete(struct mosquitto *mosq)
+{
+	int rc;
+
+	/* All data for this packet is read. */
+	mosq->in_packet.pos = 0;
+	G_MSGS_RECEIVED_INC(1);
+	if(((mosq->in_packet.command)&0xF5) == CMD_PUBLISH){
+		G_PUB_MSGS_RECEIVED_INC(1);
+	}
+	rc = handle__packet(mosq);
+
+	/* Free data and reset values */
+	packet__cleanup(&mosq->in_packet);
+
+	keepalive__update(mosq);
+	return rc;
+}
+
+
+/* Keep the data read after a CONNECT that is held while its password is
+ * checked, so it can be handled once the CONNECT has been accepted. */
+static int packet__read_hold(struct mosquitto *mosq, const uint8_t *buf, size_t len)
+{
+	if(len == 0){
+		return MOSQ_ERR_SUCCESS;
+	}
+	mosq->in_held = mosquitto__malloc(len);
+	if(!mosq->in_held){
+		return MOSQ_ERR_NOMEM;
+	}
+	memcpy(mosq->in_held, buf, len);
+	mosq->in_held_len = len;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Handle every complete packet in a buffer of data read from a client. Data
+ * belonging to an incomplete packet is stored in in_packet. */
+static int packet__read_data(struct mosquitto *mosq, const uint8_t *buf, size_t len, int *packets)
+{
+	uint8_t byte;
+	size_t pos;
+	uint32_t count;
+	int rc = 0;
+
+	pos = 0;
+	while(pos < len){
+		if(!mosq->in_packet.command){
+			byte = buf[pos++];
+			mosq->in_packet.command = byte;
+			/* Clients must send CONNECT as their first command. */
+			if(!(mosq->bridge) && mosquitto__get_state(mosq) == mosq_cs_connected && (byte&0xF0) != CMD_CONNECT){
+				return MOSQ_ERR_PROTOCOL;
+			}
+		}
+		/* remaining_count is the number of bytes that the remaining_length
+		 * parameter occupied in this incoming packet. It has three states:
+		 *   0 means that we haven't read any remaining_length bytes
+		 *   <0 means we have read some remaining_length bytes but haven't finished
+		 *   >0 means we have finished reading the remaining_length bytes.
+		 */
+		if(mosq->in_packet.remaining_count <= 0){
+			do{
+				if(pos == len){
+					return MOSQ_ERR_SUCCESS;
+				}
+				byte = buf[pos++];
+				mosq->in_packet.remaining_count--;
+				/* Max 4 bytes length for remaining length as defined by protocol.
+				 * Anything more likely means a broken/malicious client.
+				 */
+				if(mosq->in_packet.remaining_count < -4){
+					return MOSQ_ERR_PROTOCOL;
+				}
+				mosq->in_packet.remaining_length += (byte & 127) * mosq->in_packet.remaining_mult;
+				mosq->in_packet.remaining_mult *= 128;
+			}while((byte & 128) != 0);
+
+			rc = packet__read_header_complete(mosq);
+			if(rc){
+				return rc;
+			}
+		}
+
+		if(mosq->in_packet.to_process > 0){
+			if(len - pos < mosq->in_packet.to_process){
+				count = (uint32_t)(len - pos);
+			}else{
+				count = mosq->in_packet.to_process;
+			}
+			memcpy(&(mosq->in_packet.payload[mosq->in_packet.pos]), &buf[pos], count);
+			pos += count;
+			mosq->in_packet.to_process -= count;
+			mosq->in_packet.pos += count;
+			if(mosq->in_packet.to_process > 0){
+				return MOSQ_ERR_SUCCESS;
+			}
+		}
+
+		rc = packet__read_complete(mosq);
+		(*packets)++;
+		if(rc || mosq->sock == INVALID_SOCKET){
+			return rc;
+		}
+		if(mosquitto__get_state(mosq) == mosq_cs_auth_pending){
+			return packet__read_hold(mosq, &buf[pos], len - pos);
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Read once into the packet buffer and handle every complete packet found in
+ * it. more is set if the read filled the buffer, so there is likely to be more
+ * data waiting on the socket. */
+static int packet__read_buffer(struct mosquitto *mosq, int *packets, bool *more)
+{
+	uint8_t *buf;
+	ssize_t read_length;
+	int rc = 0;
+
+	*more = false;
+
+	if(mosq->in_packet.to_process > 0){
+		rc = packet__read_payload(mosq);
+		if(rc || mosq->in_packet.to_process > 0){
+			return rc;
+		}
+		rc = packet__read_complete(mosq);
+		(*packets)++;
+		if(rc || mosq->sock == INVALID_SOCKET
+				|| mosquitto__get_state(mosq) == mosq_cs_auth_pending){
+
+			return rc;
+		}
+	}
+
+	if(db.packet_buffer_size != db.config->packet_buffer_size){
+		buf = mosquitto__realloc(db.packet_buffer, db.config->packet_buffer_size);
+		if(!buf){
+			return MOSQ_ERR_NOMEM;
+		}
+		db.packet_buffer = buf;
+		db.packet_buffer_size = db.config->packet_buffer_size;
+	}
+	buf = db.packet_buffer;
+
+	read_length = net__read(mosq, buf, db.packet_buffer_size);
+	G_READ_CALLS_INC(1);
+	if(read_length <= 0){
+		return packet__read_error(read_length);
+	}
+	G_BYTES_RECEIVED_INC(read_length);
+
+	rc = packet__read_data(mosq, buf, (size_t)read_length, packets);
+	if(rc || mosq->sock == INVALID_SOCKET
+			|| mosquitto__get_state(mosq) == mosq_cs_auth_pending){
+
+		return rc;
+	}
+	*more = ((size_t)read_length == db.packet_buffer_size);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Handle the data that arrived while the CONNECT was held, now the CONNECT
+ * has been accepted. */
+int packet__read_held(struct mosquitto *mosq)
+{
+	uint8_t *held;
+	size_t held_len;
+	int packets = 0;
+	int rc;
+
+	held = mosq->in_held;
+	held_len = mosq->in_held_len;
+	mosq->in_held = NULL;
+	mosq->in_held_len = 0;
+
+	if(held){
+		rc = packet__read_data(mosq, held, held_len, &packets);
+		mosquitto__free(held);
+		if(rc){
+			return rc;
+		}
+	}
+
+	/* Data already decrypted by the TLS library won't wake the socket. */
+	while(mosq->sock != INVALID_SOCKET && SSL_DATA_PENDING(mosq)){
+		rc = packet__read(mosq);
+		if(rc){
+			return rc;
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int packet__read(struct mosquitto *mosq)
+{
+	int packets = 0;
+	bool more;
+	int rc;
+
+	if(!mosq){
+		return MOSQ_ERR_INVAL;
+	}
+	if(mosq->sock == INVALID_SOCKET){
+		return MOSQ_ERR_NO_CONN;
+	}
+
+	if(mosquitto__get_state(mosq) == mosq_cs_connect_pending
+			|| mosquitto__get_state(mosq) == mosq_cs_auth_pending){
+
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	/* This gets called if there is network data available - ie. at least one
+	 * byte. Rather than reading the command and remaining length a byte at a
+	 * time, read as much as is available into the packet buffer, which is
+	 * shared by all clients, and handle every complete packet found in it.
+	 * Whatever is left over at the end of the buffer belongs to an incomplete
+	 * packet and is stored in in_packet, exactly as if it had been read byte
+	 * by byte, so nothing needs to be kept in the packet buffer between calls.
+	 * The only exception is a packet whose payload is already partly read,
+	 * the rest of which is read directly into its payload.
+	 *
+	 * If the buffer was filled there is probably more waiting, so keep
+	 * reading until max_packets_per_read packets have been handled. The
+	 * packets in a buffer that has been read are always all handled, so the
+	 * limit may be overshot by up to a buffer's worth. Anything still unread
+	 * is left for the next time round the loop, so one busy client can't hold
+	 * up everyone else.
+	 */
+	do{
+		rc = packet__read_buffer(mosq, &packets, &more);
+	}while(rc == MOSQ_ERR_SUCCESS && more
+			&& mosq->sock != INVALID_SOCKET
+			&& (db.config->max_packets_per_read == 0 || packets < db.config->max_packets_per_read));
+
+	return rc;
+}
+#else
 int packet__read(struct mosquitto *mosq)
 {
 	uint8_t byte;
@@ -369,13 +878,6 @@ int packet__read(struct mosquitto *mosq)
 		read_length = net__read(mosq, &byte, 1);
 		if(read_length == 1){
 			mosq->in_packet.command = byte;
-#ifdef WITH_BROKER
-			G_BYTES_RECEIVED_INC(1);
-			/* Clients must send CONNECT as their first command. */
-			if(!(mosq->bridge) && state == mosq_cs_connected && (byte&0xF0) != CMD_CONNECT){
-				return MOSQ_ERR_PROTOCOL;
-			}
-#endif
 		}else{
 			if(read_length == 0){
 				return MOSQ_ERR_CONN_LOST; /* EOF */
@@ -418,7 +920,6 @@ int packet__read(struct mosquitto *mosq)
 					return MOSQ_ERR_PROTOCOL;
 				}
 
-				G_BYTES_RECEIVED_INC(1);
 				mosq->in_packet.remaining_length += (byte & 127) * mosq->in_packet.remaining_mult;
 				mosq->in_packet.remaining_mult *= 128;
 			}else{
@@ -446,18 +947,9 @@ int packet__read(struct mosquitto *mosq)
 		 * positive. */
 		mosq->in_packet.remaining_count = (int8_t)(mosq->in_packet.remaining_count * -1);
 
-#ifdef WITH_BROKER
-		if(db.config->max_packet_size > 0 && mosq->in_packet.remaining_length+1 > db.config->max_packet_size){
-			if(mosq->protocol == mosq_p_mqtt5){
-				send__disconnect(mosq, MQTT_RC_PACKET_TOO_LARGE, NULL);
-			}
-			return MOSQ_ERR_OVERSIZE_PACKET;
-		}
-#else
 		// FIXME - client case for incoming message received from broker too large
-#endif
 		if(mosq->in_packet.remaining_length > 0){
-			mosq->in_packet.payload = mosquitto__malloc(mosq->in_packet.remaining_length*sizeof(uint8_t));
+			mosq->in_packet.payload = mosquitto__malloc((mosq->in_packet.remaining_length+1)*sizeof(uint8_t));
 			if(!mosq->in_packet.payload){
 				return MOSQ_ERR_NOMEM;
 			}
@@ -467,7 +959,6 @@ int packet__read(struct mosquitto *mosq)
 	while(mosq->in_packet.to_process>0){
 		read_length = net__read(mosq, &(mosq->in_packet.payload[mosq->in_packet.pos]), mosq->in_packet.to_process);
 		if(read_length > 0){
-			G_BYTES_RECEIVED_INC(read_length);
 			mosq->in_packet.to_process -= (uint32_t)read_length;
 			mosq->in_packet.pos += (uint32_t)read_length;
 		}else{
@@ -481,13 +972,9 @@ int packet__read(struct mosquitto *mosq)
 					 * This is an arbitrary limit, but with some consideration.
 					 * If a client can't send 1000 bytes in a second it
 					 * probably shouldn't be using a 1 second keep alive. */
-#ifdef WITH_BROKER
-					keepalive__update(mosq);
-#else
 					pthread_mutex_lock(&mosq->msgtime_mutex);
 					mosq->last_msg_in = mosquitto_time();
 					pthread_mutex_unlock(&mosq->msgtime_mutex);
-#endif
 				}
 				return MOSQ_ERR_SUCCESS;
 			}else{
@@ -505,23 +992,14 @@ int packet__read(struct mosquitto *mosq)
 
 	/* All data for this packet is read. */
 	mosq->in_packet.pos = 0;
-#ifdef WITH_BROKER
-	G_MSGS_RECEIVED_INC(1);
-	if(((mosq->in_packet.command)&0xF5) == CMD_PUBLISH){
-		G_PUB_MSGS_RECEIVED_INC(1);
-	}
-#endif
 	rc = handle__packet(mosq);
 
 	/* Free data and reset values */
 	packet__cleanup(&mosq->in_packet);
 
-#ifdef WITH_BROKER
-	keepalive__update(mosq);
-#else
 	pthread_mutex_lock(&mosq->msgtime_mutex);
 	mosq->last_msg_in = mosquitto_time();
 	pthread_mutex_unlock(&mosq->msgtime_mutex);
-#endif
 	return rc;
 }
+#endif
@@ -48,5 +48,11 @@ unsigned int packet__varint_bytes(uint32_t word);
 
 int packet__write(struct mosquitto *mosq);
 int packet__read(struct mosquitto *mosq);
+#ifdef WITH_BROKER
+int packet__write_pending(struct mosquitto *mosq);
+void packet__write_closing(struct mosquitto *mosq);
+int packet__read_held(struct mosquitto *mosq);
+void packet__write_all(void);
+#endif
 
 #endif
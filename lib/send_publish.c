@@ -39,7 +39,7 @@ Contributors:
 #include "send_mosq.h"
 
 
-int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval, struct mosquitto_msg_store *store)
 {
 #ifdef WITH_BROKER
 	size_t len;
@@ -107,7 +107,7 @@ int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint3
 					}
 					log__printf(NULL, MOSQ_LOG_DEBUG, "Sending PUBLISH to %s (d%d, q%d, r%d, m%d, '%s', ... (%ld bytes))", mosq->id, dup, qos, retain, mid, mapped_topic, (long)payloadlen);
 					G_PUB_BYTES_SENT_INC(payloadlen);
-					rc =  send__real_publish(mosq, mid, mapped_topic, payloadlen, payload, qos, retain, dup, cmsg_props, store_props, expiry_interval);
+					rc =  send__real_publish(mosq, mid, mapped_topic, payloadlen, payload, qos, retain, dup, cmsg_props, store_props, expiry_interval, store);
 					mosquitto__free(mapped_topic);
 					return rc;
 				}
@@ -121,11 +121,11 @@ int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint3
 	log__printf(mosq, MOSQ_LOG_DEBUG, "Client %s sending PUBLISH (d%d, q%d, r%d, m%d, '%s', ... (%ld bytes))", mosq->id, dup, qos, retain, mid, topic, (long)payloadlen);
 #endif
 
-	return send__real_publish(mosq, mid, topic, payloadlen, payload, qos, retain, dup, cmsg_props, store_props, expiry_interval);
+	return send__real_publish(mosq, mid, topic, payloadlen, payload, qos, retain, dup, cmsg_props, store_props, expiry_interval, store);
 }
 
 
-int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval, struct mosquitto_msg_store *store)
 {
 	struct mosquitto__packet *packet = NULL;
 	unsigned int packetlen;
@@ -173,15 +173,31 @@ int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic,
 		return MOSQ_ERR_OVERSIZE_PACKET;
 	}
 
-	packet = mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+	packet = mosquitto__pool_calloc(mosq_pool_packet, sizeof(struct mosquitto__packet));
 	if(!packet) return MOSQ_ERR_NOMEM;
 
+#ifdef WITH_BROKER
+#  ifdef WITH_WEBSOCKETS
+	if(mosq->wsi){
+		/* Websockets needs the whole packet in one buffer. */
+		store = NULL;
+	}
+#  endif
+	if(store && payloadlen > 0){
+		/* Send the payload straight from the message store, so it is shared
+		 * between every client the message is sent to rather than being
+		 * copied for each one. */
+		packet->store = store;
+	}
+#else
+	UNUSED(store);
+#endif
 	packet->mid = mid;
 	packet->command = (uint8_t)(CMD_PUBLISH | (uint8_t)((dup&0x1)<<3) | (uint8_t)(qos<<1) | retain);
 	packet->remaining_length = packetlen;
 	rc = packet__alloc(packet);
 	if(rc){
-		mosquitto__free(packet);
+		mosquitto__pool_free(mosq_pool_packet, packet);
 		return rc;
 	}
 	/* Variable header (topic string) */
@@ -204,6 +220,11 @@ int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic,
 	}
 
 	/* Payload */
+#ifdef WITH_BROKER
+	if(packet->store){
+		db__msg_store_ref_inc(packet->store);
+	}else
+#endif
 	if(payloadlen){
 		packet__write_bytes(packet, payload, payloadlen);
 	}
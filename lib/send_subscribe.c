@@ -59,7 +59,7 @@ int send__subscribe(struct mosquitto *mosq, int *mid, int topic_count, const cha
 		packetlen += 2U+(uint16_t)tlen + 1U;
 	}
 
-	packet = mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+	packet = mosquitto__pool_calloc(mosq_pool_packet, sizeof(struct mosquitto__packet));
 	if(!packet) return MOSQ_ERR_NOMEM;
 
 
@@ -67,7 +67,7 @@ int send__subscribe(struct mosquitto *mosq, int *mid, int topic_count, const cha
 	packet->remaining_length = packetlen;
 	rc = packet__alloc(packet);
 	if(rc){
-		mosquitto__free(packet);
+		mosquitto__pool_free(mosq_pool_packet, packet);
 		return rc;
 	}
 
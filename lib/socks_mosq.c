@@ -127,7 +127,7 @@ int socks5__send(struct mosquitto *mosq)
 	state = mosquitto__get_state(mosq);
 
 	if(state == mosq_cs_socks5_new){
-		packet = mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+		packet = mosquitto__pool_calloc(mosq_pool_packet, sizeof(struct mosquitto__packet));
 		if(!packet) return MOSQ_ERR_NOMEM;
 
 		if(mosq->socks5_username){
@@ -155,13 +155,13 @@ int socks5__send(struct mosquitto *mosq)
 		mosq->in_packet.payload = mosquitto__malloc(sizeof(uint8_t)*2);
 		if(!mosq->in_packet.payload){
 			mosquitto__free(packet->payload);
-			mosquitto__free(packet);
+			mosquitto__pool_free(mosq_pool_packet, packet);
 			return MOSQ_ERR_NOMEM;
 		}
 
 		return packet__queue(mosq, packet);
 	}else if(state == mosq_cs_socks5_auth_ok){
-		packet = mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+		packet = mosquitto__pool_calloc(mosq_pool_packet, sizeof(struct mosquitto__packet));
 		if(!packet) return MOSQ_ERR_NOMEM;
 
 		ipv4_pton_result = inet_pton(AF_INET, mosq->host, &addr_ipv4);
@@ -171,7 +171,7 @@ int socks5__send(struct mosquitto *mosq)
 			packet->packet_length = 10;
 			packet->payload = mosquitto__malloc(sizeof(uint8_t)*packet->packet_length);
 			if(!packet->payload){
-				mosquitto__free(packet);
+				mosquitto__pool_free(mosq_pool_packet, packet);
 				return MOSQ_ERR_NOMEM;
 			}
 			packet->payload[3] = SOCKS_ATYPE_IP_V4;
@@ -183,7 +183,7 @@ int socks5__send(struct mosquitto *mosq)
 			packet->packet_length = 22;
 			packet->payload = mosquitto__malloc(sizeof(uint8_t)*packet->packet_length);
 			if(!packet->payload){
-				mosquitto__free(packet);
+				mosquitto__pool_free(mosq_pool_packet, packet);
 				return MOSQ_ERR_NOMEM;
 			}
 			packet->payload[3] = SOCKS_ATYPE_IP_V6;
@@ -194,13 +194,13 @@ int socks5__send(struct mosquitto *mosq)
 		}else{
 			slen = strlen(mosq->host);
 			if(slen > UCHAR_MAX){
-				mosquitto__free(packet);
+				mosquitto__pool_free(mosq_pool_packet, packet);
 				return MOSQ_ERR_NOMEM;
 			}
 			packet->packet_length = 7U + (uint32_t)slen;
 			packet->payload = mosquitto__malloc(sizeof(uint8_t)*packet->packet_length);
 			if(!packet->payload){
-				mosquitto__free(packet);
+				mosquitto__pool_free(mosq_pool_packet, packet);
 				return MOSQ_ERR_NOMEM;
 			}
 			packet->payload[3] = SOCKS_ATYPE_DOMAINNAME;
@@ -221,13 +221,13 @@ int socks5__send(struct mosquitto *mosq)
 		mosq->in_packet.payload = mosquitto__malloc(sizeof(uint8_t)*5);
 		if(!mosq->in_packet.payload){
 			mosquitto__free(packet->payload);
-			mosquitto__free(packet);
+			mosquitto__pool_free(mosq_pool_packet, packet);
 			return MOSQ_ERR_NOMEM;
 		}
 
 		return packet__queue(mosq, packet);
 	}else if(state == mosq_cs_socks5_send_userpass){
-		packet = mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+		packet = mosquitto__pool_calloc(mosq_pool_packet, sizeof(struct mosquitto__packet));
 		if(!packet) return MOSQ_ERR_NOMEM;
 
 		ulen = (uint8_t)strlen(mosq->socks5_username);
@@ -250,7 +250,7 @@ int socks5__send(struct mosquitto *mosq)
 		mosq->in_packet.payload = mosquitto__malloc(sizeof(uint8_t)*2);
 		if(!mosq->in_packet.payload){
 			mosquitto__free(packet->payload);
-			mosquitto__free(packet);
+			mosquitto__pool_free(mosq_pool_packet, packet);
 			return MOSQ_ERR_NOMEM;
 		}
 
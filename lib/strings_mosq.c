@@ -27,6 +27,8 @@ Contributors:
 const char *mosquitto_strerror(int mosq_errno)
 {
 	switch(mosq_errno){
+		case MOSQ_ERR_AUTH_DELAYED:
+			return "Authentication delayed.";
 		case MOSQ_ERR_AUTH_CONTINUE:
 			return "Continue with authentication.";
 		case MOSQ_ERR_NO_SUBSCRIBERS:
@@ -18,6 +18,9 @@ Contributors:
 
 #include "config.h"
 
+#include <string.h>
+#include <utlist.h>
+
 #include "dynamic_security.h"
 #include "mosquitto.h"
 #include "mosquitto_broker.h"
@@ -25,7 +28,309 @@ Contributors:
 
 typedef int (*MOSQ_FUNC_acl_check)(struct mosquitto_evt_acl_check *, struct dynsec__rolelist *);
 
-/* FIXME - CACHE! */
+struct acl__match{
+	int order;
+	bool allow;
+};
+
+/* Incremented whenever roles, groups or ACLs change, so that the compiled ACL
+ * tries of every client are rebuilt the next time they are used. */
+static unsigned int acl_generation = 0;
+static struct dynsec__acl_tries *anonymous_tries = NULL;
+
+
+/* ################################################################
+ * #
+ * # Compiled ACL tries
+ * #
+ * ################################################################ */
+
+void dynsec__acl_changed(void)
+{
+	acl_generation++;
+}
+
+
+static void acl_trie__free(struct dynsec__acl_node *node)
+{
+	struct dynsec__acl_node *child, *child_tmp;
+
+	if(node == NULL) return;
+
+	HASH_ITER(hh, node->children, child, child_tmp){
+		HASH_DELETE(hh, node->children, child);
+		acl_trie__free(child);
+	}
+	acl_trie__free(node->plus);
+	mosquitto_free(node->level);
+	mosquitto_free(node);
+}
+
+
+static void acl_trie__cleanup(struct dynsec__acl_trie *trie)
+{
+	struct dynsec__acl_invalid *invalid, *invalid_tmp;
+
+	acl_trie__free(trie->root);
+	trie->root = NULL;
+	LL_FOREACH_SAFE(trie->invalid, invalid, invalid_tmp){
+		LL_DELETE(trie->invalid, invalid);
+		mosquitto_free(invalid->topic);
+		mosquitto_free(invalid);
+	}
+}
+
+
+void dynsec__acl_tries_free(struct dynsec__acl_tries **tries)
+{
+	if(*tries == NULL) return;
+
+	acl_trie__cleanup(&(*tries)->publish_c_send);
+	acl_trie__cleanup(&(*tries)->publish_c_recv);
+	mosquitto_free(*tries);
+	*tries = NULL;
+}
+
+
+void dynsec__acl_cleanup(void)
+{
+	dynsec__acl_tries_free(&anonymous_tries);
+}
+
+
+static struct dynsec__acl_node *acl_trie__node_new(const char *level, size_t len)
+{
+	struct dynsec__acl_node *node;
+
+	node = mosquitto_calloc(1, sizeof(struct dynsec__acl_node));
+	if(node == NULL) return NULL;
+
+	if(level){
+		node->level = mosquitto_malloc(len+1);
+		if(node->level == NULL){
+			mosquitto_free(node);
+			return NULL;
+		}
+		memcpy(node->level, level, len);
+		node->level[len] = '\0';
+	}
+	node->order = -1;
+	node->hash_order = -1;
+	return node;
+}
+
+
+static int acl_trie__add_invalid(struct dynsec__acl_trie *trie, const char *topic, int order, bool allow)
+{
+	struct dynsec__acl_invalid *invalid;
+
+	invalid = mosquitto_calloc(1, sizeof(struct dynsec__acl_invalid));
+	if(invalid == NULL) return MOSQ_ERR_NOMEM;
+
+	invalid->topic = mosquitto_strdup(topic);
+	if(invalid->topic == NULL){
+		mosquitto_free(invalid);
+		return MOSQ_ERR_NOMEM;
+	}
+	invalid->order = order;
+	invalid->allow = allow;
+	LL_APPEND(trie->invalid, invalid);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Add an ACL to a trie. ACLs are added in the order they are checked, so only
+ * the first ACL for a given topic filter is kept. */
+static int acl_trie__add(struct dynsec__acl_trie *trie, const char *topic, int order, bool allow)
+{
+	struct dynsec__acl_node *node, *child;
+	const char *end;
+	size_t len;
+
+	if(topic[0] == '\0' || mosquitto_sub_topic_check(topic) != MOSQ_ERR_SUCCESS){
+		return acl_trie__add_invalid(trie, topic, order, allow);
+	}
+
+	if(trie->root == NULL){
+		trie->root = acl_trie__node_new(NULL, 0);
+		if(trie->root == NULL) return MOSQ_ERR_NOMEM;
+	}
+	node = trie->root;
+
+	while(1){
+		end = strchr(topic, '/');
+		len = end?(size_t)(end - topic):strlen(topic);
+
+		if(len == 1 && topic[0] == '#'){
+			if(node->hash_order == -1){
+				node->hash_order = order;
+				node->hash_allow = allow;
+			}
+			return MOSQ_ERR_SUCCESS;
+		}else if(len == 1 && topic[0] == '+'){
+			if(node->plus == NULL){
+				node->plus = acl_trie__node_new(NULL, 0);
+				if(node->plus == NULL) return MOSQ_ERR_NOMEM;
+			}
+			node = node->plus;
+		}else{
+			HASH_FIND(hh, node->children, topic, len, child);
+			if(child == NULL){
+				child = acl_trie__node_new(topic, len);
+				if(child == NULL) return MOSQ_ERR_NOMEM;
+				HASH_ADD_KEYPTR(hh, node->children, child->level, len, child);
+			}
+			node = child;
+		}
+
+		if(end == NULL) break;
+		topic = end+1;
+	}
+	if(node->order == -1){
+		node->order = order;
+		node->allow = allow;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int acl_tries__add_rolelist(struct dynsec__acl_tries *tries, struct dynsec__rolelist *base_rolelist, int *order)
+{
+	struct dynsec__rolelist *rolelist, *rolelist_tmp = NULL;
+	struct dynsec__acl *acl, *acl_tmp = NULL;
+	int rc;
+
+	HASH_ITER(hh, base_rolelist, rolelist, rolelist_tmp){
+		HASH_ITER(hh, rolelist->role->acls.publish_c_send, acl, acl_tmp){
+			rc = acl_trie__add(&tries->publish_c_send, acl->topic, (*order)++, acl->allow);
+			if(rc) return rc;
+		}
+		HASH_ITER(hh, rolelist->role->acls.publish_c_recv, acl, acl_tmp){
+			rc = acl_trie__add(&tries->publish_c_recv, acl->topic, (*order)++, acl->allow);
+			if(rc) return rc;
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Return the compiled ACL tries for a client, or for the anonymous group if
+ * client is NULL, building them if they are missing or out of date. */
+static struct dynsec__acl_tries *acl_tries__get(struct dynsec__acl_tries **tries, struct dynsec__client *client, struct dynsec__group *group)
+{
+	struct dynsec__grouplist *grouplist, *grouplist_tmp = NULL;
+	int order = 0;
+	int rc;
+
+	if(*tries && (*tries)->generation == acl_generation){
+		return *tries;
+	}
+	dynsec__acl_tries_free(tries);
+
+	*tries = mosquitto_calloc(1, sizeof(struct dynsec__acl_tries));
+	if(*tries == NULL) return NULL;
+
+	/* Same order as the checks in dynsec__acl_check_callback(). */
+	if(client){
+		rc = acl_tries__add_rolelist(*tries, client->rolelist, &order);
+		HASH_ITER(hh, client->grouplist, grouplist, grouplist_tmp){
+			if(rc) break;
+			rc = acl_tries__add_rolelist(*tries, grouplist->group->rolelist, &order);
+		}
+	}else{
+		rc = acl_tries__add_rolelist(*tries, group->rolelist, &order);
+	}
+	if(rc){
+		dynsec__acl_tries_free(tries);
+		return NULL;
+	}
+	(*tries)->generation = acl_generation;
+	return *tries;
+}
+
+
+static void acl_trie__match(struct acl__match *match, int order, bool allow)
+{
+	if(match->order == -1 || order < match->order){
+		match->order = order;
+		match->allow = allow;
+	}
+}
+
+
+/* Find the first ACL, in check order, matching the topic levels starting at
+ * topic. topic is NULL once all levels have been matched. Wildcards at the
+ * root don't match topics beginning with '$'. */
+static void acl_trie__search(struct dynsec__acl_node *node, const char *topic, bool root, struct acl__match *match)
+{
+	struct dynsec__acl_node *child;
+	const char *end, *next;
+	size_t len;
+	bool wildcards;
+
+	wildcards = !(root && topic[0] == '$');
+
+	if(node->hash_order != -1 && wildcards){
+		acl_trie__match(match, node->hash_order, node->hash_allow);
+	}
+	if(topic == NULL){
+		if(node->order != -1){
+			acl_trie__match(match, node->order, node->allow);
+		}
+		return;
+	}
+
+	end = strchr(topic, '/');
+	if(end){
+		len = (size_t)(end - topic);
+		next = end+1;
+	}else{
+		len = strlen(topic);
+		next = NULL;
+	}
+
+	HASH_FIND(hh, node->children, topic, len, child);
+	if(child){
+		acl_trie__search(child, next, false, match);
+	}
+	if(node->plus && wildcards){
+		acl_trie__search(node->plus, next, false, match);
+	}
+}
+
+
+static int acl_trie__check(struct dynsec__acl_trie *trie, const char *topic)
+{
+	struct acl__match match;
+	struct dynsec__acl_invalid *invalid;
+	bool result;
+
+	if(topic[0] == '\0') return MOSQ_ERR_NOT_FOUND;
+
+	match.order = -1;
+	match.allow = false;
+	if(trie->root){
+		acl_trie__search(trie->root, topic, true, &match);
+	}
+	LL_FOREACH(trie->invalid, invalid){
+		if(match.order != -1 && match.order < invalid->order){
+			break;
+		}
+		mosquitto_topic_matches_sub(invalid->topic, topic, &result);
+		if(result){
+			acl_trie__match(&match, invalid->order, invalid->allow);
+			break;
+		}
+	}
+
+	if(match.order == -1){
+		return MOSQ_ERR_NOT_FOUND;
+	}else if(match.allow){
+		return MOSQ_ERR_SUCCESS;
+	}else{
+		return MOSQ_ERR_ACL_DENIED;
+	}
+}
 
 /* ################################################################
  * #
@@ -157,6 +462,28 @@ static int acl_check_unsubscribe(struct mosquitto_evt_acl_check *ed, struct dyns
 }
 
 
+/* ################################################################
+ * #
+ * # ACL check - default access
+ * #
+ * ################################################################ */
+
+static int acl_check_default(struct mosquitto_evt_acl_check *ed, bool acl_default_access)
+{
+	if(acl_default_access == false){
+		return MOSQ_ERR_PLUGIN_DEFER;
+	}else{
+		if(!strncmp(ed->topic, "$CONTROL", strlen("$CONTROL"))){
+			/* We never give fall through access to $CONTROL topics, they must
+			 * be granted explicitly. */
+			return MOSQ_ERR_PLUGIN_DEFER;
+		}else{
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+}
+
+
 /* ################################################################
  * #
  * # ACL check - generic check
@@ -196,17 +523,51 @@ static int acl_check(struct mosquitto_evt_acl_check *ed, MOSQ_FUNC_acl_check che
 		}
 	}
 
-	if(acl_default_access == false){
-		return MOSQ_ERR_PLUGIN_DEFER;
+	return acl_check_default(ed, acl_default_access);
+}
+
+
+/* ################################################################
+ * #
+ * # ACL check - publish, using compiled ACL tries
+ * #
+ * ################################################################ */
+
+static int acl_check_publish(struct mosquitto_evt_acl_check *ed, MOSQ_FUNC_acl_check check, bool acl_default_access)
+{
+	struct dynsec__client *client;
+	struct dynsec__acl_tries *tries;
+	const char *username;
+	int rc;
+
+	username = mosquitto_client_username(ed->client);
+
+	if(username){
+		client = dynsec_clients__find(username);
+		if(client == NULL) return MOSQ_ERR_PLUGIN_DEFER;
+
+		tries = acl_tries__get(&client->acl_tries, client, NULL);
+	}else if(dynsec_anonymous_group){
+		tries = acl_tries__get(&anonymous_tries, NULL, dynsec_anonymous_group);
 	}else{
-		if(!strncmp(ed->topic, "$CONTROL", strlen("$CONTROL"))){
-			/* We never give fall through access to $CONTROL topics, they must
-			 * be granted explicitly. */
-			return MOSQ_ERR_PLUGIN_DEFER;
-		}else{
-			return MOSQ_ERR_SUCCESS;
-		}
+		return acl_check_default(ed, acl_default_access);
+	}
+
+	if(tries == NULL){
+		/* Out of memory building the tries, so check each ACL in turn. */
+		return acl_check(ed, check, acl_default_access);
 	}
+
+	if(ed->access == MOSQ_ACL_WRITE){
+		rc = acl_trie__check(&tries->publish_c_send, ed->topic);
+	}else{
+		rc = acl_trie__check(&tries->publish_c_recv, ed->topic);
+	}
+	if(rc != MOSQ_ERR_NOT_FOUND){
+		return rc;
+	}
+
+	return acl_check_default(ed, acl_default_access);
 }
 
 
@@ -241,10 +602,10 @@ int dynsec__acl_check_callback(int event, void *event_data, void *userdata)
 			return acl_check(event_data, acl_check_unsubscribe, default_access.unsubscribe);
 			break;
 		case MOSQ_ACL_WRITE: /* Client to broker */
-			return acl_check(event_data, acl_check_publish_c_send, default_access.publish_c_send);
+			return acl_check_publish(event_data, acl_check_publish_c_send, default_access.publish_c_send);
 			break;
 		case MOSQ_ACL_READ:
-			return acl_check(event_data, acl_check_publish_c_recv, default_access.publish_c_recv);
+			return acl_check_publish(event_data, acl_check_publish_c_recv, default_access.publish_c_recv);
 			break;
 		default:
 			return MOSQ_ERR_PLUGIN_DEFER;
@@ -155,28 +155,12 @@ int dynsec_auth__pw_hash(struct dynsec__client *client, const char *password, un
  * #
  * ################################################################ */
 
-static int memcmp_const(const void *a, const void *b, size_t len)
-{
-	size_t i;
-	int rc = 0;
-
-	if(!a || !b) return 1;
-
-	for(i=0; i<len; i++){
-		if( ((char *)a)[i] != ((char *)b)[i] ){
-			rc = 1;
-		}
-	}
-	return rc;
-}
-
-
 int dynsec_auth__basic_auth_callback(int event, void *event_data, void *userdata)
 {
 	struct mosquitto_evt_basic_auth *ed = event_data;
 	struct dynsec__client *client;
-	unsigned char password_hash[64]; /* For SHA512 */
 	const char *clientid;
+	int rc;
 
 	UNUSED(event);
 	UNUSED(userdata);
@@ -194,11 +178,17 @@ int dynsec_auth__basic_auth_callback(int event, void *event_data, void *userdata
 				return MOSQ_ERR_AUTH;
 			}
 		}
-		if(client->pw.valid && dynsec_auth__pw_hash(client, ed->password, password_hash, sizeof(password_hash), false) == MOSQ_ERR_SUCCESS){
-			if(memcmp_const(client->pw.password_hash, password_hash, sizeof(password_hash)) == 0){
-				return MOSQ_ERR_SUCCESS;
+		if(client->pw.valid){
+			/* The broker may check the password on a worker thread, in which
+			 * case the result is MOSQ_ERR_AUTH_DELAYED. */
+			rc = mosquitto_basic_auth_pbkdf2_check(ed->client, ed->password,
+					client->pw.salt, sizeof(client->pw.salt), client->pw.iterations,
+					client->pw.password_hash, sizeof(client->pw.password_hash));
+
+			if(rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_AUTH || rc == MOSQ_ERR_AUTH_DELAYED){
+				return rc;
 			}else{
-				return MOSQ_ERR_AUTH;
+				return MOSQ_ERR_PLUGIN_DEFER;
 			}
 		}else{
 			return MOSQ_ERR_PLUGIN_DEFER;
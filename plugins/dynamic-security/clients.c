@@ -82,6 +82,7 @@ static void client__free_item(struct dynsec__client *client)
 	}
 	dynsec_rolelist__cleanup(&client->rolelist);
 	dynsec__remove_client_from_all_groups(client->username);
+	dynsec__acl_tries_free(&client->acl_tries);
 	mosquitto_free(client->text_name);
 	mosquitto_free(client->text_description);
 	mosquitto_free(client->clientid);
@@ -456,7 +457,8 @@ int dynsec_clients__process_create(cJSON *j_responses, struct mosquitto *context
 		}
 	}
 
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 
 	dynsec__command_reply(j_responses, context, "createClient", NULL, correlation_data);
 
@@ -485,7 +487,9 @@ int dynsec_clients__process_delete(cJSON *j_responses, struct mosquitto *context
 		dynsec__remove_client_from_all_groups(username);
 		client__remove_all_roles(client);
 		client__free_item(client);
-		dynsec__config_save();
+		mosquitto_auth_cache_invalidate(username);
+		dynsec__acl_changed();
+		dynsec__config_changed();
 		dynsec__command_reply(j_responses, context, "deleteClient", NULL, correlation_data);
 
 		/* Enforce any changes */
@@ -528,7 +532,7 @@ int dynsec_clients__process_disable(cJSON *j_responses, struct mosquitto *contex
 
 	mosquitto_kick_client_by_username(username, false);
 
-	dynsec__config_save();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "disableClient", NULL, correlation_data);
 
 	admin_clientid = mosquitto_client_id(context);
@@ -563,7 +567,7 @@ int dynsec_clients__process_enable(cJSON *j_responses, struct mosquitto *context
 
 	client->disabled = false;
 
-	dynsec__config_save();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "enableClient", NULL, correlation_data);
 
 	admin_clientid = mosquitto_client_id(context);
@@ -622,7 +626,7 @@ int dynsec_clients__process_set_id(cJSON *j_responses, struct mosquitto *context
 	mosquitto_free(client->clientid);
 	client->clientid = clientid_heap;
 
-	dynsec__config_save();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "setClientId", NULL, correlation_data);
 
 	/* Enforce any changes */
@@ -639,6 +643,9 @@ int dynsec_clients__process_set_id(cJSON *j_responses, struct mosquitto *context
 
 static int client__set_password(struct dynsec__client *client, const char *password)
 {
+	/* Checks of the old password mustn't be reused. */
+	mosquitto_auth_cache_invalidate(client->username);
+
 	if(dynsec_auth__pw_hash(client, password, client->pw.password_hash, sizeof(client->pw.password_hash), true) == MOSQ_ERR_SUCCESS){
 		client->pw.valid = true;
 
@@ -682,7 +689,7 @@ int dynsec_clients__process_set_password(cJSON *j_responses, struct mosquitto *c
 	}
 	rc = client__set_password(client, password);
 	if(rc == MOSQ_ERR_SUCCESS){
-		dynsec__config_save();
+		dynsec__config_changed();
 		dynsec__command_reply(j_responses, context, "setClientPassword", NULL, correlation_data);
 
 		/* Enforce any changes */
@@ -832,7 +839,8 @@ int dynsec_clients__process_modify(cJSON *j_responses, struct mosquitto *context
 		}
 	}
 
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "modifyClient", NULL, correlation_data);
 
 	/* Enforce any changes */
@@ -1066,7 +1074,8 @@ int dynsec_clients__process_add_role(cJSON *j_responses, struct mosquitto *conte
 		dynsec__command_reply(j_responses, context, "addClientRole", "Internal error", correlation_data);
 		return MOSQ_ERR_UNKNOWN;
 	}
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "addClientRole", NULL, correlation_data);
 
 	/* Enforce any changes */
@@ -1120,7 +1129,8 @@ int dynsec_clients__process_remove_role(cJSON *j_responses, struct mosquitto *co
 	}
 
 	dynsec_rolelist__client_remove(client, role);
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "removeClientRole", NULL, correlation_data);
 
 	/* Enforce any changes */
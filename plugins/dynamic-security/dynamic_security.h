@@ -78,6 +78,7 @@ struct dynsec__client{
 	struct mosquitto_pw pw;
 	struct dynsec__rolelist *rolelist;
 	struct dynsec__grouplist *grouplist;
+	struct dynsec__acl_tries *acl_tries;
 	char *username;
 	char *clientid;
 	char *text_name;
@@ -102,6 +103,42 @@ struct dynsec__acl{
 	bool allow;
 };
 
+/* A node in a topic trie compiled from publish ACLs. order is the position of
+ * the first ACL ending at this node in the order ACLs are checked, or -1, and
+ * hash_order is the same for an ACL ending with '#' at this node. */
+struct dynsec__acl_node{
+	UT_hash_handle hh;
+	struct dynsec__acl_node *children;
+	struct dynsec__acl_node *plus;
+	char *level;
+	int order;
+	int hash_order;
+	bool allow;
+	bool hash_allow;
+};
+
+/* ACLs with a topic filter that isn't valid can't be added to a trie, so are
+ * kept in a list and checked the old way. */
+struct dynsec__acl_invalid{
+	struct dynsec__acl_invalid *next;
+	char *topic;
+	int order;
+	bool allow;
+};
+
+struct dynsec__acl_trie{
+	struct dynsec__acl_node *root;
+	struct dynsec__acl_invalid *invalid;
+};
+
+/* All of the publish ACLs that apply to a client, from its roles and the
+ * roles of its groups. */
+struct dynsec__acl_tries{
+	struct dynsec__acl_trie publish_c_send;
+	struct dynsec__acl_trie publish_c_recv;
+	unsigned int generation;
+};
+
 struct dynsec__acls{
 	struct dynsec__acl *publish_c_send;
 	struct dynsec__acl *publish_c_recv;
@@ -137,7 +174,8 @@ extern struct dynsec__acl_default_access default_access;
  * #
  * ################################################################ */
 
-void dynsec__config_save(void);
+void dynsec__config_changed(void);
+void dynsec__config_save_check(bool force);
 int dynsec__handle_control(cJSON *j_responses, struct mosquitto *context, cJSON *commands);
 void dynsec__command_reply(cJSON *j_responses, struct mosquitto *context, const char *command, const char *error, const char *correlation_data);
 
@@ -149,6 +187,9 @@ void dynsec__command_reply(cJSON *j_responses, struct mosquitto *context, const
  * ################################################################ */
 
 int dynsec__acl_check_callback(int event, void *event_data, void *userdata);
+void dynsec__acl_changed(void);
+void dynsec__acl_tries_free(struct dynsec__acl_tries **tries);
+void dynsec__acl_cleanup(void);
 bool sub_acl_check(const char *acl, const char *sub);
 
 
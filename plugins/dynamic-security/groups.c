@@ -166,7 +166,8 @@ int dynsec_groups__process_add_role(cJSON *j_responses, struct mosquitto *contex
 	mosquitto_log_printf(MOSQ_LOG_INFO, "dynsec: %s/%s | addGroupRole | groupname=%s | rolename=%s | priority=%d",
 			admin_clientid, admin_username, groupname, rolename, priority);
 
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "addGroupRole", NULL, correlation_data);
 
 	/* Enforce any changes */
@@ -443,7 +444,8 @@ int dynsec_groups__process_create(cJSON *j_responses, struct mosquitto *context,
 	mosquitto_log_printf(MOSQ_LOG_INFO, "dynsec: %s/%s | createGroup | groupname=%s",
 			admin_clientid, admin_username, groupname);
 
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "createGroup", NULL, correlation_data);
 	return MOSQ_ERR_SUCCESS;
 }
@@ -471,7 +473,8 @@ int dynsec_groups__process_delete(cJSON *j_responses, struct mosquitto *context,
 
 		dynsec__remove_all_roles_from_group(group);
 		group__free_item(group);
-		dynsec__config_save();
+		dynsec__acl_changed();
+		dynsec__config_changed();
 		dynsec__command_reply(j_responses, context, "deleteGroup", NULL, correlation_data);
 
 		admin_clientid = mosquitto_client_id(context);
@@ -520,8 +523,10 @@ int dynsec_groups__add_client(const char *username, const char *groupname, int p
 		return rc;
 	}
 
+	dynsec__acl_changed();
+
 	if(update_config){
-		dynsec__config_save();
+		dynsec__config_changed();
 	}
 
 	return MOSQ_ERR_SUCCESS;
@@ -624,8 +629,10 @@ int dynsec_groups__remove_client(const char *username, const char *groupname, bo
 	dynsec_clientlist__remove(&group->clientlist, client);
 	dynsec_grouplist__remove(&client->grouplist, group);
 
+	dynsec__acl_changed();
+
 	if(update_config){
-		dynsec__config_save();
+		dynsec__config_changed();
 	}
 	return MOSQ_ERR_SUCCESS;
 }
@@ -894,7 +901,8 @@ int dynsec_groups__process_remove_role(cJSON *j_responses, struct mosquitto *con
 	}
 
 	dynsec_rolelist__group_remove(group, role);
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "removeGroupRole", NULL, correlation_data);
 
 	/* Enforce any changes */
@@ -993,7 +1001,8 @@ int dynsec_groups__process_modify(cJSON *j_responses, struct mosquitto *context,
 		}
 	}
 
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 
 	dynsec__command_reply(j_responses, context, "modifyGroup", NULL, correlation_data);
 
@@ -1032,7 +1041,8 @@ int dynsec_groups__process_set_anonymous_group(cJSON *j_responses, struct mosqui
 
 	dynsec_anonymous_group = group;
 
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "setAnonymousGroup", NULL, correlation_data);
 
 	/* Enforce any changes */
@@ -24,6 +24,7 @@ Contributors:
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include "json_help.h"
 #include "mosquitto.h"
@@ -35,6 +36,9 @@ Contributors:
 
 static mosquitto_plugin_id_t *plg_id = NULL;
 static char *config_file = NULL;
+static int config_save_interval = 0;
+static bool config_dirty = false;
+static time_t config_last_save = 0;
 struct dynsec__acl_default_access default_access = {false, false, false, false};
 
 void dynsec__command_reply(cJSON *j_responses, struct mosquitto *context, const char *command, const char *error, const char *correlation_data)
@@ -126,6 +130,12 @@ static int dynsec_control_callback(int event, void *event_data, void *userdata)
 	dynsec__handle_control(j_responses, ed->client, commands);
 	cJSON_Delete(tree);
 
+	/* The commands may have changed the access granted to clients. */
+	mosquitto_acl_cache_invalidate(NULL);
+
+	/* However many commands there were, the config is only written once. */
+	dynsec__config_save_check(false);
+
 	send_response(j_response_tree);
 
 	return MOSQ_ERR_SUCCESS;
@@ -168,7 +178,7 @@ int dynsec__process_set_default_acl_access(cJSON *j_responses, struct mosquitto
 		}
 	}
 
-	dynsec__config_save();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "setDefaultACLAccess", NULL, correlation_data);
 	return MOSQ_ERR_SUCCESS;
 }
@@ -408,7 +418,7 @@ static int dynsec__config_load(void)
 }
 
 
-void dynsec__config_save(void)
+static void dynsec__config_save(void)
 {
 	cJSON *tree;
 	size_t file_path_len;
@@ -463,11 +473,51 @@ void dynsec__config_save(void)
 	/* Everything is ok, so move new file over proper file */
 	if(rename(file_path, config_file) < 0){
 		mosquitto_log_printf(MOSQ_LOG_ERR, "Error updating dynsec config file: %s", strerror(errno));
+	}else{
+		mosquitto_log_printf(MOSQ_LOG_DEBUG, "dynsec: Saved config file %s.", config_file);
 	}
 	mosquitto_free(file_path);
 }
 
 
+/* Record that the config needs saving. Writing the file is left to
+ * dynsec__config_save_check(), so a batch of changes is saved once rather
+ * than once per change. */
+void dynsec__config_changed(void)
+{
+	config_dirty = true;
+}
+
+
+/* Save the config if it has changed. If config_save_interval is set, saves are
+ * at least that many seconds apart, unless force is true. */
+void dynsec__config_save_check(bool force)
+{
+	time_t now;
+
+	if(!config_dirty) return;
+
+	now = time(NULL);
+	if(!force && config_save_interval > 0 && now < config_last_save + config_save_interval){
+		return;
+	}
+	config_dirty = false;
+	config_last_save = now;
+	dynsec__config_save();
+}
+
+
+static int dynsec__tick_callback(int event, void *event_data, void *userdata)
+{
+	UNUSED(event);
+	UNUSED(event_data);
+	UNUSED(userdata);
+
+	dynsec__config_save_check(false);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
 int mosquitto_plugin_init(mosquitto_plugin_id_t *identifier, void **user_data, struct mosquitto_opt *options, int option_count)
 {
 	int i;
@@ -476,11 +526,16 @@ int mosquitto_plugin_init(mosquitto_plugin_id_t *identifier, void **user_data, s
 
 	for(i=0; i<option_count; i++){
 		if(!strcasecmp(options[i].key, "config_file")){
+			mosquitto_free(config_file);
 			config_file = mosquitto_strdup(options[i].value);
 			if(config_file == NULL){
 				return MOSQ_ERR_NOMEM;
 			}
-			break;
+		}else if(!strcasecmp(options[i].key, "config_save_interval")){
+			config_save_interval = atoi(options[i].value);
+			if(config_save_interval < 0){
+				config_save_interval = 0;
+			}
 		}
 	}
 	if(config_file == NULL){
@@ -494,6 +549,9 @@ int mosquitto_plugin_init(mosquitto_plugin_id_t *identifier, void **user_data, s
 	mosquitto_callback_register(plg_id, MOSQ_EVT_CONTROL, dynsec_control_callback, "$CONTROL/dynamic-security/v1", NULL);
 	mosquitto_callback_register(plg_id, MOSQ_EVT_BASIC_AUTH, dynsec_auth__basic_auth_callback, NULL, NULL);
 	mosquitto_callback_register(plg_id, MOSQ_EVT_ACL_CHECK, dynsec__acl_check_callback, NULL, NULL);
+	if(config_save_interval > 0){
+		mosquitto_callback_register(plg_id, MOSQ_EVT_TICK, dynsec__tick_callback, NULL, NULL);
+	}
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -508,13 +566,22 @@ int mosquitto_plugin_cleanup(void *user_data, struct mosquitto_opt *options, int
 		mosquitto_callback_unregister(plg_id, MOSQ_EVT_CONTROL, dynsec_control_callback, "$CONTROL/dynamic-security/v1");
 		mosquitto_callback_unregister(plg_id, MOSQ_EVT_BASIC_AUTH, dynsec_auth__basic_auth_callback, NULL);
 		mosquitto_callback_unregister(plg_id, MOSQ_EVT_ACL_CHECK, dynsec__acl_check_callback, NULL);
+		if(config_save_interval > 0){
+			mosquitto_callback_unregister(plg_id, MOSQ_EVT_TICK, dynsec__tick_callback, NULL);
+		}
+		/* Don't lose changes still waiting for the save interval. */
+		dynsec__config_save_check(true);
 	}
 	dynsec_groups__cleanup();
 	dynsec_clients__cleanup();
 	dynsec_roles__cleanup();
+	dynsec__acl_cleanup();
 
 	mosquitto_free(config_file);
 	config_file = NULL;
+	config_save_interval = 0;
+	config_dirty = false;
+	config_last_save = 0;
 	return MOSQ_ERR_SUCCESS;
 }
 
@@ -413,7 +413,8 @@ int dynsec_roles__process_create(cJSON *j_responses, struct mosquitto *context,
 
 	HASH_ADD_KEYPTR_INORDER(hh, local_roles, role->rolename, strlen(role->rolename), role, role_cmp);
 
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 
 	dynsec__command_reply(j_responses, context, "createRole", NULL, correlation_data);
 
@@ -476,7 +477,8 @@ int dynsec_roles__process_delete(cJSON *j_responses, struct mosquitto *context,
 		role__remove_all_clients(role);
 		role__remove_all_groups(role);
 		role__free_item(role, true);
-		dynsec__config_save();
+		dynsec__acl_changed();
+		dynsec__config_changed();
 		dynsec__command_reply(j_responses, context, "deleteRole", NULL, correlation_data);
 
 		admin_clientid = mosquitto_client_id(context);
@@ -672,7 +674,8 @@ int dynsec_roles__process_add_acl(cJSON *j_responses, struct mosquitto *context,
 	json_get_bool(command, "allow", &acl->allow, true, false);
 
 	HASH_ADD_KEYPTR_INORDER(hh, *acllist, acl->topic, strlen(acl->topic), acl, insert_acl_cmp);
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 	dynsec__command_reply(j_responses, context, "addRoleACL", NULL, correlation_data);
 
 	role__kick_all(role);
@@ -750,7 +753,8 @@ int dynsec_roles__process_remove_acl(cJSON *j_responses, struct mosquitto *conte
 	HASH_FIND(hh, *acllist, topic, strlen(topic), acl);
 	if(acl){
 		role__free_acl(acllist, acl);
-		dynsec__config_save();
+		dynsec__acl_changed();
+		dynsec__config_changed();
 		dynsec__command_reply(j_responses, context, "removeRoleACL", NULL, correlation_data);
 
 		role__kick_all(role);
@@ -902,7 +906,8 @@ int dynsec_roles__process_modify(cJSON *j_responses, struct mosquitto *context,
 		role->acls.unsubscribe_pattern = tmp_unsubscribe_pattern;
 	}
 
-	dynsec__config_save();
+	dynsec__acl_changed();
+	dynsec__config_changed();
 
 	dynsec__command_reply(j_responses, context, "modifyRole", NULL, correlation_data);
 
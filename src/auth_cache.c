@@ -0,0 +1,226 @@
+/*
+Copyright (c) 2021 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR EDL-1.0
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+#include "config.h"
+
+#ifdef WITH_TLS
+
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+
+#include "uthash.h"
+
+/* Clients that reconnect check the same password against the same hash each
+ * time, which is deliberately slow. With auth_cache_ttl set, a successful
+ * check is remembered for that many seconds, and repeating it is just a hash
+ * lookup.
+ *
+ * Entries are keyed by an HMAC of the username and password, made with a
+ * secret chosen each time the broker starts, so the cache never holds
+ * anything that could be used to recover a password. The salt and hash that
+ * the password was checked against are part of the HMAC too. This means a
+ * success is only ever reused for the same stored password, so a changed
+ * password, or the same username in a different password store, can't match
+ * an old entry. Entries are also removed when the password file is reloaded,
+ * or when a plugin says a client's password has changed.
+ *
+ * Entries are kept in the order they were added or last refreshed. Each
+ * records when that was, rather than when it expires, so a change to
+ * auth_cache_ttl on reload applies to existing entries straight away and the
+ * oldest entries are always the first to expire. Expired entries are removed
+ * from the front whenever an entry is added. */
+
+#define AUTH_CACHE_KEY_LEN 32 /* SHA256 */
+
+struct auth_cache__entry{
+	UT_hash_handle hh;
+	unsigned char key[AUTH_CACHE_KEY_LEN];
+	char *username;
+	time_t added;
+};
+
+static struct auth_cache__entry *cache = NULL;
+static unsigned char secret[32];
+static bool secret_set = false;
+
+
+static int auth_cache__write_field(unsigned char *buf, const void *data, size_t len)
+{
+	buf[0] = (unsigned char)((len >> 8) & 0xFF);
+	buf[1] = (unsigned char)(len & 0xFF);
+	memcpy(&buf[2], data, len);
+
+	return (int)len + 2;
+}
+
+
+static int auth_cache__key(const char *username, const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len, unsigned char *key)
+{
+	unsigned char *buf;
+	size_t username_len, password_len, len, pos;
+	unsigned int key_len = AUTH_CACHE_KEY_LEN;
+	unsigned char *result;
+
+	if(!secret_set){
+		if(RAND_bytes(secret, sizeof(secret)) != 1){
+			return MOSQ_ERR_UNKNOWN;
+		}
+		secret_set = true;
+	}
+
+	username_len = strlen(username);
+	password_len = strlen(password);
+	if(username_len > UINT16_MAX || password_len > UINT16_MAX
+			|| salt_len > UINT16_MAX || hash_len > UINT16_MAX){
+
+		return MOSQ_ERR_INVAL;
+	}
+
+	/* Each field is prefixed with its length, so no two sets of fields give
+	 * the same data. */
+	len = 8 + username_len + password_len + salt_len + hash_len;
+	buf = mosquitto__malloc(len);
+	if(!buf){
+		return MOSQ_ERR_NOMEM;
+	}
+	pos = 0;
+	pos += (size_t)auth_cache__write_field(&buf[pos], username, username_len);
+	pos += (size_t)auth_cache__write_field(&buf[pos], password, password_len);
+	pos += (size_t)auth_cache__write_field(&buf[pos], salt, salt_len);
+	pos += (size_t)auth_cache__write_field(&buf[pos], hash, hash_len);
+
+	result = HMAC(EVP_sha256(), secret, sizeof(secret), buf, len, key, &key_len);
+
+	memset(buf, 0, len);
+	mosquitto__free(buf);
+
+	if(result == NULL || key_len != AUTH_CACHE_KEY_LEN){
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static bool auth_cache__expired(struct auth_cache__entry *entry)
+{
+	return entry->added + db.config->auth_cache_ttl <= db.now_s;
+}
+
+
+static void auth_cache__remove(struct auth_cache__entry *entry)
+{
+	HASH_DELETE(hh, cache, entry);
+	mosquitto__free(entry->username);
+	mosquitto__free(entry);
+}
+
+
+/* Returns MOSQ_ERR_SUCCESS if this password has been checked against this
+ * hash recently, or MOSQ_ERR_NOT_FOUND if it must be checked in full. */
+int auth_cache__check(const char *username, const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len)
+{
+	struct auth_cache__entry *entry;
+	unsigned char key[AUTH_CACHE_KEY_LEN];
+
+	if(db.config->auth_cache_ttl <= 0 || cache == NULL || !username || !password){
+		return MOSQ_ERR_NOT_FOUND;
+	}
+	if(auth_cache__key(username, password, salt, salt_len, hash, hash_len, key)){
+		return MOSQ_ERR_NOT_FOUND;
+	}
+
+	HASH_FIND(hh, cache, key, AUTH_CACHE_KEY_LEN, entry);
+	if(entry == NULL){
+		return MOSQ_ERR_NOT_FOUND;
+	}
+	if(auth_cache__expired(entry)){
+		auth_cache__remove(entry);
+		return MOSQ_ERR_NOT_FOUND;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Remember that this password matched this hash. */
+void auth_cache__add(const char *username, const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len)
+{
+	struct auth_cache__entry *entry, *entry_tmp;
+	unsigned char key[AUTH_CACHE_KEY_LEN];
+
+	if(db.config->auth_cache_ttl <= 0 || !username || !password){
+		return;
+	}
+	if(auth_cache__key(username, password, salt, salt_len, hash, hash_len, key)){
+		return;
+	}
+
+	HASH_ITER(hh, cache, entry, entry_tmp){
+		if(!auth_cache__expired(entry)){
+			break;
+		}
+		auth_cache__remove(entry);
+	}
+
+	HASH_FIND(hh, cache, key, AUTH_CACHE_KEY_LEN, entry);
+	if(entry){
+		/* Move to the end of the list */
+		HASH_DELETE(hh, cache, entry);
+	}else{
+		entry = mosquitto__calloc(1, sizeof(struct auth_cache__entry));
+		if(!entry){
+			return;
+		}
+		entry->username = mosquitto__strdup(username);
+		if(!entry->username){
+			mosquitto__free(entry);
+			return;
+		}
+		memcpy(entry->key, key, AUTH_CACHE_KEY_LEN);
+	}
+	entry->added = db.now_s;
+	HASH_ADD(hh, cache, key, AUTH_CACHE_KEY_LEN, entry);
+}
+
+
+/* Forget the checks for a username, or for every username if username is
+ * NULL. */
+void auth_cache__invalidate(const char *username)
+{
+	struct auth_cache__entry *entry, *entry_tmp;
+
+	HASH_ITER(hh, cache, entry, entry_tmp){
+		if(username == NULL || !strcmp(entry->username, username)){
+			auth_cache__remove(entry);
+		}
+	}
+}
+
+
+void auth_cache__cleanup(void)
+{
+	auth_cache__invalidate(NULL);
+	memset(secret, 0, sizeof(secret));
+	secret_set = false;
+}
+
+#endif
@@ -0,0 +1,359 @@
+/*
+Copyright (c) 2021 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR EDL-1.0
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+#include "config.h"
+
+#ifdef WITH_AUTH_THREADS
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "mqtt_protocol.h"
+#include "util_mosq.h"
+
+#include "utlist.h"
+
+/* The rest of the broker is single threaded, so mosquitto_internal.h replaces
+ * these with empty macros. */
+#undef pthread_create
+#undef pthread_join
+#undef pthread_mutex_lock
+#undef pthread_mutex_unlock
+
+/* Password hashes are deliberately slow to compute, so when many clients
+ * connect at once, checking their passwords can hold up the main loop for
+ * long enough that other clients time out. With auth_worker_threads set, the
+ * hash for a connecting client is instead computed on a worker thread. The
+ * client's CONNECT is held, with nothing more read from the client, until the
+ * result comes back. The main loop is woken through a pipe when there are
+ * results, and finishes each CONNECT in turn.
+ *
+ * Jobs are only allocated and freed on the main thread, because the memory
+ * functions aren't thread safe when memory tracking is enabled. A worker only
+ * reads the job's password and hash and sets its result. If the client goes
+ * away before then, the job is detached from it and discarded once it is
+ * finished. */
+
+struct auth_worker__job{
+	struct auth_worker__job *next, *prev;
+	struct mosquitto *context; /* NULL if the client has gone */
+	char *password;
+	unsigned char *salt;
+	unsigned int salt_len;
+	unsigned char *hash;
+	unsigned int hash_len;
+	enum mosquitto_pwhash_type hashtype;
+	int iterations;
+	int rc;
+	bool started; /* Taken from the queue by a worker */
+};
+
+static pthread_t *threads = NULL;
+static int thread_count = 0;
+static bool stopping = false;
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static struct auth_worker__job *job_queue = NULL; /* Waiting for a worker */
+static struct auth_worker__job *job_done = NULL; /* Waiting for the main loop */
+static int pending_count = 0; /* Jobs not yet handled by the main loop */
+static int wake_pipe[2] = {-1, -1};
+
+
+static void auth_worker__job_free(struct auth_worker__job *job)
+{
+	if(job->context){
+		job->context->auth_job = NULL;
+	}
+	if(job->password){
+		memset(job->password, 0, strlen(job->password));
+		mosquitto__free(job->password);
+	}
+	mosquitto__free(job->salt);
+	mosquitto__free(job->hash);
+	mosquitto__free(job);
+}
+
+
+static void *auth_worker__thread(void *userdata)
+{
+	struct auth_worker__job *job;
+	bool wake;
+	char byte = 0;
+
+	UNUSED(userdata);
+
+	pthread_mutex_lock(&job_mutex);
+	while(1){
+		while(job_queue == NULL && !stopping){
+			pthread_cond_wait(&job_cond, &job_mutex);
+		}
+		if(stopping){
+			break;
+		}
+		job = job_queue;
+		DL_DELETE(job_queue, job);
+		job->started = true;
+		pthread_mutex_unlock(&job_mutex);
+
+		job->rc = pw__verify(job->password, job->salt, job->salt_len,
+				job->hash, job->hash_len, job->hashtype, job->iterations);
+
+		pthread_mutex_lock(&job_mutex);
+		/* Only wake the main loop for the first result it hasn't seen, so
+		 * the pipe can't fill up. */
+		wake = (job_done == NULL);
+		DL_APPEND(job_done, job);
+		if(wake && write(wake_pipe[1], &byte, 1) != 1){
+			/* The pipe already has data waiting, which is enough. */
+		}
+	}
+	pthread_mutex_unlock(&job_mutex);
+
+	return NULL;
+}
+
+
+int auth_worker__init(void)
+{
+	sigset_t sigs, oldsigs;
+	int i;
+
+	if(db.config->auth_worker_threads <= 0){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	if(pipe(wake_pipe)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to create auth worker pipe: %s.", strerror(errno));
+		return MOSQ_ERR_ERRNO;
+	}
+	for(i=0; i<2; i++){
+		if(fcntl(wake_pipe[i], F_SETFL, fcntl(wake_pipe[i], F_GETFL, 0) | O_NONBLOCK) == -1){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to create auth worker pipe: %s.", strerror(errno));
+			auth_worker__cleanup();
+			return MOSQ_ERR_ERRNO;
+		}
+	}
+
+	threads = mosquitto__calloc((size_t)db.config->auth_worker_threads, sizeof(pthread_t));
+	if(!threads){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		auth_worker__cleanup();
+		return MOSQ_ERR_NOMEM;
+	}
+
+	/* Signals must be handled by the main thread, and new threads inherit
+	 * the signal mask. */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+	for(i=0; i<db.config->auth_worker_threads; i++){
+		if(pthread_create(&threads[i], NULL, auth_worker__thread, NULL)){
+			break;
+		}
+		thread_count++;
+	}
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+	if(thread_count < db.config->auth_worker_threads){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to start auth worker threads.");
+		auth_worker__cleanup();
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void auth_worker__cleanup(void)
+{
+	struct auth_worker__job *job, *job_tmp;
+	int i;
+
+	pthread_mutex_lock(&job_mutex);
+	stopping = true;
+	pthread_cond_broadcast(&job_cond);
+	pthread_mutex_unlock(&job_mutex);
+
+	for(i=0; i<thread_count; i++){
+		pthread_join(threads[i], NULL);
+	}
+	mosquitto__free(threads);
+	threads = NULL;
+	thread_count = 0;
+	stopping = false;
+
+	DL_FOREACH_SAFE(job_queue, job, job_tmp){
+		DL_DELETE(job_queue, job);
+		auth_worker__job_free(job);
+	}
+	DL_FOREACH_SAFE(job_done, job, job_tmp){
+		DL_DELETE(job_done, job);
+		auth_worker__job_free(job);
+	}
+	pending_count = 0;
+
+	for(i=0; i<2; i++){
+		if(wake_pipe[i] != -1){
+			close(wake_pipe[i]);
+			wake_pipe[i] = -1;
+		}
+	}
+}
+
+
+/* The file descriptor that is readable when there are results waiting. */
+int auth_worker__fd(void)
+{
+	return wake_pipe[0];
+}
+
+
+/* Queue a password check for a client's CONNECT. Returns
+ * MOSQ_ERR_AUTH_DELAYED if the check has been queued, MOSQ_ERR_AUTH if
+ * max_pending_auth checks are already queued, or MOSQ_ERR_NOT_SUPPORTED if it
+ * must be made straight away instead. */
+int auth_worker__submit(struct mosquitto *context, const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len, enum mosquitto_pwhash_type hashtype, int iterations)
+{
+	struct auth_worker__job *job;
+
+	/* Only a CONNECT can be held while the check is made. Websockets clients
+	 * are read by libwebsockets, which can't hold the rest of their data. */
+	if(thread_count == 0
+			|| context->auth_job
+			|| mosquitto__get_state(context) != mosq_cs_new
+			|| (context->in_packet.command&0xF0) != CMD_CONNECT
+#ifdef WITH_WEBSOCKETS
+			|| context->wsi
+#endif
+			){
+
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+	if(auth_worker__busy()){
+		/* The client is refused with "server busy" rather than "not
+		 * authorised". */
+		context->auth_busy = true;
+		return MOSQ_ERR_AUTH;
+	}
+
+	job = mosquitto__calloc(1, sizeof(struct auth_worker__job));
+	if(!job){
+		return MOSQ_ERR_NOMEM;
+	}
+	job->password = mosquitto__strdup(password);
+	job->salt = mosquitto__malloc(salt_len);
+	job->hash = mosquitto__malloc(hash_len);
+	if(!job->password || !job->salt || !job->hash){
+		auth_worker__job_free(job);
+		return MOSQ_ERR_NOMEM;
+	}
+	memcpy(job->salt, salt, salt_len);
+	job->salt_len = salt_len;
+	memcpy(job->hash, hash, hash_len);
+	job->hash_len = hash_len;
+	job->hashtype = hashtype;
+	job->iterations = iterations;
+
+	job->context = context;
+	context->auth_job = job;
+	pending_count++;
+
+	pthread_mutex_lock(&job_mutex);
+	DL_APPEND(job_queue, job);
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_mutex);
+
+	return MOSQ_ERR_AUTH_DELAYED;
+}
+
+
+/* Detach a client that is going away from its password check. A check that
+ * no worker has started is discarded, so it no longer counts towards
+ * max_pending_auth. */
+void auth_worker__cancel(struct mosquitto *context)
+{
+	struct auth_worker__job *job;
+	bool discard;
+
+	job = context->auth_job;
+	if(job == NULL){
+		return;
+	}
+	job->context = NULL;
+	context->auth_job = NULL;
+
+	pthread_mutex_lock(&job_mutex);
+	discard = !job->started;
+	if(discard){
+		DL_DELETE(job_queue, job);
+	}
+	pthread_mutex_unlock(&job_mutex);
+
+	if(discard){
+		pending_count--;
+		auth_worker__job_free(job);
+	}
+}
+
+
+/* True if max_pending_auth checks are already queued or in progress. */
+bool auth_worker__busy(void)
+{
+	return thread_count > 0
+			&& db.config->max_pending_auth > 0
+			&& pending_count >= db.config->max_pending_auth;
+}
+
+
+/* Finish the CONNECT of every client whose password check is complete. */
+void auth_worker__handle(void)
+{
+	struct auth_worker__job *done, *job, *job_tmp;
+	struct mosquitto *context;
+	char buf[64];
+
+	while(read(wake_pipe[0], buf, sizeof(buf)) > 0){
+	}
+
+	pthread_mutex_lock(&job_mutex);
+	done = job_done;
+	job_done = NULL;
+	pthread_mutex_unlock(&job_mutex);
+
+	DL_FOREACH_SAFE(done, job, job_tmp){
+		DL_DELETE(done, job);
+		pending_count--;
+
+		context = job->context;
+		if(context){
+			auth_worker__cancel(context);
+			if(job->rc == MOSQ_ERR_SUCCESS){
+				auth_cache__add(context->username, job->password,
+						job->salt, job->salt_len, job->hash, job->hash_len);
+			}
+			connect__on_unpwd_checked(context, job->rc);
+		}
+		auth_worker__job_free(job);
+	}
+}
+
+#endif
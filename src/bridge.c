@@ -497,7 +497,7 @@ int bridge__on_connect(struct mosquitto *context)
 		if(context->bridge->notification_topic){
 			if(!context->bridge->notifications_local_only){
 				if(send__real_publish(context, mosquitto__mid_generate(context),
-						context->bridge->notification_topic, 1, &notification_payload, qos, retain, 0, NULL, NULL, 0)){
+						context->bridge->notification_topic, 1, &notification_payload, qos, retain, 0, NULL, NULL, 0, NULL)){
 
 					return 1;
 				}
@@ -512,7 +512,7 @@ int bridge__on_connect(struct mosquitto *context)
 			notification_payload = '1';
 			if(!context->bridge->notifications_local_only){
 				if(send__real_publish(context, mosquitto__mid_generate(context),
-						notification_topic, 1, &notification_payload, qos, retain, 0, NULL, NULL, 0)){
+						notification_topic, 1, &notification_payload, qos, retain, 0, NULL, NULL, 0, NULL)){
 
 					mosquitto__free(notification_topic);
 					return 1;
@@ -631,14 +631,14 @@ void bridge__packet_cleanup(struct mosquitto *context)
 
 	if(context->current_out_packet){
 		packet__cleanup(context->current_out_packet);
-		mosquitto__free(context->current_out_packet);
+		mosquitto__pool_free(mosq_pool_packet, context->current_out_packet);
 		context->current_out_packet = NULL;
 	}
     while(context->out_packet){
 		packet__cleanup(context->out_packet);
 		packet = context->out_packet;
 		context->out_packet = context->out_packet->next;
-		mosquitto__free(packet);
+		mosquitto__pool_free(mosq_pool_packet, packet);
 	}
 	context->out_packet = NULL;
 	context->out_packet_last = NULL;
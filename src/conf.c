@@ -137,7 +137,9 @@ static void config__init_reload(struct mosquitto__config *config)
 	}
 
 	config->local_only = true;
+	config->acl_cache_size = 0;
 	config->allow_duplicate_messages = false;
+	config->auth_cache_ttl = 0;
 
 	mosquitto__free(config->security_options.acl_file);
 	config->security_options.acl_file = NULL;
@@ -155,6 +157,7 @@ static void config__init_reload(struct mosquitto__config *config)
 
 	config->autosave_interval = 1800;
 	config->autosave_on_changes = false;
+	config->autosave_background = false;
 	mosquitto__free(config->clientid_prefixes);
 	config->connection_messages = true;
 	config->clientid_prefixes = NULL;
@@ -187,13 +190,21 @@ static void config__init_reload(struct mosquitto__config *config)
 	config->log_timestamp = true;
 	mosquitto__free(config->log_timestamp_format);
 	config->log_timestamp_format = NULL;
+	config->max_accepts_per_loop = 64;
 	config->max_keepalive = 65535;
 	config->max_packet_size = 0;
+	config->max_packets_per_read = 1000;
+	config->max_pending_auth = 1000;
 	config->max_inflight_messages = 20;
 	config->max_queued_messages = 1000;
 	config->max_inflight_bytes = 0;
 	config->max_queued_bytes = 0;
+	config->max_retained_bytes = 0;
+	config->max_retained_messages = 0;
+	config->packet_buffer_size = 16384;
 	config->persistence = false;
+	config->persistence_journal = false;
+	config->persistence_journal_max_size = 10485760;
 	mosquitto__free(config->persistence_location);
 	config->persistence_location = NULL;
 	mosquitto__free(config->persistence_file);
@@ -201,7 +212,9 @@ static void config__init_reload(struct mosquitto__config *config)
 	config->persistent_client_expiration = 0;
 	config->queue_qos0_messages = false;
 	config->retain_available = true;
+	config->retained_eviction = mosq_re_lru;
 	config->set_tcp_nodelay = false;
+	config->subscription_cache_size = 0;
 	config->sys_interval = 10;
 	config->upgrade_outgoing_qos = false;
 
@@ -546,11 +559,14 @@ void config__copy(struct mosquitto__config *src, struct mosquitto__config *dest)
 	dest->security_options.psk_file = src->security_options.psk_file;
 
 
+	dest->acl_cache_size = src->acl_cache_size;
 	dest->allow_duplicate_messages = src->allow_duplicate_messages;
+	dest->auth_cache_ttl = src->auth_cache_ttl;
 
 
 	dest->autosave_interval = src->autosave_interval;
 	dest->autosave_on_changes = src->autosave_on_changes;
+	dest->autosave_background = src->autosave_background;
 
 	mosquitto__free(dest->clientid_prefixes);
 	dest->clientid_prefixes = src->clientid_prefixes;
@@ -567,7 +583,14 @@ void config__copy(struct mosquitto__config *src, struct mosquitto__config *dest)
 	mosquitto__free(dest->log_file);
 	dest->log_file = src->log_file;
 
+	dest->max_accepts_per_loop = src->max_accepts_per_loop;
+	dest->max_packets_per_read = src->max_packets_per_read;
+	dest->max_pending_auth = src->max_pending_auth;
+	dest->max_retained_bytes = src->max_retained_bytes;
+	dest->max_retained_messages = src->max_retained_messages;
+
 	dest->message_size_limit = src->message_size_limit;
+	dest->packet_buffer_size = src->packet_buffer_size;
 
 	dest->persistence = src->persistence;
 
@@ -580,10 +603,14 @@ void config__copy(struct mosquitto__config *src, struct mosquitto__config *dest)
 	mosquitto__free(dest->persistence_filepath);
 	dest->persistence_filepath = src->persistence_filepath;
 
+	dest->persistence_journal_max_size = src->persistence_journal_max_size;
+
 	dest->persistent_client_expiration = src->persistent_client_expiration;
 
 
 	dest->queue_qos0_messages = src->queue_qos0_messages;
+	dest->retained_eviction = src->retained_eviction;
+	dest->subscription_cache_size = src->subscription_cache_size;
 	dest->sys_interval = src->sys_interval;
 	dest->upgrade_outgoing_qos = src->upgrade_outgoing_qos;
 
@@ -756,7 +783,14 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 			}
 			token = strtok_r((*buf), " ", &saveptr);
 			if(token){
-				if(!strcmp(token, "acl_file")){
+				if(!strcmp(token, "acl_cache_size")){
+					if(conf__parse_int(&token, "acl_cache_size", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid acl_cache_size value (%d).", tmp_int);
+						return MOSQ_ERR_INVAL;
+					}
+					config->acl_cache_size = tmp_int;
+				}else if(!strcmp(token, "acl_file")){
 					conf__set_cur_security_options(config, cur_listener, &cur_security_options);
 					if(reload){
 						mosquitto__free(cur_security_options->acl_file);
@@ -827,6 +861,9 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 				}else if(!strcmp(token, "allow_zero_length_clientid")){
 					conf__set_cur_security_options(config, cur_listener, &cur_security_options);
 					if(conf__parse_bool(&token, "allow_zero_length_clientid", &cur_security_options->allow_zero_length_clientid, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "auth_cache_ttl")){
+					if(conf__parse_int(&token, "auth_cache_ttl", &config->auth_cache_ttl, saveptr)) return MOSQ_ERR_INVAL;
+					if(config->auth_cache_ttl < 0) config->auth_cache_ttl = 0;
 				}else if(!strncmp(token, "auth_opt_", strlen("auth_opt_")) || !strncmp(token, "plugin_opt_", strlen("plugin_opt_"))){
 					if(reload) continue; /* Auth plugin not currently valid for reloading. */
 					if(!cur_auth_plugin_config){
@@ -898,6 +935,15 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 						return MOSQ_ERR_INVAL;
 					}
 					if(conf__parse_bool(&token, "auth_plugin_deny_special_chars", &cur_auth_plugin_config->deny_special_chars, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "auth_worker_threads")){
+					if(reload) continue; /* Worker threads not valid for reloading. */
+					if(conf__parse_int(&token, "auth_worker_threads", &config->auth_worker_threads, saveptr)) return MOSQ_ERR_INVAL;
+					if(config->auth_worker_threads < 0) config->auth_worker_threads = 0;
+#ifndef WITH_AUTH_THREADS
+					if(config->auth_worker_threads > 0){
+						log__printf(NULL, MOSQ_LOG_WARNING, "Warning: auth_worker_threads is not supported by this broker, passwords will be checked on the main thread.");
+					}
+#endif
 				}else if(!strcmp(token, "auto_id_prefix")){
 					conf__set_cur_security_options(config, cur_listener, &cur_security_options);
 					if(conf__parse_string(&token, "auto_id_prefix", &cur_security_options->auto_id_prefix, saveptr)) return MOSQ_ERR_INVAL;
@@ -906,6 +952,12 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 					}else{
 						cur_security_options->auto_id_prefix_len = 0;
 					}
+				}else if(!strcmp(token, "autosave_background")){
+#ifndef WIN32
+					if(conf__parse_bool(&token, "autosave_background", &config->autosave_background, saveptr)) return MOSQ_ERR_INVAL;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: autosave_background is not supported on Windows.");
+#endif
 				}else if(!strcmp(token, "autosave_interval")){
 					if(conf__parse_int(&token, "autosave_interval", &config->autosave_interval, saveptr)) return MOSQ_ERR_INVAL;
 					if(config->autosave_interval < 0) config->autosave_interval = 0;
@@ -1622,6 +1674,10 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 					}else{
 						log__printf(NULL, MOSQ_LOG_ERR, "Error: Empty log_type value in configuration.");
 					}
+				}else if(!strcmp(token, "max_accepts_per_loop")){
+					if(conf__parse_int(&token, "max_accepts_per_loop", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0) tmp_int = 0;
+					config->max_accepts_per_loop = tmp_int;
 				}else if(!strcmp(token, "max_connections")){
 					if(reload) continue; /* Listeners not valid for reloading. */
 					token = strtok_r(NULL, " ", &saveptr);
@@ -1666,6 +1722,14 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 						return MOSQ_ERR_INVAL;
 					}
 					config->max_packet_size = (uint32_t)tmp_int;
+				}else if(!strcmp(token, "max_packets_per_read")){
+					if(conf__parse_int(&token, "max_packets_per_read", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0) tmp_int = 0;
+					config->max_packets_per_read = tmp_int;
+				}else if(!strcmp(token, "max_pending_auth")){
+					if(conf__parse_int(&token, "max_pending_auth", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0) tmp_int = 0;
+					config->max_pending_auth = tmp_int;
 				}else if(!strcmp(token, "max_queued_bytes")){
 					if(conf__parse_int(&token, "max_queued_bytes", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
 					if(tmp_int < 0) tmp_int = 0;
@@ -1674,6 +1738,21 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 					if(conf__parse_int(&token, "max_queued_messages", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
 					if(tmp_int < 0) tmp_int = 0;
 					config->max_queued_messages = tmp_int;
+				}else if(!strcmp(token, "max_retained_bytes")){
+					ssize_t lim;
+					if(conf__parse_ssize_t(&token, "max_retained_bytes", &lim, saveptr)) return MOSQ_ERR_INVAL;
+					if(lim < 0){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid max_retained_bytes value (%ld).", lim);
+						return MOSQ_ERR_INVAL;
+					}
+					config->max_retained_bytes = (size_t)lim;
+				}else if(!strcmp(token, "max_retained_messages")){
+					if(conf__parse_int(&token, "max_retained_messages", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid max_retained_messages value (%d).", tmp_int);
+						return MOSQ_ERR_INVAL;
+					}
+					config->max_retained_messages = tmp_int;
 				}else if(!strcmp(token, "memory_limit")){
 					ssize_t lim;
 					if(conf__parse_ssize_t(&token, "memory_limit", &lim, saveptr)) return MOSQ_ERR_INVAL;
@@ -1682,6 +1761,9 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 						return MOSQ_ERR_INVAL;
 					}
 					memory__set_limit((size_t)lim);
+				}else if(!strcmp(token, "memory_pools")){
+					if(reload) continue; /* Pools can't be changed once objects have been allocated. */
+					if(conf__parse_bool(&token, "memory_pools", &config->memory_pools, saveptr)) return MOSQ_ERR_INVAL;
 				}else if(!strcmp(token, "message_size_limit")){
 					if(conf__parse_int(&token, "message_size_limit", (int *)&config->message_size_limit, saveptr)) return MOSQ_ERR_INVAL;
 					if(config->message_size_limit > MQTT_MAX_PAYLOAD){
@@ -1734,6 +1816,13 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 #else
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
 #endif
+				}else if(!strcmp(token, "packet_buffer_size")){
+					if(conf__parse_int(&token, "packet_buffer_size", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 1){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid packet_buffer_size value (%d).", tmp_int);
+						return MOSQ_ERR_INVAL;
+					}
+					config->packet_buffer_size = (size_t)tmp_int;
 				}else if(!strcmp(token, "password") || !strcmp(token, "remote_password")){
 #ifdef WITH_BRIDGE
 					if(reload) continue; /* FIXME */
@@ -1762,6 +1851,21 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 					if(conf__parse_bool(&token, token, &config->persistence, saveptr)) return MOSQ_ERR_INVAL;
 				}else if(!strcmp(token, "persistence_file")){
 					if(conf__parse_string(&token, "persistence_file", &config->persistence_file, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "persistence_journal")){
+					if(reload) continue; /* The journal is opened when the database is restored. */
+#ifndef WIN32
+					if(conf__parse_bool(&token, "persistence_journal", &config->persistence_journal, saveptr)) return MOSQ_ERR_INVAL;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: persistence_journal is not supported on Windows.");
+#endif
+				}else if(!strcmp(token, "persistence_journal_max_size")){
+					ssize_t max_size;
+					if(conf__parse_ssize_t(&token, "persistence_journal_max_size", &max_size, saveptr)) return MOSQ_ERR_INVAL;
+					if(max_size < 0){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid persistence_journal_max_size value (%ld).", max_size);
+						return MOSQ_ERR_INVAL;
+					}
+					config->persistence_journal_max_size = (size_t)max_size;
 				}else if(!strcmp(token, "persistence_location")){
 					if(conf__parse_string(&token, "persistence_location", &config->persistence_location, saveptr)) return MOSQ_ERR_INVAL;
 				}else if(!strcmp(token, "persistent_client_expiration")){
@@ -1893,6 +1997,21 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 #endif
 				}else if(!strcmp(token, "retain_available")){
 					if(conf__parse_bool(&token, token, &config->retain_available, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "retained_eviction")){
+					token = strtok_r(NULL, " ", &saveptr);
+					if(token){
+						if(!strcmp(token, "lru")){
+							config->retained_eviction = mosq_re_lru;
+						}else if(!strcmp(token, "oldest")){
+							config->retained_eviction = mosq_re_oldest;
+						}else{
+							log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid retained_eviction value (%s).", token);
+							return MOSQ_ERR_INVAL;
+						}
+					}else{
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Empty retained_eviction value in configuration.");
+						return MOSQ_ERR_INVAL;
+					}
 				}else if(!strcmp(token, "retry_interval")){
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: The retry_interval option is no longer available.");
 				}else if(!strcmp(token, "round_robin")){
@@ -1953,6 +2072,13 @@ int config__read_file_core(struct mosquitto__config *config, bool reload, struct
 						log__printf(NULL, MOSQ_LOG_ERR, "Error: Empty socket_domain value in configuration.");
 						return MOSQ_ERR_INVAL;
 					}
+				}else if(!strcmp(token, "subscription_cache_size")){
+					if(conf__parse_int(&token, "subscription_cache_size", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid subscription_cache_size value (%d).", tmp_int);
+						return MOSQ_ERR_INVAL;
+					}
+					config->subscription_cache_size = tmp_int;
 				}else if(!strcmp(token, "sys_interval")){
 					if(conf__parse_int(&token, "sys_interval", &config->sys_interval, saveptr)) return MOSQ_ERR_INVAL;
 					if(config->sys_interval < 0 || config->sys_interval > 65535){
@@ -91,6 +91,12 @@ struct mosquitto *context__init(mosq_sock_t sock)
 	context->ssl = NULL;
 #endif
 
+	if(acl__cache_init(context)){
+		mosquitto__free(context->address);
+		mosquitto__free(context);
+		return NULL;
+	}
+
 	if((int)context->sock >= 0){
 		HASH_ADD(hh_sock, db.contexts_by_sock, sock, sizeof(context->sock), context);
 	}
@@ -103,6 +109,24 @@ struct mosquitto *context__init(mosq_sock_t sock)
  * but it will mean that CONNACK messages will never get sent for bad protocol
  * versions for example.
  */
+#ifdef WITH_AUTH_THREADS
+/* A client going away while its password is being checked has not connected,
+ * so has no session and no will. */
+static void context__auth_cancel(struct mosquitto *context)
+{
+	if(context->auth_job){
+		auth_worker__cancel(context);
+		mosquitto__free(context->id);
+		context->id = NULL;
+		will__clear(context);
+		context->clean_start = true;
+		context->session_expiry_interval = 0;
+		context->will_delay_interval = 0;
+	}
+}
+#endif
+
+
 void context__cleanup(struct mosquitto *context, bool force_free)
 {
 	struct mosquitto__packet *packet;
@@ -112,6 +136,9 @@ void context__cleanup(struct mosquitto *context, bool force_free)
 	if(force_free){
 		context->clean_start = true;
 	}
+#ifdef WITH_AUTH_THREADS
+	context__auth_cancel(context);
+#endif
 
 #ifdef WITH_BRIDGE
 	if(context->bridge){
@@ -120,12 +147,14 @@ void context__cleanup(struct mosquitto *context, bool force_free)
 #endif
 
 	alias__free_all(context);
+	keepalive__remove(context);
 
 	mosquitto__free(context->auth_method);
 	context->auth_method = NULL;
 
 	mosquitto__free(context->username);
 	context->username = NULL;
+	acl__cache_clear(context);
 
 	mosquitto__free(context->password);
 	context->password = NULL;
@@ -133,6 +162,7 @@ void context__cleanup(struct mosquitto *context, bool force_free)
 	net__socket_close(context);
 	if(force_free){
 		sub__clean_session(context);
+		retain__stream_remove(context, NULL);
 	}
 	db__messages_delete(context, force_free);
 
@@ -147,16 +177,19 @@ void context__cleanup(struct mosquitto *context, bool force_free)
 		context->id = NULL;
 	}
 	packet__cleanup(&(context->in_packet));
+	mosquitto__free(context->in_held);
+	context->in_held = NULL;
+	context->in_held_len = 0;
 	if(context->current_out_packet){
 		packet__cleanup(context->current_out_packet);
-		mosquitto__free(context->current_out_packet);
+		mosquitto__pool_free(mosq_pool_packet, context->current_out_packet);
 		context->current_out_packet = NULL;
 	}
 	while(context->out_packet){
 		packet__cleanup(context->out_packet);
 		packet = context->out_packet;
 		context->out_packet = context->out_packet->next;
-		mosquitto__free(packet);
+		mosquitto__pool_free(mosq_pool_packet, packet);
 	}
 #if defined(WITH_BROKER) && defined(__GLIBC__) && defined(WITH_ADNS)
 	if(context->adns){
@@ -166,6 +199,9 @@ void context__cleanup(struct mosquitto *context, bool force_free)
 	}
 #endif
 	if(force_free){
+		session_expiry__remove(context);
+		will_delay__remove(context);
+		acl__cache_free(context);
 		mosquitto__free(context);
 	}
 }
@@ -207,6 +243,9 @@ void context__disconnect(struct mosquitto *context)
 	if(mosquitto__get_state(context) == mosq_cs_disconnected){
 		return;
 	}
+#ifdef WITH_AUTH_THREADS
+	context__auth_cancel(context);
+#endif
 
 	plugin__handle_disconnect(context, -1);
 
@@ -226,6 +265,9 @@ void context__disconnect(struct mosquitto *context)
 		}
 	}else{
 		session_expiry__add(context);
+#ifdef WITH_PERSISTENCE
+		persist__journal_client(context);
+#endif
 	}
 	keepalive__remove(context);
 	mosquitto__set_state(context, mosq_cs_disconnected);
@@ -238,6 +280,11 @@ void context__add_to_disused(struct mosquitto *context)
 	mosquitto__set_state(context, mosq_cs_disused);
 
 	if(context->id){
+#ifdef WITH_PERSISTENCE
+		if(context->clean_start == false){
+			persist__journal_client_delete(context);
+		}
+#endif
 		context__remove_from_by_id(context);
 		mosquitto__free(context->id);
 		context->id = NULL;
@@ -129,8 +129,6 @@ bool db__ready_for_queue(struct mosquitto *context, int qos, struct mosquitto_ms
 
 int db__open(struct mosquitto__config *config)
 {
-	struct mosquitto__subhier *subhier;
-
 	if(!config) return MOSQ_ERR_INVAL;
 
 	db.last_db_id = 0;
@@ -146,13 +144,9 @@ int db__open(struct mosquitto__config *config)
 	/* Initialize the hashtable */
 	db.clientid_index_hash = NULL;
 
-	db.subs = NULL;
-
-	subhier = sub__add_hier_entry(NULL, &db.subs, "", 0);
-	if(!subhier) return MOSQ_ERR_NOMEM;
-
-	subhier = sub__add_hier_entry(NULL, &db.subs, "$SYS", (uint16_t)strlen("$SYS"));
-	if(!subhier) return MOSQ_ERR_NOMEM;
+	/* The root of the subscription tree */
+	db.subs = sub__add_hier_entry(NULL, "", 0);
+	if(!db.subs) return MOSQ_ERR_NOMEM;
 
 	retain__init();
 
@@ -165,30 +159,11 @@ int db__open(struct mosquitto__config *config)
 	return MOSQ_ERR_SUCCESS;
 }
 
-static void subhier_clean(struct mosquitto__subhier **subhier)
-{
-	struct mosquitto__subhier *peer, *subhier_tmp;
-	struct mosquitto__subleaf *leaf, *nextleaf;
-
-	HASH_ITER(hh, *subhier, peer, subhier_tmp){
-		leaf = peer->subs;
-		while(leaf){
-			nextleaf = leaf->next;
-			mosquitto__free(leaf);
-			leaf = nextleaf;
-		}
-		subhier_clean(&peer->children);
-		mosquitto__free(peer->topic);
-
-		HASH_DELETE(hh, *subhier, peer);
-		mosquitto__free(peer);
-	}
-}
-
 int db__close(void)
 {
-	subhier_clean(&db.subs);
+	sub__tree_clean(&db.subs);
 	retain__clean(&db.retains);
+	retain__evict_cleanup();
 	db__msg_store_clean();
 
 	return MOSQ_ERR_SUCCESS;
@@ -208,20 +183,25 @@ void db__msg_store_add(struct mosquitto_msg_store *store)
 
 void db__msg_store_free(struct mosquitto_msg_store *store)
 {
-	int i;
-
 	mosquitto__free(store->source_id);
 	mosquitto__free(store->source_username);
-	if(store->dest_ids){
-		for(i=0; i<store->dest_id_count; i++){
-			mosquitto__free(store->dest_ids[i]);
-		}
-		mosquitto__free(store->dest_ids);
-	}
 	mosquitto__free(store->topic);
 	mosquitto_property_free_all(&store->properties);
-	mosquitto__free(store->payload);
-	mosquitto__free(store);
+	db__msg_store_payload_free(store);
+	mosquitto__pool_free(mosq_pool_msg_store, store);
+}
+
+/* The payload may be part of the buffer of the packet it was received in,
+ * in which case it is the packet buffer that must be freed. */
+void db__msg_store_payload_free(struct mosquitto_msg_store *store)
+{
+	if(store->payload_buf){
+		mosquitto__free(store->payload_buf);
+		store->payload_buf = NULL;
+	}else{
+		mosquitto__free(store->payload);
+	}
+	store->payload = NULL;
 }
 
 void db__msg_store_remove(struct mosquitto_msg_store *store)
@@ -286,13 +266,72 @@ void db__msg_store_compact(void)
 }
 
 
-static void db__message_remove(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *item)
+/* The inflight and queued lists are each indexed by mid, so that
+ * acknowledgements can be matched without walking the list. Messages with a
+ * mid of 0 (outgoing QoS 0) are never looked up so aren't indexed. All
+ * changes to the lists must go through these functions. */
+void db__message_add_to_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+	DL_APPEND(msg_data->inflight, msg);
+	if(msg->mid != 0){
+		HASH_ADD(hh_mid, msg_data->inflight_by_mid, mid, sizeof(msg->mid), msg);
+	}
+	msg_data->inflight_count++;
+}
+
+
+void db__message_add_to_queued(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+	DL_APPEND(msg_data->queued, msg);
+	if(msg->mid != 0){
+		HASH_ADD(hh_mid, msg_data->queued_by_mid, mid, sizeof(msg->mid), msg);
+	}
+}
+
+
+void db__message_remove_from_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+	DL_DELETE(msg_data->inflight, msg);
+	if(msg->mid != 0){
+		HASH_DELETE(hh_mid, msg_data->inflight_by_mid, msg);
+	}
+	msg_data->inflight_count--;
+}
+
+
+void db__message_remove_from_queued(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+	DL_DELETE(msg_data->queued, msg);
+	if(msg->mid != 0){
+		HASH_DELETE(hh_mid, msg_data->queued_by_mid, msg);
+	}
+}
+
+
+static struct mosquitto_client_msg *db__message_find_inflight(struct mosquitto_msg_data *msg_data, uint16_t mid)
+{
+	struct mosquitto_client_msg *msg;
+
+	if(mid == 0) return NULL;
+
+	HASH_FIND(hh_mid, msg_data->inflight_by_mid, &mid, sizeof(mid), msg);
+	return msg;
+}
+
+
+static void db__message_remove(struct mosquitto *context, struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *item)
 {
 	if(!msg_data || !item){
 		return;
 	}
 
-	DL_DELETE(msg_data->inflight, item);
+#ifdef WITH_PERSISTENCE
+	persist__journal_msg_delete(context, item);
+#else
+	UNUSED(context);
+#endif
+
+	db__message_remove_from_inflight(msg_data, item);
 	if(item->store){
 		msg_data->msg_count--;
 		msg_data->msg_bytes -= item->store->payloadlen;
@@ -304,7 +343,7 @@ static void db__message_remove(struct mosquitto_msg_data *msg_data, struct mosqu
 	}
 
 	mosquitto_property_free_all(&item->properties);
-	mosquitto__free(item);
+	mosquitto__pool_free(mosq_pool_client_msg, item);
 }
 
 
@@ -315,8 +354,8 @@ void db__message_dequeue_first(struct mosquitto *context, struct mosquitto_msg_d
 	UNUSED(context);
 
 	msg = msg_data->queued;
-	DL_DELETE(msg_data->queued, msg);
-	DL_APPEND(msg_data->inflight, msg);
+	db__message_remove_from_queued(msg_data, msg);
+	db__message_add_to_inflight(msg_data, msg);
 	if(msg_data->inflight_quota > 0){
 		msg_data->inflight_quota--;
 	}
@@ -326,30 +365,24 @@ void db__message_dequeue_first(struct mosquitto *context, struct mosquitto_msg_d
 int db__message_delete_outgoing(struct mosquitto *context, uint16_t mid, enum mosquitto_msg_state expect_state, int qos)
 {
 	struct mosquitto_client_msg *tail, *tmp;
-	int msg_index = 0;
 
 	if(!context) return MOSQ_ERR_INVAL;
 
-	DL_FOREACH_SAFE(context->msgs_out.inflight, tail, tmp){
-		msg_index++;
-		if(tail->mid == mid){
-			if(tail->qos != qos){
-				return MOSQ_ERR_PROTOCOL;
-			}else if(qos == 2 && tail->state != expect_state){
-				return MOSQ_ERR_PROTOCOL;
-			}
-			msg_index--;
-			db__message_remove(&context->msgs_out, tail);
-			break;
+	tail = db__message_find_inflight(&context->msgs_out, mid);
+	if(tail){
+		if(tail->qos != qos){
+			return MOSQ_ERR_PROTOCOL;
+		}else if(qos == 2 && tail->state != expect_state){
+			return MOSQ_ERR_PROTOCOL;
 		}
+		db__message_remove(context, &context->msgs_out, tail);
 	}
 
 	DL_FOREACH_SAFE(context->msgs_out.queued, tail, tmp){
-		if(context->msgs_out.inflight_maximum != 0 && msg_index >= context->msgs_out.inflight_maximum){
+		if(context->msgs_out.inflight_maximum != 0 && context->msgs_out.inflight_count >= context->msgs_out.inflight_maximum){
 			break;
 		}
 
-		msg_index++;
 		tail->timestamp = db.now_s;
 		switch(tail->qos){
 			case 0:
@@ -377,8 +410,6 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 	struct mosquitto_msg_data *msg_data;
 	enum mosquitto_msg_state state = mosq_ms_invalid;
 	int rc = 0;
-	int i;
-	char **dest_ids;
 
 	assert(stored);
 	if(!context) return MOSQ_ERR_INVAL;
@@ -396,18 +427,24 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 	 * sent regardless. FIXME - this does mean retained messages will received
 	 * multiple times for overlapping subscriptions, although this is only the
 	 * case for SUBSCRIPTION with multiple subs in so is a minor concern.
+	 *
+	 * A message is delivered to all of its subscribers in one pass of
+	 * sub__messages_queue(), so a duplicate can only occur while this message
+	 * is still the last one queued for the client. The exception is if
+	 * queueing the message causes a different message to be queued for the
+	 * same client part way through, for example a will message published as
+	 * a result of another client being disconnected. The client may then
+	 * receive a duplicate, which is no worse than allow_duplicate_messages
+	 * true.
 	 */
 	if(context->protocol != mosq_p_mqtt5
 			&& db.config->allow_duplicate_messages == false
-			&& dir == mosq_md_out && retain == false && stored->dest_ids){
+			&& dir == mosq_md_out && retain == false
+			&& context->last_out_db_id == stored->db_id){
 
-		for(i=0; i<stored->dest_id_count; i++){
-			if(!strcmp(stored->dest_ids[i], context->id)){
-				/* We have already sent this message to this client. */
-				mosquitto_property_free_all(&properties);
-				return MOSQ_ERR_SUCCESS;
-			}
-		}
+		/* We have already sent this message to this client. */
+		mosquitto_property_free_all(&properties);
+		return MOSQ_ERR_SUCCESS;
 	}
 	if(context->sock == INVALID_SOCKET){
 		/* Client is not connected only queue messages with QoS>0. */
@@ -488,7 +525,7 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 	}
 #endif
 
-	msg = mosquitto__malloc(sizeof(struct mosquitto_client_msg));
+	msg = mosquitto__pool_calloc(mosq_pool_client_msg, sizeof(struct mosquitto_client_msg));
 	if(!msg) return MOSQ_ERR_NOMEM;
 	msg->prev = NULL;
 	msg->next = NULL;
@@ -508,9 +545,9 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 	msg->properties = properties;
 
 	if(state == mosq_ms_queued){
-		DL_APPEND(msg_data->queued, msg);
+		db__message_add_to_queued(msg_data, msg);
 	}else{
-		DL_APPEND(msg_data->inflight, msg);
+		db__message_add_to_inflight(msg_data, msg);
 	}
 	msg_data->msg_count++;
 	msg_data->msg_bytes+= msg->store->payloadlen;
@@ -519,25 +556,15 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 		msg_data->msg_bytes12 += msg->store->payloadlen;
 	}
 
-	if(db.config->allow_duplicate_messages == false && dir == mosq_md_out && retain == false){
-		/* Record which client ids this message has been sent to so we can avoid duplicates.
-		 * Outgoing messages only.
-		 * If retain==true then this is a stale retained message and so should be
-		 * sent regardless. FIXME - this does mean retained messages will received
-		 * multiple times for overlapping subscriptions, although this is only the
-		 * case for SUBSCRIPTION with multiple subs in so is a minor concern.
-		 */
-		dest_ids = mosquitto__realloc(stored->dest_ids, sizeof(char *)*(size_t)(stored->dest_id_count+1));
-		if(dest_ids){
-			stored->dest_ids = dest_ids;
-			stored->dest_id_count++;
-			stored->dest_ids[stored->dest_id_count-1] = mosquitto__strdup(context->id);
-			if(!stored->dest_ids[stored->dest_id_count-1]){
-				return MOSQ_ERR_NOMEM;
-			}
-		}else{
-			return MOSQ_ERR_NOMEM;
-		}
+#ifdef WITH_PERSISTENCE
+	persist__journal_msg_add(context, msg);
+#endif
+
+	if(dir == mosq_md_out && retain == false){
+		/* Record that this message has been sent to this client so we can
+		 * avoid duplicates. Outgoing messages only, see above. */
+		context->last_out_db_id = stored->db_id;
+		stored->delivered = true;
 	}
 #ifdef WITH_BRIDGE
 	if(context->bridge && context->bridge->start_type == bst_lazy
@@ -566,29 +593,32 @@ int db__message_update_outgoing(struct mosquitto *context, uint16_t mid, enum mo
 {
 	struct mosquitto_client_msg *tail;
 
-	DL_FOREACH(context->msgs_out.inflight, tail){
-		if(tail->mid == mid){
-			if(tail->qos != qos){
-				return MOSQ_ERR_PROTOCOL;
-			}
-			tail->state = state;
-			tail->timestamp = db.now_s;
-			return MOSQ_ERR_SUCCESS;
-		}
+	tail = db__message_find_inflight(&context->msgs_out, mid);
+	if(tail == NULL){
+		return MOSQ_ERR_NOT_FOUND;
+	}
+	if(tail->qos != qos){
+		return MOSQ_ERR_PROTOCOL;
 	}
-	return MOSQ_ERR_NOT_FOUND;
+	tail->state = state;
+	tail->timestamp = db.now_s;
+#ifdef WITH_PERSISTENCE
+	persist__journal_msg_update(context, tail);
+#endif
+	return MOSQ_ERR_SUCCESS;
 }
 
 
-void db__messages_delete_list(struct mosquitto_client_msg **head)
+void db__messages_delete_list(struct mosquitto_client_msg **head, struct mosquitto_client_msg **index)
 {
 	struct mosquitto_client_msg *tail, *tmp;
 
+	HASH_CLEAR(hh_mid, *index);
 	DL_FOREACH_SAFE(*head, tail, tmp){
 		DL_DELETE(*head, tail);
 		db__msg_store_ref_dec(&tail->store);
 		mosquitto_property_free_all(&tail->properties);
-		mosquitto__free(tail);
+		mosquitto__pool_free(mosq_pool_client_msg, tail);
 	}
 	*head = NULL;
 }
@@ -599,8 +629,9 @@ int db__messages_delete(struct mosquitto *context, bool force_free)
 	if(!context) return MOSQ_ERR_INVAL;
 
 	if(force_free || context->clean_start || (context->bridge && context->bridge->clean_start)){
-		db__messages_delete_list(&context->msgs_in.inflight);
-		db__messages_delete_list(&context->msgs_in.queued);
+		db__messages_delete_list(&context->msgs_in.inflight, &context->msgs_in.inflight_by_mid);
+		db__messages_delete_list(&context->msgs_in.queued, &context->msgs_in.queued_by_mid);
+		context->msgs_in.inflight_count = 0;
 		context->msgs_in.msg_bytes = 0;
 		context->msgs_in.msg_bytes12 = 0;
 		context->msgs_in.msg_count = 0;
@@ -610,8 +641,9 @@ int db__messages_delete(struct mosquitto *context, bool force_free)
 	if(force_free || (context->bridge && context->bridge->clean_start_local)
 			|| (context->bridge == NULL && context->clean_start)){
 
-		db__messages_delete_list(&context->msgs_out.inflight);
-		db__messages_delete_list(&context->msgs_out.queued);
+		db__messages_delete_list(&context->msgs_out.inflight, &context->msgs_out.inflight_by_mid);
+		db__messages_delete_list(&context->msgs_out.queued, &context->msgs_out.queued_by_mid);
+		context->msgs_out.inflight_count = 0;
 		context->msgs_out.msg_bytes = 0;
 		context->msgs_out.msg_bytes12 = 0;
 		context->msgs_out.msg_count = 0;
@@ -629,7 +661,7 @@ int db__messages_easy_queue(struct mosquitto *context, const char *topic, uint8_
 
 	if(!topic) return MOSQ_ERR_INVAL;
 
-	stored = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	stored = mosquitto__pool_calloc(mosq_pool_msg_store, sizeof(struct mosquitto_msg_store));
 	if(stored == NULL) return MOSQ_ERR_NOMEM;
 
 	stored->topic = mosquitto__strdup(topic);
@@ -710,8 +742,7 @@ int db__message_store(const struct mosquitto *source, struct mosquitto_msg_store
 		stored->message_expiry_time = 0;
 	}
 
-	stored->dest_ids = NULL;
-	stored->dest_id_count = 0;
+	stored->delivered = false;
 	db.msg_store_count++;
 	db.msg_store_bytes += stored->payloadlen;
 
@@ -732,19 +763,15 @@ int db__message_store_find(struct mosquitto *context, uint16_t mid, struct mosqu
 
 	if(!context) return MOSQ_ERR_INVAL;
 
+	/* Incoming messages are inserted with mid set to the source mid. */
 	*stored = NULL;
-	DL_FOREACH(context->msgs_in.inflight, tail){
-		if(tail->store->source_mid == mid){
-			*stored = tail->store;
-			return MOSQ_ERR_SUCCESS;
-		}
+	tail = db__message_find_inflight(&context->msgs_in, mid);
+	if(tail == NULL && mid != 0){
+		HASH_FIND(hh_mid, context->msgs_in.queued_by_mid, &mid, sizeof(mid), tail);
 	}
-
-	DL_FOREACH(context->msgs_in.queued, tail){
-		if(tail->store->source_mid == mid){
-			*stored = tail->store;
-			return MOSQ_ERR_SUCCESS;
-		}
+	if(tail){
+		*stored = tail->store;
+		return MOSQ_ERR_SUCCESS;
 	}
 
 	return 1;
@@ -843,7 +870,7 @@ int db__message_reconnect_reset_incoming(struct mosquitto *context)
 		if(msg->qos != 2){
 			/* Anything <QoS 2 can be completely retried by the client at
 			 * no harm. */
-			db__message_remove(&context->msgs_in, msg);
+			db__message_remove(context, &context->msgs_in, msg);
 		}else{
 			/* Message state can be preserved here because it should match
 			 * whatever the client has got. */
@@ -899,37 +926,36 @@ int db__message_release_incoming(struct mosquitto *context, uint16_t mid)
 	int retain;
 	char *topic;
 	char *source_id;
-	int msg_index = 0;
+	int msg_index;
 	bool deleted = false;
 	int rc;
 
 	if(!context) return MOSQ_ERR_INVAL;
 
-	DL_FOREACH_SAFE(context->msgs_in.inflight, tail, tmp){
-		msg_index++;
-		if(tail->mid == mid){
-			if(tail->store->qos != 2){
-				return MOSQ_ERR_PROTOCOL;
-			}
-			topic = tail->store->topic;
-			retain = tail->retain;
-			source_id = tail->store->source_id;
-
-			/* topic==NULL should be a QoS 2 message that was
-			 * denied/dropped and is being processed so the client doesn't
-			 * keep resending it. That means we don't send it to other
-			 * clients. */
-			if(topic == NULL){
-				db__message_remove(&context->msgs_in, tail);
+	msg_index = context->msgs_in.inflight_count;
+	tail = db__message_find_inflight(&context->msgs_in, mid);
+	if(tail){
+		if(tail->store->qos != 2){
+			return MOSQ_ERR_PROTOCOL;
+		}
+		topic = tail->store->topic;
+		retain = tail->retain;
+		source_id = tail->store->source_id;
+
+		/* topic==NULL should be a QoS 2 message that was
+		 * denied/dropped and is being processed so the client doesn't
+		 * keep resending it. That means we don't send it to other
+		 * clients. */
+		if(topic == NULL){
+			db__message_remove(context, &context->msgs_in, tail);
+			deleted = true;
+		}else{
+			rc = sub__messages_queue(source_id, topic, 2, retain, &tail->store);
+			if(rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_NO_SUBSCRIBERS){
+				db__message_remove(context, &context->msgs_in, tail);
 				deleted = true;
 			}else{
-				rc = sub__messages_queue(source_id, topic, 2, retain, &tail->store);
-				if(rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_NO_SUBSCRIBERS){
-					db__message_remove(&context->msgs_in, tail);
-					deleted = true;
-				}else{
-					return 1;
-				}
+				return 1;
 			}
 		}
 	}
@@ -968,7 +994,7 @@ int db__message_write_inflight_in(struct mosquitto *context)
 		if(tail->store->message_expiry_time){
 			if(db.now_real_s > tail->store->message_expiry_time){
 				/* Message is expired, must not send. */
-				db__message_remove(&context->msgs_in, tail);
+				db__message_remove(context, &context->msgs_in, tail);
 				if(tail->qos > 0){
 					util__increment_receive_quota(context);
 				}
@@ -1032,7 +1058,7 @@ static int db__message_write_inflight_out_single(struct mosquitto *context, stru
 			if(msg->direction == mosq_md_out && msg->qos > 0){
 				util__increment_send_quota(context);
 			}
-			db__message_remove(&context->msgs_out, msg);
+			db__message_remove(context, &context->msgs_out, msg);
 			return MOSQ_ERR_SUCCESS;
 		}else{
 			expiry_interval = (uint32_t)(msg->store->message_expiry_time - db.now_real_s);
@@ -1050,35 +1076,35 @@ static int db__message_write_inflight_out_single(struct mosquitto *context, stru
 
 	switch(msg->state){
 		case mosq_ms_publish_qos0:
-			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval);
+			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval, msg->store);
 			if(rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_OVERSIZE_PACKET){
-				db__message_remove(&context->msgs_out, msg);
+				db__message_remove(context, &context->msgs_out, msg);
 			}else{
 				return rc;
 			}
 			break;
 
 		case mosq_ms_publish_qos1:
-			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval);
+			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval, msg->store);
 			if(rc == MOSQ_ERR_SUCCESS){
 				msg->timestamp = db.now_s;
 				msg->dup = 1; /* Any retry attempts are a duplicate. */
 				msg->state = mosq_ms_wait_for_puback;
 			}else if(rc == MOSQ_ERR_OVERSIZE_PACKET){
-				db__message_remove(&context->msgs_out, msg);
+				db__message_remove(context, &context->msgs_out, msg);
 			}else{
 				return rc;
 			}
 			break;
 
 		case mosq_ms_publish_qos2:
-			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval);
+			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval, msg->store);
 			if(rc == MOSQ_ERR_SUCCESS){
 				msg->timestamp = db.now_s;
 				msg->dup = 1; /* Any retry attempts are a duplicate. */
 				msg->state = mosq_ms_wait_for_pubrec;
 			}else if(rc == MOSQ_ERR_OVERSIZE_PACKET){
-				db__message_remove(&context->msgs_out, msg);
+				db__message_remove(context, &context->msgs_out, msg);
 			}else{
 				return rc;
 			}
@@ -83,33 +83,49 @@ static char *client_id_gen(uint16_t *idlen, const char *auto_id_prefix, uint16_t
 
 /* Remove any queued messages that are no longer allowed through ACL,
  * assuming a possible change of username. */
-void connection_check_acl(struct mosquitto *context, struct mosquitto_client_msg **head)
+static void connection_check_acl_list(struct mosquitto *context, struct mosquitto_msg_data *msg_data, bool inflight)
 {
 	struct mosquitto_client_msg *msg_tail, *tmp;
+	struct mosquitto_client_msg *head;
 
-	DL_FOREACH_SAFE((*head), msg_tail, tmp){
+	head = inflight?msg_data->inflight:msg_data->queued;
+	DL_FOREACH_SAFE(head, msg_tail, tmp){
 		if(msg_tail->direction == mosq_md_out){
 			if(mosquitto_acl_check(context, msg_tail->store->topic,
 								   msg_tail->store->payloadlen, msg_tail->store->payload,
 								   msg_tail->store->qos, msg_tail->store->retain, MOSQ_ACL_READ) != MOSQ_ERR_SUCCESS){
 
-				DL_DELETE((*head), msg_tail);
+				if(inflight){
+					db__message_remove_from_inflight(msg_data, msg_tail);
+				}else{
+					db__message_remove_from_queued(msg_data, msg_tail);
+				}
+#ifdef WITH_PERSISTENCE
+				persist__journal_msg_delete(context, msg_tail);
+#endif
 				db__msg_store_ref_dec(&msg_tail->store);
 				mosquitto_property_free_all(&msg_tail->properties);
-				mosquitto__free(msg_tail);
+				mosquitto__pool_free(mosq_pool_client_msg, msg_tail);
 			}
 		}
 	}
 }
 
 
+void connection_check_acl(struct mosquitto *context, struct mosquitto_msg_data *msg_data)
+{
+	connection_check_acl_list(context, msg_data, true);
+	connection_check_acl_list(context, msg_data, false);
+}
+
+
 int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint16_t auth_data_out_len)
 {
 	struct mosquitto *found_context;
 	struct mosquitto__subleaf *leaf;
 	mosquitto_property *connack_props = NULL;
 	uint8_t connect_ack = 0;
-	int i;
+	int i, j;
 	int rc;
 
 	/* Find if this client already has an entry. This must be done *after* any security checks. */
@@ -147,16 +163,16 @@ int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint1
 			found_context->subs = NULL;
 			context->sub_count = found_context->sub_count;
 			found_context->sub_count = 0;
+			retain__stream_move(found_context, context);
 			context->last_mid = found_context->last_mid;
 
 			for(i=0; i<context->sub_count; i++){
 				if(context->subs[i]){
-					leaf = context->subs[i]->subs;
-					while(leaf){
+					for(j=0; j<context->subs[i]->sub_count; j++){
+						leaf = &context->subs[i]->subs[j];
 						if(leaf->context == found_context){
 							leaf->context = context;
 						}
-						leaf = leaf->next;
 					}
 				}
 			}
@@ -177,6 +193,14 @@ int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint1
 		will_delay__remove(found_context);
 		will__clear(found_context);
 
+#ifdef WITH_PERSISTENCE
+		if(found_context->clean_start == false
+				&& !(context->clean_start == false && found_context->session_expiry_interval > 0)){
+
+			/* The old session is not being resumed */
+			persist__journal_client_delete(found_context);
+		}
+#endif
 		found_context->clean_start = true;
 		found_context->session_expiry_interval = 0;
 		mosquitto__set_state(found_context, mosq_cs_duplicate);
@@ -223,16 +247,15 @@ int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint1
 	context->ping_t = 0;
 	context->is_dropping = false;
 
-	connection_check_acl(context, &context->msgs_in.inflight);
-	connection_check_acl(context, &context->msgs_in.queued);
-	connection_check_acl(context, &context->msgs_out.inflight);
-	connection_check_acl(context, &context->msgs_out.queued);
+	connection_check_acl(context, &context->msgs_in);
+	connection_check_acl(context, &context->msgs_out);
 
 	HASH_ADD_KEYPTR(hh_id, db.contexts_by_id, context->id, strlen(context->id), context);
 
 #ifdef WITH_PERSISTENCE
 	if(!context->clean_start){
 		db.persistence_changes++;
+		persist__journal_client(context);
 	}
 #endif
 	context->max_qos = context->listener->max_qos;
@@ -291,6 +314,59 @@ error:
 }
 
 
+/* Refuse a client whose username and password check has failed. */
+static void connect__on_unpwd_fail(struct mosquitto *context, int rc)
+{
+	/* We must have context->id == NULL here so we don't later try and
+	* remove the client from the by_id hash table */
+	mosquitto__free(context->id);
+	context->id = NULL;
+
+	if(rc == MOSQ_ERR_AUTH && context->auth_busy){
+		/* Too many clients were already waiting for their password to be
+		 * checked. */
+		if(context->protocol == mosq_p_mqtt5){
+			send__connack(context, 0, MQTT_RC_SERVER_BUSY, NULL);
+		}else{
+			send__connack(context, 0, CONNACK_REFUSED_SERVER_UNAVAILABLE, NULL);
+		}
+	}else if(rc == MOSQ_ERR_AUTH){
+		if(context->protocol == mosq_p_mqtt5){
+			send__connack(context, 0, MQTT_RC_NOT_AUTHORIZED, NULL);
+		}else{
+			send__connack(context, 0, CONNACK_REFUSED_NOT_AUTHORIZED, NULL);
+		}
+	}
+	context__disconnect(context);
+}
+
+
+/* Finish a CONNECT that was held while the client's password was checked on
+ * a worker thread. */
+void connect__on_unpwd_checked(struct mosquitto *context, int rc)
+{
+	mosquitto__set_state(context, mosq_cs_new);
+
+	if(rc == MOSQ_ERR_SUCCESS){
+		mux__add_in(context);
+		rc = connect__on_authorised(context, NULL, 0);
+		if(rc == MOSQ_ERR_SUCCESS){
+			/* Anything the client sent after its CONNECT. */
+			rc = packet__read_held(context);
+		}
+		if(rc){
+			do_disconnect(context, rc);
+		}
+	}else{
+		will__clear(context);
+		context->clean_start = true;
+		context->session_expiry_interval = 0;
+		context->will_delay_interval = 0;
+		connect__on_unpwd_fail(context, rc);
+	}
+}
+
+
 static int will__read(struct mosquitto *context, struct mosquitto_message_all **will, uint8_t will_qos, int will_retain)
 {
 	int rc = MOSQ_ERR_SUCCESS;
@@ -525,6 +601,7 @@ int handle__connect(struct mosquitto *context)
 		rc = MOSQ_ERR_PROTOCOL;
 		goto handle_connect_error;
 	}
+	keepalive__add(context);
 
 	if(protocol_version == PROTOCOL_VERSION_v5){
 		rc = property__read_all(CMD_CONNECT, &context->in_packet, &properties);
@@ -859,29 +936,17 @@ int handle__connect(struct mosquitto *context)
 #endif
 		{
 			rc = mosquitto_unpwd_check(context);
-			if(rc != MOSQ_ERR_SUCCESS){
-				/* We must have context->id == NULL here so we don't later try and
-				* remove the client from the by_id hash table */
-				mosquitto__free(context->id);
-				context->id = NULL;
-			}
-			switch(rc){
-				case MOSQ_ERR_SUCCESS:
-					break;
-				case MOSQ_ERR_AUTH:
-					if(context->protocol == mosq_p_mqtt5){
-						send__connack(context, 0, MQTT_RC_NOT_AUTHORIZED, NULL);
-					}else{
-						send__connack(context, 0, CONNACK_REFUSED_NOT_AUTHORIZED, NULL);
-					}
-					context__disconnect(context);
-					rc = MOSQ_ERR_AUTH;
-					goto handle_connect_error;
-					break;
-				default:
-					context__disconnect(context);
-					goto handle_connect_error;
-					break;
+			if(rc == MOSQ_ERR_AUTH_DELAYED){
+				/* The password is being checked on a worker thread. Nothing more
+				 * is read from the client until connect__on_unpwd_checked() is
+				 * called with the result. */
+				mosquitto__set_state(context, mosq_cs_auth_pending);
+				mux__remove_in(context);
+				keepalive__add(context);
+				return MOSQ_ERR_SUCCESS;
+			}else if(rc != MOSQ_ERR_SUCCESS){
+				connect__on_unpwd_fail(context, rc);
+				goto handle_connect_error;
 			}
 		}
 		return connect__on_authorised(context, NULL, 0);
@@ -57,7 +57,7 @@ int handle__publish(struct mosquitto *context)
 		return MOSQ_ERR_PROTOCOL;
 	}
 
-	msg = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	msg = mosquitto__pool_calloc(mosq_pool_msg_store, sizeof(struct mosquitto_msg_store));
 	if(msg == NULL){
 		return MOSQ_ERR_NOMEM;
 	}
@@ -227,18 +227,28 @@ int handle__publish(struct mosquitto *context)
 			reason_code = MQTT_RC_IMPLEMENTATION_SPECIFIC;
 			goto process_bad_message;
 		}
-		msg->payload = mosquitto__malloc(msg->payloadlen+1);
-		if(msg->payload == NULL){
-			db__msg_store_free(msg);
-			return MOSQ_ERR_NOMEM;
-		}
-		/* Ensure payload is always zero terminated, this is the reason for the extra byte above */
-		((uint8_t *)msg->payload)[msg->payloadlen] = 0;
+		if(msg->payloadlen >= context->in_packet.pos){
+			/* The payload is most of the packet, so keep the packet buffer
+			 * as the payload rather than copying it. in_packet allocates an
+			 * extra byte so the payload can be zero terminated. */
+			msg->payload_buf = context->in_packet.payload;
+			msg->payload = &context->in_packet.payload[context->in_packet.pos];
+			context->in_packet.payload = NULL;
+			context->in_packet.pos += msg->payloadlen;
+		}else{
+			msg->payload = mosquitto__malloc(msg->payloadlen+1);
+			if(msg->payload == NULL){
+				db__msg_store_free(msg);
+				return MOSQ_ERR_NOMEM;
+			}
 
-		if(packet__read_bytes(&context->in_packet, msg->payload, msg->payloadlen)){
-			db__msg_store_free(msg);
-			return MOSQ_ERR_MALFORMED_PACKET;
+			if(packet__read_bytes(&context->in_packet, msg->payload, msg->payloadlen)){
+				db__msg_store_free(msg);
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
 		}
+		/* Ensure payload is always zero terminated, this is the reason for the extra byte allocated for it */
+		((uint8_t *)msg->payload)[msg->payloadlen] = 0;
 	}
 
 	/* Check for topic access */
@@ -190,6 +190,9 @@ int handle__subscribe(struct mosquitto *context)
 					mosquitto__free(sub);
 					return rc2;
 				}
+#ifdef WITH_PERSISTENCE
+				persist__journal_sub(context, sub, qos, subscription_identifier, subscription_options);
+#endif
 				if(context->protocol == mosq_p_mqtt311 || context->protocol == mosq_p_mqtt31){
 					if(rc2 == MOSQ_ERR_SUCCESS || rc2 == MOSQ_ERR_SUB_EXISTS){
 						if(retain__queue(context, sub, qos, 0)) rc = 1;
@@ -127,6 +127,12 @@ int handle__unsubscribe(struct mosquitto *context)
 		log__printf(NULL, MOSQ_LOG_DEBUG, "\t%s", sub);
 		if(allowed){
 			rc = sub__remove(context, sub, db.subs, &reason);
+			retain__stream_remove(context, sub);
+#ifdef WITH_PERSISTENCE
+			if(rc == MOSQ_ERR_SUCCESS && reason == 0){
+				persist__journal_unsub(context, sub);
+			}
+#endif
 		}else{
 			rc = MOSQ_ERR_SUCCESS;
 		}
@@ -19,48 +19,144 @@ Contributors:
 #include "config.h"
 #include <time.h>
 #include "mosquitto_broker_internal.h"
+#include "utlist.h"
+
+/* Clients are kept in a timing wheel of one second slots, indexed by the time
+ * at which they will have exceeded 1.5x their keepalive. Receiving a packet
+ * only updates last_msg_in, so a client is not moved between slots every time
+ * it is active. Instead, when its slot is reached the deadline is recalculated
+ * and the client is either disconnected or moved to its new slot. Deadlines
+ * further in the future than the size of the wheel are handled the same way,
+ * the client is just looked at again once per revolution.
+ *
+ * The extra slot at the end holds clients that are being processed, so that
+ * disconnecting one client can safely remove others from the wheel.
+ */
+#define KEEPALIVE_WHEEL_SIZE 1024
+#define KEEPALIVE_PENDING KEEPALIVE_WHEEL_SIZE
+
+static struct mosquitto *keepalive_wheel[KEEPALIVE_WHEEL_SIZE+1];
+static time_t last_keepalive_check = 0;
 
 
-static time_t last_keepalive_check = 0;
+/* A client whose CONNECT is held for a password check is given the default
+ * keepalive if it asked for none, so it can't hold its connection and its
+ * place in the queue indefinitely. */
+static uint16_t keepalive__get(struct mosquitto *context)
+{
+	if(context->keepalive == 0 && context->state == mosq_cs_auth_pending){
+		return 60;
+	}
+	return context->keepalive;
+}
 
-/* FIXME - this is the prototype for the future tree/trie based keepalive check implementation. */
 
+static time_t keepalive__expiry(struct mosquitto *context)
+{
+	return context->last_msg_in + (time_t)(keepalive__get(context))*3/2 + 1;
+}
+
+
+static void keepalive__insert(struct mosquitto *context, time_t expiry)
+{
+	if(expiry <= last_keepalive_check){
+		expiry = last_keepalive_check + 1;
+	}
+	context->keepalive_slot = (int)(expiry & (KEEPALIVE_WHEEL_SIZE-1));
+	DL_APPEND2(keepalive_wheel[context->keepalive_slot], context, keepalive_prev, keepalive_next);
+}
+
+
+/* Add a client to the wheel, or move it if its keepalive has changed. Clients
+ * are added when they are accepted, with the default keepalive, so those that
+ * never finish connecting are still disconnected, and again once their
+ * CONNECT has been read. */
 int keepalive__add(struct mosquitto *context)
 {
-	UNUSED(context);
+	keepalive__remove(context);
+
+	/* Local bridges never time out in this fashion. */
+	if(keepalive__get(context) == 0 || context->bridge){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	if(last_keepalive_check == 0){
+		last_keepalive_check = db.now_s;
+	}
+	keepalive__insert(context, keepalive__expiry(context));
 
 	return MOSQ_ERR_SUCCESS;
 }
 
 
+static void keepalive__process_slot(int slot)
+{
+	struct mosquitto *context;
+	time_t expiry;
+
+	if(keepalive_wheel[slot] == NULL) return;
+
+	keepalive_wheel[KEEPALIVE_PENDING] = keepalive_wheel[slot];
+	keepalive_wheel[slot] = NULL;
+	DL_FOREACH2(keepalive_wheel[KEEPALIVE_PENDING], context, keepalive_next){
+		context->keepalive_slot = KEEPALIVE_PENDING;
+	}
+
+	while(keepalive_wheel[KEEPALIVE_PENDING]){
+		context = keepalive_wheel[KEEPALIVE_PENDING];
+		DL_DELETE2(keepalive_wheel[KEEPALIVE_PENDING], context, keepalive_prev, keepalive_next);
+		context->keepalive_prev = NULL;
+		context->keepalive_next = NULL;
+
+		if(context->sock == INVALID_SOCKET || keepalive__get(context) == 0){
+			continue;
+		}
+
+		expiry = keepalive__expiry(context);
+		if(expiry <= db.now_s){
+			/* Client has exceeded keepalive*1.5 */
+			do_disconnect(context, MOSQ_ERR_KEEPALIVE);
+		}else{
+			keepalive__insert(context, expiry);
+		}
+	}
+}
+
+
 void keepalive__check(void)
 {
-	struct mosquitto *context, *ctxt_tmp;
+	time_t t, end;
 
-	if(last_keepalive_check + 5 < db.now_s){
+	if(last_keepalive_check == 0){
 		last_keepalive_check = db.now_s;
+		return;
+	}
+	if(db.now_s <= last_keepalive_check){
+		return;
+	}
 
-		/* FIXME - this needs replacing with something more efficient */
-		HASH_ITER(hh_sock, db.contexts_by_sock, context, ctxt_tmp){
-			if(context->sock != INVALID_SOCKET){
-				/* Local bridges never time out in this fashion. */
-				if(!(context->keepalive)
-						|| context->bridge
-						|| db.now_s - context->last_msg_in <= (time_t)(context->keepalive)*3/2){
-
-				}else{
-					/* Client has exceeded keepalive*1.5 */
-					do_disconnect(context, MOSQ_ERR_KEEPALIVE);
-				}
-			}
-		}
+	/* After a long pause every slot is due, but each only needs looking at once. */
+	end = db.now_s;
+	if(end - last_keepalive_check > KEEPALIVE_WHEEL_SIZE){
+		last_keepalive_check = end - KEEPALIVE_WHEEL_SIZE;
+	}
+	for(t=last_keepalive_check+1; t<=end; t++){
+		/* Clients moved to a later slot must not be placed before this one. */
+		last_keepalive_check = t;
+		keepalive__process_slot((int)(t & (KEEPALIVE_WHEEL_SIZE-1)));
 	}
 }
 
 
 int keepalive__remove(struct mosquitto *context)
 {
-	UNUSED(context);
+	if(context->keepalive_prev == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	DL_DELETE2(keepalive_wheel[context->keepalive_slot], context, keepalive_prev, keepalive_next);
+	context->keepalive_prev = NULL;
+	context->keepalive_next = NULL;
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -68,6 +164,16 @@ int keepalive__remove(struct mosquitto *context)
 
 void keepalive__remove_all(void)
 {
+	struct mosquitto *context;
+	int i;
+
+	for(i=0; i<KEEPALIVE_WHEEL_SIZE+1; i++){
+		while(keepalive_wheel[i]){
+			context = keepalive_wheel[i];
+			keepalive__remove(context);
+		}
+	}
+	last_keepalive_check = 0;
 }
 
 
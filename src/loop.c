@@ -74,7 +74,7 @@ static int single_publish(struct mosquitto *context, struct mosquitto_message_v5
 	struct mosquitto_msg_store *stored;
 	uint16_t mid;
 
-	stored = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	stored = mosquitto__pool_calloc(mosq_pool_msg_store, sizeof(struct mosquitto_msg_store));
 	if(stored == NULL) return MOSQ_ERR_NOMEM;
 
 	stored->topic = msg->topic;
@@ -174,12 +174,23 @@ int mosquitto_main_loop(struct mosquitto__listener_sock *listensock, int listens
 		bridge_check();
 #endif
 
-		rc = mux__handle(listensock, listensock_count);
+#ifdef WITH_PERSISTENCE
+		persist__journal_sync();
+#endif
+		retain__stream_process();
+		retain__evict_check();
+		packet__write_all();
+
+		/* Don't wait for network activity if there are more retained
+		 * messages that can be sent straight away. */
+		rc = mux__handle(listensock, listensock_count, retain__stream_ready()?0:100);
 		if(rc) return rc;
 
 		session_expiry__check();
 		will_delay__check();
 #ifdef WITH_PERSISTENCE
+		persist__backup_check(false);
+		persist__journal_check();
 		if(db.config->persistence && db.config->autosave_interval){
 			if(db.config->autosave_on_changes){
 				if(db.persistence_changes >= db.config->autosave_interval){
@@ -494,6 +494,7 @@ int main(int argc, char *argv[])
 	rc = config__parse_args(&config, argc, argv);
 	if(rc != MOSQ_ERR_SUCCESS) return rc;
 	db.config = &config;
+	memory__pool_enable(config.memory_pools);
 
 	/* Drop privileges permanently immediately after the config is loaded.
 	 * This requires the user to ensure that all certificates, log locations,
@@ -561,6 +562,11 @@ int main(int argc, char *argv[])
 	sd_notify(0, "READY=1");
 #endif
 
+#ifdef WITH_AUTH_THREADS
+	/* Started late, so the threads belong to the daemonised process. */
+	if(auth_worker__init()) return 1;
+#endif
+
 	run = 1;
 	rc = mosquitto_main_loop(listensock, listensock_count);
 
@@ -601,8 +607,12 @@ int main(int argc, char *argv[])
 	mosquitto__free(db.bridges);
 #endif
 	context__free_disused();
+#ifdef WITH_AUTH_THREADS
+	auth_worker__cleanup();
+#endif
 
 	db__close();
+	mosquitto__free(db.packet_buffer);
 
 	mosquitto_security_module_cleanup();
 
@@ -613,6 +623,7 @@ int main(int argc, char *argv[])
 	log__close(&config);
 	config__cleanup(db.config);
 	net__broker_cleanup();
+	memory__pool_cleanup();
 
 	return rc;
 }
@@ -91,6 +91,17 @@ enum mosquitto_msg_origin{
 	mosq_mo_broker = 1
 };
 
+enum mosquitto_retain_state{
+	mosq_rs_none = 0, /* Not a retained message, or a $SYS message */
+	mosq_rs_memory = 1,
+	mosq_rs_evicted = 2 /* Payload is in the retained message store on disk */
+};
+
+enum mosquitto__retained_eviction{
+	mosq_re_lru = 0,
+	mosq_re_oldest = 1
+};
+
 struct mosquitto__auth_plugin{
 	void *lib;
 	void *user_data;
@@ -144,6 +155,7 @@ struct mosquitto__callback{
 	MOSQ_FUNC_generic_callback cb;
 	void *userdata;
 	char *data; /* e.g. topic for control event */
+	bool no_cache; /* For acl check event, set by mosquitto_acl_cache_disable() */
 };
 
 struct plugin__callbacks{
@@ -168,6 +180,7 @@ struct mosquitto__security_options {
 	struct mosquitto__unpwd *psk_id;
 	struct mosquitto__acl_user *acl_list;
 	struct mosquitto__acl *acl_patterns;
+	struct mosquitto__acl_node *acl_pattern_trie;
 	char *password_file;
 	char *psk_file;
 	char *acl_file;
@@ -187,6 +200,7 @@ enum struct_ident{
 	id_listener = 1,
 	id_client = 2,
 	id_listener_ws = 3,
+	id_auth_worker = 4,
 };
 #endif
 
@@ -250,9 +264,13 @@ typedef struct mosquitto_plugin_id_t{
 } mosquitto_plugin_id_t;
 
 struct mosquitto__config {
+	int acl_cache_size;
 	bool allow_duplicate_messages;
+	int auth_worker_threads;
+	int auth_cache_ttl;
 	int autosave_interval;
 	bool autosave_on_changes;
+	bool autosave_background;
 	bool check_retain_source;
 	char *clientid_prefixes;
 	bool connection_messages;
@@ -270,11 +288,18 @@ struct mosquitto__config {
 	char *log_timestamp_format;
 	char *log_file;
 	FILE *log_fptr;
+	int max_accepts_per_loop;
 	size_t max_inflight_bytes;
 	size_t max_queued_bytes;
 	int max_queued_messages;
 	uint32_t max_packet_size;
+	int max_packets_per_read;
+	int max_pending_auth;
+	size_t max_retained_bytes;
+	int max_retained_messages;
+	bool memory_pools;
 	uint32_t message_size_limit;
+	size_t packet_buffer_size;
 	uint16_t max_inflight_messages;
 	uint16_t max_keepalive;
 	uint8_t max_qos;
@@ -282,12 +307,16 @@ struct mosquitto__config {
 	char *persistence_location;
 	char *persistence_file;
 	char *persistence_filepath;
+	bool persistence_journal;
+	size_t persistence_journal_max_size;
 	time_t persistent_client_expiration;
 	char *pid_file;
 	bool queue_qos0_messages;
 	bool per_listener_settings;
 	bool retain_available;
+	enum mosquitto__retained_eviction retained_eviction;
 	bool set_tcp_nodelay;
+	int subscription_cache_size;
 	int sys_interval;
 	bool upgrade_outgoing_qos;
 	char *user;
@@ -303,8 +332,6 @@ struct mosquitto__config {
 };
 
 struct mosquitto__subleaf {
-	struct mosquitto__subleaf *prev;
-	struct mosquitto__subleaf *next;
 	struct mosquitto *context;
 	uint32_t identifier;
 	uint8_t qos;
@@ -322,16 +349,25 @@ struct mosquitto__subshared_ref {
 struct mosquitto__subshared {
 	UT_hash_handle hh;
 	char *name;
-	struct mosquitto__subleaf *subs;
+	struct mosquitto__subleaf *subs; /* Array of sub_count leaves */
+	int sub_count;
+	int next_sub; /* Index of the next leaf to receive a message */
 };
 
+/* A level in the subscription tree. Children are kept in a small array that
+ * is searched linearly, until there are more than SUBHIER_VECTOR_MAX of them,
+ * at which point the array becomes an open addressed hash table. Either way,
+ * children[0..child_capacity-1] holds every child, with unused entries set to
+ * NULL. Topic strings are shared between all nodes with the same level name. */
 struct mosquitto__subhier {
-	UT_hash_handle hh;
 	struct mosquitto__subhier *parent;
-	struct mosquitto__subhier *children;
-	struct mosquitto__subleaf *subs;
+	struct mosquitto__subhier **children;
+	struct mosquitto__subleaf *subs; /* Array of sub_count leaves */
 	struct mosquitto__subshared *shared;
 	char *topic;
+	int sub_count;
+	uint32_t child_count;
+	uint32_t child_capacity;
 	uint16_t topic_len;
 };
 
@@ -350,12 +386,6 @@ struct mosquitto__retainhier {
 	uint16_t topic_len;
 };
 
-struct mosquitto_msg_store_load{
-	UT_hash_handle hh;
-	dbid_t db_id;
-	struct mosquitto_msg_store *store;
-};
-
 struct mosquitto_msg_store{
 	struct mosquitto_msg_store *next;
 	struct mosquitto_msg_store *prev;
@@ -363,12 +393,14 @@ struct mosquitto_msg_store{
 	char *source_id;
 	char *source_username;
 	struct mosquitto__listener *source_listener;
-	char **dest_ids;
-	int dest_id_count;
 	int ref_count;
 	char* topic;
 	mosquitto_property *properties;
 	void *payload;
+	void *payload_buf; /* If set, payload points into this buffer, which is the packet the message was received in */
+	struct mosquitto_msg_store *retain_prev; /* Eviction order of retained messages, or the segment an evicted payload is in */
+	struct mosquitto_msg_store *retain_next;
+	uint64_t retain_offset; /* Position of an evicted payload in the retained message store */
 	time_t message_expiry_time;
 	uint32_t payloadlen;
 	enum mosquitto_msg_origin origin;
@@ -376,11 +408,15 @@ struct mosquitto_msg_store{
 	uint16_t mid;
 	uint8_t qos;
 	bool retain;
+	bool delivered; /* Queued for at least one client as a non-retained message */
+	bool journalled; /* Written to the persistence journal */
+	enum mosquitto_retain_state retain_state;
 };
 
 struct mosquitto_client_msg{
 	struct mosquitto_client_msg *prev;
 	struct mosquitto_client_msg *next;
+	UT_hash_handle hh_mid;
 	struct mosquitto_msg_store *store;
 	mosquitto_property *properties;
 	time_t timestamp;
@@ -390,6 +426,7 @@ struct mosquitto_client_msg{
 	enum mosquitto_msg_direction direction;
 	enum mosquitto_msg_state state;
 	bool dup;
+	bool journalled;
 };
 
 
@@ -415,10 +452,36 @@ struct mosquitto__acl{
 	int ccount;
 };
 
+/* ACLs compiled into a tree of topic levels, so a topic can be checked
+ * against all of them in one pass. */
+struct mosquitto__acl_node{
+	UT_hash_handle hh;
+	struct mosquitto__acl_node *children; /* Literal levels */
+	struct mosquitto__acl_node *plus;
+	struct mosquitto__acl_node *templates; /* Pattern levels containing %c or %u */
+	struct mosquitto__acl_node *next;
+	char *level;
+	int access; /* ACLs ending at this level */
+	int hash_access; /* ACLs ending in '#' below this level */
+	bool deny;
+	bool hash_deny;
+};
+
+/* A cached ACL check result for a client. */
+struct mosquitto__acl_cache_entry{
+	char *topic;
+	unsigned hash;
+	int access;
+	int result;
+	uint8_t qos;
+	bool retain;
+};
+
 struct mosquitto__acl_user{
 	struct mosquitto__acl_user *next;
 	char *username;
 	struct mosquitto__acl *acl;
+	struct mosquitto__acl_node *trie;
 };
 
 
@@ -447,7 +510,6 @@ struct mosquitto_db{
 #endif
 	struct clientid__index_hash *clientid_index_hash;
 	struct mosquitto_msg_store *msg_store;
-	struct mosquitto_msg_store_load *msg_store_load;
 	time_t now_s; /* Monotonic clock, where possible */
 	time_t now_real_s; /* Read clock, for measuring session/message expiry */
 #ifdef WITH_BRIDGE
@@ -463,9 +525,17 @@ struct mosquitto_db{
 	int subscription_count;
 	int shared_subscription_count;
 	int retained_count;
+	uint64_t subscription_cache_hits;
+	uint64_t subscription_cache_misses;
 #endif
 	int persistence_changes;
+	uint64_t persistence_save_bytes;
+	uint64_t persistence_save_ms;
+	unsigned long persistence_save_count;
 	struct mosquitto *ll_for_free;
+	struct mosquitto *ll_for_write;
+	uint8_t *packet_buffer;
+	size_t packet_buffer_size;
 #ifdef WITH_EPOLL
 	int epollfd;
 #endif
@@ -633,7 +703,19 @@ int db__open(struct mosquitto__config *config);
 int db__close(void);
 #ifdef WITH_PERSISTENCE
 int persist__backup(bool shutdown);
+void persist__backup_check(bool wait);
+bool persist__background_running(void);
 int persist__restore(void);
+void persist__journal_sync(void);
+void persist__journal_check(void);
+void persist__journal_client(struct mosquitto *context);
+void persist__journal_client_delete(struct mosquitto *context);
+void persist__journal_msg_add(struct mosquitto *context, struct mosquitto_client_msg *msg);
+void persist__journal_msg_update(struct mosquitto *context, struct mosquitto_client_msg *msg);
+void persist__journal_msg_delete(struct mosquitto *context, struct mosquitto_client_msg *msg);
+void persist__journal_sub(struct mosquitto *context, const char *topic, uint8_t qos, uint32_t identifier, int options);
+void persist__journal_unsub(struct mosquitto *context, const char *topic);
+void persist__journal_retain(const char *topic, struct mosquitto_msg_store *stored);
 #endif
 /* Return the number of in-flight messages in count. */
 int db__message_count(int *count);
@@ -642,6 +724,10 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 int db__message_release_incoming(struct mosquitto *context, uint16_t mid);
 int db__message_update_outgoing(struct mosquitto *context, uint16_t mid, enum mosquitto_msg_state state, int qos);
 void db__message_dequeue_first(struct mosquitto *context, struct mosquitto_msg_data *msg_data);
+void db__message_add_to_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg);
+void db__message_add_to_queued(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg);
+void db__message_remove_from_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg);
+void db__message_remove_from_queued(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg);
 int db__messages_delete(struct mosquitto *context, bool force_free);
 int db__messages_easy_queue(struct mosquitto *context, const char *topic, uint8_t qos, uint32_t payloadlen, const void *payload, int retain, uint32_t message_expiry_interval, mosquitto_property **properties);
 int db__message_store(const struct mosquitto *source, struct mosquitto_msg_store *stored, uint32_t message_expiry_interval, dbid_t store_id, enum mosquitto_msg_origin origin);
@@ -653,6 +739,7 @@ void db__msg_store_ref_dec(struct mosquitto_msg_store **store);
 void db__msg_store_clean(void);
 void db__msg_store_compact(void);
 void db__msg_store_free(struct mosquitto_msg_store *store);
+void db__msg_store_payload_free(struct mosquitto_msg_store *store);
 int db__message_reconnect_reset(struct mosquitto *context);
 bool db__ready_for_flight(struct mosquitto_msg_data *msgs, int qos);
 bool db__ready_for_queue(struct mosquitto *context, int qos, struct mosquitto_msg_data *msg_data);
@@ -667,9 +754,10 @@ int db__message_write_queued_in(struct mosquitto *context);
  * Subscription functions
  * ============================================================ */
 int sub__add(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t identifier, int options, struct mosquitto__subhier **root);
-struct mosquitto__subhier *sub__add_hier_entry(struct mosquitto__subhier *parent, struct mosquitto__subhier **sibling, const char *topic, uint16_t len);
+struct mosquitto__subhier *sub__add_hier_entry(struct mosquitto__subhier *parent, const char *topic, uint16_t len);
 int sub__remove(struct mosquitto *context, const char *sub, struct mosquitto__subhier *root, uint8_t *reason);
 void sub__tree_print(struct mosquitto__subhier *root, int level);
+void sub__tree_clean(struct mosquitto__subhier **root);
 int sub__clean_session(struct mosquitto *context);
 int sub__messages_queue(const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store **stored);
 int sub__topic_tokenise(const char *subtopic, char **local_sub, char ***topics, const char **sharename);
@@ -687,6 +775,7 @@ void context__send_will(struct mosquitto *context);
 void context__remove_from_by_id(struct mosquitto *context);
 
 int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint16_t auth_data_out_len);
+void connect__on_unpwd_checked(struct mosquitto *context, int rc);
 
 
 /* ============================================================
@@ -735,9 +824,10 @@ int mux__loop_prepare(void);
 int mux__add_out(struct mosquitto *context);
 int mux__remove_out(struct mosquitto *context);
 int mux__add_in(struct mosquitto *context);
+int mux__remove_in(struct mosquitto *context);
 int mux__delete(struct mosquitto *context);
 int mux__wait(void);
-int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_count);
+int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_count, int timeout);
 int mux__cleanup(void);
 
 /* ============================================================
@@ -781,11 +871,25 @@ int retain__init(void);
 void retain__clean(struct mosquitto__retainhier **retainhier);
 int retain__queue(struct mosquitto *context, const char *sub, uint8_t sub_qos, uint32_t subscription_identifier);
 int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **split_topics);
+void retain__stream_process(void);
+bool retain__stream_ready(void);
+void retain__stream_remove(struct mosquitto *context, const char *sub);
+void retain__stream_move(struct mosquitto *from, struct mosquitto *to);
+void retain__track(struct mosquitto_msg_store *stored);
+void retain__untrack(struct mosquitto_msg_store *stored);
+int retain__payload_load(struct mosquitto_msg_store *stored);
+void *retain__payload(struct mosquitto_msg_store *stored);
+void retain__evict_check(void);
+void retain__evict_cleanup(void);
 
 /* ============================================================
  * Security related functions
  * ============================================================ */
 int acl__find_acls(struct mosquitto *context);
+int acl__cache_init(struct mosquitto *context);
+void acl__cache_clear(struct mosquitto *context);
+void acl__cache_free(struct mosquitto *context);
+void acl__cache_invalidate(void);
 int mosquitto_security_module_init(void);
 int mosquitto_security_module_cleanup(void);
 
@@ -806,6 +910,35 @@ int mosquitto_security_auth_continue(struct mosquitto *context, const void *data
 
 void unpwd__free_item(struct mosquitto__unpwd **unpwd, struct mosquitto__unpwd *item);
 
+#ifdef WITH_TLS
+int pw__digest(const char *password, const unsigned char *salt, unsigned int salt_len, unsigned char *hash, unsigned int *hash_len, enum mosquitto_pwhash_type hashtype, int iterations);
+int pw__verify(const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len, enum mosquitto_pwhash_type hashtype, int iterations);
+int pw__check(struct mosquitto *context, const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len, enum mosquitto_pwhash_type hashtype, int iterations);
+#endif
+
+/* ============================================================
+ * Password check worker threads
+ * ============================================================ */
+#ifdef WITH_AUTH_THREADS
+int auth_worker__init(void);
+void auth_worker__cleanup(void);
+int auth_worker__fd(void);
+int auth_worker__submit(struct mosquitto *context, const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len, enum mosquitto_pwhash_type hashtype, int iterations);
+void auth_worker__cancel(struct mosquitto *context);
+bool auth_worker__busy(void);
+void auth_worker__handle(void);
+#endif
+
+/* ============================================================
+ * Verified password cache
+ * ============================================================ */
+#ifdef WITH_TLS
+int auth_cache__check(const char *username, const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len);
+void auth_cache__add(const char *username, const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len);
+void auth_cache__invalidate(const char *username);
+void auth_cache__cleanup(void);
+#endif
+
 /* ============================================================
  * Session expiry
  * ============================================================ */
@@ -834,6 +967,21 @@ void mosq_websockets_init(struct mosquitto__listener *listener, const struct mos
 #endif
 void do_disconnect(struct mosquitto *context, int reason);
 
+/* ============================================================
+ * Timer heap
+ * ============================================================ */
+struct mosquitto__timer_heap{
+	struct mosquitto__timer **timers;
+	size_t count;
+	size_t capacity;
+	uint64_t next_seq;
+};
+
+int timer_heap__add(struct mosquitto__timer_heap *heap, struct mosquitto__timer *timer);
+void timer_heap__remove(struct mosquitto__timer_heap *heap, struct mosquitto__timer *timer);
+struct mosquitto__timer *timer_heap__peek(struct mosquitto__timer_heap *heap);
+void timer_heap__cleanup(struct mosquitto__timer_heap *heap);
+
 /* ============================================================
  * Will delay
  * ============================================================ */
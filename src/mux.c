@@ -58,6 +58,16 @@ int mux__add_in(struct mosquitto *context)
 }
 
 
+int mux__remove_in(struct mosquitto *context)
+{
+#ifdef WITH_EPOLL
+	return mux_epoll__remove_in(context);
+#else
+	return mux_poll__remove_in(context);
+#endif
+}
+
+
 int mux__delete(struct mosquitto *context)
 {
 #ifdef WITH_EPOLL
@@ -68,12 +78,15 @@ int mux__delete(struct mosquitto *context)
 }
 
 
-int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_count)
+int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_count, int timeout)
 {
 #ifdef WITH_EPOLL
-	return mux_epoll__handle(listensock, listensock_count);
+	UNUSED(listensock);
+	UNUSED(listensock_count);
+
+	return mux_epoll__handle(timeout);
 #else
-	return mux_poll__handle(listensock, listensock_count);
+	return mux_poll__handle(listensock, listensock_count, timeout);
 #endif
 }
 
@@ -68,6 +68,9 @@ static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events)
 
 static sigset_t my_sigblock;
 static struct epoll_event ep_events[MAX_EVENTS];
+#ifdef WITH_AUTH_THREADS
+static int auth_worker_ident = id_auth_worker;
+#endif
 
 int mux_epoll__init(struct mosquitto__listener_sock *listensock, int listensock_count)
 {
@@ -101,6 +104,18 @@ int mux_epoll__init(struct mosquitto__listener_sock *listensock, int listensock_
 			return MOSQ_ERR_UNKNOWN;
 		}
 	}
+#ifdef WITH_AUTH_THREADS
+	if(auth_worker__fd() != -1){
+		ev.data.ptr = &auth_worker_ident;
+		ev.events = EPOLLIN;
+		if (epoll_ctl(db.epollfd, EPOLL_CTL_ADD, auth_worker__fd(), &ev) == -1) {
+			log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll initial registering: %s", strerror(errno));
+			(void)close(db.epollfd);
+			db.epollfd = 0;
+			return MOSQ_ERR_UNKNOWN;
+		}
+	}
+#endif
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -118,13 +133,13 @@ int mux_epoll__add_out(struct mosquitto *context)
 	if(!(context->events & EPOLLOUT)) {
 		memset(&ev, 0, sizeof(struct epoll_event));
 		ev.data.ptr = context;
-		ev.events = EPOLLIN | EPOLLOUT;
+		ev.events = context->events | EPOLLOUT;
 		if(epoll_ctl(db.epollfd, EPOLL_CTL_ADD, context->sock, &ev) == -1) {
 			if((errno != EEXIST)||(epoll_ctl(db.epollfd, EPOLL_CTL_MOD, context->sock, &ev) == -1)) {
 				log__printf(NULL, MOSQ_LOG_DEBUG, "Error in epoll re-registering to EPOLLOUT: %s", strerror(errno));
 			}
 		}
-		context->events = EPOLLIN | EPOLLOUT;
+		context->events = ev.events;
 	}
 	return MOSQ_ERR_SUCCESS;
 }
@@ -137,13 +152,13 @@ int mux_epoll__remove_out(struct mosquitto *context)
 	if(context->events & EPOLLOUT) {
 		memset(&ev, 0, sizeof(struct epoll_event));
 		ev.data.ptr = context;
-		ev.events = EPOLLIN;
+		ev.events = context->events & ~(uint32_t)EPOLLOUT;
 		if(epoll_ctl(db.epollfd, EPOLL_CTL_ADD, context->sock, &ev) == -1) {
 			if((errno != EEXIST)||(epoll_ctl(db.epollfd, EPOLL_CTL_MOD, context->sock, &ev) == -1)) {
 					log__printf(NULL, MOSQ_LOG_DEBUG, "Error in epoll re-registering to EPOLLIN: %s", strerror(errno));
 			}
 		}
-		context->events = EPOLLIN;
+		context->events = ev.events;
 	}
 	return MOSQ_ERR_SUCCESS;
 }
@@ -154,12 +169,33 @@ int mux_epoll__add_in(struct mosquitto *context)
 	struct epoll_event ev;
 
 	memset(&ev, 0, sizeof(struct epoll_event));
-	ev.events = EPOLLIN;
+	ev.events = context->events | EPOLLIN;
 	ev.data.ptr = context;
 	if (epoll_ctl(db.epollfd, EPOLL_CTL_ADD, context->sock, &ev) == -1) {
-		log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll accepting: %s", strerror(errno));
+		if((errno != EEXIST)||(epoll_ctl(db.epollfd, EPOLL_CTL_MOD, context->sock, &ev) == -1)) {
+			log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll accepting: %s", strerror(errno));
+		}
+	}
+	context->events = ev.events;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Stop reading from a client, for example while its CONNECT is held for a
+ * password check. Adding or removing EPOLLOUT leaves this in place. */
+int mux_epoll__remove_in(struct mosquitto *context)
+{
+	struct epoll_event ev;
+
+	if(context->events & EPOLLIN) {
+		memset(&ev, 0, sizeof(struct epoll_event));
+		ev.data.ptr = context;
+		ev.events = context->events & ~(uint32_t)EPOLLIN;
+		if(epoll_ctl(db.epollfd, EPOLL_CTL_MOD, context->sock, &ev) == -1) {
+			log__printf(NULL, MOSQ_LOG_DEBUG, "Error in epoll de-registering from EPOLLIN: %s", strerror(errno));
+		}
+		context->events = ev.events;
 	}
-	context->events = EPOLLIN;
 	return MOSQ_ERR_SUCCESS;
 }
 
@@ -169,6 +205,7 @@ int mux_epoll__delete(struct mosquitto *context)
 	struct epoll_event ev;
 
 	memset(&ev, 0, sizeof(struct epoll_event));
+	context->events = 0;
 	if(context->sock != INVALID_SOCKET){
 		if(epoll_ctl(db.epollfd, EPOLL_CTL_DEL, context->sock, &ev) == -1){
 			return 1;
@@ -178,19 +215,19 @@ int mux_epoll__delete(struct mosquitto *context)
 }
 
 
-int mux_epoll__handle(void)
+int mux_epoll__handle(int timeout)
 {
 	int i;
 	struct epoll_event ev;
-	sigset_t origsig;
 	struct mosquitto *context;
 	struct mosquitto__listener_sock *listensock;
 	int event_count;
+	int accept_count;
 
 	memset(&ev, 0, sizeof(struct epoll_event));
-	sigprocmask(SIG_SETMASK, &my_sigblock, &origsig);
-	event_count = epoll_wait(db.epollfd, ep_events, MAX_EVENTS, 100);
-	sigprocmask(SIG_SETMASK, &origsig, NULL);
+	/* epoll_pwait() swaps in the signal mask for the duration of the wait
+	 * only, which saves a pair of sigprocmask() calls on every loop. */
+	event_count = epoll_pwait(db.epollfd, ep_events, MAX_EVENTS, timeout, &my_sigblock);
 
 	db.now_s = mosquitto_time();
 	db.now_real_s = time(NULL);
@@ -212,11 +249,24 @@ int mux_epoll__handle(void)
 				listensock = ep_events[i].data.ptr;
 
 				if (ep_events[i].events & (EPOLLIN | EPOLLPRI)){
+					/* Limit how many connections are accepted in one go, so a
+					 * reconnect storm can't starve existing clients. Any
+					 * remaining connections wait in the listen backlog until
+					 * the next loop. */
+					accept_count = 0;
 					while((context = net__socket_accept(listensock)) != NULL){
 						context->events = EPOLLIN;
 						mux__add_in(context);
+						accept_count++;
+						if(db.config->max_accepts_per_loop > 0 && accept_count >= db.config->max_accepts_per_loop){
+							break;
+						}
 					}
 				}
+#ifdef WITH_AUTH_THREADS
+			}else if(context->ident == id_auth_worker){
+				auth_worker__handle();
+#endif
 #ifdef WITH_WEBSOCKETS
 			}else if(context->ident == id_listener_ws){
 				/* Nothing needs to happen here, because we always call lws_service in the loop.
@@ -300,7 +350,7 @@ static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events)
 				do_disconnect(context, rc);
 				return;
 			}
-		}while(SSL_DATA_PENDING(context));
+		}while(SSL_DATA_PENDING(context) && context->state != mosq_cs_auth_pending);
 	}else{
 		if(events & (EPOLLERR | EPOLLHUP)){
 			do_disconnect(context, MOSQ_ERR_CONN_LOST);
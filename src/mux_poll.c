@@ -60,6 +60,9 @@ static void loop_handle_reads_writes(void);
 
 static struct pollfd *pollfds = NULL;
 static size_t pollfd_max, pollfd_current_max;
+#ifdef WITH_AUTH_THREADS
+static int auth_worker_index = -1;
+#endif
 #ifndef WIN32
 static sigset_t my_sigblock;
 #endif
@@ -100,36 +103,53 @@ int mux_poll__init(struct mosquitto__listener_sock *listensock, int listensock_c
 		pollfds[pollfd_index].revents = 0;
 		pollfd_index++;
 	}
+#ifdef WITH_AUTH_THREADS
+	if(auth_worker__fd() != -1){
+		auth_worker_index = (int)pollfd_index;
+		pollfds[pollfd_index].fd = auth_worker__fd();
+		pollfds[pollfd_index].events = POLLIN;
+		pollfds[pollfd_index].revents = 0;
+		pollfd_index++;
+	}
+#endif
 
 	pollfd_current_max = pollfd_index-1;
 	return MOSQ_ERR_SUCCESS;
 }
 
 
-int mux_poll__add_out(struct mosquitto *context)
+/* Set the events polled for a client, giving it a slot in pollfds if it
+ * doesn't have one. */
+static void mux_poll__set_events(struct mosquitto *context, uint32_t events)
 {
 	int i;
 
-	if(!(context->events & POLLOUT)) {
-		if(context->pollfd_index != -1){
-			pollfds[context->pollfd_index].fd = context->sock;
-			pollfds[context->pollfd_index].events = POLLIN | POLLOUT;
-			pollfds[context->pollfd_index].revents = 0;
-		}else{
-			for(i=0; i<pollfd_max; i++){
-				if(pollfds[i].fd == INVALID_SOCKET){
-					pollfds[i].fd = context->sock;
-					pollfds[i].events = POLLIN | POLLOUT;
-					pollfds[i].revents = 0;
-					context->pollfd_index = i;
-					if(i > pollfd_current_max){
-						pollfd_current_max = (size_t )i;
-					}
-					break;
+	if(context->pollfd_index != -1){
+		pollfds[context->pollfd_index].fd = context->sock;
+		pollfds[context->pollfd_index].events = (short)events;
+		pollfds[context->pollfd_index].revents = 0;
+	}else{
+		for(i=0; i<pollfd_max; i++){
+			if(pollfds[i].fd == INVALID_SOCKET){
+				pollfds[i].fd = context->sock;
+				pollfds[i].events = (short)events;
+				pollfds[i].revents = 0;
+				context->pollfd_index = i;
+				if(i > pollfd_current_max){
+					pollfd_current_max = (size_t )i;
 				}
+				break;
 			}
 		}
-		context->events = POLLIN | POLLOUT;
+	}
+	context->events = events;
+}
+
+
+int mux_poll__add_out(struct mosquitto *context)
+{
+	if(!(context->events & POLLOUT)) {
+		mux_poll__set_events(context, context->events | POLLOUT);
 	}
 
 	return MOSQ_ERR_SUCCESS;
@@ -139,36 +159,29 @@ int mux_poll__add_out(struct mosquitto *context)
 int mux_poll__remove_out(struct mosquitto *context)
 {
 	if(context->events & POLLOUT) {
-		return mux_poll__add_in(context);
-	}else{
-		return MOSQ_ERR_SUCCESS;
+		mux_poll__set_events(context, context->events & ~(uint32_t)POLLOUT);
 	}
+
+	return MOSQ_ERR_SUCCESS;
 }
 
 
 int mux_poll__add_in(struct mosquitto *context)
 {
-	int i;
+	mux_poll__set_events(context, context->events | POLLIN);
+
+	return MOSQ_ERR_SUCCESS;
+}
 
+
+/* Stop reading from a client, for example while its CONNECT is held for a
+ * password check. Adding or removing POLLOUT leaves this in place. */
+int mux_poll__remove_in(struct mosquitto *context)
+{
 	if(context->pollfd_index != -1){
-		pollfds[context->pollfd_index].fd = context->sock;
-		pollfds[context->pollfd_index].events = POLLIN;
-		pollfds[context->pollfd_index].revents = 0;
-	}else{
-		for(i=0; i<pollfd_max; i++){
-			if(pollfds[i].fd == INVALID_SOCKET){
-				pollfds[i].fd = context->sock;
-				pollfds[i].events = POLLIN;
-				pollfds[i].revents = 0;
-				context->pollfd_index = i;
-				if(i > pollfd_current_max){
-					pollfd_current_max = (size_t )i;
-				}
-				break;
-			}
-		}
+		pollfds[context->pollfd_index].events &= ~POLLIN;
 	}
-	context->events = POLLIN;
+	context->events &= ~(uint32_t)POLLIN;
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -177,6 +190,7 @@ int mux_poll__delete(struct mosquitto *context)
 {
 	size_t pollfd_index;
 
+	context->events = 0;
 	if(context->pollfd_index != -1){
 		pollfds[context->pollfd_index].fd = INVALID_SOCKET;
 		pollfds[context->pollfd_index].events = 0;
@@ -201,21 +215,22 @@ int mux_poll__delete(struct mosquitto *context)
 
 
 
-int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock_count)
+int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock_count, int timeout)
 {
 	struct mosquitto *context;
 	int i;
 	int fdcount;
+	int accept_count;
 #ifndef WIN32
 	sigset_t origsig;
 #endif
 
 #ifndef WIN32
 	sigprocmask(SIG_SETMASK, &my_sigblock, &origsig);
-	fdcount = poll(pollfds, pollfd_current_max+1, 100);
+	fdcount = poll(pollfds, pollfd_current_max+1, timeout);
 	sigprocmask(SIG_SETMASK, &origsig, NULL);
 #else
-	fdcount = WSAPoll(pollfds, pollfd_current_max+1, 100);
+	fdcount = WSAPoll(pollfds, pollfd_current_max+1, timeout);
 #endif
 
 	db.now_s = mosquitto_time();
@@ -237,6 +252,12 @@ int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock
 	}else{
 		loop_handle_reads_writes();
 
+#ifdef WITH_AUTH_THREADS
+		if(auth_worker_index != -1 && pollfds[auth_worker_index].revents & POLLIN){
+			auth_worker__handle();
+		}
+#endif
+
 		for(i=0; i<listensock_count; i++){
 			if(pollfds[i].revents & POLLIN){
 #ifdef WITH_WEBSOCKETS
@@ -246,9 +267,14 @@ int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock
 				}else
 #endif
 				{
+					accept_count = 0;
 					while((context = net__socket_accept(&listensock[i])) != NULL){
 						context->pollfd_index = -1;
 						mux__add_in(context);
+						accept_count++;
+						if(db.config->max_accepts_per_loop > 0 && accept_count >= db.config->max_accepts_per_loop){
+							break;
+						}
 					}
 				}
 			}
@@ -262,6 +288,9 @@ int mux_poll__cleanup(void)
 {
 	mosquitto__free(pollfds);
 	pollfds = NULL;
+#ifdef WITH_AUTH_THREADS
+	auth_worker_index = -1;
+#endif
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -351,7 +380,7 @@ static void loop_handle_reads_writes(void)
 					do_disconnect(context, rc);
 					continue;
 				}
-			}while(SSL_DATA_PENDING(context));
+			}while(SSL_DATA_PENDING(context) && context->state != mosq_cs_auth_pending);
 		}else{
 			if(context->pollfd_index >= 0 && pollfds[context->pollfd_index].revents & (POLLERR | POLLNVAL | POLLHUP)){
 				do_disconnect(context, MOSQ_ERR_CONN_LOST);
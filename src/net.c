@@ -244,6 +244,7 @@ struct mosquitto *net__socket_accept(struct mosquitto__listener_sock *listensock
 		log__printf(NULL, MOSQ_LOG_NOTICE, "New connection from %s:%d on port %d.",
 				new_context->address, new_context->remote_port, new_context->listener->port);
 	}
+	keepalive__add(new_context);
 
 	return new_context;
 }
@@ -742,7 +743,7 @@ static int net__socket_listen_tcp(struct mosquitto__listener *listener)
 			return 1;
 		}
 
-		if(listen(sock, 100) == -1){
+		if(listen(sock, SOMAXCONN) == -1){
 			net__print_error(MOSQ_LOG_ERR, "Error: %s");
 			freeaddrinfo(ainfo);
 			COMPAT_CLOSE(sock);
@@ -29,11 +29,22 @@ extern const unsigned char magic[15];
 #define DB_CHUNK_RETAIN 4
 #define DB_CHUNK_SUB 5
 #define DB_CHUNK_CLIENT 6
+#define DB_CHUNK_JOURNAL 7
+/* The following chunks are only found in the journal */
+#define DB_CHUNK_CLIENT_MSG_UPDATE 8
+#define DB_CHUNK_CLIENT_MSG_DELETE 9
+#define DB_CHUNK_SUB_DELETE 10
+#define DB_CHUNK_RETAIN_DELETE 11
+#define DB_CHUNK_CLIENT_DELETE 12
 /* End DB read/write */
 
 #define read_e(f, b, c) if(fread(b, 1, c, f) != c){ goto error; }
 #define write_e(f, b, c) if(fwrite(b, 1, c, f) != c){ goto error; }
 
+/* Payloads at least this large are written with writev() rather than being
+ * copied through the stdio buffer. */
+#define PERSIST_WRITEV_MIN 4096
+
 /* COMPATIBILITY NOTES
  *
  * The P_* structs (persist structs) contain all of the data for a particular
@@ -143,6 +154,22 @@ struct P_retain{
 };
 
 
+struct PF_retain_delete{
+	uint16_t topic_len;
+};
+struct P_retain_delete{
+	struct PF_retain_delete F;
+	char *topic;
+};
+
+
+/* Marks the start of a journal generation. In a database file, all
+ * generations before this one are included in the file. */
+struct PF_journal{
+	uint64_t generation;
+};
+
+
 int persist__read_string_len(FILE *db_fptr, char **str, uint16_t len);
 int persist__read_string(FILE *db_fptr, char **str);
 
@@ -163,12 +190,29 @@ int persist__chunk_client_msg_read_v56(FILE *db_fptr, struct P_client_msg *chunk
 int persist__chunk_msg_store_read_v56(FILE *db_fptr, struct P_msg_store *chunk, uint32_t length);
 int persist__chunk_retain_read_v56(FILE *db_fptr, struct P_retain *chunk);
 int persist__chunk_sub_read_v56(FILE *db_fptr, struct P_sub *chunk);
+int persist__chunk_journal_read_v56(FILE *db_fptr, struct PF_journal *chunk);
+int persist__chunk_retain_delete_read_v56(FILE *db_fptr, struct P_retain_delete *chunk);
 
 int persist__chunk_cfg_write_v6(FILE *db_fptr, struct PF_cfg *chunk);
-int persist__chunk_client_write_v6(FILE *db_fptr, struct P_client *chunk);
-int persist__chunk_client_msg_write_v6(FILE *db_fptr, struct P_client_msg *chunk);
+int persist__chunk_client_write_v6(FILE *db_fptr, struct P_client *chunk, uint32_t type);
+int persist__chunk_client_msg_write_v6(FILE *db_fptr, struct P_client_msg *chunk, uint32_t type);
 int persist__chunk_message_store_write_v6(FILE *db_fptr, struct P_msg_store *chunk);
 int persist__chunk_retain_write_v6(FILE *db_fptr, struct P_retain *chunk);
-int persist__chunk_sub_write_v6(FILE *db_fptr, struct P_sub *chunk);
+int persist__chunk_sub_write_v6(FILE *db_fptr, struct P_sub *chunk, uint32_t type);
+int persist__chunk_journal_write_v6(FILE *db_fptr, struct PF_journal *chunk);
+int persist__chunk_retain_delete_write_v6(FILE *db_fptr, struct P_retain_delete *chunk);
+
+int persist__file_header_write(FILE *db_fptr);
+int persist__message_store_write(FILE *db_fptr, struct mosquitto_msg_store *stored);
+int persist__client_write(FILE *db_fptr, struct mosquitto *context, uint32_t type);
+int persist__client_msg_write(FILE *db_fptr, struct mosquitto *context, struct mosquitto_client_msg *cmsg, uint32_t type);
+
+char *persist__journal_filename(const char *suffix);
+int persist__journal_open(uint64_t generation, long valid_length, bool save_needed);
+void persist__journal_close(void);
+void persist__journal_rotate(void);
+int persist__journal_chunk_write(FILE *db_fptr);
+void persist__journal_save_complete(bool success);
+int persist__journal_restore(bool snapshot_found, bool snapshot_journalled, uint64_t snapshot_generation);
 
 #endif
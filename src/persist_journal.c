@@ -0,0 +1,483 @@
+/*
+Copyright (c) 2021 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR EDL-1.0
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+#include "config.h"
+
+#ifdef WITH_PERSISTENCE
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "misc_mosq.h"
+#include "persist.h"
+#include "util_mosq.h"
+
+/* The journal records changes to the in-memory database between saves, so
+ * they aren't lost if the broker stops unexpectedly. It uses the same format
+ * as the database file, plus chunks for updates and deletions. Records are
+ * buffered as changes are made, and written to disk with a single fsync()
+ * before any packets are sent, so a client is never sent an acknowledgement
+ * for a change that isn't on disk.
+ *
+ * Each save starts a new generation by adding a DB_CHUNK_JOURNAL marker to
+ * the journal, and the database file records the generation that was
+ * started. When the save has completed, the earlier generations are removed
+ * from the journal. On restore, only generations at or after the one in the
+ * database file are replayed.
+ */
+
+static FILE *journal_fptr = NULL;
+static char *journal_path = NULL;
+static uint64_t journal_generation = 0;
+static bool journal_dirty = false;
+static long journal_bytes = 0;
+/* Offset of the generation started by a save that is in progress, or -1. */
+static long compact_offset = -1;
+
+
+char *persist__journal_filename(const char *suffix)
+{
+	char *filename;
+	size_t len;
+
+	len = strlen(db.config->persistence_filepath) + strlen(".journal") + strlen(suffix) + 1;
+	filename = mosquitto__malloc(len);
+	if(filename){
+		snprintf(filename, len, "%s.journal%s", db.config->persistence_filepath, suffix);
+	}
+	return filename;
+}
+
+
+/* Stop journalling after an error. Anything already in the journal is still
+ * valid, but the next save will not refer to it so it won't be replayed. */
+static void persist__journal_error(void)
+{
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to write to persistence journal %s: %s. Journalling disabled.",
+			journal_path, strerror(errno));
+	if(journal_fptr){
+		fclose(journal_fptr);
+		journal_fptr = NULL;
+	}
+	journal_dirty = false;
+	compact_offset = -1;
+}
+
+
+static FILE *persist__journal_create(const char *filename, uint64_t generation)
+{
+	FILE *fptr;
+	struct PF_journal chunk;
+
+#ifndef WIN32
+	/* See persist__write() */
+	if(unlink(filename) && errno != ENOENT){
+		return NULL;
+	}
+#endif
+	fptr = mosquitto__fopen(filename, "wb", true);
+	if(!fptr) return NULL;
+
+	memset(&chunk, 0, sizeof(struct PF_journal));
+	chunk.generation = generation;
+	if(persist__file_header_write(fptr) || persist__chunk_journal_write_v6(fptr, &chunk)){
+		fclose(fptr);
+		return NULL;
+	}
+	return fptr;
+}
+
+
+static int persist__journal_fsync(FILE *fptr)
+{
+	if(fflush(fptr)) return 1;
+#ifndef WIN32
+	if(fsync(fileno(fptr))) return 1;
+#endif
+	return 0;
+}
+
+
+/* Called once the database has been restored. If valid_length is greater
+ * than zero, the existing journal is kept up to that point and new records
+ * are added to the given generation, otherwise a new journal is started. */
+int persist__journal_open(uint64_t generation, long valid_length, bool save_needed)
+{
+	if(db.config->persistence_journal == false) return MOSQ_ERR_SUCCESS;
+
+	journal_path = persist__journal_filename("");
+	if(!journal_path) return MOSQ_ERR_NOMEM;
+
+	if(valid_length > 0){
+#ifndef WIN32
+		if(truncate(journal_path, valid_length)){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open persistence journal %s: %s.",
+					journal_path, strerror(errno));
+			return 1;
+		}
+#endif
+		journal_fptr = mosquitto__fopen(journal_path, "ab", true);
+	}else{
+		journal_fptr = persist__journal_create(journal_path, generation);
+		if(journal_fptr && persist__journal_fsync(journal_fptr)){
+			fclose(journal_fptr);
+			journal_fptr = NULL;
+		}
+	}
+	if(!journal_fptr){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open persistence journal %s: %s.",
+				journal_path, strerror(errno));
+		return 1;
+	}
+	fseek(journal_fptr, 0, SEEK_END);
+	journal_bytes = ftell(journal_fptr);
+	journal_generation = generation;
+
+	if(save_needed){
+		/* The database file doesn't refer to the journal yet. */
+		return persist__backup(false);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void persist__journal_close(void)
+{
+	if(journal_fptr){
+		persist__journal_sync();
+	}
+	if(journal_fptr){
+		fclose(journal_fptr);
+		journal_fptr = NULL;
+	}
+	mosquitto__free(journal_path);
+	journal_path = NULL;
+	compact_offset = -1;
+}
+
+
+/* Write everything recorded so far to disk. This must be called before any
+ * packets are sent, so that acknowledgements are only sent for changes that
+ * have been recorded. All of the changes made since the last call are
+ * written together. */
+void persist__journal_sync(void)
+{
+	if(journal_dirty == false) return;
+
+	journal_dirty = false;
+	if(persist__journal_fsync(journal_fptr)){
+		persist__journal_error();
+		return;
+	}
+	journal_bytes = ftell(journal_fptr);
+}
+
+
+/* Start a save if the journal has grown too large. */
+void persist__journal_check(void)
+{
+	if(journal_fptr == NULL
+			|| db.config->persistence_journal_max_size == 0
+			|| compact_offset != -1){
+
+		return;
+	}
+
+	if((size_t)journal_bytes >= db.config->persistence_journal_max_size){
+		log__printf(NULL, MOSQ_LOG_INFO, "Persistence journal has reached %ld bytes.", journal_bytes);
+		persist__backup(false);
+	}
+}
+
+
+/* Called when a save starts. Everything recorded after this point is in the
+ * new generation. */
+void persist__journal_rotate(void)
+{
+	struct PF_journal chunk;
+	struct mosquitto_msg_store *stored;
+
+	if(journal_fptr == NULL) return;
+
+	compact_offset = ftell(journal_fptr);
+	journal_generation++;
+
+	/* Not every message is included in the database file, so any that are
+	 * referred to in the new generation must be written to it again. */
+	for(stored = db.msg_store; stored; stored = stored->next){
+		stored->journalled = false;
+	}
+
+	memset(&chunk, 0, sizeof(struct PF_journal));
+	chunk.generation = journal_generation;
+	if(persist__chunk_journal_write_v6(journal_fptr, &chunk)){
+		persist__journal_error();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+/* Add the current generation to a database file being saved, so that
+ * restoring it knows where to start replaying the journal. */
+int persist__journal_chunk_write(FILE *db_fptr)
+{
+	struct PF_journal chunk;
+
+	if(journal_fptr == NULL || compact_offset == -1) return MOSQ_ERR_SUCCESS;
+
+	memset(&chunk, 0, sizeof(struct PF_journal));
+	chunk.generation = journal_generation;
+	return persist__chunk_journal_write_v6(db_fptr, &chunk);
+}
+
+
+/* Called when a save has finished. If it succeeded, the generations it
+ * includes are removed from the journal by copying the current generation
+ * to a new file. */
+void persist__journal_save_complete(bool success)
+{
+	FILE *in_fptr = NULL, *out_fptr = NULL;
+	char *filename;
+	char buf[4096];
+	size_t len;
+	long offset;
+
+	if(journal_fptr == NULL || compact_offset == -1) return;
+
+	offset = compact_offset;
+	compact_offset = -1;
+	if(success == false) return;
+
+	journal_dirty = true;
+	persist__journal_sync();
+	if(journal_fptr == NULL) return;
+
+	filename = persist__journal_filename(".new");
+	if(!filename) return;
+
+	in_fptr = mosquitto__fopen(journal_path, "rb", false);
+	if(!in_fptr || fseek(in_fptr, offset, SEEK_SET)){
+		goto error;
+	}
+	out_fptr = mosquitto__fopen(filename, "wb", true);
+	if(!out_fptr || persist__file_header_write(out_fptr)){
+		goto error;
+	}
+	while((len = fread(buf, 1, sizeof(buf), in_fptr)) > 0){
+		if(fwrite(buf, 1, len, out_fptr) != len){
+			goto error;
+		}
+	}
+	if(ferror(in_fptr) || persist__journal_fsync(out_fptr)){
+		goto error;
+	}
+	fclose(in_fptr);
+	fclose(out_fptr);
+
+	if(rename(filename, journal_path)){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to compact persistence journal: %s.", strerror(errno));
+		mosquitto__free(filename);
+		return;
+	}
+	mosquitto__free(filename);
+
+	fclose(journal_fptr);
+	journal_fptr = mosquitto__fopen(journal_path, "ab", true);
+	if(journal_fptr == NULL){
+		persist__journal_error();
+		return;
+	}
+	fseek(journal_fptr, 0, SEEK_END);
+	journal_bytes = ftell(journal_fptr);
+	return;
+
+error:
+	/* The existing journal is still valid, it is just larger than it needs
+	 * to be. */
+	log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to compact persistence journal: %s.", strerror(errno));
+	if(in_fptr) fclose(in_fptr);
+	if(out_fptr){
+		fclose(out_fptr);
+		remove(filename);
+	}
+	mosquitto__free(filename);
+}
+
+
+/* ========================================================================
+ * Records
+ * ======================================================================== */
+
+static bool persist__journal_wanted(struct mosquitto *context)
+{
+	return journal_fptr != NULL && context->id != NULL && context->clean_start == false;
+}
+
+
+static int persist__journal_store(struct mosquitto_msg_store *stored)
+{
+	if(stored->journalled) return MOSQ_ERR_SUCCESS;
+
+	if(persist__message_store_write(journal_fptr, stored)){
+		return 1;
+	}
+	stored->journalled = true;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void persist__journal_client(struct mosquitto *context)
+{
+	if(!persist__journal_wanted(context)) return;
+
+	if(persist__client_write(journal_fptr, context, DB_CHUNK_CLIENT)){
+		persist__journal_error();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+void persist__journal_client_delete(struct mosquitto *context)
+{
+	if(journal_fptr == NULL || context->id == NULL) return;
+
+	if(persist__client_write(journal_fptr, context, DB_CHUNK_CLIENT_DELETE)){
+		persist__journal_error();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+void persist__journal_msg_add(struct mosquitto *context, struct mosquitto_client_msg *msg)
+{
+	if(!persist__journal_wanted(context)) return;
+	if(msg->store->topic == NULL) return;
+	/* QoS 0 messages for connected clients are sent straight away. */
+	if(msg->qos == 0 && context->sock != INVALID_SOCKET) return;
+
+	if(persist__journal_store(msg->store)
+			|| persist__client_msg_write(journal_fptr, context, msg, DB_CHUNK_CLIENT_MSG)){
+
+		persist__journal_error();
+		return;
+	}
+	msg->journalled = true;
+	journal_dirty = true;
+}
+
+
+void persist__journal_msg_update(struct mosquitto *context, struct mosquitto_client_msg *msg)
+{
+	if(msg->journalled == false || !persist__journal_wanted(context)) return;
+
+	if(persist__client_msg_write(journal_fptr, context, msg, DB_CHUNK_CLIENT_MSG_UPDATE)){
+		persist__journal_error();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+void persist__journal_msg_delete(struct mosquitto *context, struct mosquitto_client_msg *msg)
+{
+	if(msg->journalled == false || !persist__journal_wanted(context)) return;
+
+	if(persist__client_msg_write(journal_fptr, context, msg, DB_CHUNK_CLIENT_MSG_DELETE)){
+		persist__journal_error();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+static void persist__journal_sub_write(struct mosquitto *context, const char *topic, uint8_t qos, uint32_t identifier, int options, uint32_t type)
+{
+	struct P_sub chunk;
+
+	if(!persist__journal_wanted(context)) return;
+
+	memset(&chunk, 0, sizeof(struct P_sub));
+	chunk.F.identifier = identifier;
+	chunk.F.id_len = (uint16_t)strlen(context->id);
+	chunk.F.topic_len = (uint16_t)strlen(topic);
+	chunk.F.qos = qos;
+	chunk.F.options = (uint8_t)options;
+	chunk.client_id = context->id;
+	chunk.topic = (char *)topic;
+
+	if(persist__chunk_sub_write_v6(journal_fptr, &chunk, type)){
+		persist__journal_error();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+void persist__journal_sub(struct mosquitto *context, const char *topic, uint8_t qos, uint32_t identifier, int options)
+{
+	persist__journal_sub_write(context, topic, qos, identifier, options, DB_CHUNK_SUB);
+}
+
+
+void persist__journal_unsub(struct mosquitto *context, const char *topic)
+{
+	persist__journal_sub_write(context, topic, 0, 0, 0, DB_CHUNK_SUB_DELETE);
+}
+
+
+void persist__journal_retain(const char *topic, struct mosquitto_msg_store *stored)
+{
+	struct P_retain retain_chunk;
+	struct P_retain_delete delete_chunk;
+	int rc;
+
+	if(journal_fptr == NULL || !strncmp(topic, "$SYS", 4)) return;
+
+	if(stored->payloadlen){
+		memset(&retain_chunk, 0, sizeof(struct P_retain));
+		retain_chunk.F.store_id = stored->db_id;
+		rc = persist__journal_store(stored);
+		if(rc == MOSQ_ERR_SUCCESS){
+			rc = persist__chunk_retain_write_v6(journal_fptr, &retain_chunk);
+		}
+	}else{
+		memset(&delete_chunk, 0, sizeof(struct P_retain_delete));
+		delete_chunk.F.topic_len = (uint16_t)strlen(topic);
+		delete_chunk.topic = (char *)topic;
+		rc = persist__chunk_retain_delete_write_v6(journal_fptr, &delete_chunk);
+	}
+	if(rc){
+		persist__journal_error();
+		return;
+	}
+	journal_dirty = true;
+}
+
+#endif
@@ -45,14 +45,147 @@ const unsigned char magic[15] = {0x00, 0xB5, 0x00, 'm','o','s','q','u','i','t','
 
 static int persist__restore_sub(const char *client_id, const char *sub, uint8_t qos, uint32_t identifier, int options);
 
+/* Messages restored so far, so that client messages and retained messages
+ * can find the message they refer to. This is an array sorted by id rather
+ * than a hash table, to save an allocation per message. The database file
+ * lists messages in descending id order and the journal in ascending order,
+ * so the array is built by appending and only sorted when needed. */
+struct persist__store_ref{
+	dbid_t db_id;
+	struct mosquitto_msg_store *store;
+};
+
+static struct persist__store_ref *store_index = NULL;
+static size_t store_index_count = 0;
+static size_t store_index_size = 0;
+static bool store_index_sorted = true;
+static dbid_t store_index_min = 0;
+static dbid_t store_index_max = 0;
+
+/* Client chunks are followed by that client's messages, so most lookups are
+ * for the same client as the last one. */
+static struct mosquitto *last_context = NULL;
+
+
+static int persist__store_index_add(struct mosquitto_msg_store *stored)
+{
+	struct persist__store_ref *new_index;
+	size_t new_size;
+
+	if(store_index_count == store_index_size){
+		new_size = store_index_size?store_index_size*2:1024;
+		new_index = mosquitto__realloc(store_index, new_size*sizeof(struct persist__store_ref));
+		if(!new_index){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+			return MOSQ_ERR_NOMEM;
+		}
+		store_index = new_index;
+		store_index_size = new_size;
+	}
+	if(store_index_count == 0){
+		store_index_min = stored->db_id;
+		store_index_max = stored->db_id;
+	}else{
+		if(stored->db_id < store_index[store_index_count-1].db_id){
+			store_index_sorted = false;
+		}
+		if(stored->db_id < store_index_min) store_index_min = stored->db_id;
+		if(stored->db_id > store_index_max) store_index_max = stored->db_id;
+	}
+	store_index[store_index_count].db_id = stored->db_id;
+	store_index[store_index_count].store = stored;
+	store_index_count++;
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int persist__store_ref_cmp(const void *a, const void *b)
+{
+	const struct persist__store_ref *ra = a, *rb = b;
+
+	if(ra->db_id < rb->db_id){
+		return -1;
+	}else if(ra->db_id > rb->db_id){
+		return 1;
+	}else{
+		return 0;
+	}
+}
+
+
+static struct mosquitto_msg_store *persist__store_index_find(dbid_t db_id)
+{
+	size_t lo, hi, pos;
+	dbid_t lo_id, hi_id;
+	bool bisect = false;
+
+	/* Checking the range first means that looking for duplicates while
+	 * appending doesn't force a sort. */
+	if(store_index_count == 0 || db_id < store_index_min || db_id > store_index_max){
+		return NULL;
+	}
+
+	if(!store_index_sorted){
+		qsort(store_index, store_index_count, sizeof(struct persist__store_ref), persist__store_ref_cmp);
+		store_index_sorted = true;
+	}
+
+	/* Ids are normally close to evenly spread, so guessing the position from
+	 * the id finds most messages straight away. Guesses alternate with
+	 * halving the range so an uneven spread can't make this slower than a
+	 * binary search. */
+	lo = 0;
+	hi = store_index_count-1;
+	while(lo <= hi){
+		lo_id = store_index[lo].db_id;
+		hi_id = store_index[hi].db_id;
+		if(db_id < lo_id || db_id > hi_id){
+			return NULL;
+		}
+		if(bisect || hi_id == lo_id){
+			pos = lo + (hi-lo)/2;
+		}else{
+			pos = lo + (size_t)((double)(db_id - lo_id) / (double)(hi_id - lo_id) * (double)(hi-lo));
+			if(pos > hi) pos = hi;
+		}
+		bisect = !bisect;
+
+		if(store_index[pos].db_id == db_id){
+			return store_index[pos].store;
+		}else if(store_index[pos].db_id < db_id){
+			lo = pos+1;
+		}else{
+			if(pos == 0) return NULL;
+			hi = pos-1;
+		}
+	}
+	return NULL;
+}
+
+
+static void persist__store_index_free(void)
+{
+	mosquitto__free(store_index);
+	store_index = NULL;
+	store_index_count = 0;
+	store_index_size = 0;
+	store_index_sorted = true;
+}
+
+
 static struct mosquitto *persist__find_or_add_context(const char *client_id, uint16_t last_mid)
 {
 	struct mosquitto *context;
 
 	if(!client_id) return NULL;
 
-	context = NULL;
-	HASH_FIND(hh_id, db.contexts_by_id, client_id, strlen(client_id), context);
+	if(last_context && !strcmp(last_context->id, client_id)){
+		context = last_context;
+	}else{
+		context = NULL;
+		HASH_FIND(hh_id, db.contexts_by_id, client_id, strlen(client_id), context);
+	}
 	if(!context){
 		context = context__init(INVALID_SOCKET);
 		if(!context) return NULL;
@@ -69,6 +202,7 @@ static struct mosquitto *persist__find_or_add_context(const char *client_id, uin
 	if(last_mid){
 		context->last_mid = last_mid;
 	}
+	last_context = context;
 	return context;
 }
 
@@ -112,12 +246,12 @@ int persist__read_string(FILE *db_fptr, char **str)
 static int persist__client_msg_restore(struct P_client_msg *chunk)
 {
 	struct mosquitto_client_msg *cmsg;
-	struct mosquitto_msg_store_load *load;
+	struct mosquitto_msg_store *stored;
 	struct mosquitto *context;
 	struct mosquitto_msg_data *msg_data;
 
-	HASH_FIND(hh, db.msg_store_load, &chunk->F.store_id, sizeof(dbid_t), load);
-	if(!load){
+	stored = persist__store_index_find(chunk->F.store_id);
+	if(!stored){
 		/* Can't find message - probably expired */
 		return MOSQ_ERR_SUCCESS;
 	}
@@ -128,7 +262,7 @@ static int persist__client_msg_restore(struct P_client_msg *chunk)
 		return 0;
 	}
 
-	cmsg = mosquitto__calloc(1, sizeof(struct mosquitto_client_msg));
+	cmsg = mosquitto__pool_calloc(mosq_pool_client_msg, sizeof(struct mosquitto_client_msg));
 	if(!cmsg){
 		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
 		return MOSQ_ERR_NOMEM;
@@ -144,8 +278,10 @@ static int persist__client_msg_restore(struct P_client_msg *chunk)
 	cmsg->state = chunk->F.state;
 	cmsg->dup = chunk->F.retain_dup&0x0F;
 	cmsg->properties = chunk->properties;
+	/* Changes to the message must be recorded in the journal */
+	cmsg->journalled = true;
 
-	cmsg->store = load->store;
+	cmsg->store = stored;
 	db__msg_store_ref_inc(cmsg->store);
 
 	if(cmsg->direction == mosq_md_out){
@@ -155,9 +291,9 @@ static int persist__client_msg_restore(struct P_client_msg *chunk)
 	}
 
 	if(chunk->F.state == mosq_ms_queued || (chunk->F.qos > 0 && msg_data->inflight_quota == 0)){
-		DL_APPEND(msg_data->queued, cmsg);
+		db__message_add_to_queued(msg_data, cmsg);
 	}else{
-		DL_APPEND(msg_data->inflight, cmsg);
+		db__message_add_to_inflight(msg_data, cmsg);
 		if(chunk->F.qos > 0 && msg_data->inflight_quota > 0){
 			msg_data->inflight_quota--;
 		}
@@ -252,7 +388,6 @@ static int persist__msg_store_chunk_restore(FILE *db_fptr, uint32_t length)
 {
 	struct P_msg_store chunk;
 	struct mosquitto_msg_store *stored = NULL;
-	struct mosquitto_msg_store_load *load;
 	int64_t message_expiry_interval64;
 	uint32_t message_expiry_interval;
 	int rc = 0;
@@ -269,6 +404,16 @@ static int persist__msg_store_chunk_restore(FILE *db_fptr, uint32_t length)
 		return rc;
 	}
 
+	if(persist__store_index_find(chunk.F.store_id)){
+		/* Already restored from the database file or earlier in the journal */
+		mosquitto__free(chunk.source.id);
+		mosquitto__free(chunk.source.username);
+		mosquitto__free(chunk.topic);
+		mosquitto__free(chunk.payload);
+		mosquitto_property_free_all(&chunk.properties);
+		return MOSQ_ERR_SUCCESS;
+	}
+
 	if(chunk.F.source_port){
 		for(i=0; i<db.config->listener_count; i++){
 			if(db.config->listeners[i].port == chunk.F.source_port){
@@ -277,16 +422,6 @@ static int persist__msg_store_chunk_restore(FILE *db_fptr, uint32_t length)
 			}
 		}
 	}
-	load = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store_load));
-	if(!load){
-		mosquitto__free(chunk.source.id);
-		mosquitto__free(chunk.source.username);
-		mosquitto__free(chunk.topic);
-		mosquitto__free(chunk.payload);
-		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
-		return MOSQ_ERR_NOMEM;
-	}
-
 	if(chunk.F.expiry_time > 0){
 		message_expiry_interval64 = chunk.F.expiry_time - time(NULL);
 		if(message_expiry_interval64 < 0 || message_expiry_interval64 > UINT32_MAX){
@@ -295,7 +430,6 @@ static int persist__msg_store_chunk_restore(FILE *db_fptr, uint32_t length)
 			mosquitto__free(chunk.source.username);
 			mosquitto__free(chunk.topic);
 			mosquitto__free(chunk.payload);
-			mosquitto__free(load);
 			return MOSQ_ERR_SUCCESS;
 		}else{
 			message_expiry_interval = (uint32_t)message_expiry_interval64;
@@ -304,9 +438,8 @@ static int persist__msg_store_chunk_restore(FILE *db_fptr, uint32_t length)
 		message_expiry_interval = 0;
 	}
 
-	stored = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	stored = mosquitto__pool_calloc(mosq_pool_msg_store, sizeof(struct mosquitto_msg_store));
 	if(stored == NULL){
-		mosquitto__free(load);
 		mosquitto__free(chunk.source.id);
 		mosquitto__free(chunk.source.username);
 		mosquitto__free(chunk.topic);
@@ -333,20 +466,15 @@ static int persist__msg_store_chunk_restore(FILE *db_fptr, uint32_t length)
 
 	if(rc == MOSQ_ERR_SUCCESS){
 		stored->source_listener = chunk.source.listener;
-		load->db_id = stored->db_id;
-		load->store = stored;
-
-		HASH_ADD(hh, db.msg_store_load, db_id, sizeof(dbid_t), load);
-		return MOSQ_ERR_SUCCESS;
+		return persist__store_index_add(stored);
 	}else{
-		mosquitto__free(load);
 		return rc;
 	}
 }
 
 static int persist__retain_chunk_restore(FILE *db_fptr)
 {
-	struct mosquitto_msg_store_load *load;
+	struct mosquitto_msg_store *stored;
 	struct P_retain chunk;
 	int rc;
 	char **split_topics;
@@ -363,10 +491,10 @@ static int persist__retain_chunk_restore(FILE *db_fptr)
 		return rc;
 	}
 
-	HASH_FIND(hh, db.msg_store_load, &chunk.F.store_id, sizeof(dbid_t), load);
-	if(load){
-		if(sub__topic_tokenise(load->store->topic, &local_topic, &split_topics, NULL)) return 1;
-		retain__store(load->store->topic, load->store, split_topics);
+	stored = persist__store_index_find(chunk.F.store_id);
+	if(stored){
+		if(sub__topic_tokenise(stored->topic, &local_topic, &split_topics, NULL)) return 1;
+		retain__store(stored->topic, stored, split_topics);
 		mosquitto__free(local_topic);
 		mosquitto__free(split_topics);
 	}else{
@@ -410,32 +538,385 @@ int persist__chunk_header_read(FILE *db_fptr, uint32_t *chunk, uint32_t *length)
 }
 
 
-int persist__restore(void)
+/* ========================================================================
+ * Journal replay
+ * ======================================================================== */
+
+static struct mosquitto_client_msg *persist__client_msg_find(struct mosquitto_msg_data *msg_data, struct P_client_msg *chunk, bool *inflight)
+{
+	struct mosquitto_client_msg *cmsg;
+	uint16_t mid = chunk->F.mid;
+
+	if(mid){
+		HASH_FIND(hh_mid, msg_data->inflight_by_mid, &mid, sizeof(mid), cmsg);
+		if(cmsg && cmsg->store->db_id == chunk->F.store_id){
+			*inflight = true;
+			return cmsg;
+		}
+		HASH_FIND(hh_mid, msg_data->queued_by_mid, &mid, sizeof(mid), cmsg);
+		if(cmsg && cmsg->store->db_id == chunk->F.store_id){
+			*inflight = false;
+			return cmsg;
+		}
+	}else{
+		DL_FOREACH(msg_data->inflight, cmsg){
+			if(cmsg->mid == 0 && cmsg->store->db_id == chunk->F.store_id){
+				*inflight = true;
+				return cmsg;
+			}
+		}
+		DL_FOREACH(msg_data->queued, cmsg){
+			if(cmsg->mid == 0 && cmsg->store->db_id == chunk->F.store_id){
+				*inflight = false;
+				return cmsg;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+static void persist__client_msg_remove(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *cmsg, bool inflight)
+{
+	if(inflight){
+		db__message_remove_from_inflight(msg_data, cmsg);
+		if(cmsg->qos > 0 && msg_data->inflight_quota < msg_data->inflight_maximum){
+			msg_data->inflight_quota++;
+		}
+	}else{
+		db__message_remove_from_queued(msg_data, cmsg);
+	}
+	msg_data->msg_count--;
+	msg_data->msg_bytes -= cmsg->store->payloadlen;
+	if(cmsg->qos > 0){
+		msg_data->msg_count12--;
+		msg_data->msg_bytes12 -= cmsg->store->payloadlen;
+	}
+
+	/* The message store isn't freed here, because later records may still
+	 * refer to it. Unused messages are removed once replay is complete. */
+	cmsg->store->ref_count--;
+	mosquitto_property_free_all(&cmsg->properties);
+	mosquitto__pool_free(mosq_pool_client_msg, cmsg);
+}
+
+
+static int persist__journal_client_msg_restore(FILE *db_fptr, uint32_t type, uint32_t length)
+{
+	struct P_client_msg chunk;
+	struct mosquitto *context;
+	struct mosquitto_msg_data *msg_data;
+	struct mosquitto_client_msg *cmsg;
+	bool inflight;
+	int rc;
+
+	memset(&chunk, 0, sizeof(struct P_client_msg));
+
+	rc = persist__chunk_client_msg_read_v56(db_fptr, &chunk, length);
+	if(rc){
+		return rc;
+	}
+
+	if(type == DB_CHUNK_CLIENT_MSG){
+		rc = persist__client_msg_restore(&chunk);
+		if(rc == MOSQ_ERR_SUCCESS && chunk.F.direction == mosq_md_out && chunk.F.mid){
+			/* The client record only holds the last mid from when the
+			 * client connected. */
+			HASH_FIND(hh_id, db.contexts_by_id, chunk.client_id, strlen(chunk.client_id), context);
+			if(context){
+				context->last_mid = chunk.F.mid;
+			}
+		}
+		mosquitto__free(chunk.client_id);
+		return rc;
+	}
+
+	HASH_FIND(hh_id, db.contexts_by_id, chunk.client_id, strlen(chunk.client_id), context);
+	if(context){
+		if(chunk.F.direction == mosq_md_out){
+			msg_data = &context->msgs_out;
+		}else{
+			msg_data = &context->msgs_in;
+		}
+		cmsg = persist__client_msg_find(msg_data, &chunk, &inflight);
+		if(cmsg && type == DB_CHUNK_CLIENT_MSG_DELETE){
+			persist__client_msg_remove(msg_data, cmsg, inflight);
+		}else if(cmsg){
+			cmsg->state = chunk.F.state;
+			cmsg->dup = chunk.F.retain_dup&0x0F;
+			if(!inflight){
+				db__message_remove_from_queued(msg_data, cmsg);
+				db__message_add_to_inflight(msg_data, cmsg);
+				if(cmsg->qos > 0 && msg_data->inflight_quota > 0){
+					msg_data->inflight_quota--;
+				}
+			}
+		}
+	}
+	mosquitto__free(chunk.client_id);
+	mosquitto_property_free_all(&chunk.properties);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int persist__journal_client_delete_restore(FILE *db_fptr)
+{
+	struct P_client chunk;
+	struct mosquitto *context;
+	int rc;
+
+	memset(&chunk, 0, sizeof(struct P_client));
+
+	rc = persist__chunk_client_read_v56(db_fptr, &chunk, MOSQ_DB_VERSION);
+	if(rc > 0){
+		return rc;
+	}else if(rc < 0){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	HASH_FIND(hh_id, db.contexts_by_id, chunk.client_id, strlen(chunk.client_id), context);
+	if(context){
+		if(context == last_context){
+			last_context = NULL;
+		}
+		context__cleanup(context, true);
+	}
+	mosquitto__free(chunk.client_id);
+	mosquitto__free(chunk.username);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int persist__journal_sub_delete_restore(FILE *db_fptr)
+{
+	struct P_sub chunk;
+	struct mosquitto *context;
+	uint8_t reason;
+	int rc;
+
+	memset(&chunk, 0, sizeof(struct P_sub));
+
+	rc = persist__chunk_sub_read_v56(db_fptr, &chunk);
+	if(rc){
+		return rc;
+	}
+
+	if(chunk.client_id && chunk.topic){
+		HASH_FIND(hh_id, db.contexts_by_id, chunk.client_id, strlen(chunk.client_id), context);
+		if(context){
+			sub__remove(context, chunk.topic, db.subs, &reason);
+		}
+	}
+	mosquitto__free(chunk.client_id);
+	mosquitto__free(chunk.topic);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int persist__journal_retain_delete_restore(FILE *db_fptr)
+{
+	struct P_retain_delete chunk;
+	struct mosquitto_msg_store empty;
+	char **split_topics;
+	char *local_topic;
+	int rc;
+
+	memset(&chunk, 0, sizeof(struct P_retain_delete));
+
+	rc = persist__chunk_retain_delete_read_v56(db_fptr, &chunk);
+	if(rc){
+		return rc;
+	}
+	if(chunk.topic == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	rc = sub__topic_tokenise(chunk.topic, &local_topic, &split_topics, NULL);
+	if(rc == MOSQ_ERR_SUCCESS){
+		/* A message with no payload clears the retained message */
+		memset(&empty, 0, sizeof(struct mosquitto_msg_store));
+		retain__store(chunk.topic, &empty, split_topics);
+		mosquitto__free(local_topic);
+		mosquitto__free(split_topics);
+	}
+	mosquitto__free(chunk.topic);
+
+	return rc;
+}
+
+
+/* Returns -1 if the chunk isn't a journal record. */
+static int persist__journal_chunk_restore(FILE *db_fptr, uint32_t chunk, uint32_t length)
+{
+	switch(chunk){
+		case DB_CHUNK_MSG_STORE:
+			return persist__msg_store_chunk_restore(db_fptr, length);
+
+		case DB_CHUNK_CLIENT_MSG:
+		case DB_CHUNK_CLIENT_MSG_UPDATE:
+		case DB_CHUNK_CLIENT_MSG_DELETE:
+			return persist__journal_client_msg_restore(db_fptr, chunk, length);
+
+		case DB_CHUNK_RETAIN:
+			return persist__retain_chunk_restore(db_fptr);
+
+		case DB_CHUNK_RETAIN_DELETE:
+			return persist__journal_retain_delete_restore(db_fptr);
+
+		case DB_CHUNK_SUB:
+			return persist__sub_chunk_restore(db_fptr);
+
+		case DB_CHUNK_SUB_DELETE:
+			return persist__journal_sub_delete_restore(db_fptr);
+
+		case DB_CHUNK_CLIENT:
+			return persist__client_chunk_restore(db_fptr);
+
+		case DB_CHUNK_CLIENT_DELETE:
+			return persist__journal_client_delete_restore(db_fptr);
+
+		default:
+			return -1;
+	}
+}
+
+
+/* Replay the journal on top of what was restored from the database file, then
+ * open it for new records. Only generations at least as new as the one the
+ * database file was started in are replayed. If the broker stopped part way
+ * through writing a record, the journal is truncated to the last complete
+ * record. */
+int persist__journal_restore(bool snapshot_found, bool snapshot_journalled, uint64_t snapshot_generation)
 {
 	FILE *fptr;
+	char *filename;
 	char header[15];
+	uint32_t i32temp;
+	uint32_t chunk, length;
+	long file_size, pos;
+	long valid_length = 0;
+	struct PF_journal journal_chunk;
+	uint64_t generation = 0;
+	bool replay = false;
+	unsigned long records = 0;
+	struct mosquitto_msg_store *stored;
 	int rc = 0;
+
+	if(snapshot_found && !snapshot_journalled){
+		/* The database file was saved without the journal, so anything in
+		 * the journal is older than it. Start again, and save straight away
+		 * so the database file refers to the new journal. */
+		return persist__journal_open(1, 0, true);
+	}
+
+	filename = persist__journal_filename("");
+	if(!filename) return MOSQ_ERR_NOMEM;
+
+	fptr = mosquitto__fopen(filename, "rb", false);
+	if(fptr){
+		fseek(fptr, 0, SEEK_END);
+		file_size = ftell(fptr);
+		fseek(fptr, 0, SEEK_SET);
+
+		if(fread(&header, 1, 15, fptr) != 15 || memcmp(header, magic, 15)
+				|| fseek(fptr, sizeof(uint32_t), SEEK_CUR)
+				|| fread(&i32temp, 1, sizeof(uint32_t), fptr) != sizeof(uint32_t)
+				|| ntohl(i32temp) != MOSQ_DB_VERSION){
+
+			if(file_size > 0){
+				log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Persistence journal %s not recognised, ignoring.", filename);
+			}
+		}else{
+			db_version = MOSQ_DB_VERSION;
+			valid_length = ftell(fptr);
+			while(1){
+				pos = ftell(fptr);
+				if(persist__chunk_header_read(fptr, &chunk, &length)
+						|| pos + (long)sizeof(struct PF_header) + (long)length > file_size){
+
+					/* End of the journal, or an incomplete record */
+					break;
+				}
+
+				if(chunk == DB_CHUNK_JOURNAL){
+					if(length != sizeof(struct PF_journal)
+							|| persist__chunk_journal_read_v56(fptr, &journal_chunk)
+							|| journal_chunk.generation <= generation){
+
+						break;
+					}
+					generation = journal_chunk.generation;
+					replay = (!snapshot_found || generation >= snapshot_generation);
+				}else if(generation == 0){
+					/* Records must follow a generation marker */
+					break;
+				}else if(replay){
+					rc = persist__journal_chunk_restore(fptr, chunk, length);
+					if(rc < 0){
+						rc = 0;
+						break;
+					}else if(rc > 0){
+						break;
+					}
+					records++;
+				}
+				valid_length = pos + (long)sizeof(struct PF_header) + (long)length;
+				if(fseek(fptr, valid_length, SEEK_SET)){
+					break;
+				}
+			}
+			if(rc == 0 && valid_length < file_size){
+				log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Persistence journal %s is incomplete, discarding the last %ld bytes.",
+						filename, file_size - valid_length);
+			}
+		}
+		fclose(fptr);
+	}
+	mosquitto__free(filename);
+	if(rc){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to restore persistence journal.");
+		return rc;
+	}
+
+	if(records > 0){
+		log__printf(NULL, MOSQ_LOG_INFO, "Restored %lu records from persistence journal.", records);
+
+		/* Messages that were removed in the journal are no longer needed */
+		db__msg_store_compact();
+		for(stored = db.msg_store; stored; stored = stored->next){
+			if(stored->db_id > db.last_db_id){
+				db.last_db_id = stored->db_id;
+			}
+		}
+	}
+
+	if(replay){
+		return persist__journal_open(generation, valid_length, false);
+	}else if(snapshot_generation > 0){
+		/* Nothing in the journal is newer than the database file */
+		return persist__journal_open(snapshot_generation, 0, false);
+	}else{
+		return persist__journal_open(1, 0, false);
+	}
+}
+
+
+static int persist__restore_file(FILE *fptr, bool *found, bool *journalled, uint64_t *generation)
+{
+	char header[15];
 	uint32_t crc;
 	uint32_t i32temp;
 	uint32_t chunk, length;
 	size_t rlen;
 	char *err;
-	struct mosquitto_msg_store_load *load, *load_tmp;
 	struct PF_cfg cfg_chunk;
+	struct PF_journal journal_chunk;
 
-	assert(db.config);
-
-	if(!db.config->persistence || db.config->persistence_filepath == NULL){
-		return MOSQ_ERR_SUCCESS;
-	}
-
-	db.msg_store_load = NULL;
-
-	fptr = mosquitto__fopen(db.config->persistence_filepath, "rb", false);
-	if(fptr == NULL) return MOSQ_ERR_SUCCESS;
 	rlen = fread(&header, 1, 15, fptr);
 	if(rlen == 0){
-		fclose(fptr);
 		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Persistence file is empty.");
 		return 0;
 	}else if(rlen != 15){
@@ -458,30 +939,27 @@ int persist__restore(void)
 			}else if(db_version == 2){
 				/* Addition of disconnect_t to client chunk in v3. */
 			}else{
-				fclose(fptr);
 				log__printf(NULL, MOSQ_LOG_ERR, "Error: Unsupported persistent database format version %d (need version %d).", db_version, MOSQ_DB_VERSION);
 				return 1;
 			}
 		}
+		*found = true;
 
 		while(persist__chunk_header_read(fptr, &chunk, &length) == MOSQ_ERR_SUCCESS){
 			switch(chunk){
 				case DB_CHUNK_CFG:
 					if(db_version == 6 || db_version == 5){
 						if(persist__chunk_cfg_read_v56(fptr, &cfg_chunk)){
-							fclose(fptr);
 							return 1;
 						}
 					}else{
 						if(persist__chunk_cfg_read_v234(fptr, &cfg_chunk)){
-							fclose(fptr);
 							return 1;
 						}
 					}
 					if(cfg_chunk.dbid_size != sizeof(dbid_t)){
 						log__printf(NULL, MOSQ_LOG_ERR, "Error: Incompatible database configuration (dbid size is %d bytes, expected %lu)",
 								cfg_chunk.dbid_size, (unsigned long)sizeof(dbid_t));
-						fclose(fptr);
 						return 1;
 					}
 					db.last_db_id = cfg_chunk.last_db_id;
@@ -489,39 +967,42 @@ int persist__restore(void)
 
 				case DB_CHUNK_MSG_STORE:
 					if(persist__msg_store_chunk_restore(fptr, length)){
-						fclose(fptr);
 						return 1;
 					}
 					break;
 
 				case DB_CHUNK_CLIENT_MSG:
 					if(persist__client_msg_chunk_restore(fptr, length)){
-						fclose(fptr);
 						return 1;
 					}
 					break;
 
 				case DB_CHUNK_RETAIN:
 					if(persist__retain_chunk_restore(fptr)){
-						fclose(fptr);
 						return 1;
 					}
 					break;
 
 				case DB_CHUNK_SUB:
 					if(persist__sub_chunk_restore(fptr)){
-						fclose(fptr);
 						return 1;
 					}
 					break;
 
 				case DB_CHUNK_CLIENT:
 					if(persist__client_chunk_restore(fptr)){
-						fclose(fptr);
 						return 1;
 					}
 					break;
 
+				case DB_CHUNK_JOURNAL:
+					if(persist__chunk_journal_read_v56(fptr, &journal_chunk)){
+						return 1;
+					}
+					*journalled = true;
+					*generation = journal_chunk.generation;
+					break;
+
 				default:
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unsupported chunk \"%d\" in persistent database file. Ignoring.", chunk);
 					fseek(fptr, length, SEEK_CUR);
@@ -530,23 +1011,48 @@ int persist__restore(void)
 		}
 	}else{
 		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to restore persistent database. Unrecognised file format.");
-		rc = 1;
+		return 1;
 	}
 
-	fclose(fptr);
-
-	HASH_ITER(hh, db.msg_store_load, load, load_tmp){
-		HASH_DELETE(hh, db.msg_store_load, load);
-		mosquitto__free(load);
-	}
-	return rc;
+	return MOSQ_ERR_SUCCESS;
 error:
 	err = strerror(errno);
 	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", err);
-	if(fptr) fclose(fptr);
 	return 1;
 }
 
+
+int persist__restore(void)
+{
+	FILE *fptr;
+	int rc = 0;
+	bool found = false;
+	bool journalled = false;
+	uint64_t generation = 0;
+
+	assert(db.config);
+
+	if(!db.config->persistence || db.config->persistence_filepath == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	last_context = NULL;
+
+	fptr = mosquitto__fopen(db.config->persistence_filepath, "rb", false);
+	if(fptr){
+		rc = persist__restore_file(fptr, &found, &journalled, &generation);
+		fclose(fptr);
+	}
+
+	if(rc == MOSQ_ERR_SUCCESS && db.config->persistence_journal){
+		rc = persist__journal_restore(found, journalled, generation);
+	}
+
+	persist__store_index_free();
+	last_context = NULL;
+	return rc;
+}
+
 static int persist__restore_sub(const char *client_id, const char *sub, uint8_t qos, uint32_t identifier, int options)
 {
 	struct mosquitto *context;
@@ -276,4 +276,26 @@ error:
 	return 1;
 }
 
+
+int persist__chunk_journal_read_v56(FILE *db_fptr, struct PF_journal *chunk)
+{
+	if(fread(chunk, sizeof(struct PF_journal), 1, db_fptr) != 1){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+		return 1;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int persist__chunk_retain_delete_read_v56(FILE *db_fptr, struct P_retain_delete *chunk)
+{
+	read_e(db_fptr, &chunk->F, sizeof(struct PF_retain_delete));
+	chunk->F.topic_len = ntohs(chunk->F.topic_len);
+
+	return persist__read_string_len(db_fptr, &chunk->topic, chunk->F.topic_len);
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
+
 #endif
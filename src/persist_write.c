@@ -30,6 +30,11 @@ Contributors:
 #include <string.h>
 #include <sys/stat.h>
 #include <time.h>
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #include "mosquitto_broker_internal.h"
 #include "memory_mosq.h"
@@ -38,22 +43,41 @@ Contributors:
 #include "misc_mosq.h"
 #include "util_mosq.h"
 
-static int persist__client_messages_save(FILE *db_fptr, struct mosquitto *context, struct mosquitto_client_msg *queue)
+int persist__client_msg_write(FILE *db_fptr, struct mosquitto *context, struct mosquitto_client_msg *cmsg, uint32_t type)
 {
 	struct P_client_msg chunk;
+
+	memset(&chunk, 0, sizeof(struct P_client_msg));
+
+	chunk.F.store_id = cmsg->store->db_id;
+	chunk.F.mid = cmsg->mid;
+	chunk.F.id_len = (uint16_t)strlen(context->id);
+	chunk.F.qos = cmsg->qos;
+	chunk.F.retain_dup = (uint8_t)((cmsg->retain&0x0F)<<4 | (cmsg->dup&0x0F));
+	chunk.F.direction = (uint8_t)cmsg->direction;
+	chunk.F.state = (uint8_t)cmsg->state;
+	chunk.client_id = context->id;
+	if(type == DB_CHUNK_CLIENT_MSG){
+		chunk.properties = cmsg->properties;
+	}
+
+	return persist__chunk_client_msg_write_v6(db_fptr, &chunk, type);
+}
+
+
+static int persist__client_messages_save(FILE *db_fptr, struct mosquitto *context, struct mosquitto_client_msg *queue)
+{
 	struct mosquitto_client_msg *cmsg;
 	int rc;
 
 	assert(db_fptr);
 	assert(context);
 
-	memset(&chunk, 0, sizeof(struct P_client_msg));
-
 	cmsg = queue;
 	while(cmsg){
 		if(!strncmp(cmsg->store->topic, "$SYS", 4)
 				&& cmsg->store->ref_count <= 1
-				&& cmsg->store->dest_id_count == 0){
+				&& cmsg->store->delivered == false){
 
 			/* This $SYS message won't have been persisted, so we can't persist
 			 * this client message. */
@@ -61,17 +85,7 @@ static int persist__client_messages_save(FILE *db_fptr, struct mosquitto *contex
 			continue;
 		}
 
-		chunk.F.store_id = cmsg->store->db_id;
-		chunk.F.mid = cmsg->mid;
-		chunk.F.id_len = (uint16_t)strlen(context->id);
-		chunk.F.qos = cmsg->qos;
-		chunk.F.retain_dup = (uint8_t)((cmsg->retain&0x0F)<<4 | (cmsg->dup&0x0F));
-		chunk.F.direction = (uint8_t)cmsg->direction;
-		chunk.F.state = (uint8_t)cmsg->state;
-		chunk.client_id = context->id;
-		chunk.properties = cmsg->properties;
-
-		rc = persist__chunk_client_msg_write_v6(db_fptr, &chunk);
+		rc = persist__client_msg_write(db_fptr, context, cmsg, DB_CHUNK_CLIENT_MSG);
 		if(rc){
 			return rc;
 		}
@@ -83,16 +97,64 @@ static int persist__client_messages_save(FILE *db_fptr, struct mosquitto *contex
 }
 
 
-static int persist__message_store_save(FILE *db_fptr)
+int persist__message_store_write(FILE *db_fptr, struct mosquitto_msg_store *stored)
 {
 	struct P_msg_store chunk;
+
+	memset(&chunk, 0, sizeof(struct P_msg_store));
+
+	if(!strncmp(stored->topic, "$SYS", 4)){
+		/* Don't save $SYS messages as retained otherwise they can give
+		 * misleading information when reloaded. They should still be saved
+		 * because a disconnected durable client may have them in their
+		 * queue. */
+		chunk.F.retain = 0;
+	}else{
+		chunk.F.retain = (uint8_t)stored->retain;
+	}
+
+	chunk.F.store_id = stored->db_id;
+	chunk.F.expiry_time = stored->message_expiry_time;
+	chunk.F.payloadlen = stored->payloadlen;
+	chunk.F.source_mid = stored->source_mid;
+	if(stored->source_id){
+		chunk.F.source_id_len = (uint16_t)strlen(stored->source_id);
+		chunk.source.id = stored->source_id;
+	}else{
+		chunk.F.source_id_len = 0;
+		chunk.source.id = NULL;
+	}
+	if(stored->source_username){
+		chunk.F.source_username_len = (uint16_t)strlen(stored->source_username);
+		chunk.source.username = stored->source_username;
+	}else{
+		chunk.F.source_username_len = 0;
+		chunk.source.username = NULL;
+	}
+
+	chunk.F.topic_len = (uint16_t)strlen(stored->topic);
+	chunk.topic = stored->topic;
+
+	if(stored->source_listener){
+		chunk.F.source_port = stored->source_listener->port;
+	}else{
+		chunk.F.source_port = 0;
+	}
+	chunk.F.qos = stored->qos;
+	chunk.payload = retain__payload(stored);
+	chunk.properties = stored->properties;
+
+	return persist__chunk_message_store_write_v6(db_fptr, &chunk);
+}
+
+
+static int persist__message_store_save(FILE *db_fptr)
+{
 	struct mosquitto_msg_store *stored;
 	int rc;
 
 	assert(db_fptr);
 
-	memset(&chunk, 0, sizeof(struct P_msg_store));
-
 	stored = db.msg_store;
 	while(stored){
 		if(stored->ref_count < 1 || stored->topic == NULL){
@@ -100,53 +162,15 @@ static int persist__message_store_save(FILE *db_fptr)
 			continue;
 		}
 
-		if(!strncmp(stored->topic, "$SYS", 4)){
-			if(stored->ref_count <= 1 && stored->dest_id_count == 0){
-				/* $SYS messages that are only retained shouldn't be persisted. */
-				stored = stored->next;
-				continue;
-			}
-			/* Don't save $SYS messages as retained otherwise they can give
-			 * misleading information when reloaded. They should still be saved
-			 * because a disconnected durable client may have them in their
-			 * queue. */
-			chunk.F.retain = 0;
-		}else{
-			chunk.F.retain = (uint8_t)stored->retain;
-		}
-
-		chunk.F.store_id = stored->db_id;
-		chunk.F.expiry_time = stored->message_expiry_time;
-		chunk.F.payloadlen = stored->payloadlen;
-		chunk.F.source_mid = stored->source_mid;
-		if(stored->source_id){
-			chunk.F.source_id_len = (uint16_t)strlen(stored->source_id);
-			chunk.source.id = stored->source_id;
-		}else{
-			chunk.F.source_id_len = 0;
-			chunk.source.id = NULL;
-		}
-		if(stored->source_username){
-			chunk.F.source_username_len = (uint16_t)strlen(stored->source_username);
-			chunk.source.username = stored->source_username;
-		}else{
-			chunk.F.source_username_len = 0;
-			chunk.source.username = NULL;
-		}
-
-		chunk.F.topic_len = (uint16_t)strlen(stored->topic);
-		chunk.topic = stored->topic;
+		if(!strncmp(stored->topic, "$SYS", 4)
+				&& stored->ref_count <= 1 && stored->delivered == false){
 
-		if(stored->source_listener){
-			chunk.F.source_port = stored->source_listener->port;
-		}else{
-			chunk.F.source_port = 0;
+			/* $SYS messages that are only retained shouldn't be persisted. */
+			stored = stored->next;
+			continue;
 		}
-		chunk.F.qos = stored->qos;
-		chunk.payload = stored->payload;
-		chunk.properties = stored->properties;
 
-		rc = persist__chunk_message_store_write_v6(db_fptr, &chunk);
+		rc = persist__message_store_write(db_fptr, stored);
 		if(rc){
 			return rc;
 		}
@@ -156,38 +180,46 @@ static int persist__message_store_save(FILE *db_fptr)
 	return MOSQ_ERR_SUCCESS;
 }
 
+
+int persist__client_write(FILE *db_fptr, struct mosquitto *context, uint32_t type)
+{
+	struct P_client chunk;
+
+	memset(&chunk, 0, sizeof(struct P_client));
+
+	chunk.F.session_expiry_time = context->session_expiry_time;
+	chunk.F.session_expiry_interval = context->session_expiry_interval;
+	chunk.F.last_mid = context->last_mid;
+	chunk.F.id_len = (uint16_t)strlen(context->id);
+	chunk.client_id = context->id;
+	if(context->username){
+		chunk.F.username_len = (uint16_t)strlen(context->username);
+		chunk.username = context->username;
+	}
+	if(context->listener){
+		chunk.F.listener_port = context->listener->port;
+	}
+
+	return persist__chunk_client_write_v6(db_fptr, &chunk, type);
+}
+
+
 static int persist__client_save(FILE *db_fptr)
 {
 	struct mosquitto *context, *ctxt_tmp;
-	struct P_client chunk;
 	int rc;
 
 	assert(db_fptr);
 
-	memset(&chunk, 0, sizeof(struct P_client));
-
 	HASH_ITER(hh_id, db.contexts_by_id, context, ctxt_tmp){
 		if(context && context->clean_start == false){
-			chunk.F.session_expiry_time = context->session_expiry_time;
-			chunk.F.session_expiry_interval = context->session_expiry_interval;
-			chunk.F.last_mid = context->last_mid;
-			chunk.F.id_len = (uint16_t)strlen(context->id);
-			chunk.client_id = context->id;
-			if(context->username){
-				chunk.F.username_len = (uint16_t)strlen(context->username);
-				chunk.username = context->username;
-			}
-			if(context->listener){
-				chunk.F.listener_port = context->listener->port;
-			}
-
-			if(chunk.F.id_len == 0){
+			if(strlen(context->id) == 0){
 				/* This should never happen, but in case we have a client with
 				 * zero length ID, don't persist them. */
 				continue;
 			}
 
-			rc = persist__chunk_client_write_v6(db_fptr, &chunk);
+			rc = persist__client_write(db_fptr, context, DB_CHUNK_CLIENT);
 			if(rc){
 				return rc;
 			}
@@ -205,11 +237,12 @@ static int persist__client_save(FILE *db_fptr)
 
 static int persist__subs_save(FILE *db_fptr, struct mosquitto__subhier *node, const char *topic, int level)
 {
-	struct mosquitto__subhier *subhier, *subhier_tmp;
 	struct mosquitto__subleaf *sub;
 	struct P_sub sub_chunk;
 	char *thistopic;
 	size_t slen;
+	uint32_t j;
+	int i;
 	int rc;
 
 	memset(&sub_chunk, 0, sizeof(struct P_sub));
@@ -223,8 +256,8 @@ static int persist__subs_save(FILE *db_fptr, struct mosquitto__subhier *node, co
 		snprintf(thistopic, slen, "%s", node->topic);
 	}
 
-	sub = node->subs;
-	while(sub){
+	for(i=0; i<node->sub_count; i++){
+		sub = &node->subs[i];
 		if(sub->context->clean_start == false && sub->context->id){
 			sub_chunk.F.identifier = sub->identifier;
 			sub_chunk.F.id_len = (uint16_t)strlen(sub->context->id);
@@ -234,17 +267,18 @@ static int persist__subs_save(FILE *db_fptr, struct mosquitto__subhier *node, co
 			sub_chunk.client_id = sub->context->id;
 			sub_chunk.topic = thistopic;
 
-			rc = persist__chunk_sub_write_v6(db_fptr, &sub_chunk);
+			rc = persist__chunk_sub_write_v6(db_fptr, &sub_chunk, DB_CHUNK_SUB);
 			if(rc){
 				mosquitto__free(thistopic);
 				return rc;
 			}
 		}
-		sub = sub->next;
 	}
 
-	HASH_ITER(hh, node->children, subhier, subhier_tmp){
-		persist__subs_save(db_fptr, subhier, thistopic, level+1);
+	for(j=0; j<node->child_capacity; j++){
+		if(node->children[j]){
+			persist__subs_save(db_fptr, node->children[j], thistopic, level+1);
+		}
 	}
 	mosquitto__free(thistopic);
 	return MOSQ_ERR_SUCCESS;
@@ -252,11 +286,13 @@ static int persist__subs_save(FILE *db_fptr, struct mosquitto__subhier *node, co
 
 static int persist__subs_save_all(FILE *db_fptr)
 {
-	struct mosquitto__subhier *subhier, *subhier_tmp;
+	uint32_t i;
 
-	HASH_ITER(hh, db.subs, subhier, subhier_tmp){
-		if(subhier->children){
-			persist__subs_save(db_fptr, subhier->children, "", 0);
+	if(!db.subs) return MOSQ_ERR_SUCCESS;
+
+	for(i=0; i<db.subs->child_capacity; i++){
+		if(db.subs->children[i]){
+			persist__subs_save(db_fptr, db.subs->children[i], "", 0);
 		}
 	}
 
@@ -299,22 +335,67 @@ static int persist__retain_save_all(FILE *db_fptr)
 	return MOSQ_ERR_SUCCESS;
 }
 
-int persist__backup(bool shutdown)
+int persist__file_header_write(FILE *db_fptr)
 {
-	int rc = 0;
-	FILE *db_fptr = NULL;
 	uint32_t db_version_w = htonl(MOSQ_DB_VERSION);
 	uint32_t crc = 0;
+
+	write_e(db_fptr, magic, 15);
+	write_e(db_fptr, &crc, sizeof(uint32_t));
+	write_e(db_fptr, &db_version_w, sizeof(uint32_t));
+
+	return MOSQ_ERR_SUCCESS;
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
+
+
+/* Statistics reported by a background save to the broker, over a pipe. */
+struct persist__save_result{
+	uint64_t bytes;
+	uint64_t duration_ms;
+};
+
+#ifndef WIN32
+static pid_t save_pid = 0;
+static int save_pipe = -1;
+#endif
+
+
+static uint64_t persist__now_ms(void)
+{
+#ifdef WIN32
+	return GetTickCount64();
+#else
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (uint64_t)tp.tv_sec*1000 + (uint64_t)tp.tv_nsec/1000000;
+#endif
+}
+
+
+static void persist__save_complete(struct persist__save_result *result)
+{
+	db.persistence_save_bytes = result->bytes;
+	db.persistence_save_ms = result->duration_ms;
+	db.persistence_save_count++;
+}
+
+
+static int persist__write(bool shutdown, struct persist__save_result *result)
+{
+	int rc = 0;
+	FILE *db_fptr = NULL;
 	char *err;
 	char *outfile = NULL;
 	size_t len;
+	long pos;
 	struct PF_cfg cfg_chunk;
+	uint64_t start_ms;
 
-	if(db.config == NULL) return MOSQ_ERR_INVAL;
-	if(db.config->persistence == false) return MOSQ_ERR_SUCCESS;
-	if(db.config->persistence_filepath == NULL) return MOSQ_ERR_INVAL;
-
-	log__printf(NULL, MOSQ_LOG_INFO, "Saving in-memory database to %s.", db.config->persistence_filepath);
+	start_ms = persist__now_ms();
 
 	len = strlen(db.config->persistence_filepath)+5;
 	outfile = mosquitto__malloc(len+1);
@@ -362,9 +443,9 @@ int persist__backup(bool shutdown)
 	}
 
 	/* Header */
-	write_e(db_fptr, magic, 15);
-	write_e(db_fptr, &crc, sizeof(uint32_t));
-	write_e(db_fptr, &db_version_w, sizeof(uint32_t));
+	if(persist__file_header_write(db_fptr)){
+		goto error;
+	}
 
 	memset(&cfg_chunk, 0, sizeof(struct PF_cfg));
 	cfg_chunk.last_db_id = db.last_db_id;
@@ -373,6 +454,9 @@ int persist__backup(bool shutdown)
 	if(persist__chunk_cfg_write_v6(db_fptr, &cfg_chunk)){
 		goto error;
 	}
+	if(persist__journal_chunk_write(db_fptr)){
+		goto error;
+	}
 
 	if(persist__message_store_save(db_fptr)){
 		goto error;
@@ -408,7 +492,9 @@ int persist__backup(bool shutdown)
 	fflush(db_fptr);
 	fsync(fileno(db_fptr));
 #endif
+	pos = ftell(db_fptr);
 	fclose(db_fptr);
+	db_fptr = NULL;
 
 #ifdef WIN32
 	if(remove(db.config->persistence_filepath) != 0){
@@ -422,6 +508,9 @@ int persist__backup(bool shutdown)
 	}
 	mosquitto__free(outfile);
 	outfile = NULL;
+
+	result->bytes = pos > 0?(uint64_t)pos:0;
+	result->duration_ms = persist__now_ms() - start_ms;
 	return rc;
 error:
 	mosquitto__free(outfile);
@@ -432,4 +521,197 @@ error:
 }
 
 
+#ifndef WIN32
+/* Close the child's copies of the broker's sockets. While the child holds
+ * them, closing a connection in the broker would not actually close it, and
+ * with epoll the broker could still receive events for it. */
+static void persist__child_close_sockets(void)
+{
+	struct mosquitto *context, *ctxt_tmp;
+	int i, j;
+
+	HASH_ITER(hh_sock, db.contexts_by_sock, context, ctxt_tmp){
+		if(context->sock != INVALID_SOCKET){
+			close(context->sock);
+		}
+	}
+	for(i=0; i<db.config->listener_count; i++){
+		for(j=0; j<db.config->listeners[i].sock_count; j++){
+			close(db.config->listeners[i].socks[j]);
+		}
+	}
+#ifdef WITH_EPOLL
+	close(db.epollfd);
+#endif
+}
+
+
+/* Save the database from a forked child, which sees a copy-on-write snapshot
+ * of the broker's memory, so the broker can carry on routing messages. */
+static int persist__backup_background(void)
+{
+	int pipefd[2];
+	pid_t pid;
+	char ready;
+	ssize_t rc;
+	struct persist__save_result result;
+
+	if(pipe(pipefd)){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to start background save: %s.", strerror(errno));
+		return MOSQ_ERR_ERRNO;
+	}
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Saving in-memory database to %s in the background.", db.config->persistence_filepath);
+
+	/* Don't let the child inherit any buffered log output. */
+	fflush(NULL);
+	pid = fork();
+	if(pid == -1){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to start background save: %s.", strerror(errno));
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return MOSQ_ERR_ERRNO;
+	}else if(pid == 0){
+		close(pipefd[0]);
+		persist__child_close_sockets();
+		ready = 0;
+		if(write(pipefd[1], &ready, 1) != 1){
+			_exit(1);
+		}
+		memset(&result, 0, sizeof(result));
+		if(persist__write(false, &result)){
+			_exit(1);
+		}
+		if(write(pipefd[1], &result, sizeof(result)) != sizeof(result)){
+			_exit(1);
+		}
+		_exit(0);
+	}
+
+	close(pipefd[1]);
+	save_pid = pid;
+	save_pipe = pipefd[0];
+
+	/* Wait for the child to release its copies of the sockets. */
+	do{
+		rc = read(save_pipe, &ready, 1);
+	}while(rc == -1 && errno == EINTR);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void persist__background_finished(int status)
+{
+	struct persist__save_result result;
+	ssize_t rc;
+
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 0){
+		do{
+			rc = read(save_pipe, &result, sizeof(result));
+		}while(rc == -1 && errno == EINTR);
+
+		if(rc == sizeof(result)){
+			persist__save_complete(&result);
+			log__printf(NULL, MOSQ_LOG_INFO, "Background save of in-memory database complete, %llu bytes in %llu ms.",
+					(unsigned long long)result.bytes, (unsigned long long)result.duration_ms);
+		}
+		persist__journal_save_complete(true);
+	}else{
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Background save of in-memory database failed.");
+		persist__journal_save_complete(false);
+	}
+	close(save_pipe);
+	save_pipe = -1;
+	save_pid = 0;
+}
+#endif
+
+
+bool persist__background_running(void)
+{
+#ifndef WIN32
+	return save_pid != 0;
+#else
+	return false;
+#endif
+}
+
+
+/* Reap a finished background save, if there is one. If wait is true, block
+ * until it has finished. */
+void persist__backup_check(bool wait)
+{
+#ifndef WIN32
+	pid_t pid;
+	int status;
+
+	if(save_pid == 0) return;
+
+	do{
+		pid = waitpid(save_pid, &status, wait?0:WNOHANG);
+	}while(pid == -1 && errno == EINTR);
+
+	if(pid == save_pid){
+		persist__background_finished(status);
+	}else if(pid == -1){
+		/* The child has already gone, e.g. because SIGCHLD is ignored, so
+		 * whether the save succeeded isn't known. */
+		close(save_pipe);
+		save_pipe = -1;
+		save_pid = 0;
+		persist__journal_save_complete(false);
+	}
+#else
+	UNUSED(wait);
+#endif
+}
+
+
+int persist__backup(bool shutdown)
+{
+	struct persist__save_result result;
+	int rc;
+
+	if(db.config == NULL) return MOSQ_ERR_INVAL;
+	if(db.config->persistence == false) return MOSQ_ERR_SUCCESS;
+	if(db.config->persistence_filepath == NULL) return MOSQ_ERR_INVAL;
+
+#ifndef WIN32
+	if(shutdown){
+		/* The final save must include everything, and must not race with
+		 * a background save writing the same file. */
+		persist__backup_check(true);
+	}else if(save_pid != 0){
+		log__printf(NULL, MOSQ_LOG_INFO, "Background save of in-memory database already in progress.");
+		return MOSQ_ERR_SUCCESS;
+	}
+#endif
+
+	persist__journal_rotate();
+
+#ifndef WIN32
+	if(!shutdown && db.config->autosave_background){
+		if(persist__backup_background() == MOSQ_ERR_SUCCESS){
+			return MOSQ_ERR_SUCCESS;
+		}
+		/* Fall back to saving in the foreground */
+	}
+#endif
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Saving in-memory database to %s.", db.config->persistence_filepath);
+
+	memset(&result, 0, sizeof(result));
+	rc = persist__write(shutdown, &result);
+	if(rc == MOSQ_ERR_SUCCESS){
+		persist__save_complete(&result);
+	}
+	persist__journal_save_complete(rc == MOSQ_ERR_SUCCESS);
+	if(shutdown){
+		persist__journal_close();
+	}
+	return rc;
+}
+
+
 #endif
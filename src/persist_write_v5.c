@@ -22,6 +22,8 @@ Contributors:
 
 #ifndef WIN32
 #include <arpa/inet.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #endif
 #include <assert.h>
 #include <errno.h>
@@ -39,6 +41,39 @@ Contributors:
 #include "time_mosq.h"
 #include "util_mosq.h"
 
+#ifndef WIN32
+/* Write a set of buffers to a stream with writev(). Anything already
+ * buffered in the stream is flushed first. Chunks are only ever added to the
+ * end of the file, so the stream position is moved to the end afterwards to
+ * keep it in step with the file. */
+static int persist__writev(FILE *db_fptr, struct iovec *iov, int iovcnt)
+{
+	ssize_t len;
+
+	if(fflush(db_fptr)) return 1;
+
+	while(iovcnt > 0){
+		len = writev(fileno(db_fptr), iov, iovcnt);
+		if(len < 0){
+			if(errno == EINTR) continue;
+			return 1;
+		}
+		while(iovcnt > 0 && (size_t)len >= iov[0].iov_len){
+			len -= (ssize_t)iov[0].iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0){
+			iov[0].iov_base = (uint8_t *)iov[0].iov_base + len;
+			iov[0].iov_len -= (size_t)len;
+		}
+	}
+
+	return fseek(db_fptr, 0, SEEK_END);
+}
+#endif
+
+
 int persist__chunk_cfg_write_v6(FILE *db_fptr, struct PF_cfg *chunk)
 {
 	struct PF_header header;
@@ -55,7 +90,7 @@ error:
 }
 
 
-int persist__chunk_client_write_v6(FILE *db_fptr, struct P_client *chunk)
+int persist__chunk_client_write_v6(FILE *db_fptr, struct P_client *chunk, uint32_t type)
 {
 	struct PF_header header;
 	uint16_t id_len = chunk->F.id_len;
@@ -67,7 +102,7 @@ int persist__chunk_client_write_v6(FILE *db_fptr, struct P_client *chunk)
 	chunk->F.username_len = htons(chunk->F.username_len);
 	chunk->F.listener_port = htons(chunk->F.listener_port);
 
-	header.chunk = htonl(DB_CHUNK_CLIENT);
+	header.chunk = htonl(type);
 	header.length = htonl((uint32_t)sizeof(struct PF_client)+id_len+username_len);
 
 	write_e(db_fptr, &header, sizeof(struct PF_header));
@@ -85,7 +120,7 @@ error:
 }
 
 
-int persist__chunk_client_msg_write_v6(FILE *db_fptr, struct P_client_msg *chunk)
+int persist__chunk_client_msg_write_v6(FILE *db_fptr, struct P_client_msg *chunk, uint32_t type)
 {
 	struct PF_header header;
 	struct mosquitto__packet prop_packet;
@@ -101,7 +136,7 @@ int persist__chunk_client_msg_write_v6(FILE *db_fptr, struct P_client_msg *chunk
 	chunk->F.mid = htons(chunk->F.mid);
 	chunk->F.id_len = htons(chunk->F.id_len);
 
-	header.chunk = htonl(DB_CHUNK_CLIENT_MSG);
+	header.chunk = htonl(type);
 	header.length = htonl((uint32_t)sizeof(struct PF_client_msg) + id_len + proplen);
 
 	write_e(db_fptr, &header, sizeof(struct PF_header));
@@ -142,12 +177,29 @@ int persist__chunk_message_store_write_v6(FILE *db_fptr, struct P_msg_store *chu
 	uint16_t topic_len = chunk->F.topic_len;
 	uint32_t proplen = 0;
 	struct mosquitto__packet prop_packet;
+#ifndef WIN32
+	struct iovec iov[7];
+	int iovcnt = 0;
+#endif
 	int rc;
 
 	memset(&prop_packet, 0, sizeof(struct mosquitto__packet));
 	if(chunk->properties){
 		proplen += property__get_remaining_length(chunk->properties);
 	}
+	if(proplen > 0){
+		prop_packet.remaining_length = proplen;
+		prop_packet.packet_length = proplen;
+		prop_packet.payload = mosquitto__malloc(proplen);
+		if(!prop_packet.payload){
+			return MOSQ_ERR_NOMEM;
+		}
+		rc = property__write_all(&prop_packet, chunk->properties, true);
+		if(rc){
+			mosquitto__free(prop_packet.payload);
+			return rc;
+		}
+	}
 
 	chunk->F.payloadlen = htonl(chunk->F.payloadlen);
 	chunk->F.source_mid = htons(chunk->F.source_mid);
@@ -161,6 +213,38 @@ int persist__chunk_message_store_write_v6(FILE *db_fptr, struct P_msg_store *chu
 			topic_len + payloadlen +
 			source_id_len + source_username_len + proplen);
 
+#ifndef WIN32
+	if(payloadlen >= PERSIST_WRITEV_MIN){
+		/* Write a large payload straight from the message rather than
+		 * copying it through the stdio buffer. */
+		iov[iovcnt].iov_base = &header;
+		iov[iovcnt++].iov_len = sizeof(struct PF_header);
+		iov[iovcnt].iov_base = &chunk->F;
+		iov[iovcnt++].iov_len = sizeof(struct PF_msg_store);
+		if(source_id_len){
+			iov[iovcnt].iov_base = chunk->source.id;
+			iov[iovcnt++].iov_len = source_id_len;
+		}
+		if(source_username_len){
+			iov[iovcnt].iov_base = chunk->source.username;
+			iov[iovcnt++].iov_len = source_username_len;
+		}
+		iov[iovcnt].iov_base = chunk->topic;
+		iov[iovcnt++].iov_len = topic_len;
+		iov[iovcnt].iov_base = chunk->payload;
+		iov[iovcnt++].iov_len = payloadlen;
+		if(proplen > 0){
+			iov[iovcnt].iov_base = prop_packet.payload;
+			iov[iovcnt++].iov_len = proplen;
+		}
+		if(persist__writev(db_fptr, iov, iovcnt)){
+			goto error;
+		}
+		mosquitto__free(prop_packet.payload);
+		return MOSQ_ERR_SUCCESS;
+	}
+#endif
+
 	write_e(db_fptr, &header, sizeof(struct PF_header));
 	write_e(db_fptr, &chunk->F, sizeof(struct PF_msg_store));
 	if(source_id_len){
@@ -173,24 +257,10 @@ int persist__chunk_message_store_write_v6(FILE *db_fptr, struct P_msg_store *chu
 	if(payloadlen){
 		write_e(db_fptr, chunk->payload, (unsigned int)payloadlen);
 	}
-	if(chunk->properties){
-		if(proplen > 0){
-			prop_packet.remaining_length = proplen;
-			prop_packet.packet_length = proplen;
-			prop_packet.payload = mosquitto__malloc(proplen);
-			if(!prop_packet.payload){
-				return MOSQ_ERR_NOMEM;
-			}
-			rc = property__write_all(&prop_packet, chunk->properties, true);
-			if(rc){
-				mosquitto__free(prop_packet.payload);
-				return rc;
-			}
-
-			write_e(db_fptr, prop_packet.payload, proplen);
-			mosquitto__free(prop_packet.payload);
-		}
+	if(proplen > 0){
+		write_e(db_fptr, prop_packet.payload, proplen);
 	}
+	mosquitto__free(prop_packet.payload);
 
 	return MOSQ_ERR_SUCCESS;
 error:
@@ -217,7 +287,7 @@ error:
 }
 
 
-int persist__chunk_sub_write_v6(FILE *db_fptr, struct P_sub *chunk)
+int persist__chunk_sub_write_v6(FILE *db_fptr, struct P_sub *chunk, uint32_t type)
 {
 	struct PF_header header;
 	uint16_t id_len = chunk->F.id_len;
@@ -227,7 +297,7 @@ int persist__chunk_sub_write_v6(FILE *db_fptr, struct P_sub *chunk)
 	chunk->F.id_len = htons(chunk->F.id_len);
 	chunk->F.topic_len = htons(chunk->F.topic_len);
 
-	header.chunk = htonl(DB_CHUNK_SUB);
+	header.chunk = htonl(type);
 	header.length = htonl((uint32_t)sizeof(struct PF_sub) +
 			id_len + topic_len);
 
@@ -241,4 +311,42 @@ error:
 	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
 	return 1;
 }
+
+
+int persist__chunk_journal_write_v6(FILE *db_fptr, struct PF_journal *chunk)
+{
+	struct PF_header header;
+
+	header.chunk = htonl(DB_CHUNK_JOURNAL);
+	header.length = htonl((uint32_t)sizeof(struct PF_journal));
+
+	write_e(db_fptr, &header, sizeof(struct PF_header));
+	write_e(db_fptr, chunk, sizeof(struct PF_journal));
+
+	return MOSQ_ERR_SUCCESS;
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
+
+
+int persist__chunk_retain_delete_write_v6(FILE *db_fptr, struct P_retain_delete *chunk)
+{
+	struct PF_header header;
+	uint16_t topic_len = chunk->F.topic_len;
+
+	chunk->F.topic_len = htons(chunk->F.topic_len);
+
+	header.chunk = htonl(DB_CHUNK_RETAIN_DELETE);
+	header.length = htonl((uint32_t)sizeof(struct PF_retain_delete) + topic_len);
+
+	write_e(db_fptr, &header, sizeof(struct PF_header));
+	write_e(db_fptr, &chunk->F, sizeof(struct PF_retain_delete));
+	write_e(db_fptr, chunk->topic, topic_len);
+
+	return MOSQ_ERR_SUCCESS;
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
 #endif
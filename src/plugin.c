@@ -164,7 +164,7 @@ int plugin__handle_message(struct mosquitto *context, struct mosquitto_msg_store
 
 	stored->topic = event_data.topic;
 	if(stored->payload != event_data.payload){
-		mosquitto__free(stored->payload);
+		db__msg_store_payload_free(stored);
 		stored->payload = event_data.payload;
 		stored->payloadlen = event_data.payloadlen;
 	}
@@ -261,6 +261,11 @@ int mosquitto_callback_register(
 	cb_new->cb = cb_func;
 	cb_new->userdata = userdata;
 
+	if(event == MOSQ_EVT_ACL_CHECK){
+		/* Cached results may no longer be correct. */
+		acl__cache_invalidate();
+	}
+
 	return MOSQ_ERR_SUCCESS;
 }
 
@@ -287,6 +292,7 @@ int mosquitto_callback_unregister(
 			break;
 		case MOSQ_EVT_ACL_CHECK:
 			cb_base = &security_options->plugin_callbacks.acl_check;
+			acl__cache_invalidate();
 			break;
 		case MOSQ_EVT_BASIC_AUTH:
 			cb_base = &security_options->plugin_callbacks.basic_auth;
@@ -319,3 +325,28 @@ int mosquitto_callback_unregister(
 
 	return remove_callback(cb_base, cb_func);
 }
+
+
+int mosquitto_acl_cache_disable(mosquitto_plugin_id_t *identifier, MOSQ_FUNC_generic_callback cb_func)
+{
+	struct mosquitto__callback *cb_base;
+	struct mosquitto__security_options *security_options;
+
+	if(cb_func == NULL) return MOSQ_ERR_INVAL;
+
+	if(identifier->listener == NULL){
+		security_options = &db.config->security_options;
+	}else{
+		security_options = &identifier->listener->security_options;
+	}
+
+	DL_FOREACH(security_options->plugin_callbacks.acl_check, cb_base){
+		if(cb_base->cb == cb_func){
+			cb_base->no_cache = true;
+			/* Results from this callback may already be cached. */
+			acl__cache_invalidate();
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+	return MOSQ_ERR_NOT_FOUND;
+}
@@ -311,3 +311,57 @@ int mosquitto_kick_client_by_username(const char *username, bool with_will)
 	}
 	return MOSQ_ERR_SUCCESS;
 }
+
+int mosquitto_acl_cache_invalidate(const char *clientid)
+{
+	struct mosquitto *ctxt;
+
+	if(clientid == NULL){
+		acl__cache_invalidate();
+		return MOSQ_ERR_SUCCESS;
+	}else{
+		HASH_FIND(hh_id, db.contexts_by_id, clientid, strlen(clientid), ctxt);
+		if(ctxt){
+			acl__cache_clear(ctxt);
+			return MOSQ_ERR_SUCCESS;
+		}else{
+			return MOSQ_ERR_NOT_FOUND;
+		}
+	}
+}
+
+
+int mosquitto_basic_auth_pbkdf2_check(struct mosquitto *client, const char *password, const unsigned char *salt, int salt_len, int iterations, const unsigned char *hash, int hash_len)
+{
+#ifdef WITH_TLS
+	if(client == NULL || password == NULL || salt == NULL || hash == NULL
+			|| salt_len < 1 || hash_len < 1 || iterations < 1){
+
+		return MOSQ_ERR_INVAL;
+	}
+
+	return pw__check(client, password, salt, (unsigned int)salt_len,
+			hash, (unsigned int)hash_len, pw_sha512_pbkdf2, iterations);
+#else
+	UNUSED(client);
+	UNUSED(password);
+	UNUSED(salt);
+	UNUSED(salt_len);
+	UNUSED(iterations);
+	UNUSED(hash);
+	UNUSED(hash_len);
+
+	return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+}
+
+
+int mosquitto_auth_cache_invalidate(const char *username)
+{
+#ifdef WITH_TLS
+	auth_cache__invalidate(username);
+#else
+	UNUSED(username);
+#endif
+	return MOSQ_ERR_SUCCESS;
+}
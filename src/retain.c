@@ -29,6 +29,36 @@ Contributors:
 
 #include "utlist.h"
 
+/* Finding the retained messages that match a subscription is a quick walk of
+ * the retained tree. Checking access to each message and queueing it for the
+ * client is the expensive part, so where there are many matches this is done
+ * a batch at a time from the main loop, as the client has room for them.
+ * Nodes of the retained tree are only freed at shutdown, so the matching
+ * nodes remain valid while a stream is in progress, and the message sent is
+ * whatever is retained on each node at the time. */
+#define RETAIN_BATCH 100
+
+struct retain__matches{
+	struct mosquitto__retainhier **nodes;
+	size_t count;
+	size_t size;
+	bool error;
+};
+
+struct retain__stream{
+	struct retain__stream *next, *prev;
+	struct mosquitto *context;
+	char *sub;
+	struct mosquitto__retainhier **nodes;
+	size_t count;
+	size_t pos;
+	dbid_t last_db_id;
+	uint32_t subscription_identifier;
+	uint8_t qos;
+};
+
+static struct retain__stream *retain_streams = NULL;
+
 static struct mosquitto__retainhier *retain__add_hier_entry(struct mosquitto__retainhier *parent, struct mosquitto__retainhier **sibling, const char *topic, uint16_t len)
 {
 	struct mosquitto__retainhier *child;
@@ -102,9 +132,11 @@ int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **
 		/* Retained messages count as a persistence change, but only if
 		 * they aren't for $SYS. */
 		db.persistence_changes++;
+		persist__journal_retain(topic, stored);
 	}
 #endif
 	if(retainhier->retained){
+		retain__untrack(retainhier->retained);
 		db__msg_store_ref_dec(&retainhier->retained);
 #ifdef WITH_SYS_TREE
 		db.retained_count--;
@@ -113,6 +145,9 @@ int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **
 	if(stored->payloadlen){
 		retainhier->retained = stored;
 		db__msg_store_ref_inc(retainhier->retained);
+		if(strncmp(topic, "$SYS", 4)){
+			retain__track(stored);
+		}
 #ifdef WITH_SYS_TREE
 		db.retained_count++;
 #endif
@@ -133,6 +168,7 @@ static int retain__process(struct mosquitto__retainhier *branch, struct mosquitt
 	struct mosquitto_msg_store *retained;
 
 	if(branch->retained->message_expiry_time > 0 && db.now_real_s >= branch->retained->message_expiry_time){
+		retain__untrack(branch->retained);
 		db__msg_store_ref_dec(&branch->retained);
 		branch->retained = NULL;
 #ifdef WITH_SYS_TREE
@@ -143,6 +179,9 @@ static int retain__process(struct mosquitto__retainhier *branch, struct mosquitt
 
 	retained = branch->retained;
 
+	rc = retain__payload_load(retained);
+	if(rc) return rc;
+
 	rc = mosquitto_acl_check(context, retained->topic, retained->payloadlen, retained->payload,
 			retained->qos, retained->retain, MOSQ_ACL_READ);
 	if(rc == MOSQ_ERR_ACL_DENIED){
@@ -190,7 +229,28 @@ static int retain__process(struct mosquitto__retainhier *branch, struct mosquitt
 }
 
 
-static int retain__search(struct mosquitto__retainhier *retainhier, char **split_topics, struct mosquitto *context, const char *sub, uint8_t sub_qos, uint32_t subscription_identifier, int level)
+static int retain__match_add(struct retain__matches *matches, struct mosquitto__retainhier *branch)
+{
+	struct mosquitto__retainhier **nodes;
+	size_t size;
+
+	if(matches->count == matches->size){
+		size = matches->size?matches->size*2:RETAIN_BATCH;
+		nodes = mosquitto__realloc(matches->nodes, size*sizeof(struct mosquitto__retainhier *));
+		if(!nodes){
+			matches->error = true;
+			return MOSQ_ERR_NOMEM;
+		}
+		matches->nodes = nodes;
+		matches->size = size;
+	}
+	matches->nodes[matches->count] = branch;
+	matches->count++;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int retain__search(struct mosquitto__retainhier *retainhier, char **split_topics, struct retain__matches *matches, int level)
 {
 	struct mosquitto__retainhier *branch, *branch_tmp;
 	int flag = 0;
@@ -203,26 +263,26 @@ static int retain__search(struct mosquitto__retainhier *retainhier, char **split
 			 */
 			flag = -1;
 			if(branch->retained){
-				retain__process(branch, context, sub_qos, subscription_identifier);
+				retain__match_add(matches, branch);
 			}
 			if(branch->children){
-				retain__search(branch, split_topics, context, sub, sub_qos, subscription_identifier, level+1);
+				retain__search(branch, split_topics, matches, level+1);
 			}
 		}
 	}else{
 		if(!strcmp(split_topics[0], "+")){
 			HASH_ITER(hh, retainhier->children, branch, branch_tmp){
 				if(split_topics[1] != NULL){
-					if(retain__search(branch, &(split_topics[1]), context, sub, sub_qos, subscription_identifier, level+1) == -1
+					if(retain__search(branch, &(split_topics[1]), matches, level+1) == -1
 							|| (split_topics[1] != NULL && !strcmp(split_topics[1], "#") && level>0)){
 
 						if(branch->retained){
-							retain__process(branch, context, sub_qos, subscription_identifier);
+							retain__match_add(matches, branch);
 						}
 					}
 				}else{
 					if(branch->retained){
-						retain__process(branch, context, sub_qos, subscription_identifier);
+						retain__match_add(matches, branch);
 					}
 				}
 			}
@@ -230,16 +290,16 @@ static int retain__search(struct mosquitto__retainhier *retainhier, char **split
 			HASH_FIND(hh, retainhier->children, split_topics[0], strlen(split_topics[0]), branch);
 			if(branch){
 				if(split_topics[1] != NULL){
-					if(retain__search(branch, &(split_topics[1]), context, sub, sub_qos, subscription_identifier, level+1) == -1
+					if(retain__search(branch, &(split_topics[1]), matches, level+1) == -1
 							|| (split_topics[1] != NULL && !strcmp(split_topics[1], "#") && level>0)){
 
 						if(branch->retained){
-							retain__process(branch, context, sub_qos, subscription_identifier);
+							retain__match_add(matches, branch);
 						}
 					}
 				}else{
 					if(branch->retained){
-						retain__process(branch, context, sub_qos, subscription_identifier);
+						retain__match_add(matches, branch);
 					}
 				}
 			}
@@ -249,11 +309,66 @@ static int retain__search(struct mosquitto__retainhier *retainhier, char **split
 }
 
 
+static void retain__stream_free(struct retain__stream *stream)
+{
+	DL_DELETE(retain_streams, stream);
+	mosquitto__free(stream->sub);
+	mosquitto__free(stream->nodes);
+	mosquitto__free(stream);
+}
+
+
+static bool retain__stream_can_send(struct retain__stream *stream)
+{
+	struct mosquitto *context = stream->context;
+
+	if(context->sock == INVALID_SOCKET
+			|| mosquitto__get_state(context) != mosq_cs_active
+			|| context->current_out_packet
+			|| context->out_packet){
+
+		return false;
+	}
+	if(stream->qos > 0 && !db__ready_for_flight(&context->msgs_out, stream->qos)){
+		return false;
+	}
+	return true;
+}
+
+
+/* Queue the next batch of retained messages for a stream. Returns true once
+ * there is nothing left to send. */
+static bool retain__stream_send(struct retain__stream *stream)
+{
+	struct mosquitto__retainhier *branch;
+	int count = 0;
+
+	while(stream->pos < stream->count && count < RETAIN_BATCH){
+		if(stream->qos > 0 && !db__ready_for_flight(&stream->context->msgs_out, stream->qos)){
+			break;
+		}
+		branch = stream->nodes[stream->pos];
+		stream->pos++;
+
+		/* Anything retained since the subscription was made has already been
+		 * delivered as a normal message. */
+		if(branch->retained && branch->retained->db_id <= stream->last_db_id){
+			retain__process(branch, stream->context, stream->qos, stream->subscription_identifier);
+			count++;
+		}
+	}
+	return stream->pos == stream->count;
+}
+
+
 int retain__queue(struct mosquitto *context, const char *sub, uint8_t sub_qos, uint32_t subscription_identifier)
 {
 	struct mosquitto__retainhier *retainhier;
+	struct retain__matches matches;
+	struct retain__stream *stream;
 	char *local_sub;
 	char **split_topics;
+	size_t i;
 	int rc;
 
 	assert(context);
@@ -264,16 +379,115 @@ int retain__queue(struct mosquitto *context, const char *sub, uint8_t sub_qos, u
 
 	HASH_FIND(hh, db.retains, split_topics[0], strlen(split_topics[0]), retainhier);
 
+	memset(&matches, 0, sizeof(struct retain__matches));
 	if(retainhier){
-		retain__search(retainhier, split_topics, context, sub, sub_qos, subscription_identifier, 0);
+		retain__search(retainhier, split_topics, &matches, 0);
 	}
 	mosquitto__free(local_sub);
 	mosquitto__free(split_topics);
 
+	if(matches.error){
+		mosquitto__free(matches.nodes);
+		return MOSQ_ERR_NOMEM;
+	}
+
+	/* Subscribing again restarts delivery of the retained messages */
+	retain__stream_remove(context, sub);
+
+	if(matches.count <= RETAIN_BATCH){
+		for(i=0; i<matches.count; i++){
+			retain__process(matches.nodes[i], context, sub_qos, subscription_identifier);
+		}
+		mosquitto__free(matches.nodes);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	stream = mosquitto__calloc(1, sizeof(struct retain__stream));
+	if(!stream){
+		mosquitto__free(matches.nodes);
+		return MOSQ_ERR_NOMEM;
+	}
+	stream->sub = mosquitto__strdup(sub);
+	if(!stream->sub){
+		mosquitto__free(matches.nodes);
+		mosquitto__free(stream);
+		return MOSQ_ERR_NOMEM;
+	}
+	stream->context = context;
+	stream->nodes = matches.nodes;
+	stream->count = matches.count;
+	stream->last_db_id = db.last_db_id;
+	stream->subscription_identifier = subscription_identifier;
+	stream->qos = sub_qos;
+	DL_APPEND(retain_streams, stream);
+
+	/* The first batch goes out straight after the SUBACK, the rest as the
+	 * client has room for them. */
+	if(retain__stream_send(stream)){
+		retain__stream_free(stream);
+	}
+
 	return MOSQ_ERR_SUCCESS;
 }
 
 
+void retain__stream_process(void)
+{
+	struct retain__stream *stream, *stream_tmp;
+	struct mosquitto *context;
+
+	DL_FOREACH_SAFE(retain_streams, stream, stream_tmp){
+		if(retain__stream_can_send(stream)){
+			context = stream->context;
+			if(retain__stream_send(stream)){
+				retain__stream_free(stream);
+			}
+			db__message_write_inflight_out_latest(context);
+		}
+	}
+}
+
+
+bool retain__stream_ready(void)
+{
+	struct retain__stream *stream;
+
+	DL_FOREACH(retain_streams, stream){
+		if(retain__stream_can_send(stream)){
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/* Stop sending retained messages for a subscription, or for all of a
+ * client's subscriptions if sub is NULL. */
+void retain__stream_remove(struct mosquitto *context, const char *sub)
+{
+	struct retain__stream *stream, *stream_tmp;
+
+	DL_FOREACH_SAFE(retain_streams, stream, stream_tmp){
+		if(stream->context == context && (sub == NULL || !strcmp(stream->sub, sub))){
+			retain__stream_free(stream);
+		}
+	}
+}
+
+
+/* Hand any unsent retained messages over to a client taking over a session. */
+void retain__stream_move(struct mosquitto *from, struct mosquitto *to)
+{
+	struct retain__stream *stream;
+
+	DL_FOREACH(retain_streams, stream){
+		if(stream->context == from){
+			stream->context = to;
+		}
+	}
+}
+
+
 void retain__clean(struct mosquitto__retainhier **retainhier)
 {
 	struct mosquitto__retainhier *peer, *retainhier_tmp;
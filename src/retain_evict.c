@@ -0,0 +1,380 @@
+/*
+Copyright (c) 2021 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR EDL-1.0
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef WIN32
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+
+#include "utlist.h"
+
+/* Retained messages with their payload in memory are kept in a list in the
+ * order they were last sent to a subscriber, or the order they were retained
+ * if retained_eviction is "oldest". Once there are more than
+ * max_retained_messages of them, or more than max_retained_bytes of payload,
+ * payloads from the front of the list are moved to the retained message store
+ * on disk. Everything else about the message stays in memory, and the payload
+ * is read back in when the message is next sent.
+ *
+ * The store is a file made up of fixed size segments, each mapped into
+ * memory. Payloads are appended to the current segment. A segment is reused
+ * once none of its payloads are needed, and a segment that is mostly unused
+ * has its remaining payloads moved to the current segment. The store is only
+ * a cache, so it is recreated each time the broker starts.
+ *
+ * Only messages that aren't queued for any client can be evicted, and every
+ * message is read back in before it is queued. $SYS messages are never
+ * evicted. */
+
+#define RETAIN_SEGMENT_SIZE (64*1024*1024)
+
+struct retain__segment{
+	struct mosquitto_msg_store *stores; /* Messages with their payload in this segment */
+	char *map;
+	size_t used;
+	size_t live;
+};
+
+static struct mosquitto_msg_store *retain_lru = NULL;
+static size_t retain_lru_count = 0;
+static size_t retain_lru_bytes = 0;
+
+static struct retain__segment *segments = NULL;
+static int segment_count = 0;
+static int segment_current = -1;
+static int store_fd = -1;
+static char *store_path = NULL;
+static bool store_failed = false;
+
+
+static struct retain__segment *retain__segment_of(struct mosquitto_msg_store *stored)
+{
+	return &segments[stored->retain_offset / RETAIN_SEGMENT_SIZE];
+}
+
+
+/* A background save is reading payloads from the store, so space that it may
+ * still refer to mustn't be overwritten. */
+static bool retain__segments_in_use(void)
+{
+#ifdef WITH_PERSISTENCE
+	return persist__background_running();
+#else
+	return false;
+#endif
+}
+
+
+static char *retain__store_filename(void)
+{
+	char *filename;
+	size_t len;
+
+	if(db.config->persistence_filepath){
+		len = strlen(db.config->persistence_filepath) + strlen(".retained") + 1;
+		filename = mosquitto__malloc(len);
+		if(filename){
+			snprintf(filename, len, "%s.retained", db.config->persistence_filepath);
+		}
+	}else if(db.config->persistence_location && strlen(db.config->persistence_location)){
+		len = strlen(db.config->persistence_location) + strlen("/mosquitto.retained") + 1;
+		filename = mosquitto__malloc(len);
+		if(filename){
+			snprintf(filename, len, "%s/mosquitto.retained", db.config->persistence_location);
+		}
+	}else{
+		filename = mosquitto__strdup("mosquitto.retained");
+	}
+	return filename;
+}
+
+
+#ifndef WIN32
+static int retain__segment_add(void)
+{
+	struct retain__segment *new_segments;
+	off_t offset;
+	char *map;
+	int rc;
+
+	if(store_fd == -1){
+		store_path = retain__store_filename();
+		if(!store_path) return MOSQ_ERR_NOMEM;
+
+		store_fd = open(store_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if(store_fd == -1) return MOSQ_ERR_ERRNO;
+	}
+
+	new_segments = mosquitto__realloc(segments, (size_t)(segment_count+1)*sizeof(struct retain__segment));
+	if(!new_segments) return MOSQ_ERR_NOMEM;
+	segments = new_segments;
+
+	offset = (off_t)segment_count*RETAIN_SEGMENT_SIZE;
+	/* Allocate the disk space now, so running out of space can't cause a
+	 * SIGBUS when writing to the mapping. */
+#ifdef __linux__
+	rc = posix_fallocate(store_fd, offset, RETAIN_SEGMENT_SIZE);
+	if(rc){
+		errno = rc;
+		return MOSQ_ERR_ERRNO;
+	}
+#else
+	rc = ftruncate(store_fd, offset + RETAIN_SEGMENT_SIZE);
+	if(rc) return MOSQ_ERR_ERRNO;
+#endif
+
+	map = mmap(NULL, RETAIN_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, store_fd, offset);
+	if(map == MAP_FAILED) return MOSQ_ERR_ERRNO;
+
+	memset(&segments[segment_count], 0, sizeof(struct retain__segment));
+	segments[segment_count].map = map;
+	segment_current = segment_count;
+	segment_count++;
+
+	return MOSQ_ERR_SUCCESS;
+}
+#endif
+
+
+static int retain__segment_next(void)
+{
+#ifndef WIN32
+	int i;
+
+	if(!retain__segments_in_use()){
+		for(i=0; i<segment_count; i++){
+			if(i != segment_current && segments[i].live == 0){
+				segments[i].used = 0;
+				segment_current = i;
+				return MOSQ_ERR_SUCCESS;
+			}
+		}
+	}
+	return retain__segment_add();
+#else
+	return MOSQ_ERR_NOT_SUPPORTED;
+#endif
+}
+
+
+/* Copy a payload to the end of the current segment, and link the message to
+ * that segment. */
+static int retain__segment_write(struct mosquitto_msg_store *stored, const void *payload)
+{
+	struct retain__segment *segment;
+	int rc;
+
+	if(segment_current == -1 || segments[segment_current].used + stored->payloadlen > RETAIN_SEGMENT_SIZE){
+		rc = retain__segment_next();
+		if(rc) return rc;
+	}
+	segment = &segments[segment_current];
+
+	memcpy(segment->map + segment->used, payload, stored->payloadlen);
+	stored->retain_offset = (uint64_t)segment_current*RETAIN_SEGMENT_SIZE + segment->used;
+	segment->used += stored->payloadlen;
+	segment->live += stored->payloadlen;
+	DL_APPEND2(segment->stores, stored, retain_prev, retain_next);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void retain__store_error(int rc)
+{
+	if(rc == MOSQ_ERR_ERRNO){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to write to retained message store %s: %s. Retained messages will no longer be evicted.",
+				store_path?store_path:"", strerror(errno));
+	}else{
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to write to retained message store. Retained messages will no longer be evicted.");
+	}
+	store_failed = true;
+}
+
+
+/* Move the payloads still needed out of a mostly unused segment, so the
+ * segment can be reused. Adding a segment may move the array of segments, so
+ * this works with the index of the segment. */
+static void retain__segment_compact(int index)
+{
+	struct mosquitto_msg_store *stored, *stored_tmp;
+	void *payload;
+	int rc;
+
+	DL_FOREACH_SAFE2(segments[index].stores, stored, stored_tmp, retain_next){
+		payload = segments[index].map + stored->retain_offset % RETAIN_SEGMENT_SIZE;
+		DL_DELETE2(segments[index].stores, stored, retain_prev, retain_next);
+
+		/* The space is still counted as live while it is copied, so the
+		 * segment can't be picked for reuse part way through. */
+		rc = retain__segment_write(stored, payload);
+		if(rc){
+			DL_APPEND2(segments[index].stores, stored, retain_prev, retain_next);
+			retain__store_error(rc);
+			return;
+		}
+		segments[index].live -= stored->payloadlen;
+	}
+}
+
+
+void retain__track(struct mosquitto_msg_store *stored)
+{
+	stored->retain_state = mosq_rs_memory;
+	DL_APPEND2(retain_lru, stored, retain_prev, retain_next);
+	retain_lru_count++;
+	retain_lru_bytes += stored->payloadlen;
+}
+
+
+void retain__untrack(struct mosquitto_msg_store *stored)
+{
+	struct retain__segment *segment;
+	int index;
+
+	if(stored->retain_state == mosq_rs_memory){
+		DL_DELETE2(retain_lru, stored, retain_prev, retain_next);
+		retain_lru_count--;
+		retain_lru_bytes -= stored->payloadlen;
+	}else if(stored->retain_state == mosq_rs_evicted){
+		index = (int)(stored->retain_offset / RETAIN_SEGMENT_SIZE);
+		segment = &segments[index];
+		DL_DELETE2(segment->stores, stored, retain_prev, retain_next);
+		segment->live -= stored->payloadlen;
+
+		if(index != segment_current && !store_failed
+				&& segment->live > 0 && segment->live < segment->used/4){
+
+			retain__segment_compact(index);
+		}
+	}
+	stored->retain_state = mosq_rs_none;
+}
+
+
+/* Make sure the payload of a retained message is in memory, because it is
+ * about to be sent. */
+int retain__payload_load(struct mosquitto_msg_store *stored)
+{
+	void *payload;
+
+	if(stored->retain_state == mosq_rs_memory){
+		if(db.config->retained_eviction == mosq_re_lru){
+			DL_DELETE2(retain_lru, stored, retain_prev, retain_next);
+			DL_APPEND2(retain_lru, stored, retain_prev, retain_next);
+		}
+	}else if(stored->retain_state == mosq_rs_evicted){
+		payload = mosquitto__malloc((size_t)stored->payloadlen+1);
+		if(!payload) return MOSQ_ERR_NOMEM;
+
+		memcpy(payload, retain__payload(stored), stored->payloadlen);
+		((uint8_t *)payload)[stored->payloadlen] = 0;
+
+		retain__untrack(stored);
+		stored->payload = payload;
+		retain__track(stored);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* The payload of a message, wherever it is. */
+void *retain__payload(struct mosquitto_msg_store *stored)
+{
+	if(stored->retain_state == mosq_rs_evicted){
+		return retain__segment_of(stored)->map + stored->retain_offset % RETAIN_SEGMENT_SIZE;
+	}else{
+		return stored->payload;
+	}
+}
+
+
+static bool retain__over_limit(void)
+{
+	return (db.config->max_retained_messages > 0 && retain_lru_count > (size_t)db.config->max_retained_messages)
+			|| (db.config->max_retained_bytes > 0 && retain_lru_bytes > db.config->max_retained_bytes);
+}
+
+
+/* Evict retained payloads until the limits are met. */
+void retain__evict_check(void)
+{
+	struct mosquitto_msg_store *stored, *stored_next;
+	int rc;
+
+	if(store_failed) return;
+
+	stored = retain_lru;
+	while(stored && retain__over_limit()){
+		stored_next = stored->retain_next;
+
+		/* Messages queued for a client need their payload in memory. */
+		if(stored->ref_count == 1 && stored->payloadlen <= RETAIN_SEGMENT_SIZE){
+			DL_DELETE2(retain_lru, stored, retain_prev, retain_next);
+			retain_lru_count--;
+			retain_lru_bytes -= stored->payloadlen;
+
+			rc = retain__segment_write(stored, stored->payload);
+			if(rc){
+				retain__track(stored);
+				retain__store_error(rc);
+				return;
+			}
+			stored->retain_state = mosq_rs_evicted;
+			db__msg_store_payload_free(stored);
+		}
+		stored = stored_next;
+	}
+}
+
+
+void retain__evict_cleanup(void)
+{
+#ifndef WIN32
+	int i;
+
+	for(i=0; i<segment_count; i++){
+		munmap(segments[i].map, RETAIN_SEGMENT_SIZE);
+	}
+	if(store_fd != -1){
+		close(store_fd);
+		unlink(store_path);
+	}
+#endif
+	mosquitto__free(segments);
+	segments = NULL;
+	segment_count = 0;
+	segment_current = -1;
+	store_fd = -1;
+	mosquitto__free(store_path);
+	store_path = NULL;
+	store_failed = false;
+
+	retain_lru = NULL;
+	retain_lru_count = 0;
+	retain_lru_bytes = 0;
+}
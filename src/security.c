@@ -33,6 +33,10 @@ typedef int (*FUNC_plugin_version)(int, const int *);
 
 static int security__cleanup_single(struct mosquitto__security_options *opts, bool reload);
 
+/* ACL check results are cached for each client, keyed on the topic and access.
+ * Incrementing the epoch discards the results for every client at once. */
+static unsigned int acl_cache_epoch = 0;
+
 void LIB_ERROR(void)
 {
 #ifdef WIN32
@@ -538,6 +542,17 @@ int mosquitto_security_init(bool reload)
  */
 int mosquitto_security_apply(void)
 {
+	struct mosquitto *context, *ctxt_tmp;
+
+	/* The ACLs may have changed, and so may acl_cache_size. */
+	acl__cache_invalidate();
+	HASH_ITER(hh_id, db.contexts_by_id, context, ctxt_tmp){
+		if(acl__cache_init(context)) return MOSQ_ERR_NOMEM;
+	}
+	HASH_ITER(hh_sock, db.contexts_by_sock, context, ctxt_tmp){
+		if(acl__cache_init(context)) return MOSQ_ERR_NOMEM;
+	}
+
 	return mosquitto_security_apply_default();
 }
 
@@ -676,40 +691,145 @@ static int acl__check_dollar(const char *topic, int access)
 }
 
 
-int mosquitto_acl_check(struct mosquitto *context, const char *topic, uint32_t payloadlen, void* payload, uint8_t qos, bool retain, int access)
+/* Allocate the ACL cache for a client, or resize it if acl_cache_size has
+ * changed. Only clients have a cache, not contexts created for checking the
+ * source of retained messages. */
+int acl__cache_init(struct mosquitto *context)
+{
+	struct mosquitto__acl_cache_entry *cache = NULL;
+
+	if(context->acl_cache_size == db.config->acl_cache_size){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	acl__cache_free(context);
+	if(db.config->acl_cache_size > 0){
+		cache = mosquitto__calloc((size_t)db.config->acl_cache_size, sizeof(struct mosquitto__acl_cache_entry));
+		if(!cache) return MOSQ_ERR_NOMEM;
+	}
+	context->acl_cache = cache;
+	context->acl_cache_size = db.config->acl_cache_size;
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void acl__cache_clear(struct mosquitto *context)
 {
-	int rc;
 	int i;
-	struct mosquitto__security_options *opts;
-	struct mosquitto_acl_msg msg;
+
+	for(i=0; i<context->acl_cache_count; i++){
+		mosquitto__free(context->acl_cache[i].topic);
+	}
+	context->acl_cache_count = 0;
+	context->acl_cache_epoch = acl_cache_epoch;
+}
+
+
+void acl__cache_free(struct mosquitto *context)
+{
+	acl__cache_clear(context);
+	mosquitto__free(context->acl_cache);
+	context->acl_cache = NULL;
+	context->acl_cache_size = 0;
+}
+
+
+void acl__cache_invalidate(void)
+{
+	acl_cache_epoch++;
+}
+
+
+/* Results can only be cached if no plugin has said that its result depends on
+ * more than the client, topic, access, QoS and retain flag. Older plugins are passed the
+ * payload and have no way to say, so are never cached. */
+static bool acl__cache_allowed(struct mosquitto__security_options *opts)
+{
 	struct mosquitto__callback *cb_base;
-	struct mosquitto_evt_acl_check event_data;
+	int i;
 
-	if(!context->id){
-		return MOSQ_ERR_ACL_DENIED;
+	DL_FOREACH(opts->plugin_callbacks.acl_check, cb_base){
+		if(cb_base->no_cache){
+			return false;
+		}
 	}
-	if(context->bridge){
-		return MOSQ_ERR_SUCCESS;
+	for(i=0; i<opts->auth_plugin_config_count; i++){
+		if(opts->auth_plugin_configs[i].plugin.version < 5){
+			return false;
+		}
 	}
+	return true;
+}
+
+
+/* Find a cached result, moving it to the front of the cache. */
+static struct mosquitto__acl_cache_entry *acl__cache_find(struct mosquitto *context, const char *topic, unsigned hash, int access, uint8_t qos, bool retain)
+{
+	struct mosquitto__acl_cache_entry entry;
+	int i;
+
+	if(context->acl_cache_epoch != acl_cache_epoch){
+		acl__cache_clear(context);
+		return NULL;
+	}
+
+	for(i=0; i<context->acl_cache_count; i++){
+		if(context->acl_cache[i].hash == hash
+				&& context->acl_cache[i].access == access
+				&& context->acl_cache[i].qos == qos
+				&& context->acl_cache[i].retain == retain
+				&& !strcmp(context->acl_cache[i].topic, topic)){
+
+			if(i > 0){
+				entry = context->acl_cache[i];
+				memmove(&context->acl_cache[1], &context->acl_cache[0], (size_t)i*sizeof(struct mosquitto__acl_cache_entry));
+				context->acl_cache[0] = entry;
+			}
+			return &context->acl_cache[0];
+		}
+	}
+	return NULL;
+}
 
-	rc = acl__check_dollar(topic, access);
-	if(rc) return rc;
+
+/* Add a result to the front of the cache, replacing the least recently used
+ * result if the cache is full. */
+static void acl__cache_add(struct mosquitto *context, const char *topic, unsigned hash, int access, uint8_t qos, bool retain, int result)
+{
+	char *topic_dup;
+
+	topic_dup = mosquitto__strdup(topic);
+	if(!topic_dup) return;
+
+	if(context->acl_cache_count == context->acl_cache_size){
+		context->acl_cache_count--;
+		mosquitto__free(context->acl_cache[context->acl_cache_count].topic);
+	}
+	memmove(&context->acl_cache[1], &context->acl_cache[0], (size_t)context->acl_cache_count*sizeof(struct mosquitto__acl_cache_entry));
+	context->acl_cache[0].topic = topic_dup;
+	context->acl_cache[0].hash = hash;
+	context->acl_cache[0].access = access;
+	context->acl_cache[0].qos = qos;
+	context->acl_cache[0].retain = retain;
+	context->acl_cache[0].result = result;
+	context->acl_cache_count++;
+}
+
+
+static int acl__check_plugins(struct mosquitto__security_options *opts, struct mosquitto *context, const char *topic, uint32_t payloadlen, void* payload, uint8_t qos, bool retain, int access)
+{
+	int rc;
+	int i;
+	struct mosquitto_acl_msg msg;
+	struct mosquitto__callback *cb_base;
+	struct mosquitto_evt_acl_check event_data;
 
 	/* 
 	 * If no plugins exist we should accept at this point so set rc to success.
 	 */
 	rc = MOSQ_ERR_SUCCESS;
 
-	if(db.config->per_listener_settings){
-		if(context->listener){
-			opts = &context->listener->security_options;
-		}else{
-			return MOSQ_ERR_ACL_DENIED;
-		}
-	}else{
-		opts = &db.config->security_options;
-	}
-
 	memset(&msg, 0, sizeof(msg));
 	msg.topic = topic;
 	msg.payloadlen = payloadlen;
@@ -752,6 +872,53 @@ int mosquitto_acl_check(struct mosquitto *context, const char *topic, uint32_t p
 	return rc;
 }
 
+
+int mosquitto_acl_check(struct mosquitto *context, const char *topic, uint32_t payloadlen, void* payload, uint8_t qos, bool retain, int access)
+{
+	int rc;
+	struct mosquitto__security_options *opts;
+	struct mosquitto__acl_cache_entry *entry;
+	bool use_cache;
+	unsigned hash = 0;
+
+	if(!context->id){
+		return MOSQ_ERR_ACL_DENIED;
+	}
+	if(context->bridge){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	rc = acl__check_dollar(topic, access);
+	if(rc) return rc;
+
+	if(db.config->per_listener_settings){
+		if(context->listener){
+			opts = &context->listener->security_options;
+		}else{
+			return MOSQ_ERR_ACL_DENIED;
+		}
+	}else{
+		opts = &db.config->security_options;
+	}
+
+	use_cache = context->acl_cache && acl__cache_allowed(opts);
+	if(use_cache){
+		HASH_VALUE(topic, strlen(topic), hash);
+		entry = acl__cache_find(context, topic, hash, access, qos, retain);
+		if(entry){
+			return entry->result;
+		}
+	}
+
+	rc = acl__check_plugins(opts, context, topic, payloadlen, payload, qos, retain, access);
+
+	/* Errors other than a denial aren't a result, so aren't cached. */
+	if(use_cache && (rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_ACL_DENIED)){
+		acl__cache_add(context, topic, hash, access, qos, retain, rc);
+	}
+	return rc;
+}
+
 int mosquitto_unpwd_check(struct mosquitto *context)
 {
 	int rc;
@@ -28,6 +28,7 @@ Contributors:
 #include "send_mosq.h"
 #include "misc_mosq.h"
 #include "util_mosq.h"
+#include "utlist.h"
 
 static int aclfile__parse(struct mosquitto__security_options *security_opts);
 static int unpwd__file_parse(struct mosquitto__unpwd **unpwd, const char *password_file);
@@ -35,7 +36,6 @@ static int acl__cleanup(bool reload);
 static int unpwd__cleanup(struct mosquitto__unpwd **unpwd, bool reload);
 static int psk__file_parse(struct mosquitto__unpwd **psk_id, const char *psk_file);
 #ifdef WITH_TLS
-static int pw__digest(const char *password, const unsigned char *salt, unsigned int salt_len, unsigned char *hash, unsigned int *hash_len, enum mosquitto_pwhash_type hashtype, int iterations);
 #endif
 static int mosquitto_unpwd_check_default(int event, void *event_data, void *userdata);
 static int mosquitto_acl_check_default(int event, void *event_data, void *userdata);
@@ -160,6 +160,16 @@ int mosquitto_security_cleanup_default(bool reload)
 	rc = unpwd__cleanup(&db.config->security_options.unpwd, reload);
 	if(rc != MOSQ_ERR_SUCCESS) return rc;
 
+#ifdef WITH_TLS
+	/* The password file may have changed, so previous checks no longer
+	 * apply. */
+	if(reload){
+		auth_cache__invalidate(NULL);
+	}else{
+		auth_cache__cleanup();
+	}
+#endif
+
 	for(i=0; i<db.config->listener_count; i++){
 		if(db.config->listeners[i].security_options.unpwd){
 			rc = unpwd__cleanup(&db.config->listeners[i].security_options.unpwd, reload);
@@ -197,6 +207,130 @@ int mosquitto_security_cleanup_default(bool reload)
 	return MOSQ_ERR_SUCCESS;
 }
 
+/* Find or create the node for a single topic level. In patterns, a level
+ * containing %c or %u is a template, matched by expanding it in place when
+ * checking. */
+static struct mosquitto__acl_node *acl__node_child(struct mosquitto__acl_node *node, const char *level, size_t len, bool pattern)
+{
+	struct mosquitto__acl_node *child = NULL;
+	bool template = false;
+	size_t i;
+
+	if(len == 1 && level[0] == '+'){
+		if(!node->plus){
+			node->plus = mosquitto__calloc(1, sizeof(struct mosquitto__acl_node));
+		}
+		return node->plus;
+	}
+
+	if(pattern){
+		for(i=0; i+1<len; i++){
+			if(level[i] == '%' && (level[i+1] == 'c' || level[i+1] == 'u')){
+				template = true;
+				break;
+			}
+		}
+	}
+
+	if(template){
+		LL_FOREACH(node->templates, child){
+			if(strlen(child->level) == len && !strncmp(child->level, level, len)){
+				return child;
+			}
+		}
+	}else{
+		HASH_FIND(hh, node->children, level, len, child);
+		if(child) return child;
+	}
+
+	child = mosquitto__calloc(1, sizeof(struct mosquitto__acl_node));
+	if(!child) return NULL;
+	child->level = mosquitto__malloc(len+1);
+	if(!child->level){
+		mosquitto__free(child);
+		return NULL;
+	}
+	memcpy(child->level, level, len);
+	child->level[len] = '\0';
+
+	if(template){
+		LL_APPEND(node->templates, child);
+	}else{
+		HASH_ADD_KEYPTR(hh, node->children, child->level, len, child);
+	}
+	return child;
+}
+
+
+static int acl__trie_add(struct mosquitto__acl_node **root, const char *topic, int access, bool pattern)
+{
+	struct mosquitto__acl_node *node;
+	const char *level, *end;
+	size_t len;
+
+	if(!(*root)){
+		*root = mosquitto__calloc(1, sizeof(struct mosquitto__acl_node));
+		if(!(*root)) return MOSQ_ERR_NOMEM;
+	}
+	node = *root;
+
+	level = topic;
+	while(level){
+		end = strchr(level, '/');
+		if(end){
+			len = (size_t)(end - level);
+		}else{
+			len = strlen(level);
+		}
+
+		if(len == 1 && level[0] == '#'){
+			/* Only valid as the last level */
+			if(access == MOSQ_ACL_NONE){
+				node->hash_deny = true;
+			}else{
+				node->hash_access |= access;
+			}
+			return MOSQ_ERR_SUCCESS;
+		}
+
+		node = acl__node_child(node, level, len, pattern);
+		if(!node) return MOSQ_ERR_NOMEM;
+
+		if(end){
+			level = end+1;
+		}else{
+			level = NULL;
+		}
+	}
+
+	if(access == MOSQ_ACL_NONE){
+		node->deny = true;
+	}else{
+		node->access |= access;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void acl__trie_free(struct mosquitto__acl_node *node)
+{
+	struct mosquitto__acl_node *child, *child_tmp;
+
+	if(!node) return;
+
+	HASH_ITER(hh, node->children, child, child_tmp){
+		HASH_DELETE(hh, node->children, child);
+		acl__trie_free(child);
+	}
+	LL_FOREACH_SAFE(node->templates, child, child_tmp){
+		LL_DELETE(node->templates, child);
+		acl__trie_free(child);
+	}
+	acl__trie_free(node->plus);
+	mosquitto__free(node->level);
+	mosquitto__free(node);
+}
+
 
 int add__acl(struct mosquitto__security_options *security_opts, const char *user, const char *topic, int access)
 {
@@ -246,6 +380,7 @@ int add__acl(struct mosquitto__security_options *security_opts, const char *user
 		}
 		acl_user->next = NULL;
 		acl_user->acl = NULL;
+		acl_user->trie = NULL;
 	}
 
 	acl = mosquitto__malloc(sizeof(struct mosquitto__acl));
@@ -291,7 +426,7 @@ int add__acl(struct mosquitto__security_options *security_opts, const char *user
 		}
 	}
 
-	return MOSQ_ERR_SUCCESS;
+	return acl__trie_add(&acl_user->trie, local_topic, access, false);
 }
 
 int add__acl_pattern(struct mosquitto__security_options *security_opts, const char *topic, int access)
@@ -358,92 +493,113 @@ int add__acl_pattern(struct mosquitto__security_options *security_opts, const ch
 		security_opts->acl_patterns = acl;
 	}
 
-	return MOSQ_ERR_SUCCESS;
+	return acl__trie_add(&security_opts->acl_pattern_trie, local_topic, access, true);
 }
 
-static int mosquitto_acl_check_default(int event, void *event_data, void *userdata)
+struct acl__search{
+	const char *clientid;
+	const char *username;
+	size_t clen;
+	size_t ulen;
+	int access;
+	bool deny;
+};
+
+
+/* Does a template level, e.g. "%c-data", match a topic level once %c and %u
+ * are replaced? %u never matches for clients without a username. */
+static bool acl__template_matches(const char *template, const char *level, size_t len, const struct acl__search *search)
 {
-	struct mosquitto_evt_acl_check *ed = event_data;
-	char *local_acl;
-	struct mosquitto__acl *acl_root;
-	bool result;
-	int i;
-	size_t len, tlen, clen, ulen;
-	char *s;
-	struct mosquitto__security_options *security_opts = NULL;
+	size_t pos = 0;
 
-	UNUSED(event);
-	UNUSED(userdata);
+	while(template[0]){
+		if(template[0] == '%' && template[1] == 'c'){
+			if(len - pos < search->clen || memcmp(&level[pos], search->clientid, search->clen)){
+				return false;
+			}
+			pos += search->clen;
+			template += 2;
+		}else if(template[0] == '%' && template[1] == 'u'){
+			if(!search->username || len - pos < search->ulen || memcmp(&level[pos], search->username, search->ulen)){
+				return false;
+			}
+			pos += search->ulen;
+			template += 2;
+		}else{
+			if(pos == len || level[pos] != template[0]){
+				return false;
+			}
+			pos++;
+			template++;
+		}
+	}
+	return pos == len;
+}
 
-	if(ed->client->bridge) return MOSQ_ERR_SUCCESS;
-	if(ed->access == MOSQ_ACL_SUBSCRIBE || ed->access == MOSQ_ACL_UNSUBSCRIBE) return MOSQ_ERR_SUCCESS; /* FIXME - implement ACL subscription strings. */
 
-	if(db.config->per_listener_settings){
-		if(!ed->client->listener) return MOSQ_ERR_ACL_DENIED;
-		security_opts = &ed->client->listener->security_options;
-	}else{
-		security_opts = &db.config->security_options;
+/* Collect the access from every ACL below this node that matches the rest of
+ * the topic, starting at level. level is NULL once the whole topic has been
+ * matched. As with mosquitto_topic_matches_sub(), wildcards at the root don't
+ * match topics beginning with '$'. */
+static void acl__trie_search(struct mosquitto__acl_node *node, const char *level, bool root, struct acl__search *search)
+{
+	struct mosquitto__acl_node *child;
+	const char *end, *next;
+	size_t len;
+	bool wildcards;
+
+	wildcards = !root || (level && level[0] != '$');
+
+	/* '#' also matches the level it is below, e.g. "a/#" matches "a". */
+	if(wildcards){
+		search->deny |= node->hash_deny;
+		search->access |= node->hash_access;
 	}
-	if(!security_opts->acl_file && !security_opts->acl_list && !security_opts->acl_patterns){
-		return MOSQ_ERR_PLUGIN_DEFER;
+	if(!level){
+		search->deny |= node->deny;
+		search->access |= node->access;
+		return;
 	}
+	if(search->deny) return;
 
-	if(!ed->client->acl_list && !security_opts->acl_patterns) return MOSQ_ERR_ACL_DENIED;
-
-	if(ed->client->acl_list){
-		acl_root = ed->client->acl_list->acl;
+	end = strchr(level, '/');
+	if(end){
+		len = (size_t)(end - level);
+		next = end+1;
 	}else{
-		acl_root = NULL;
+		len = strlen(level);
+		next = NULL;
 	}
 
-	/* Loop through all ACLs for this client. ACL denials are iterated over first. */
-	while(acl_root){
-		/* Loop through the topic looking for matches to this ACL. */
-
-		/* If subscription starts with $, acl_root->topic must also start with $. */
-		if(ed->topic[0] == '$' && acl_root->topic[0] != '$'){
-			acl_root = acl_root->next;
-			continue;
-		}
-		mosquitto_topic_matches_sub(acl_root->topic, ed->topic, &result);
-		if(result){
-			if(acl_root->access == MOSQ_ACL_NONE){
-				/* Access was explicitly denied for this topic. */
-				return MOSQ_ERR_ACL_DENIED;
-			}
-			if(ed->access & acl_root->access){
-				/* And access is allowed. */
-				return MOSQ_ERR_SUCCESS;
-			}
+	HASH_FIND(hh, node->children, level, len, child);
+	if(child){
+		acl__trie_search(child, next, false, search);
+	}
+	if(node->plus && wildcards){
+		acl__trie_search(node->plus, next, false, search);
+	}
+	LL_FOREACH(node->templates, child){
+		if(acl__template_matches(child->level, level, len, search)){
+			acl__trie_search(child, next, false, search);
 		}
-		acl_root = acl_root->next;
 	}
+}
 
-	acl_root = security_opts->acl_patterns;
-
-	if(acl_root){
-		/* We are using pattern based acls. Check whether the username or
-		 * client id contains a + or # and if so deny access.
-		 *
-		 * Without this, a malicious client may configure its username/client
-		 * id to bypass ACL checks (or have a username/client id that cannot
-		 * publish or receive messages to its own place in the hierarchy).
-		 */
-		if(ed->client->username && strpbrk(ed->client->username, "+#")){
-			log__printf(NULL, MOSQ_LOG_NOTICE, "ACL denying access to client with dangerous username \"%s\"", ed->client->username);
-			return MOSQ_ERR_ACL_DENIED;
-		}
 
-		if(ed->client->id && strpbrk(ed->client->id, "+#")){
-			log__printf(NULL, MOSQ_LOG_NOTICE, "ACL denying access to client with dangerous client id \"%s\"", ed->client->id);
-			return MOSQ_ERR_ACL_DENIED;
-		}
-	}
+/* Check pattern ACLs by expanding each one in full. This is only needed for
+ * client ids or usernames containing a '/', which the pattern trie can't
+ * match because they span more than one topic level. */
+static int acl__check_patterns_expanded(struct mosquitto__acl *acl_root, struct mosquitto_evt_acl_check *ed)
+{
+	char *local_acl;
+	bool result;
+	size_t i;
+	size_t len, tlen, clen, ulen;
+	char *s;
 
-	/* Loop through all pattern ACLs. ACL denial patterns are iterated over first. */
-	if(!ed->client->id) return MOSQ_ERR_ACL_DENIED;
 	clen = strlen(ed->client->id);
 
+	/* Loop through all pattern ACLs. ACL denial patterns are iterated over first. */
 	while(acl_root){
 		tlen = strlen(acl_root->topic);
 
@@ -501,6 +657,93 @@ static int mosquitto_acl_check_default(int event, void *event_data, void *userda
 }
 
 
+static int mosquitto_acl_check_default(int event, void *event_data, void *userdata)
+{
+	struct mosquitto_evt_acl_check *ed = event_data;
+	struct mosquitto__security_options *security_opts = NULL;
+	struct acl__search search;
+
+	UNUSED(event);
+	UNUSED(userdata);
+
+	if(ed->client->bridge) return MOSQ_ERR_SUCCESS;
+	if(ed->access == MOSQ_ACL_SUBSCRIBE || ed->access == MOSQ_ACL_UNSUBSCRIBE) return MOSQ_ERR_SUCCESS; /* FIXME - implement ACL subscription strings. */
+
+	if(db.config->per_listener_settings){
+		if(!ed->client->listener) return MOSQ_ERR_ACL_DENIED;
+		security_opts = &ed->client->listener->security_options;
+	}else{
+		security_opts = &db.config->security_options;
+	}
+	if(!security_opts->acl_file && !security_opts->acl_list && !security_opts->acl_patterns){
+		return MOSQ_ERR_PLUGIN_DEFER;
+	}
+
+	if(!ed->client->acl_list && !security_opts->acl_patterns) return MOSQ_ERR_ACL_DENIED;
+
+	memset(&search, 0, sizeof(search));
+
+	/* Check all ACLs for this client at once. A matching denial takes
+	 * precedence over everything else. */
+	if(ed->client->acl_list && ed->client->acl_list->trie){
+		acl__trie_search(ed->client->acl_list->trie, ed->topic, true, &search);
+		if(search.deny){
+			/* Access was explicitly denied for this topic. */
+			return MOSQ_ERR_ACL_DENIED;
+		}
+		if(ed->access & search.access){
+			/* And access is allowed. */
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+
+	if(security_opts->acl_patterns){
+		/* We are using pattern based acls. Check whether the username or
+		 * client id contains a + or # and if so deny access.
+		 *
+		 * Without this, a malicious client may configure its username/client
+		 * id to bypass ACL checks (or have a username/client id that cannot
+		 * publish or receive messages to its own place in the hierarchy).
+		 */
+		if(ed->client->username && strpbrk(ed->client->username, "+#")){
+			log__printf(NULL, MOSQ_LOG_NOTICE, "ACL denying access to client with dangerous username \"%s\"", ed->client->username);
+			return MOSQ_ERR_ACL_DENIED;
+		}
+
+		if(ed->client->id && strpbrk(ed->client->id, "+#")){
+			log__printf(NULL, MOSQ_LOG_NOTICE, "ACL denying access to client with dangerous client id \"%s\"", ed->client->id);
+			return MOSQ_ERR_ACL_DENIED;
+		}
+	}
+
+	if(!ed->client->id || !security_opts->acl_pattern_trie) return MOSQ_ERR_ACL_DENIED;
+
+	if(strchr(ed->client->id, '/') || (ed->client->username && strchr(ed->client->username, '/'))){
+		return acl__check_patterns_expanded(security_opts->acl_patterns, ed);
+	}
+
+	/* Check all pattern ACLs at once. */
+	memset(&search, 0, sizeof(search));
+	search.clientid = ed->client->id;
+	search.clen = strlen(ed->client->id);
+	if(ed->client->username){
+		search.username = ed->client->username;
+		search.ulen = strlen(ed->client->username);
+	}
+	acl__trie_search(security_opts->acl_pattern_trie, ed->topic, true, &search);
+	if(search.deny){
+		/* Access was explicitly denied for this topic pattern. */
+		return MOSQ_ERR_ACL_DENIED;
+	}
+	if(ed->access & search.access){
+		/* And access is allowed. */
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	return MOSQ_ERR_ACL_DENIED;
+}
+
+
 static int aclfile__parse(struct mosquitto__security_options *security_opts)
 {
 	FILE *aclfptr = NULL;
@@ -655,6 +898,7 @@ static void acl__cleanup_single(struct mosquitto__security_options *security_opt
 		user_tail = security_opts->acl_list->next;
 
 		free__acl(security_opts->acl_list->acl);
+		acl__trie_free(security_opts->acl_list->trie);
 		mosquitto__free(security_opts->acl_list->username);
 		mosquitto__free(security_opts->acl_list);
 
@@ -665,6 +909,8 @@ static void acl__cleanup_single(struct mosquitto__security_options *security_opt
 		free__acl(security_opts->acl_patterns);
 		security_opts->acl_patterns = NULL;
 	}
+	acl__trie_free(security_opts->acl_pattern_trie);
+	security_opts->acl_pattern_trie = NULL;
 }
 
 
@@ -702,6 +948,9 @@ int acl__find_acls(struct mosquitto *context)
 	struct mosquitto__acl_user *acl_tail;
 	struct mosquitto__security_options *security_opts;
 
+	/* The client's username has changed, so cached results are wrong. */
+	acl__cache_clear(context);
+
 	/* Associate user with its ACL, assuming we have ACLs loaded. */
 	if(db.config->per_listener_settings){
 		if(!context->listener){
@@ -982,6 +1231,53 @@ static int mosquitto__memcmp_const(const void *a, const void *b, size_t len)
 	}
 	return rc;
 }
+
+
+/* Check a password against a hash. This is called from the password check
+ * worker threads, so must only use thread safe functions. */
+int pw__verify(const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len, enum mosquitto_pwhash_type hashtype, int iterations)
+{
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len;
+	int rc;
+
+	rc = pw__digest(password, salt, salt_len, digest, &digest_len, hashtype, iterations);
+	if(rc == MOSQ_ERR_SUCCESS){
+		if(digest_len == hash_len && !mosquitto__memcmp_const(hash, digest, digest_len)){
+			return MOSQ_ERR_SUCCESS;
+		}else{
+			return MOSQ_ERR_AUTH;
+		}
+	}else{
+		return rc;
+	}
+}
+
+
+/* Check a client's password against a hash, on a worker thread if the
+ * client is connecting and auth_worker_threads is set. Recent successful checks
+ * are answered from the cache if auth_cache_ttl is set. */
+int pw__check(struct mosquitto *context, const char *password, const unsigned char *salt, unsigned int salt_len, const unsigned char *hash, unsigned int hash_len, enum mosquitto_pwhash_type hashtype, int iterations)
+{
+	int rc;
+
+	if(auth_cache__check(context->username, password, salt, salt_len, hash, hash_len) == MOSQ_ERR_SUCCESS){
+		log__printf(NULL, MOSQ_LOG_DEBUG, "Password for %s accepted from cache.", context->username);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+#ifdef WITH_AUTH_THREADS
+	rc = auth_worker__submit(context, password, salt, salt_len, hash, hash_len, hashtype, iterations);
+	if(rc != MOSQ_ERR_NOT_SUPPORTED){
+		return rc;
+	}
+#endif
+	rc = pw__verify(password, salt, salt_len, hash, hash_len, hashtype, iterations);
+	if(rc == MOSQ_ERR_SUCCESS){
+		auth_cache__add(context->username, password, salt, salt_len, hash, hash_len);
+	}
+	return rc;
+}
 #endif
 
 
@@ -990,11 +1286,6 @@ static int mosquitto_unpwd_check_default(int event, void *event_data, void *user
 	struct mosquitto_evt_basic_auth *ed = event_data;
 	struct mosquitto__unpwd *u;
 	struct mosquitto__unpwd *unpwd_ref;
-#ifdef WITH_TLS
-	unsigned char hash[EVP_MAX_MD_SIZE];
-	unsigned int hash_len;
-	int rc;
-#endif
 
 	UNUSED(event);
 	UNUSED(userdata);
@@ -1016,16 +1307,8 @@ static int mosquitto_unpwd_check_default(int event, void *event_data, void *user
 		if(u->password){
 			if(ed->client->password){
 #ifdef WITH_TLS
-				rc = pw__digest(ed->client->password, u->salt, u->salt_len, hash, &hash_len, u->hashtype, u->iterations);
-				if(rc == MOSQ_ERR_SUCCESS){
-					if(hash_len == u->password_len && !mosquitto__memcmp_const(u->password, hash, hash_len)){
-						return MOSQ_ERR_SUCCESS;
-					}else{
-						return MOSQ_ERR_AUTH;
-					}
-				}else{
-					return rc;
-				}
+				return pw__check(ed->client, ed->client->password, u->salt, u->salt_len,
+						(unsigned char *)u->password, u->password_len, u->hashtype, u->iterations);
 #else
 				if(!strcmp(u->password, ed->client->password)){
 					return MOSQ_ERR_SUCCESS;
@@ -33,7 +33,7 @@ int send__unsuback(struct mosquitto *mosq, uint16_t mid, int reason_code_count,
 	int rc;
 
 	assert(mosq);
-	packet = mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+	packet = mosquitto__pool_calloc(mosq_pool_packet, sizeof(struct mosquitto__packet));
 	if(!packet) return MOSQ_ERR_NOMEM;
 
 	packet->command = CMD_UNSUBACK;
@@ -46,7 +46,7 @@ int send__unsuback(struct mosquitto *mosq, uint16_t mid, int reason_code_count,
 
 	rc = packet__alloc(packet);
 	if(rc){
-		mosquitto__free(packet);
+		mosquitto__pool_free(mosq_pool_packet, packet);
 		return rc;
 	}
 
@@ -50,6 +50,7 @@ Contributors:
 #include "config.h"
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -60,6 +61,361 @@ Contributors:
 
 #include "utlist.h"
 
+/* Nodes with up to this many children keep them in a plain array that is
+ * searched linearly. Above this, the array is used as a hash table. */
+#ifndef SUBHIER_VECTOR_MAX
+#  define SUBHIER_VECTOR_MAX 8
+#endif
+
+/* An interned topic level string. Every node with the same level name, for
+ * example "temperature", shares a single copy of the string. The hash is kept
+ * so it doesn't need recalculating when children are rehashed. */
+struct sub__level {
+	uint32_t hash;
+	uint32_t ref_count;
+	uint16_t len;
+	char topic[];
+};
+
+#define SUB__LEVEL(T) ((struct sub__level *)((T) - offsetof(struct sub__level, topic)))
+
+static struct sub__level **level_table = NULL;
+static uint32_t level_count = 0;
+static uint32_t level_capacity = 0;
+
+/* A cached match result for a published topic: the nodes whose subscribers
+ * receive messages on that topic, in the order they are delivered to. The
+ * subscribers themselves aren't cached, so shared subscription round robin,
+ * no_local and ACL checks still happen for every message. Entries are only
+ * valid while their generation matches sub_generation, which changes
+ * whenever the tree is modified. */
+struct sub__cache_entry {
+	UT_hash_handle hh;
+	struct mosquitto__subhier **nodes;
+	uint64_t generation;
+	int node_count;
+	int node_capacity;
+	char topic[];
+};
+
+static struct sub__cache_entry *sub_cache = NULL;
+static int sub_cache_count = 0;
+static uint64_t sub_generation = 1;
+
+
+/* FNV-1a */
+static uint32_t sub__hash(const char *topic, size_t len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for(i=0; i<len; i++){
+		hash ^= (uint8_t)topic[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+
+/* Remove the entry at slot from a linear probing hash table, moving any
+ * following entries that would no longer be found back into the gap. */
+static void sub__table_delete(void **table, uint32_t capacity, uint32_t slot, uint32_t (*hash_fn)(void *))
+{
+	uint32_t mask = capacity-1;
+	uint32_t i, j, k;
+
+	i = slot;
+	table[i] = NULL;
+	j = i;
+	while(1){
+		j = (j+1) & mask;
+		if(table[j] == NULL){
+			break;
+		}
+		k = hash_fn(table[j]) & mask;
+		if((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))){
+			table[i] = table[j];
+			table[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+
+static uint32_t sub__level_hash(void *entry)
+{
+	return ((struct sub__level *)entry)->hash;
+}
+
+
+static uint32_t sub__hier_hash(void *entry)
+{
+	return SUB__LEVEL(((struct mosquitto__subhier *)entry)->topic)->hash;
+}
+
+
+static int sub__level_table_resize(uint32_t capacity)
+{
+	struct sub__level **table;
+	uint32_t i, slot;
+
+	table = mosquitto__calloc(capacity, sizeof(struct sub__level *));
+	if(!table) return MOSQ_ERR_NOMEM;
+
+	for(i=0; i<level_capacity; i++){
+		if(level_table[i]){
+			slot = level_table[i]->hash & (capacity-1);
+			while(table[slot]){
+				slot = (slot+1) & (capacity-1);
+			}
+			table[slot] = level_table[i];
+		}
+	}
+	mosquitto__free(level_table);
+	level_table = table;
+	level_capacity = capacity;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Return the interned copy of a topic level, creating it if needed. */
+static char *sub__level_get(const char *topic, uint16_t len)
+{
+	struct sub__level *level;
+	uint32_t hash, slot;
+
+	if((level_count+1)*4 > level_capacity*3){
+		if(sub__level_table_resize(level_capacity ? level_capacity*2 : 64)){
+			return NULL;
+		}
+	}
+
+	hash = sub__hash(topic, len);
+	slot = hash & (level_capacity-1);
+	while(level_table[slot]){
+		level = level_table[slot];
+		if(level->hash == hash && level->len == len && !memcmp(level->topic, topic, len)){
+			level->ref_count++;
+			return level->topic;
+		}
+		slot = (slot+1) & (level_capacity-1);
+	}
+
+	level = mosquitto__malloc(sizeof(struct sub__level) + len + 1);
+	if(!level) return NULL;
+	level->hash = hash;
+	level->ref_count = 1;
+	level->len = len;
+	memcpy(level->topic, topic, len);
+	level->topic[len] = '\0';
+
+	level_table[slot] = level;
+	level_count++;
+	return level->topic;
+}
+
+
+static void sub__level_put(char *topic)
+{
+	struct sub__level *level;
+	uint32_t slot;
+
+	if(!topic) return;
+
+	level = SUB__LEVEL(topic);
+	level->ref_count--;
+	if(level->ref_count > 0) return;
+
+	slot = level->hash & (level_capacity-1);
+	while(level_table[slot] != level){
+		slot = (slot+1) & (level_capacity-1);
+	}
+	sub__table_delete((void **)level_table, level_capacity, slot, sub__level_hash);
+	level_count--;
+	mosquitto__free(level);
+
+	if(level_count == 0){
+		mosquitto__free(level_table);
+		level_table = NULL;
+		level_capacity = 0;
+	}
+}
+
+
+static struct mosquitto__subhier *sub__child_find(struct mosquitto__subhier *hier, const char *topic, size_t len)
+{
+	struct mosquitto__subhier *child;
+	uint32_t i, mask;
+
+	if(hier->child_capacity <= SUBHIER_VECTOR_MAX){
+		for(i=0; i<hier->child_count; i++){
+			child = hier->children[i];
+			if(child->topic_len == len && !memcmp(child->topic, topic, len)){
+				return child;
+			}
+		}
+		return NULL;
+	}
+
+	mask = hier->child_capacity-1;
+	i = sub__hash(topic, len) & mask;
+	while(hier->children[i]){
+		child = hier->children[i];
+		if(child->topic_len == len && !memcmp(child->topic, topic, len)){
+			return child;
+		}
+		i = (i+1) & mask;
+	}
+	return NULL;
+}
+
+
+static void sub__child_insert_hashed(struct mosquitto__subhier **table, uint32_t capacity, struct mosquitto__subhier *child)
+{
+	uint32_t slot;
+
+	slot = sub__hier_hash(child) & (capacity-1);
+	while(table[slot]){
+		slot = (slot+1) & (capacity-1);
+	}
+	table[slot] = child;
+}
+
+
+/* Move the children of hier to a new array. If capacity is larger than
+ * SUBHIER_VECTOR_MAX the array is used as a hash table, otherwise the children
+ * are packed at the start. */
+static int sub__children_resize(struct mosquitto__subhier *hier, uint32_t capacity)
+{
+	struct mosquitto__subhier **children;
+	uint32_t i, count = 0;
+
+	children = mosquitto__calloc(capacity, sizeof(struct mosquitto__subhier *));
+	if(!children) return MOSQ_ERR_NOMEM;
+
+	for(i=0; i<hier->child_capacity; i++){
+		if(hier->children[i]){
+			if(capacity > SUBHIER_VECTOR_MAX){
+				sub__child_insert_hashed(children, capacity, hier->children[i]);
+			}else{
+				children[count] = hier->children[i];
+				count++;
+			}
+		}
+	}
+	mosquitto__free(hier->children);
+	hier->children = children;
+	hier->child_capacity = capacity;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int sub__child_add(struct mosquitto__subhier *hier, struct mosquitto__subhier *child)
+{
+	uint32_t capacity;
+
+	if(hier->child_capacity <= SUBHIER_VECTOR_MAX && hier->child_count < SUBHIER_VECTOR_MAX){
+		if(hier->child_count == hier->child_capacity){
+			capacity = hier->child_capacity ? hier->child_capacity*2 : 1;
+			if(capacity > SUBHIER_VECTOR_MAX){
+				capacity = SUBHIER_VECTOR_MAX;
+			}
+			if(sub__children_resize(hier, capacity)) return MOSQ_ERR_NOMEM;
+		}
+		hier->children[hier->child_count] = child;
+	}else{
+		if((hier->child_count+1)*4 > hier->child_capacity*3){
+			capacity = hier->child_capacity > SUBHIER_VECTOR_MAX ? hier->child_capacity*2 : 4;
+			while(capacity <= SUBHIER_VECTOR_MAX || (hier->child_count+1)*4 > capacity*3){
+				capacity *= 2;
+			}
+			if(sub__children_resize(hier, capacity)) return MOSQ_ERR_NOMEM;
+		}
+		sub__child_insert_hashed(hier->children, hier->child_capacity, child);
+	}
+	hier->child_count++;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void sub__child_remove(struct mosquitto__subhier *hier, struct mosquitto__subhier *child)
+{
+	uint32_t i;
+
+	if(hier->child_capacity <= SUBHIER_VECTOR_MAX){
+		for(i=0; i<hier->child_count; i++){
+			if(hier->children[i] == child){
+				hier->children[i] = hier->children[hier->child_count-1];
+				hier->children[hier->child_count-1] = NULL;
+				break;
+			}
+		}
+	}else{
+		i = sub__hier_hash(child) & (hier->child_capacity-1);
+		while(hier->children[i] != child){
+			i = (i+1) & (hier->child_capacity-1);
+		}
+		sub__table_delete((void **)hier->children, hier->child_capacity, i, sub__hier_hash);
+	}
+	hier->child_count--;
+
+	if(hier->child_count == 0){
+		mosquitto__free(hier->children);
+		hier->children = NULL;
+		hier->child_capacity = 0;
+	}else if(hier->child_capacity > SUBHIER_VECTOR_MAX && hier->child_count <= SUBHIER_VECTOR_MAX/2){
+		/* Back to a plain array. Failure to shrink isn't a problem. */
+		sub__children_resize(hier, SUBHIER_VECTOR_MAX);
+	}
+}
+
+
+static void sub__hier_free(struct mosquitto__subhier *hier)
+{
+	sub__level_put(hier->topic);
+	mosquitto__free(hier->children);
+	mosquitto__free(hier->subs);
+	mosquitto__free(hier);
+}
+
+
+/* Leaves are kept in arrays with a capacity of the next power of two above
+ * the count, so that the capacity doesn't need storing. */
+static struct mosquitto__subleaf *sub__leaf_array_add(struct mosquitto__subleaf **subs, int *count)
+{
+	struct mosquitto__subleaf *new_subs;
+
+	if(*count == 0 || (*count & (*count-1)) == 0){
+		new_subs = mosquitto__realloc(*subs, sizeof(struct mosquitto__subleaf)*(size_t)(*count ? *count*2 : 1));
+		if(!new_subs) return NULL;
+		*subs = new_subs;
+	}
+	memset(&(*subs)[*count], 0, sizeof(struct mosquitto__subleaf));
+	(*count)++;
+	return &(*subs)[*count-1];
+}
+
+
+static void sub__leaf_array_remove(struct mosquitto__subleaf **subs, int *count, int index)
+{
+	struct mosquitto__subleaf *new_subs;
+
+	if(index < *count-1){
+		memmove(&(*subs)[index], &(*subs)[index+1], sizeof(struct mosquitto__subleaf)*(size_t)(*count-index-1));
+	}
+	(*count)--;
+	if(*count == 0){
+		mosquitto__free(*subs);
+		*subs = NULL;
+	}else if((*count & (*count-1)) == 0){
+		new_subs = mosquitto__realloc(*subs, sizeof(struct mosquitto__subleaf)*(size_t)(*count));
+		if(new_subs){
+			*subs = new_subs;
+		}
+	}
+}
+
+
 static int subs__send(struct mosquitto__subleaf *leaf, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store *stored)
 {
 	bool client_retain;
@@ -111,14 +467,14 @@ static int subs__shared_process(struct mosquitto__subhier *hier, const char *top
 {
 	int rc = 0, rc2;
 	struct mosquitto__subshared *shared, *shared_tmp;
-	struct mosquitto__subleaf *leaf;
 
 	HASH_ITER(hh, hier->shared, shared, shared_tmp){
-		leaf = shared->subs;
-		rc2 = subs__send(leaf, topic, qos, retain, stored);
-		/* Remove current from the top, add back to the bottom */
-		DL_DELETE(shared->subs, leaf);
-		DL_APPEND(shared->subs, leaf);
+		if(shared->next_sub >= shared->sub_count){
+			shared->next_sub = 0;
+		}
+		rc2 = subs__send(&shared->subs[shared->next_sub], topic, qos, retain, stored);
+		/* The next message goes to the next client in the group */
+		shared->next_sub++;
 
 		if(rc2) rc = 1;
 	}
@@ -130,21 +486,20 @@ static int subs__process(struct mosquitto__subhier *hier, const char *source_id,
 {
 	int rc = 0;
 	int rc2;
+	int i;
 	struct mosquitto__subleaf *leaf;
 
 	rc = subs__shared_process(hier, topic, qos, retain, stored);
 
-	leaf = hier->subs;
-	while(source_id && leaf){
+	for(i=0; source_id && i<hier->sub_count; i++){
+		leaf = &hier->subs[i];
 		if(!leaf->context->id || (leaf->no_local && !strcmp(leaf->context->id, source_id))){
-			leaf = leaf->next;
 			continue;
 		}
 		rc2 = subs__send(leaf, topic, qos, retain, stored);
 		if(rc2){
 			rc = 1;
 		}
-		leaf = leaf->next;
 	}
 	if(hier->subs || hier->shared){
 		return rc;
@@ -154,14 +509,81 @@ static int subs__process(struct mosquitto__subhier *hier, const char *source_id,
 }
 
 
-static int sub__add_leaf(struct mosquitto *context, uint8_t qos, uint32_t identifier, int options, struct mosquitto__subleaf **head, struct mosquitto__subleaf **newleaf)
+static void sub__cache_entry_free(struct sub__cache_entry *entry)
 {
-	struct mosquitto__subleaf *leaf;
+	HASH_DELETE(hh, sub_cache, entry);
+	sub_cache_count--;
+	mosquitto__free(entry->nodes);
+	mosquitto__free(entry);
+}
+
+
+static void sub__cache_clear(void)
+{
+	struct sub__cache_entry *entry, *entry_tmp;
+
+	HASH_ITER(hh, sub_cache, entry, entry_tmp){
+		sub__cache_entry_free(entry);
+	}
+}
+
+
+static int sub__cache_entry_append(struct sub__cache_entry *entry, struct mosquitto__subhier *hier)
+{
+	struct mosquitto__subhier **nodes;
+	int capacity;
+
+	if(entry->node_count == entry->node_capacity){
+		capacity = entry->node_capacity ? entry->node_capacity*2 : 4;
+		nodes = mosquitto__realloc(entry->nodes, (size_t)capacity*sizeof(struct mosquitto__subhier *));
+		if(!nodes) return MOSQ_ERR_NOMEM;
+		entry->nodes = nodes;
+		entry->node_capacity = capacity;
+	}
+	entry->nodes[entry->node_count] = hier;
+	entry->node_count++;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Find the cache entry for a topic, moving it to the most recently used end
+ * of the list, or create a new one, evicting the least recently used entries
+ * if the cache is full. New entries have no valid generation, so the caller
+ * must fill them in. */
+static struct sub__cache_entry *sub__cache_get(const char *topic)
+{
+	struct sub__cache_entry *entry;
+	size_t len;
+
+	len = strlen(topic);
+	HASH_FIND(hh, sub_cache, topic, len, entry);
+	if(entry){
+		HASH_DELETE(hh, sub_cache, entry);
+		HASH_ADD_KEYPTR(hh, sub_cache, entry->topic, len, entry);
+		return entry;
+	}
+
+	while(sub_cache && sub_cache_count >= db.config->subscription_cache_size){
+		sub__cache_entry_free(sub_cache);
+	}
+
+	entry = mosquitto__calloc(1, sizeof(struct sub__cache_entry) + len + 1);
+	if(!entry) return NULL;
+	memcpy(entry->topic, topic, len+1);
+	HASH_ADD_KEYPTR(hh, sub_cache, entry->topic, len, entry);
+	sub_cache_count++;
 
-	*newleaf = NULL;
-	leaf = *head;
+	return entry;
+}
+
+
+static int sub__add_leaf(struct mosquitto *context, uint8_t qos, uint32_t identifier, int options, struct mosquitto__subleaf **subs, int *sub_count)
+{
+	struct mosquitto__subleaf *leaf;
+	int i;
 
-	while(leaf){
+	for(i=0; i<*sub_count; i++){
+		leaf = &(*subs)[i];
 		if(leaf->context && leaf->context->id && !strcmp(leaf->context->id, context->id)){
 			/* Client making a second subscription to same topic. Only
 			 * need to update QoS. Return MOSQ_ERR_SUB_EXISTS to
@@ -170,9 +592,8 @@ static int sub__add_leaf(struct mosquitto *context, uint8_t qos, uint32_t identi
 			leaf->identifier = identifier;
 			return MOSQ_ERR_SUB_EXISTS;
 		}
-		leaf = leaf->next;
 	}
-	leaf = mosquitto__calloc(1, sizeof(struct mosquitto__subleaf));
+	leaf = sub__leaf_array_add(subs, sub_count);
 	if(!leaf) return MOSQ_ERR_NOMEM;
 	leaf->context = context;
 	leaf->qos = qos;
@@ -180,28 +601,26 @@ static int sub__add_leaf(struct mosquitto *context, uint8_t qos, uint32_t identi
 	leaf->no_local = ((options & MQTT_SUB_OPT_NO_LOCAL) != 0);
 	leaf->retain_as_published = ((options & MQTT_SUB_OPT_RETAIN_AS_PUBLISHED) != 0);
 
-	DL_APPEND(*head, leaf);
-	*newleaf = leaf;
-
 	return MOSQ_ERR_SUCCESS;
 }
 
 
-static void sub__remove_shared_leaf(struct mosquitto__subhier *subhier, struct mosquitto__subshared *shared, struct mosquitto__subleaf *leaf)
+static void sub__remove_shared_leaf(struct mosquitto__subhier *subhier, struct mosquitto__subshared *shared, int index)
 {
-	DL_DELETE(shared->subs, leaf);
+	sub__leaf_array_remove(&shared->subs, &shared->sub_count, index);
+	if(index < shared->next_sub){
+		shared->next_sub--;
+	}
 	if(shared->subs == NULL){
 		HASH_DELETE(hh, subhier->shared, shared);
 		mosquitto__free(shared->name);
 		mosquitto__free(shared);
 	}
-	mosquitto__free(leaf);
 }
 
 
 static int sub__add_shared(struct mosquitto *context, uint8_t qos, uint32_t identifier, int options, struct mosquitto__subhier *subhier, const char *sharename)
 {
-	struct mosquitto__subleaf *newleaf;
 	struct mosquitto__subshared *shared = NULL;
 	struct mosquitto__subshared_ref **shared_subs;
 	struct mosquitto__subshared_ref *shared_ref;
@@ -226,7 +645,7 @@ static int sub__add_shared(struct mosquitto *context, uint8_t qos, uint32_t iden
 		HASH_ADD_KEYPTR(hh, subhier->shared, shared->name, slen, shared);
 	}
 
-	rc = sub__add_leaf(context, qos, identifier, options, &shared->subs, &newleaf);
+	rc = sub__add_leaf(context, qos, identifier, options, &shared->subs, &shared->sub_count);
 	if(rc > 0){
 		if(shared->subs == NULL){
 			HASH_DELETE(hh, subhier->shared, shared);
@@ -239,7 +658,7 @@ static int sub__add_shared(struct mosquitto *context, uint8_t qos, uint32_t iden
 	if(rc != MOSQ_ERR_SUB_EXISTS){
 		shared_ref = mosquitto__calloc(1, sizeof(struct mosquitto__subshared_ref));
 		if(!shared_ref){
-			sub__remove_shared_leaf(subhier, shared, newleaf);
+			sub__remove_shared_leaf(subhier, shared, shared->sub_count-1);
 			return MOSQ_ERR_NOMEM;
 		}
 		shared_ref->hier = subhier;
@@ -256,8 +675,7 @@ static int sub__add_shared(struct mosquitto *context, uint8_t qos, uint32_t iden
 			shared_subs = mosquitto__realloc(context->shared_subs, sizeof(struct mosquitto__subshared_ref *)*(size_t)(context->shared_sub_count + 1));
 			if(!shared_subs){
 				mosquitto__free(shared_ref);
-				context->shared_subs[context->shared_sub_count-1] = NULL;
-				sub__remove_shared_leaf(subhier, shared, newleaf);
+				sub__remove_shared_leaf(subhier, shared, shared->sub_count-1);
 				return MOSQ_ERR_NOMEM;
 			}
 			context->shared_subs = shared_subs;
@@ -281,12 +699,11 @@ static int sub__add_shared(struct mosquitto *context, uint8_t qos, uint32_t iden
 
 static int sub__add_normal(struct mosquitto *context, uint8_t qos, uint32_t identifier, int options, struct mosquitto__subhier *subhier)
 {
-	struct mosquitto__subleaf *newleaf = NULL;
 	struct mosquitto__subhier **subs;
 	int i;
 	int rc;
 
-	rc = sub__add_leaf(context, qos, identifier, options, &subhier->subs, &newleaf);
+	rc = sub__add_leaf(context, qos, identifier, options, &subhier->subs, &subhier->sub_count);
 	if(rc > 0){
 		return rc;
 	}
@@ -301,8 +718,7 @@ static int sub__add_normal(struct mosquitto *context, uint8_t qos, uint32_t iden
 		if(i == context->sub_count){
 			subs = mosquitto__realloc(context->subs, sizeof(struct mosquitto__subhier *)*(size_t)(context->sub_count + 1));
 			if(!subs){
-				DL_DELETE(subhier->subs, newleaf);
-				mosquitto__free(newleaf);
+				sub__leaf_array_remove(&subhier->subs, &subhier->sub_count, subhier->sub_count-1);
 				return MOSQ_ERR_NOMEM;
 			}
 			context->subs = subs;
@@ -336,10 +752,10 @@ static int sub__add_context(struct mosquitto *context, uint8_t qos, uint32_t ide
 		if(topiclen > UINT16_MAX){
 			return MOSQ_ERR_INVAL;
 		}
-		HASH_FIND(hh, subhier->children, topics[topic_index], topiclen, branch);
+		branch = sub__child_find(subhier, topics[topic_index], topiclen);
 		if(!branch){
 			/* Not found */
-			branch = sub__add_hier_entry(subhier, &subhier->children, topics[topic_index], (uint16_t)topiclen);
+			branch = sub__add_hier_entry(subhier, topics[topic_index], (uint16_t)topiclen);
 			if(!branch) return MOSQ_ERR_NOMEM;
 		}
 		subhier = branch;
@@ -361,17 +777,14 @@ static int sub__add_context(struct mosquitto *context, uint8_t qos, uint32_t ide
 
 static int sub__remove_normal(struct mosquitto *context, struct mosquitto__subhier *subhier, uint8_t *reason)
 {
-	struct mosquitto__subleaf *leaf;
 	int i;
 
-	leaf = subhier->subs;
-	while(leaf){
-		if(leaf->context==context){
+	for(i=0; i<subhier->sub_count; i++){
+		if(subhier->subs[i].context==context){
 #ifdef WITH_SYS_TREE
 			db.subscription_count--;
 #endif
-			DL_DELETE(subhier->subs, leaf);
-			mosquitto__free(leaf);
+			sub__leaf_array_remove(&subhier->subs, &subhier->sub_count, i);
 
 			/* Remove the reference to the sub that the client is keeping.
 			 * It would be nice to be able to use the reference directly,
@@ -386,7 +799,6 @@ static int sub__remove_normal(struct mosquitto *context, struct mosquitto__subhi
 			*reason = 0;
 			return MOSQ_ERR_SUCCESS;
 		}
-		leaf = leaf->next;
 	}
 	return MOSQ_ERR_NO_SUBSCRIBERS;
 }
@@ -395,20 +807,15 @@ static int sub__remove_normal(struct mosquitto *context, struct mosquitto__subhi
 static int sub__remove_shared(struct mosquitto *context, struct mosquitto__subhier *subhier, uint8_t *reason, const char *sharename)
 {
 	struct mosquitto__subshared *shared;
-	struct mosquitto__subleaf *leaf;
-	int i;
+	int i, j;
 
 	HASH_FIND(hh, subhier->shared, sharename, strlen(sharename), shared);
 	if(shared){
-		leaf = shared->subs;
-		while(leaf){
-			if(leaf->context==context){
+		for(j=0; j<shared->sub_count; j++){
+			if(shared->subs[j].context==context){
 #ifdef WITH_SYS_TREE
 				db.shared_subscription_count--;
 #endif
-				DL_DELETE(shared->subs, leaf);
-				mosquitto__free(leaf);
-
 				/* Remove the reference to the sub that the client is keeping.
 				* It would be nice to be able to use the reference directly,
 				* but that would involve keeping a copy of the topic string in
@@ -424,16 +831,11 @@ static int sub__remove_shared(struct mosquitto *context, struct mosquitto__subhi
 					}
 				}
 
-				if(shared->subs == NULL){
-					HASH_DELETE(hh, subhier->shared, shared);
-					mosquitto__free(shared->name);
-					mosquitto__free(shared);
-				}
+				sub__remove_shared_leaf(subhier, shared, j);
 
 				*reason = 0;
 				return MOSQ_ERR_SUCCESS;
 			}
-			leaf = leaf->next;
 		}
 		return MOSQ_ERR_NO_SUBSCRIBERS;
 	}else{
@@ -454,39 +856,57 @@ static int sub__remove_recurse(struct mosquitto *context, struct mosquitto__subh
 		}
 	}
 
-	HASH_FIND(hh, subhier->children, topics[0], strlen(topics[0]), branch);
+	branch = sub__child_find(subhier, topics[0], strlen(topics[0]));
 	if(branch){
 		sub__remove_recurse(context, branch, &(topics[1]), reason, sharename);
 		if(!branch->children && !branch->subs && !branch->shared){
-			HASH_DELETE(hh, subhier->children, branch);
-			mosquitto__free(branch->topic);
-			mosquitto__free(branch);
+			sub__child_remove(subhier, branch);
+			sub__hier_free(branch);
 		}
 	}
 	return MOSQ_ERR_SUCCESS;
 }
 
 
-static int sub__search(struct mosquitto__subhier *subhier, char **split_topics, const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store *stored)
+/* Process the subscribers of a matching node, or if filling in a cache entry
+ * just record the node so it can be processed afterwards. */
+static int sub__search_match(struct mosquitto__subhier *branch, const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store *stored, struct sub__cache_entry *entry)
+{
+	if(entry){
+		if(branch->subs == NULL && branch->shared == NULL){
+			return MOSQ_ERR_NO_SUBSCRIBERS;
+		}
+		return sub__cache_entry_append(entry, branch);
+	}else{
+		return subs__process(branch, source_id, topic, qos, retain, stored);
+	}
+}
+
+
+static int sub__search(struct mosquitto__subhier *subhier, char **split_topics, const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store *stored, struct sub__cache_entry *entry)
 {
 	/* FIXME - need to take into account source_id if the client is a bridge */
 	struct mosquitto__subhier *branch;
 	int rc;
 	bool have_subscribers = false;
 
+	if(subhier->child_count == 0){
+		return MOSQ_ERR_NO_SUBSCRIBERS;
+	}
+
 	if(split_topics && split_topics[0]){
 		/* Check for literal match */
-		HASH_FIND(hh, subhier->children, split_topics[0], strlen(split_topics[0]), branch);
+		branch = sub__child_find(subhier, split_topics[0], strlen(split_topics[0]));
 
 		if(branch){
-			rc = sub__search(branch, &(split_topics[1]), source_id, topic, qos, retain, stored);
+			rc = sub__search(branch, &(split_topics[1]), source_id, topic, qos, retain, stored, entry);
 			if(rc == MOSQ_ERR_SUCCESS){
 				have_subscribers = true;
 			}else if(rc != MOSQ_ERR_NO_SUBSCRIBERS){
 				return rc;
 			}
 			if(split_topics[1] == NULL){ /* End of list */
-				rc = subs__process(branch, source_id, topic, qos, retain, stored);
+				rc = sub__search_match(branch, source_id, topic, qos, retain, stored, entry);
 				if(rc == MOSQ_ERR_SUCCESS){
 					have_subscribers = true;
 				}else if(rc != MOSQ_ERR_NO_SUBSCRIBERS){
@@ -496,17 +916,17 @@ static int sub__search(struct mosquitto__subhier *subhier, char **split_topics,
 		}
 
 		/* Check for + match */
-		HASH_FIND(hh, subhier->children, "+", 1, branch);
+		branch = sub__child_find(subhier, "+", 1);
 
 		if(branch){
-			rc = sub__search(branch, &(split_topics[1]), source_id, topic, qos, retain, stored);
+			rc = sub__search(branch, &(split_topics[1]), source_id, topic, qos, retain, stored, entry);
 			if(rc == MOSQ_ERR_SUCCESS){
 				have_subscribers = true;
 			}else if(rc != MOSQ_ERR_NO_SUBSCRIBERS){
 				return rc;
 			}
 			if(split_topics[1] == NULL){ /* End of list */
-				rc = subs__process(branch, source_id, topic, qos, retain, stored);
+				rc = sub__search_match(branch, source_id, topic, qos, retain, stored, entry);
 				if(rc == MOSQ_ERR_SUCCESS){
 					have_subscribers = true;
 				}else if(rc != MOSQ_ERR_NO_SUBSCRIBERS){
@@ -517,13 +937,13 @@ static int sub__search(struct mosquitto__subhier *subhier, char **split_topics,
 	}
 
 	/* Check for # match */
-	HASH_FIND(hh, subhier->children, "#", 1, branch);
+	branch = sub__child_find(subhier, "#", 1);
 	if(branch && !branch->children){
 		/* The topic matches due to a # wildcard - process the
 		 * subscriptions but *don't* return. Although this branch has ended
 		 * there may still be other subscriptions to deal with.
 		 */
-		rc = subs__process(branch, source_id, topic, qos, retain, stored);
+		rc = sub__search_match(branch, source_id, topic, qos, retain, stored, entry);
 		if(rc == MOSQ_ERR_SUCCESS){
 			have_subscribers = true;
 		}else if(rc != MOSQ_ERR_NO_SUBSCRIBERS){
@@ -539,12 +959,12 @@ static int sub__search(struct mosquitto__subhier *subhier, char **split_topics,
 }
 
 
-struct mosquitto__subhier *sub__add_hier_entry(struct mosquitto__subhier *parent, struct mosquitto__subhier **sibling, const char *topic, uint16_t len)
+/* Create a new node in the subscription tree as a child of parent. If parent
+ * is NULL, the node is the root of a new tree. */
+struct mosquitto__subhier *sub__add_hier_entry(struct mosquitto__subhier *parent, const char *topic, uint16_t len)
 {
 	struct mosquitto__subhier *child;
 
-	assert(sibling);
-
 	child = mosquitto__calloc(1, sizeof(struct mosquitto__subhier));
 	if(!child){
 		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
@@ -552,15 +972,18 @@ struct mosquitto__subhier *sub__add_hier_entry(struct mosquitto__subhier *parent
 	}
 	child->parent = parent;
 	child->topic_len = len;
-	child->topic = mosquitto__strdup(topic);
+	child->topic = sub__level_get(topic, len);
 	if(!child->topic){
-		child->topic_len = 0;
 		mosquitto__free(child);
 		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
 		return NULL;
 	}
 
-	HASH_ADD_KEYPTR(hh, *sibling, child->topic, child->topic_len, child);
+	if(parent && sub__child_add(parent, child)){
+		sub__hier_free(child);
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		return NULL;
+	}
 
 	return child;
 }
@@ -569,11 +992,9 @@ struct mosquitto__subhier *sub__add_hier_entry(struct mosquitto__subhier *parent
 int sub__add(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t identifier, int options, struct mosquitto__subhier **root)
 {
 	int rc = 0;
-	struct mosquitto__subhier *subhier;
 	const char *sharename = NULL;
 	char *local_sub;
 	char **topics;
-	size_t topiclen;
 
 	assert(root);
 	assert(*root);
@@ -582,24 +1003,8 @@ int sub__add(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t i
 	rc = sub__topic_tokenise(sub, &local_sub, &topics, &sharename);
 	if(rc) return rc;
 
-	topiclen = strlen(topics[0]);
-	if(topiclen > UINT16_MAX){
-		mosquitto__free(local_sub);
-		mosquitto__free(topics);
-		return MOSQ_ERR_INVAL;
-	}
-	HASH_FIND(hh, *root, topics[0], topiclen, subhier);
-	if(!subhier){
-		subhier = sub__add_hier_entry(NULL, root, topics[0], (uint16_t)topiclen);
-		if(!subhier){
-			mosquitto__free(local_sub);
-			mosquitto__free(topics);
-			log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
-			return MOSQ_ERR_NOMEM;
-		}
-
-	}
-	rc = sub__add_context(context, qos, identifier, options, subhier, topics, sharename);
+	sub_generation++;
+	rc = sub__add_context(context, qos, identifier, options, *root, topics, sharename);
 
 	mosquitto__free(local_sub);
 	mosquitto__free(topics);
@@ -610,7 +1015,6 @@ int sub__add(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t i
 int sub__remove(struct mosquitto *context, const char *sub, struct mosquitto__subhier *root, uint8_t *reason)
 {
 	int rc = 0;
-	struct mosquitto__subhier *subhier;
 	const char *sharename = NULL;
 	char *local_sub = NULL;
 	char **topics = NULL;
@@ -621,11 +1025,9 @@ int sub__remove(struct mosquitto *context, const char *sub, struct mosquitto__su
 	rc = sub__topic_tokenise(sub, &local_sub, &topics, &sharename);
 	if(rc) return rc;
 
-	HASH_FIND(hh, root, topics[0], strlen(topics[0]), subhier);
-	if(subhier){
-		*reason = MQTT_RC_NO_SUBSCRIPTION_EXISTED;
-		rc = sub__remove_recurse(context, subhier, topics, reason, sharename);
-	}
+	*reason = MQTT_RC_NO_SUBSCRIPTION_EXISTED;
+	sub_generation++;
+	rc = sub__remove_recurse(context, root, topics, reason, sharename);
 
 	mosquitto__free(local_sub);
 	mosquitto__free(topics);
@@ -633,10 +1035,55 @@ int sub__remove(struct mosquitto *context, const char *sub, struct mosquitto__su
 	return rc;
 }
 
+static int sub__cache_search(char **split_topics, const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store *stored)
+{
+	struct sub__cache_entry *entry;
+	bool have_subscribers = false;
+	int i;
+	int rc;
+
+	entry = sub__cache_get(topic);
+	if(!entry){
+		return sub__search(db.subs, split_topics, source_id, topic, qos, retain, stored, NULL);
+	}
+
+	if(entry->generation == sub_generation){
+#ifdef WITH_SYS_TREE
+		db.subscription_cache_hits++;
+#endif
+	}else{
+#ifdef WITH_SYS_TREE
+		db.subscription_cache_misses++;
+#endif
+		entry->node_count = 0;
+		rc = sub__search(db.subs, split_topics, source_id, topic, qos, retain, stored, entry);
+		if(rc != MOSQ_ERR_SUCCESS && rc != MOSQ_ERR_NO_SUBSCRIBERS){
+			sub__cache_entry_free(entry);
+			return sub__search(db.subs, split_topics, source_id, topic, qos, retain, stored, NULL);
+		}
+		entry->generation = sub_generation;
+	}
+
+	for(i=0; i<entry->node_count; i++){
+		rc = subs__process(entry->nodes[i], source_id, topic, qos, retain, stored);
+		if(rc == MOSQ_ERR_SUCCESS){
+			have_subscribers = true;
+		}else if(rc != MOSQ_ERR_NO_SUBSCRIBERS){
+			return rc;
+		}
+	}
+
+	if(have_subscribers){
+		return MOSQ_ERR_SUCCESS;
+	}else{
+		return MOSQ_ERR_NO_SUBSCRIBERS;
+	}
+}
+
+
 int sub__messages_queue(const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store **stored)
 {
 	int rc = MOSQ_ERR_SUCCESS, rc2;
-	struct mosquitto__subhier *subhier;
 	char **split_topics = NULL;
 	char *local_topic = NULL;
 
@@ -650,9 +1097,13 @@ int sub__messages_queue(const char *source_id, const char *topic, uint8_t qos, i
 	*/
 	db__msg_store_ref_inc(*stored);
 
-	HASH_FIND(hh, db.subs, split_topics[0], strlen(split_topics[0]), subhier);
-	if(subhier){
-		rc = sub__search(subhier, split_topics, source_id, topic, qos, retain, *stored);
+	if(db.config->subscription_cache_size > 0){
+		rc = sub__cache_search(split_topics, source_id, topic, qos, retain, *stored);
+	}else{
+		if(sub_cache){
+			sub__cache_clear();
+		}
+		rc = sub__search(db.subs, split_topics, source_id, topic, qos, retain, *stored, NULL);
 	}
 
 	if(retain){
@@ -678,14 +1129,13 @@ static struct mosquitto__subhier *tmp_remove_subs(struct mosquitto__subhier *sub
 		return NULL;
 	}
 
-	if(sub->children || sub->subs){
+	if(sub->children || sub->subs || sub->shared){
 		return NULL;
 	}
 
 	parent = sub->parent;
-	HASH_DELETE(hh, parent->children, sub);
-	mosquitto__free(sub->topic);
-	mosquitto__free(sub);
+	sub__child_remove(parent, sub);
+	sub__hier_free(sub);
 
 	if(parent->subs == NULL
 			&& parent->children == NULL
@@ -701,24 +1151,23 @@ static struct mosquitto__subhier *tmp_remove_subs(struct mosquitto__subhier *sub
 
 static int sub__clean_session_shared(struct mosquitto *context)
 {
-	int i;
-	struct mosquitto__subleaf *leaf;
+	int i, j;
+	struct mosquitto__subshared *shared;
 	struct mosquitto__subhier *hier;
 
 	for(i=0; i<context->shared_sub_count; i++){
 		if(context->shared_subs[i] == NULL){
 			continue;
 		}
-		leaf = context->shared_subs[i]->shared->subs;
-		while(leaf){
-			if(leaf->context==context){
+		shared = context->shared_subs[i]->shared;
+		for(j=0; j<shared->sub_count; j++){
+			if(shared->subs[j].context==context){
 #ifdef WITH_SYS_TREE
 				db.shared_subscription_count--;
 #endif
-				sub__remove_shared_leaf(context->shared_subs[i]->hier, context->shared_subs[i]->shared, leaf);
+				sub__remove_shared_leaf(context->shared_subs[i]->hier, shared, j);
 				break;
 			}
-			leaf = leaf->next;
 		}
 		if(context->shared_subs[i]->hier->subs == NULL
 				&& context->shared_subs[i]->hier->children == NULL
@@ -744,32 +1193,32 @@ static int sub__clean_session_shared(struct mosquitto *context)
  */
 int sub__clean_session(struct mosquitto *context)
 {
-	int i;
-	struct mosquitto__subleaf *leaf;
+	int i, j;
 	struct mosquitto__subhier *hier;
 
+	if(context->sub_count > 0 || context->shared_sub_count > 0){
+		sub_generation++;
+	}
+
 	for(i=0; i<context->sub_count; i++){
 		if(context->subs[i] == NULL){
 			continue;
 		}
-		leaf = context->subs[i]->subs;
-		while(leaf){
-			if(leaf->context==context){
+		hier = context->subs[i];
+		for(j=0; j<hier->sub_count; j++){
+			if(hier->subs[j].context==context){
 #ifdef WITH_SYS_TREE
 				db.subscription_count--;
 #endif
-				DL_DELETE(context->subs[i]->subs, leaf);
-				mosquitto__free(leaf);
+				sub__leaf_array_remove(&hier->subs, &hier->sub_count, j);
 				break;
 			}
-			leaf = leaf->next;
 		}
-		if(context->subs[i]->subs == NULL
-				&& context->subs[i]->children == NULL
-				&& context->subs[i]->shared == NULL
-				&& context->subs[i]->parent){
+		if(hier->subs == NULL
+				&& hier->children == NULL
+				&& hier->shared == NULL
+				&& hier->parent){
 
-			hier = context->subs[i];
 			context->subs[i] = NULL;
 			do{
 				hier = tmp_remove_subs(hier);
@@ -786,27 +1235,60 @@ int sub__clean_session(struct mosquitto *context)
 void sub__tree_print(struct mosquitto__subhier *root, int level)
 {
 	int i;
-	struct mosquitto__subhier *branch, *branch_tmp;
+	uint32_t j;
+	struct mosquitto__subhier *branch;
 	struct mosquitto__subleaf *leaf;
 
-	HASH_ITER(hh, root, branch, branch_tmp){
-	if(level > -1){
+	for(j=0; j<root->child_capacity; j++){
+		branch = root->children[j];
+		if(!branch) continue;
+
 		for(i=0; i<(level+2)*2; i++){
 			printf(" ");
 		}
 		printf("%s", branch->topic);
-		leaf = branch->subs;
-		while(leaf){
+		for(i=0; i<branch->sub_count; i++){
+			leaf = &branch->subs[i];
 			if(leaf->context){
 				printf(" (%s, %d)", leaf->context->id, leaf->qos);
 			}else{
 				printf(" (%s, %d)", "", leaf->qos);
 			}
-			leaf = leaf->next;
 		}
 		printf("\n");
+
+		sub__tree_print(branch, level+1);
 	}
+}
+
+
+static void sub__tree_clean_recurse(struct mosquitto__subhier *hier)
+{
+	struct mosquitto__subshared *shared, *shared_tmp;
+	uint32_t i;
 
-		sub__tree_print(branch->children, level+1);
+	for(i=0; i<hier->child_capacity; i++){
+		if(hier->children[i]){
+			sub__tree_clean_recurse(hier->children[i]);
+		}
+	}
+	HASH_ITER(hh, hier->shared, shared, shared_tmp){
+		HASH_DELETE(hh, hier->shared, shared);
+		mosquitto__free(shared->subs);
+		mosquitto__free(shared->name);
+		mosquitto__free(shared);
+	}
+	sub__hier_free(hier);
+}
+
+
+/* Free a subscription tree and everything in it. */
+void sub__tree_clean(struct mosquitto__subhier **root)
+{
+	sub__cache_clear();
+	sub_generation++;
+	if(*root){
+		sub__tree_clean_recurse(*root);
+		*root = NULL;
 	}
 }
@@ -36,6 +36,8 @@ uint64_t g_bytes_received = 0;
 uint64_t g_bytes_sent = 0;
 uint64_t g_pub_bytes_received = 0;
 uint64_t g_pub_bytes_sent = 0;
+uint64_t g_read_calls = 0;
+uint64_t g_write_calls = 0;
 unsigned long g_msgs_received = 0;
 unsigned long g_msgs_sent = 0;
 unsigned long g_pub_msgs_received = 0;
@@ -127,6 +129,48 @@ static void sys_tree__update_memory(char *buf)
 }
 #endif
 
+static void sys_tree__update_pools(char *buf)
+{
+	static const char *names[mosq_pool_count] = {"client_messages", "messages", "packets"};
+	static unsigned long last_used[mosq_pool_count] = {ULONG_MAX, ULONG_MAX, ULONG_MAX};
+	static unsigned long last_free[mosq_pool_count] = {ULONG_MAX, ULONG_MAX, ULONG_MAX};
+	unsigned long used, free_count;
+	char topic[100];
+	uint32_t len;
+	int i;
+
+	for(i=0; i<mosq_pool_count; i++){
+		memory__pool_stats((enum mosquitto__pool_type)i, &used, &free_count);
+		if(used != last_used[i]){
+			last_used[i] = used;
+			snprintf(topic, sizeof(topic), "$SYS/broker/heap/pools/%s/used", names[i]);
+			len = (uint32_t)snprintf(buf, BUFLEN, "%lu", used);
+			db__messages_easy_queue(NULL, topic, SYS_TREE_QOS, len, buf, 1, 60, NULL);
+		}
+		if(free_count != last_free[i]){
+			last_free[i] = free_count;
+			snprintf(topic, sizeof(topic), "$SYS/broker/heap/pools/%s/free", names[i]);
+			len = (uint32_t)snprintf(buf, BUFLEN, "%lu", free_count);
+			db__messages_easy_queue(NULL, topic, SYS_TREE_QOS, len, buf, 1, 60, NULL);
+		}
+	}
+}
+
+/* Publish the average number of bytes transferred per read or write call
+ * since the last update. */
+static void sys_tree__update_per_call(char *buf, const char *topic, uint64_t bytes, uint64_t calls, uint64_t *last_bytes, uint64_t *last_calls)
+{
+	uint32_t len;
+
+	if(calls != *last_calls){
+		len = (uint32_t)snprintf(buf, BUFLEN, "%.2f", (double)(bytes - *last_bytes)/(double)(calls - *last_calls));
+		db__messages_easy_queue(NULL, topic, SYS_TREE_QOS, len, buf, 1, 60, NULL);
+		*last_bytes = bytes;
+		*last_calls = calls;
+	}
+}
+
+
 static void calc_load(char *buf, const char *topic, bool initial, double exponent, double interval, double *current)
 {
 	double new_value;
@@ -169,9 +213,18 @@ void sys_tree__update(int interval, time_t start_time)
 	static unsigned long long bytes_sent = ULLONG_MAX;
 	static unsigned long long pub_bytes_received = ULLONG_MAX;
 	static unsigned long long pub_bytes_sent = ULLONG_MAX;
+	static uint64_t read_bytes = 0;
+	static uint64_t read_calls = 0;
+	static uint64_t write_bytes = 0;
+	static uint64_t write_calls = 0;
 	static int subscription_count = INT_MAX;
 	static int shared_subscription_count = INT_MAX;
+	static uint64_t subscription_cache_hits = 0;
+	static uint64_t subscription_cache_misses = 0;
 	static int retained_count = INT_MAX;
+#ifdef WITH_PERSISTENCE
+	static unsigned long persistence_save_count = 0;
+#endif
 
 	static double msgs_received_load1 = 0;
 	static double msgs_received_load5 = 0;
@@ -303,6 +356,18 @@ void sys_tree__update(int interval, time_t start_time)
 			db__messages_easy_queue(NULL, "$SYS/broker/subscriptions/count", SYS_TREE_QOS, len, buf, 1, 60, NULL);
 		}
 
+		if(db.subscription_cache_hits != subscription_cache_hits){
+			subscription_cache_hits = db.subscription_cache_hits;
+			len = (uint32_t)snprintf(buf, BUFLEN, "%llu", (unsigned long long)subscription_cache_hits);
+			db__messages_easy_queue(NULL, "$SYS/broker/subscriptions/cache/hits", SYS_TREE_QOS, len, buf, 1, 60, NULL);
+		}
+
+		if(db.subscription_cache_misses != subscription_cache_misses){
+			subscription_cache_misses = db.subscription_cache_misses;
+			len = (uint32_t)snprintf(buf, BUFLEN, "%llu", (unsigned long long)subscription_cache_misses);
+			db__messages_easy_queue(NULL, "$SYS/broker/subscriptions/cache/misses", SYS_TREE_QOS, len, buf, 1, 60, NULL);
+		}
+
 		if(db.shared_subscription_count != shared_subscription_count){
 			shared_subscription_count = db.shared_subscription_count;
 			len = (uint32_t)snprintf(buf, BUFLEN, "%d", shared_subscription_count);
@@ -318,6 +383,19 @@ void sys_tree__update(int interval, time_t start_time)
 #ifdef REAL_WITH_MEMORY_TRACKING
 		sys_tree__update_memory(buf);
 #endif
+		if(memory__pool_enabled()){
+			sys_tree__update_pools(buf);
+		}
+
+#ifdef WITH_PERSISTENCE
+		if(db.persistence_save_count != persistence_save_count){
+			persistence_save_count = db.persistence_save_count;
+			len = (uint32_t)snprintf(buf, BUFLEN, "%llu", (unsigned long long)db.persistence_save_bytes);
+			db__messages_easy_queue(NULL, "$SYS/broker/persistence/save/bytes", SYS_TREE_QOS, len, buf, 1, 60, NULL);
+			len = (uint32_t)snprintf(buf, BUFLEN, "%llu", (unsigned long long)db.persistence_save_ms);
+			db__messages_easy_queue(NULL, "$SYS/broker/persistence/save/duration", SYS_TREE_QOS, len, buf, 1, 60, NULL);
+		}
+#endif
 
 		if(msgs_received != g_msgs_received){
 			msgs_received = g_msgs_received;
@@ -360,6 +438,9 @@ void sys_tree__update(int interval, time_t start_time)
 			len = (uint32_t)snprintf(buf, BUFLEN, "%llu", bytes_sent);
 			db__messages_easy_queue(NULL, "$SYS/broker/bytes/sent", SYS_TREE_QOS, len, buf, 1, 60, NULL);
 		}
+
+		sys_tree__update_per_call(buf, "$SYS/broker/bytes/received/per_call", g_bytes_received, g_read_calls, &read_bytes, &read_calls);
+		sys_tree__update_per_call(buf, "$SYS/broker/bytes/sent/per_call", g_bytes_sent, g_write_calls, &write_bytes, &write_calls);
 		
 		if(pub_bytes_received != g_pub_bytes_received){
 			pub_bytes_received = g_pub_bytes_received;
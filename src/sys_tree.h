@@ -24,6 +24,8 @@ extern uint64_t g_bytes_received;
 extern uint64_t g_bytes_sent;
 extern uint64_t g_pub_bytes_received;
 extern uint64_t g_pub_bytes_sent;
+extern uint64_t g_read_calls;
+extern uint64_t g_write_calls;
 extern unsigned long g_msgs_received;
 extern unsigned long g_msgs_sent;
 extern unsigned long g_pub_msgs_received;
@@ -37,6 +39,8 @@ extern unsigned int g_connection_count;
 #define G_BYTES_SENT_INC(A) (g_bytes_sent+=(uint64_t)(A))
 #define G_PUB_BYTES_RECEIVED_INC(A) (g_pub_bytes_received+=(A))
 #define G_PUB_BYTES_SENT_INC(A) (g_pub_bytes_sent+=(A))
+#define G_READ_CALLS_INC(A) (g_read_calls+=(uint64_t)(A))
+#define G_WRITE_CALLS_INC(A) (g_write_calls+=(uint64_t)(A))
 #define G_MSGS_RECEIVED_INC(A) (g_msgs_received+=(A))
 #define G_MSGS_SENT_INC(A) (g_msgs_sent+=(A))
 #define G_PUB_MSGS_RECEIVED_INC(A) (g_pub_msgs_received+=(A))
@@ -52,6 +56,8 @@ extern unsigned int g_connection_count;
 #define G_BYTES_SENT_INC(A)
 #define G_PUB_BYTES_RECEIVED_INC(A)
 #define G_PUB_BYTES_SENT_INC(A)
+#define G_READ_CALLS_INC(A)
+#define G_WRITE_CALLS_INC(A)
 #define G_MSGS_RECEIVED_INC(A)
 #define G_MSGS_SENT_INC(A)
 #define G_PUB_MSGS_RECEIVED_INC(A)
@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2021 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+ 
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+ 
+SPDX-License-Identifier: EPL-2.0 OR EDL-1.0
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+#include "config.h"
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+
+/* A binary min-heap of timers, ordered by time and then by the order they
+ * were added, so timers that are due at the same time fire in the order they
+ * were added. Each timer records its position in the heap, so any timer can
+ * be removed in O(log n), not just the earliest.
+ *
+ * Timers are owned by the caller, the heap only holds pointers to them.
+ */
+
+static bool timer_heap__less(struct mosquitto__timer *t1, struct mosquitto__timer *t2)
+{
+	if(t1->time == t2->time){
+		return t1->seq < t2->seq;
+	}else{
+		return t1->time < t2->time;
+	}
+}
+
+
+/* The heap is stored in timers[1..count], so the parent of i is i/2. */
+static void timer_heap__set(struct mosquitto__timer_heap *heap, size_t i, struct mosquitto__timer *timer)
+{
+	heap->timers[i] = timer;
+	timer->index = i;
+}
+
+
+static void timer_heap__sift_up(struct mosquitto__timer_heap *heap, size_t i)
+{
+	struct mosquitto__timer *timer = heap->timers[i];
+
+	while(i > 1 && timer_heap__less(timer, heap->timers[i/2])){
+		timer_heap__set(heap, i, heap->timers[i/2]);
+		i /= 2;
+	}
+	timer_heap__set(heap, i, timer);
+}
+
+
+static void timer_heap__sift_down(struct mosquitto__timer_heap *heap, size_t i)
+{
+	struct mosquitto__timer *timer = heap->timers[i];
+	size_t child;
+
+	while(i*2 <= heap->count){
+		child = i*2;
+		if(child < heap->count && timer_heap__less(heap->timers[child+1], heap->timers[child])){
+			child++;
+		}
+		if(!timer_heap__less(heap->timers[child], timer)){
+			break;
+		}
+		timer_heap__set(heap, i, heap->timers[child]);
+		i = child;
+	}
+	timer_heap__set(heap, i, timer);
+}
+
+
+int timer_heap__add(struct mosquitto__timer_heap *heap, struct mosquitto__timer *timer)
+{
+	struct mosquitto__timer **timers;
+	size_t capacity;
+
+	if(timer->index != 0){
+		timer_heap__remove(heap, timer);
+	}
+
+	if(heap->count+1 >= heap->capacity){
+		capacity = heap->capacity?heap->capacity*2:64;
+		timers = mosquitto__realloc(heap->timers, capacity*sizeof(struct mosquitto__timer *));
+		if(!timers) return MOSQ_ERR_NOMEM;
+		heap->timers = timers;
+		heap->capacity = capacity;
+	}
+
+	timer->seq = heap->next_seq++;
+	heap->count++;
+	timer_heap__set(heap, heap->count, timer);
+	timer_heap__sift_up(heap, heap->count);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void timer_heap__remove(struct mosquitto__timer_heap *heap, struct mosquitto__timer *timer)
+{
+	struct mosquitto__timer *last;
+	size_t i = timer->index;
+
+	if(i == 0 || i > heap->count || heap->timers[i] != timer){
+		return;
+	}
+
+	timer->index = 0;
+	last = heap->timers[heap->count];
+	heap->timers[heap->count] = NULL;
+	heap->count--;
+
+	if(last != timer){
+		timer_heap__set(heap, i, last);
+		if(i > 1 && timer_heap__less(last, heap->timers[i/2])){
+			timer_heap__sift_up(heap, i);
+		}else{
+			timer_heap__sift_down(heap, i);
+		}
+	}
+}
+
+
+struct mosquitto__timer *timer_heap__peek(struct mosquitto__timer_heap *heap)
+{
+	if(heap->count == 0){
+		return NULL;
+	}
+	return heap->timers[1];
+}
+
+
+void timer_heap__cleanup(struct mosquitto__timer_heap *heap)
+{
+	size_t i;
+
+	for(i=1; i<=heap->count; i++){
+		heap->timers[i]->index = 0;
+	}
+	mosquitto__free(heap->timers);
+	heap->timers = NULL;
+	heap->count = 0;
+	heap->capacity = 0;
+}
@@ -177,6 +177,7 @@ static int callback_mqtt(
 			mosq->sock = lws_get_socket_fd(wsi);
 			HASH_ADD(hh_sock, db.contexts_by_sock, sock, sizeof(mosq->sock), mosq);
 			mux__add_in(mosq);
+			keepalive__add(mosq);
 			break;
 
 		case LWS_CALLBACK_CLOSED:
@@ -281,7 +282,7 @@ static int callback_mqtt(
 				}
 
 				packet__cleanup(packet);
-				mosquitto__free(packet);
+				mosquitto__pool_free(mosq_pool_packet, packet);
 
 				mosq->next_msg_out = db.now_s + mosq->keepalive;
 			}
@@ -304,6 +305,7 @@ static int callback_mqtt(
 			pos = 0;
 			buf = (uint8_t *)in;
 			G_BYTES_RECEIVED_INC(len);
+			G_READ_CALLS_INC(1);
 			while(pos < len){
 				if(!mosq->in_packet.command){
 					mosq->in_packet.command = buf[pos];
@@ -335,7 +337,7 @@ static int callback_mqtt(
 					mosq->in_packet.remaining_count = (int8_t)(mosq->in_packet.remaining_count * -1);
 
 					if(mosq->in_packet.remaining_length > 0){
-						mosq->in_packet.payload = mosquitto__malloc(mosq->in_packet.remaining_length*sizeof(uint8_t));
+						mosq->in_packet.payload = mosquitto__malloc((mosq->in_packet.remaining_length+1)*sizeof(uint8_t));
 						if(!mosq->in_packet.payload){
 							return -1;
 						}
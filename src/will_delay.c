@@ -20,86 +20,65 @@ Contributors:
 
 #include <math.h>
 #include <stdio.h>
-#include <utlist.h>
 
 #include "mosquitto_broker_internal.h"
 #include "memory_mosq.h"
 #include "time_mosq.h"
 
-static struct will_delay_list *delay_list = NULL;
+static struct mosquitto__timer_heap delay_heap;
 static time_t last_check = 0;
 
 
-static int will_delay__cmp(struct will_delay_list *i1, struct will_delay_list *i2)
-{
-	return (int)(i1->context->will_delay_interval - i2->context->will_delay_interval);
-}
-
-
 int will_delay__add(struct mosquitto *context)
 {
-	struct will_delay_list *item;
-
-	item = mosquitto__calloc(1, sizeof(struct will_delay_list));
-	if(!item) return MOSQ_ERR_NOMEM;
+	context->will_delay_time = db.now_real_s + context->will_delay_interval;
+	context->will_delay_timer.context = context;
+	context->will_delay_timer.time = context->will_delay_time;
 
-	item->context = context;
-	context->will_delay_entry = item;
-	item->context->will_delay_time = db.now_real_s + item->context->will_delay_interval;
-
-	DL_INSERT_INORDER(delay_list, item, will_delay__cmp);
-
-	return MOSQ_ERR_SUCCESS;
+	/* If the client is already waiting, this replaces its entry. */
+	return timer_heap__add(&delay_heap, &context->will_delay_timer);
 }
 
 
 /* Call on broker shutdown only */
 void will_delay__send_all(void)
 {
-	struct will_delay_list *item, *tmp;
-
-	DL_FOREACH_SAFE(delay_list, item, tmp){
-		DL_DELETE(delay_list, item);
-		item->context->will_delay_interval = 0;
-		item->context->will_delay_entry = NULL;
-		context__send_will(item->context);
-		mosquitto__free(item);
+	struct mosquitto__timer *timer;
+	struct mosquitto *context;
+
+	while((timer = timer_heap__peek(&delay_heap)) != NULL){
+		context = timer->context;
+		timer_heap__remove(&delay_heap, timer);
+		context->will_delay_interval = 0;
+		context__send_will(context);
 	}
-	
+	timer_heap__cleanup(&delay_heap);
 }
 
 void will_delay__check(void)
 {
-	struct will_delay_list *item, *tmp;
+	struct mosquitto__timer *timer;
+	struct mosquitto *context;
 
 	if(db.now_real_s <= last_check) return;
 
 	last_check = db.now_real_s;
 
-	DL_FOREACH_SAFE(delay_list, item, tmp){
-		if(item->context->will_delay_time < db.now_real_s){
-			DL_DELETE(delay_list, item);
-			item->context->will_delay_interval = 0;
-			item->context->will_delay_entry = NULL;
-			context__send_will(item->context);
-			if(item->context->session_expiry_interval == 0){
-				context__add_to_disused(item->context);
-			}
-			mosquitto__free(item);
-		}else{
-			return;
+	while((timer = timer_heap__peek(&delay_heap)) != NULL
+			&& timer->time < db.now_real_s){
+
+		context = timer->context;
+		timer_heap__remove(&delay_heap, timer);
+		context->will_delay_interval = 0;
+		context__send_will(context);
+		if(context->session_expiry_interval == 0){
+			context__add_to_disused(context);
 		}
 	}
-	
 }
 
 
 void will_delay__remove(struct mosquitto *mosq)
 {
-	if(mosq->will_delay_entry != NULL){
-		DL_DELETE(delay_list, mosq->will_delay_entry);
-		mosquitto__free(mosq->will_delay_entry);
-		mosq->will_delay_entry = NULL;
-	}
+	timer_heap__remove(&delay_heap, &mosq->will_delay_timer);
 }
-
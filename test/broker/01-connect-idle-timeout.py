@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+
+# Test whether a client that opens a connection but never sends a CONNECT is
+# disconnected once it has exceeded 1.5x the default keepalive of 60s.
+
+from mosq_test_helper import *
+
+def do_test():
+    rc = 1
+
+    port = mosq_test.get_port()
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port)
+
+    try:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        sock.settimeout(120)
+        sock.connect(("localhost", port))
+        start = time.time()
+
+        try:
+            data = sock.recv(1)
+        except ConnectionResetError:
+            data = b""
+        except socket.timeout:
+            data = None
+
+        if data is None:
+            print("FAIL: Idle client not disconnected.")
+        elif len(data) != 0:
+            print("FAIL: Unexpected data from broker.")
+        elif time.time() - start < 85:
+            print("FAIL: Idle client disconnected after %.1fs." % (time.time() - start))
+        else:
+            rc = 0
+
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
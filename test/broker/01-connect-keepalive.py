@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+
+# Test whether a client that exceeds 1.5x its keepalive is disconnected
+# promptly, and that a client that keeps sending packets is not.
+
+from mosq_test_helper import *
+
+def do_test():
+    rc = 1
+    keepalive = 2
+    idle_connect_packet = mosq_test.gen_connect("keepalive-idle", keepalive=keepalive)
+    active_connect_packet = mosq_test.gen_connect("keepalive-active", keepalive=keepalive)
+    connack_packet = mosq_test.gen_connack(rc=0)
+
+    port = mosq_test.get_port()
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port)
+
+    try:
+        idle = mosq_test.do_client_connect(idle_connect_packet, connack_packet, port=port)
+        active = mosq_test.do_client_connect(active_connect_packet, connack_packet, port=port)
+        start = time.time()
+
+        # The idle client must be disconnected after 3s, and within 1s of that.
+        idle.settimeout(0.5)
+        disconnected = None
+        while time.time() - start < 6:
+            mosq_test.do_ping(active)
+            try:
+                data = idle.recv(1)
+                if len(data) == 0:
+                    disconnected = time.time() - start
+                    break
+            except socket.timeout:
+                pass
+            except ConnectionResetError:
+                disconnected = time.time() - start
+                break
+
+        if disconnected is None:
+            print("FAIL: Idle client not disconnected.")
+        elif disconnected < 2.5 or disconnected > 4.5:
+            print("FAIL: Idle client disconnected after %.1fs." % (disconnected))
+        else:
+            mosq_test.do_ping(active)
+            rc = 0
+
+        idle.close()
+        active.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
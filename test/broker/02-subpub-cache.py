@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+
+# Test whether messages are delivered correctly when the subscription cache is
+# enabled. The cache only holds one topic, so publishing to a second topic
+# evicts the first. Adding and removing subscriptions must be seen by the next
+# publish to a topic that is already cached, and shared subscriptions must
+# still alternate between their members.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("subscription_cache_size 1\n")
+
+def do_test():
+    rc = 1
+    keepalive = 60
+
+    connect1_packet = mosq_test.gen_connect("cache-sub1", keepalive=keepalive, proto_ver=5)
+    connect2_packet = mosq_test.gen_connect("cache-sub2", keepalive=keepalive, proto_ver=5)
+    connect3_packet = mosq_test.gen_connect("cache-sub3", keepalive=keepalive, proto_ver=5)
+    connect_pub_packet = mosq_test.gen_connect("cache-pub", keepalive=keepalive, proto_ver=5)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=5)
+
+    subscribe1_packet = mosq_test.gen_subscribe(1, "cache/+/a", 0, proto_ver=5)
+    subscribe2_packet = mosq_test.gen_subscribe(1, "cache/#", 0, proto_ver=5)
+    suback_packet = mosq_test.gen_suback(1, 0, proto_ver=5)
+
+    unsubscribe1_packet = mosq_test.gen_unsubscribe(2, "cache/+/a", proto_ver=5)
+    unsuback1_packet = mosq_test.gen_unsuback(2, proto_ver=5)
+
+    subscribe_shared_packet = mosq_test.gen_subscribe(3, "$share/group/cache/shared", 0, proto_ver=5)
+    suback_shared_packet = mosq_test.gen_suback(3, 0, proto_ver=5)
+
+    publish1_packet = mosq_test.gen_publish("cache/1/a", qos=0, payload="message", proto_ver=5)
+    publish2_packet = mosq_test.gen_publish("cache/2/a", qos=0, payload="message", proto_ver=5)
+    publish_shared_packet = mosq_test.gen_publish("cache/shared", qos=0, payload="shared", proto_ver=5)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock1 = mosq_test.do_client_connect(connect1_packet, connack_packet, timeout=5, port=port)
+        mosq_test.do_send_receive(sock1, subscribe1_packet, suback_packet, "suback1")
+
+        pub = mosq_test.do_client_connect(connect_pub_packet, connack_packet, timeout=5, port=port)
+
+        # Miss, then hit
+        pub.send(publish1_packet)
+        mosq_test.expect_packet(sock1, "publish1a", publish1_packet)
+        pub.send(publish1_packet)
+        mosq_test.expect_packet(sock1, "publish1b", publish1_packet)
+
+        # Evict cache/1/a, then look it up again
+        pub.send(publish2_packet)
+        mosq_test.expect_packet(sock1, "publish2", publish2_packet)
+        pub.send(publish1_packet)
+        mosq_test.expect_packet(sock1, "publish1c", publish1_packet)
+
+        # A new subscription must be seen for the cached topic
+        sock2 = mosq_test.do_client_connect(connect2_packet, connack_packet, timeout=5, port=port)
+        mosq_test.do_send_receive(sock2, subscribe2_packet, suback_packet, "suback2")
+        pub.send(publish1_packet)
+        mosq_test.expect_packet(sock1, "publish1d", publish1_packet)
+        mosq_test.expect_packet(sock2, "publish1e", publish1_packet)
+
+        # So must a removed one
+        mosq_test.do_send_receive(sock1, unsubscribe1_packet, unsuback1_packet, "unsuback1")
+        pub.send(publish1_packet)
+        mosq_test.expect_packet(sock2, "publish1f", publish1_packet)
+        mosq_test.do_ping(sock1)
+
+        # Shared subscriptions alternate between members on cache hits
+        mosq_test.do_send_receive(sock1, subscribe_shared_packet, suback_shared_packet, "suback_shared1")
+        sock3 = mosq_test.do_client_connect(connect3_packet, connack_packet, timeout=5, port=port)
+        mosq_test.do_send_receive(sock3, subscribe_shared_packet, suback_shared_packet, "suback_shared3")
+        mosq_test.do_ping(sock2)
+
+        pub.send(publish_shared_packet)
+        mosq_test.expect_packet(sock2, "publish_shared2a", publish_shared_packet)
+        pub.send(publish_shared_packet)
+        mosq_test.expect_packet(sock2, "publish_shared2b", publish_shared_packet)
+        mosq_test.expect_packet(sock1, "publish_shared1", publish_shared_packet)
+        mosq_test.expect_packet(sock3, "publish_shared3", publish_shared_packet)
+        mosq_test.do_ping(sock1)
+        mosq_test.do_ping(sock3)
+
+        rc = 0
+
+        sock1.close()
+        sock2.close()
+        sock3.close()
+        pub.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
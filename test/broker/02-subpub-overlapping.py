@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+
+# Test whether clients with overlapping subscriptions receive the correct
+# number of copies of a message. MQTT v3.1.1 clients should receive a single
+# copy, MQTT v5 clients one copy per matching subscription.
+
+from mosq_test_helper import *
+
+def do_test():
+    rc = 1
+    keepalive = 60
+    topics = ["overlap/#", "overlap/+", "overlap/a"]
+
+    port = mosq_test.get_port()
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port)
+
+    try:
+        socks = []
+        for proto_ver in [4, 4, 5]:
+            client_id = "overlap-%d-%d" % (proto_ver, len(socks))
+            connect_packet = mosq_test.gen_connect(client_id, keepalive=keepalive, proto_ver=proto_ver)
+            connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+            sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=5, port=port)
+
+            mid = 1
+            for topic in topics:
+                subscribe_packet = mosq_test.gen_subscribe(mid, topic, 0, proto_ver=proto_ver)
+                suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+                mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+                mid += 1
+            socks.append((sock, proto_ver))
+
+        pub_connect_packet = mosq_test.gen_connect("overlap-pub", keepalive=keepalive)
+        pub_connack_packet = mosq_test.gen_connack(rc=0)
+        pub = mosq_test.do_client_connect(pub_connect_packet, pub_connack_packet, timeout=5, port=port)
+
+        for payload in ["message1", "message2"]:
+            pub.send(mosq_test.gen_publish("overlap/a", qos=0, payload=payload))
+
+            for (sock, proto_ver) in socks:
+                publish_packet = mosq_test.gen_publish("overlap/a", qos=0, payload=payload, proto_ver=proto_ver)
+                if proto_ver == 5:
+                    copies = len(topics)
+                else:
+                    copies = 1
+                for i in range(0, copies):
+                    mosq_test.expect_packet(sock, "publish", publish_packet)
+
+        # Nothing else should have been sent
+        for (sock, proto_ver) in socks:
+            mosq_test.do_ping(sock)
+
+        rc = 0
+
+        for (sock, proto_ver) in socks:
+            sock.close()
+        pub.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+
+# Does the broker respect receive maximum when messages are acknowledged out of
+# order, and match each PUBACK to the right message?
+# MQTT v5
+
+from mosq_test_helper import *
+
+def do_test():
+    rc = 1
+    keepalive = 60
+    props = mqtt5_props.gen_uint16_prop(mqtt5_props.PROP_RECEIVE_MAXIMUM, 4)
+    connect_packet = mosq_test.gen_connect("subpub-qos1-test", keepalive=keepalive, proto_ver=5, properties=props)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=5)
+
+    subscribe_packet = mosq_test.gen_subscribe(1, "subpub/qos1", 1, proto_ver=5)
+    suback_packet = mosq_test.gen_suback(1, 1, proto_ver=5)
+
+    pub_connect_packet = mosq_test.gen_connect("subpub-qos1-pub", keepalive=keepalive, proto_ver=5)
+
+    port = mosq_test.get_port()
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=20, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+        pub = mosq_test.do_client_connect(pub_connect_packet, connack_packet, timeout=20, port=port)
+        for mid in range(1, 9):
+            publish_packet = mosq_test.gen_publish("subpub/qos1", qos=1, mid=mid, payload="message%d" % (mid), proto_ver=5)
+            puback_packet = mosq_test.gen_puback(mid, proto_ver=5)
+            mosq_test.do_send_receive(pub, publish_packet, puback_packet, "puback%d" % (mid))
+
+        # Only four messages may be in flight
+        for mid in range(1, 5):
+            publish_packet = mosq_test.gen_publish("subpub/qos1", qos=1, mid=mid, payload="message%d" % (mid), proto_ver=5)
+            mosq_test.expect_packet(sock, "publish%d" % (mid), publish_packet)
+
+        # An unknown mid releases nothing, each known mid releases one message
+        sock.send(mosq_test.gen_puback(100, proto_ver=5))
+        for (ack_mid, mid) in [(3, 5), (1, 6), (4, 7), (6, 8)]:
+            sock.send(mosq_test.gen_puback(ack_mid, proto_ver=5))
+            publish_packet = mosq_test.gen_publish("subpub/qos1", qos=1, mid=mid, payload="message%d" % (mid), proto_ver=5)
+            mosq_test.expect_packet(sock, "publish%d" % (mid), publish_packet)
+
+        # Acknowledging a message twice releases nothing further
+        sock.send(mosq_test.gen_puback(3, proto_ver=5))
+        mosq_test.do_ping(sock)
+
+        rc = 0
+
+        sock.close()
+        pub.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+
+# Test whether a large message published to several subscribers with different
+# protocol versions and QoS is delivered intact to each of them. One
+# subscriber delays reading, so the broker has to finish writing to it after
+# the publisher has gone and the message has been removed from the other
+# clients.
+
+from mosq_test_helper import *
+
+def expect_packets(sock, name, expected):
+    received = b""
+    while len(received) < len(expected):
+        data = sock.recv(len(expected) - len(received))
+        if len(data) == 0:
+            break
+        received += data
+    if received != expected:
+        print("FAIL: Received incorrect %s (%d of %d bytes)." % (name, len(received), len(expected)))
+        raise mosq_test.TestError
+
+def do_test():
+    rc = 1
+    keepalive = 60
+    payload = "0123456789abcdef"*60000
+
+    subscribers = []
+    for (proto_ver, qos) in [(3, 0), (4, 1), (5, 2)]:
+        client_id = "fanout-sub-%d" % (proto_ver)
+        connect_packet = mosq_test.gen_connect(client_id, keepalive=keepalive, proto_ver=proto_ver)
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+        subscribe_packet = mosq_test.gen_subscribe(1, "fanout/shared", qos, proto_ver=proto_ver)
+        suback_packet = mosq_test.gen_suback(1, qos, proto_ver=proto_ver)
+        publish_packet = mosq_test.gen_publish("fanout/shared", qos=min(qos, 1), mid=1, payload=payload, proto_ver=proto_ver)
+        subscribers.append((connect_packet, connack_packet, subscribe_packet, suback_packet, publish_packet))
+
+    pub_connect_packet = mosq_test.gen_connect("fanout-pub", keepalive=keepalive, proto_ver=4)
+    pub_connack_packet = mosq_test.gen_connack(rc=0, proto_ver=4)
+    pub_publish_packet = mosq_test.gen_publish("fanout/shared", qos=1, mid=1, payload=payload, proto_ver=4)
+    pub_puback_packet = mosq_test.gen_puback(1, proto_ver=4)
+
+    port = mosq_test.get_port()
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port)
+
+    try:
+        socks = []
+        for (connect_packet, connack_packet, subscribe_packet, suback_packet, publish_packet) in subscribers:
+            sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+            mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+            socks.append(sock)
+
+        pub_sock = mosq_test.do_client_connect(pub_connect_packet, pub_connack_packet, port=port)
+        pub_sock.sendall(pub_publish_packet)
+        mosq_test.expect_packet(pub_sock, "puback", pub_puback_packet)
+        pub_sock.close()
+
+        for i in range(0, 2):
+            expect_packets(socks[i], "publish %d" % (i), subscribers[i][4])
+
+        # Give the broker time to complete the message flow for the other
+        # clients before the last one starts reading.
+        socks[1].send(mosq_test.gen_puback(1, proto_ver=4))
+        time.sleep(0.5)
+        expect_packets(socks[2], "publish 2", subscribers[2][4])
+
+        rc = 0
+
+        for sock in socks:
+            sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+
+# Test whether messages are delivered correctly with memory_pools enabled,
+# including messages queued for an offline client and messages removed from a
+# client's queue when it reconnects with a username that the ACL denies.
+
+from mosq_test_helper import *
+
+def write_config(filename, port, acl_file):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("memory_pools true\n")
+        f.write("acl_file %s\n" % (acl_file))
+
+def write_acl(filename):
+    with open(filename, 'w') as f:
+        f.write("topic readwrite pools/#\n")
+        f.write("\n")
+        f.write("user denied\n")
+        f.write("topic write pools/#\n")
+
+def do_test():
+    rc = 1
+    keepalive = 60
+
+    sub_connect_packet = mosq_test.gen_connect("pools-sub", keepalive=keepalive, clean_session=False, proto_ver=4)
+    sub_denied_connect_packet = mosq_test.gen_connect("pools-sub", keepalive=keepalive, clean_session=False, username="denied", proto_ver=4)
+    sub_connack_packet = mosq_test.gen_connack(rc=0, proto_ver=4)
+    sub_connack_present_packet = mosq_test.gen_connack(rc=0, flags=1, proto_ver=4)
+
+    subscribe_packet = mosq_test.gen_subscribe(1, "pools/#", 1, proto_ver=4)
+    suback_packet = mosq_test.gen_suback(1, 1, proto_ver=4)
+
+    pub_connect_packet = mosq_test.gen_connect("pools-pub", keepalive=keepalive, proto_ver=4)
+    pub_connack_packet = mosq_test.gen_connack(rc=0, proto_ver=4)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    acl_file = os.path.basename(__file__).replace('.py', '.acl')
+    write_config(conf_file, port, acl_file)
+    write_acl(acl_file)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(sub_connect_packet, sub_connack_packet, timeout=5, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+        sock.close()
+
+        pub = mosq_test.do_client_connect(pub_connect_packet, pub_connack_packet, timeout=5, port=port)
+        for mid in range(1, 21):
+            publish_packet = mosq_test.gen_publish("pools/%d" % (mid), qos=1, mid=mid, payload="message %d" % (mid), proto_ver=4)
+            puback_packet = mosq_test.gen_puback(mid, proto_ver=4)
+            mosq_test.do_send_receive(pub, publish_packet, puback_packet, "puback %d" % (mid))
+
+        # Reconnect and receive the queued messages, but don't acknowledge them
+        sock = mosq_test.do_client_connect(sub_connect_packet, sub_connack_present_packet, timeout=5, port=port)
+        for mid in range(1, 21):
+            publish_packet = mosq_test.gen_publish("pools/%d" % (mid), qos=1, mid=mid, payload="message %d" % (mid), proto_ver=4)
+            mosq_test.expect_packet(sock, "publish %d" % (mid), publish_packet)
+        sock.close()
+
+        # Reconnect as a user that can't read the messages, so they are
+        # removed from the session.
+        sock = mosq_test.do_client_connect(sub_denied_connect_packet, sub_connack_present_packet, timeout=5, port=port)
+        mosq_test.do_ping(sock)
+        sock.close()
+
+        # Messages still flow normally afterwards
+        sock = mosq_test.do_client_connect(sub_connect_packet, sub_connack_present_packet, timeout=5, port=port)
+        mosq_test.do_ping(sock)
+        publish_packet = mosq_test.gen_publish("pools/final", qos=1, mid=21, payload="final", proto_ver=4)
+        puback_packet = mosq_test.gen_puback(21, proto_ver=4)
+        mosq_test.do_send_receive(pub, publish_packet, puback_packet, "puback final")
+        mosq_test.expect_packet(sock, "publish final", publish_packet)
+
+        rc = 0
+
+        sock.close()
+        pub.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(acl_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
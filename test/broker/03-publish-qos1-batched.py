@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+
+# Test whether the broker correctly handles packets that arrive together in a
+# single read, packets that are split across reads, and payloads that are
+# larger than the packet buffer. A small packet_buffer_size is used so that
+# packets regularly straddle the end of the buffer. This is repeated with
+# different values of max_packets_per_read, so that reading stops part way
+# through packets and resumes on the next pass of the event loop.
+
+from mosq_test_helper import *
+
+def write_config(filename, port, max_packets_per_read):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("packet_buffer_size 20\n")
+        f.write("max_packets_per_read %d\n" % (max_packets_per_read))
+
+def expect_packets(sock, name, expected):
+    # The responses to a batch may not all arrive in a single recv()
+    received = b""
+    while len(received) < len(expected):
+        data = sock.recv(len(expected) - len(received))
+        if len(data) == 0:
+            break
+        received += data
+    if received != expected:
+        print("FAIL: Received incorrect %s." % (name))
+        raise mosq_test.TestError
+
+def do_test(proto_ver, max_packets_per_read):
+    rc = 1
+    keepalive = 60
+    connect_packet = mosq_test.gen_connect("pub-qos1-batched", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    if proto_ver == 5:
+        reason_code = mqtt5_rc.MQTT_RC_NO_MATCHING_SUBSCRIBERS
+    else:
+        reason_code = 0
+
+    publish_packets = b""
+    puback_packets = b""
+    for mid in range(1, 51):
+        publish_packets += mosq_test.gen_publish("pub/qos1/batched", qos=1, mid=mid, payload="message %d" % (mid), proto_ver=proto_ver)
+        puback_packets += mosq_test.gen_puback(mid, proto_ver=proto_ver, reason_code=reason_code)
+
+    mid = 51
+    publish_large_packet = mosq_test.gen_publish("pub/qos1/batched", qos=1, mid=mid, payload="x"*5000, proto_ver=proto_ver)
+    puback_large_packet = mosq_test.gen_puback(mid, proto_ver=proto_ver, reason_code=reason_code)
+
+    mid = 52
+    publish_split_packet = mosq_test.gen_publish("pub/qos1/batched", qos=1, mid=mid, payload="message", proto_ver=proto_ver)
+    puback_split_packet = mosq_test.gen_puback(mid, proto_ver=proto_ver, reason_code=reason_code)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port, max_packets_per_read)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port, use_conf=True)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+
+        # Many packets in a single write
+        sock.send(publish_packets)
+        expect_packets(sock, "puback batch", puback_packets)
+
+        # Payload larger than the packet buffer
+        mosq_test.do_send_receive(sock, publish_large_packet, puback_large_packet, "puback large")
+
+        # One byte at a time
+        for i in range(len(publish_split_packet)):
+            sock.send(publish_split_packet[i:i+1])
+            time.sleep(0.01)
+        mosq_test.expect_packet(sock, "puback split", puback_split_packet)
+
+        rc = 0
+
+        sock.close()
+
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d max_packets_per_read=%d" % (proto_ver, max_packets_per_read))
+            exit(rc)
+
+
+for max_packets_per_read in [1, 3, 0]:
+    do_test(proto_ver=4, max_packets_per_read=max_packets_per_read)
+    do_test(proto_ver=5, max_packets_per_read=max_packets_per_read)
+exit(0)
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+
+# Test whether retained messages evicted to the retained message store by
+# max_retained_messages and max_retained_bytes are delivered correctly, after
+# being replaced or cleared, and after being saved to and restored from the
+# persistence database.
+
+from mosq_test_helper import *
+
+RETAINED_COUNT = 200
+
+def write_config(filename, port, persistence_file):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("max_retained_messages 20\n")
+        f.write("max_retained_bytes 100000\n")
+        f.write("persistence true\n")
+        f.write("persistence_file %s\n" % (persistence_file))
+
+def recv_exact(sock, length):
+    data = b""
+    while len(data) < length:
+        chunk = sock.recv(length - len(data))
+        if len(chunk) == 0:
+            print("FAIL: Connection closed.")
+            raise mosq_test.TestError
+        data += chunk
+    return data
+
+def read_publish(sock):
+    cmd, = struct.unpack("!B", recv_exact(sock, 1))
+    if cmd != 0x31:
+        print("FAIL: Expected retained PUBLISH, got command 0x%02X." % (cmd))
+        raise mosq_test.TestError
+
+    rl = 0
+    multiplier = 1
+    while True:
+        byte, = struct.unpack("!B", recv_exact(sock, 1))
+        rl += (byte & 127)*multiplier
+        multiplier *= 128
+        if byte & 128 == 0:
+            break
+
+    packet = recv_exact(sock, rl)
+    slen, = struct.unpack("!H", packet[0:2])
+    return (packet[2:2+slen].decode('utf-8'), packet[2+slen:].decode('utf-8'))
+
+def payload_for(i, generation):
+    # Every tenth message is large enough to exceed max_retained_bytes alone.
+    if i % 10 == 0:
+        return ("%d-%d:" % (generation, i)) + "x"*150000
+    else:
+        return "%d-%d" % (generation, i)
+
+def publish(port, messages):
+    connect_packet = mosq_test.gen_connect("evict-pub")
+    connack_packet = mosq_test.gen_connack(rc=0)
+
+    sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=20, port=port)
+    mid = 1
+    for topic in sorted(messages):
+        publish_packet = mosq_test.gen_publish(topic, qos=1, mid=mid, payload=messages[topic], retain=True)
+        puback_packet = mosq_test.gen_puback(mid)
+        sock.send(publish_packet)
+        if recv_exact(sock, len(puback_packet)) != puback_packet:
+            print("FAIL: Incorrect PUBACK.")
+            raise mosq_test.TestError
+        mid += 1
+    sock.close()
+
+def check_retained(port, expected):
+    connect_packet = mosq_test.gen_connect("evict-check")
+    connack_packet = mosq_test.gen_connack(rc=0)
+    subscribe_packet = mosq_test.gen_subscribe(1, "evict/#", 0)
+    suback_packet = mosq_test.gen_suback(1, 0)
+
+    sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=20, port=port)
+    mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+    received = {}
+    for i in range(len(expected)):
+        (topic, payload) = read_publish(sock)
+        received[topic] = payload
+    mosq_test.do_ping(sock)
+    sock.close()
+
+    if received != expected:
+        print("FAIL: Incorrect retained messages (%d of %d)." % (len(received), len(expected)))
+        raise mosq_test.TestError
+
+def do_test():
+    rc = 1
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    persistence_file = os.path.basename(__file__).replace('.py', '.db')
+    store_file = persistence_file + ".retained"
+    try:
+        os.remove(persistence_file)
+    except OSError:
+        pass
+    write_config(conf_file, port, persistence_file)
+    # Not verbose, the log would fill the pipe before anything reads it.
+    cmd = ['../../src/mosquitto', '-c', conf_file]
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), cmd=cmd, port=port)
+
+    try:
+        expected = {}
+        for i in range(RETAINED_COUNT):
+            expected["evict/%d" % (i)] = payload_for(i, 1)
+        publish(port, expected)
+        check_retained(port, expected)
+
+        if not os.path.exists(store_file):
+            print("FAIL: Retained message store not created.")
+            raise mosq_test.TestError
+
+        # Reading every message again brings evicted payloads back into
+        # memory, and evicts others in their place.
+        check_retained(port, expected)
+
+        # Replace half of the messages and clear a quarter of them.
+        changes = {}
+        for i in range(0, RETAINED_COUNT, 2):
+            changes["evict/%d" % (i)] = payload_for(i, 2)
+        for i in range(1, RETAINED_COUNT, 4):
+            changes["evict/%d" % (i)] = None
+        publish(port, changes)
+        for topic in changes:
+            if changes[topic] is None:
+                del expected[topic]
+            else:
+                expected[topic] = changes[topic]
+        check_retained(port, expected)
+
+        # Evicted payloads must be saved to the persistence database.
+        broker.terminate()
+        broker.wait()
+        broker.communicate()
+        if os.path.exists(store_file):
+            print("FAIL: Retained message store not removed.")
+            raise mosq_test.TestError
+        broker = mosq_test.start_broker(filename=os.path.basename(__file__), cmd=cmd, port=port)
+
+        check_retained(port, expected)
+
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        for f in [persistence_file, store_file]:
+            try:
+                os.remove(f)
+            except OSError:
+                pass
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+# Test whether autosave_background writes the persistence file from a forked
+# process while the broker carries on, and whether the save statistics are
+# published in $SYS.
+
+from mosq_test_helper import *
+
+def write_config(filename, port, persistence_file):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("persistence true\n")
+        f.write("persistence_file %s\n" % (persistence_file))
+        f.write("autosave_interval 1\n")
+        f.write("autosave_background true\n")
+        f.write("sys_interval 1\n")
+
+def do_test():
+    rc = 1
+    keepalive = 60
+
+    connect_packet = mosq_test.gen_connect("persist-background", keepalive=keepalive)
+    connack_packet = mosq_test.gen_connack(rc=0)
+
+    subscribe_packet = mosq_test.gen_subscribe(1, "$SYS/broker/persistence/save/bytes", 0)
+    suback_packet = mosq_test.gen_suback(1, 0)
+
+    publish_packet = mosq_test.gen_publish("test/background", qos=0, payload="retained message", retain=True)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    persistence_file = os.path.basename(__file__).replace('.py', '.db')
+    try:
+        os.remove(persistence_file)
+    except OSError:
+        pass
+    write_config(conf_file, port, persistence_file)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=20, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+        sock.send(publish_packet)
+
+        # The second save to complete must have started after the publish.
+        sock.settimeout(10)
+        for i in range(0, 2):
+            saved_bytes = int(mosq_test.read_publish(sock))
+            if saved_bytes <= 0:
+                raise mosq_test.TestError
+        mosq_test.do_ping(sock)
+
+        with open(persistence_file, 'rb') as f:
+            data = f.read()
+        if b"retained message" not in data:
+            print("FAIL: Retained message not in persistence file.")
+        else:
+            rc = 0
+
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        try:
+            os.remove(persistence_file)
+        except OSError:
+            pass
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
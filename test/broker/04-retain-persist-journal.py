@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+
+# Test whether changes recorded in the persistence journal survive the broker
+# being killed before it has saved the persistence database. Queued messages,
+# retained messages, cleared retained messages and acknowledgements must all
+# be restored from the journal.
+
+from mosq_test_helper import *
+import signal
+
+def write_config(filename, port, persistence_file):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("persistence true\n")
+        f.write("persistence_file %s\n" % (persistence_file))
+        f.write("persistence_journal true\n")
+        f.write("autosave_interval 3600\n")
+
+def kill_broker(broker):
+    broker.send_signal(signal.SIGKILL)
+    broker.wait()
+    broker.communicate()
+
+def do_test():
+    rc = 1
+    keepalive = 60
+
+    sub_connect_packet = mosq_test.gen_connect("journal-sub", keepalive=keepalive, clean_session=False)
+    sub_connack_packet = mosq_test.gen_connack(rc=0)
+    sub_connack_present_packet = mosq_test.gen_connack(rc=0, flags=1)
+
+    subscribe_packet = mosq_test.gen_subscribe(1, "journal/#", 1)
+    suback_packet = mosq_test.gen_suback(1, 1)
+
+    pub_connect_packet = mosq_test.gen_connect("journal-pub", keepalive=keepalive)
+    pub_connack_packet = mosq_test.gen_connack(rc=0)
+
+    queued_publish_packet = mosq_test.gen_publish("journal/queued", qos=1, mid=1, payload="queued message")
+    queued_puback_packet = mosq_test.gen_puback(1)
+
+    retained_publish_packet = mosq_test.gen_publish("retained/kept", qos=1, mid=2, payload="retained message", retain=True)
+    retained_puback_packet = mosq_test.gen_puback(2)
+
+    cleared_publish_packet = mosq_test.gen_publish("retained/cleared", qos=1, mid=3, payload="cleared message", retain=True)
+    cleared_puback_packet = mosq_test.gen_puback(3)
+
+    clear_publish_packet = mosq_test.gen_publish("retained/cleared", qos=1, mid=4, payload=None, retain=True)
+    clear_puback_packet = mosq_test.gen_puback(4)
+
+    check_connect_packet = mosq_test.gen_connect("journal-check", keepalive=keepalive)
+    check_connack_packet = mosq_test.gen_connack(rc=0)
+
+    check_subscribe_packet = mosq_test.gen_subscribe(1, "retained/#", 0)
+    check_suback_packet = mosq_test.gen_suback(1, 0)
+
+    check_publish_packet = mosq_test.gen_publish("retained/kept", qos=0, payload="retained message", retain=True)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    persistence_file = os.path.basename(__file__).replace('.py', '.db')
+    journal_file = persistence_file + ".journal"
+    for f in [persistence_file, journal_file]:
+        try:
+            os.remove(f)
+        except OSError:
+            pass
+    write_config(conf_file, port, persistence_file)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        # Create a session with a subscription, then go offline.
+        sock = mosq_test.do_client_connect(sub_connect_packet, sub_connack_packet, timeout=5, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+        sock.close()
+
+        pub = mosq_test.do_client_connect(pub_connect_packet, pub_connack_packet, timeout=5, port=port)
+        mosq_test.do_send_receive(pub, queued_publish_packet, queued_puback_packet, "puback queued")
+        mosq_test.do_send_receive(pub, retained_publish_packet, retained_puback_packet, "puback retained")
+        mosq_test.do_send_receive(pub, cleared_publish_packet, cleared_puback_packet, "puback cleared")
+        mosq_test.do_send_receive(pub, clear_publish_packet, clear_puback_packet, "puback clear")
+        pub.close()
+
+        # Everything that was acknowledged must be in the journal.
+        kill_broker(broker)
+        broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+        sock = mosq_test.do_client_connect(sub_connect_packet, sub_connack_present_packet, timeout=5, port=port)
+        mosq_test.expect_packet(sock, "queued publish", queued_publish_packet)
+        sock.send(queued_puback_packet)
+        mosq_test.do_ping(sock)
+        sock.close()
+
+        check = mosq_test.do_client_connect(check_connect_packet, check_connack_packet, timeout=5, port=port)
+        mosq_test.do_send_receive(check, check_subscribe_packet, check_suback_packet, "check suback")
+        mosq_test.expect_packet(check, "retained publish", check_publish_packet)
+        mosq_test.do_ping(check)
+        check.close()
+
+        # The acknowledgement must be in the journal too, so the message isn't
+        # sent again.
+        kill_broker(broker)
+        broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+        sock = mosq_test.do_client_connect(sub_connect_packet, sub_connack_present_packet, timeout=5, port=port)
+        mosq_test.do_ping(sock)
+        sock.close()
+
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        for f in [persistence_file, journal_file]:
+            try:
+                os.remove(f)
+            except OSError:
+                pass
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
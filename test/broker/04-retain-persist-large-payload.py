@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+
+# Test whether large retained messages, with and without properties, survive
+# being restored from the persistence journal and from the persistence
+# database. Large payloads are kept in the buffer of the packet they arrived
+# in, and are written to disk directly from that buffer.
+
+from mosq_test_helper import *
+import signal
+
+def write_config(filename, port, persistence_file):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("persistence true\n")
+        f.write("persistence_file %s\n" % (persistence_file))
+        f.write("persistence_journal true\n")
+        f.write("autosave_interval 3600\n")
+
+def expect_packets(sock, name, expected):
+    received = b""
+    while len(received) < len(expected):
+        data = sock.recv(len(expected) - len(received))
+        if len(data) == 0:
+            break
+        received += data
+    if received != expected:
+        print("FAIL: Received incorrect %s (%d of %d bytes)." % (name, len(received), len(expected)))
+        raise mosq_test.TestError
+
+def check_retained(port, topic, publish_packet):
+    connect_packet = mosq_test.gen_connect("large-check", keepalive=60, proto_ver=5)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=5)
+    subscribe_packet = mosq_test.gen_subscribe(1, topic, 0, proto_ver=5)
+    suback_packet = mosq_test.gen_suback(1, 0, proto_ver=5)
+
+    sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=5, port=port)
+    mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+    expect_packets(sock, "retained %s" % (topic), publish_packet)
+    mosq_test.do_ping(sock)
+    sock.close()
+
+def publish(port, publish_packet, puback_packet, proto_ver):
+    connect_packet = mosq_test.gen_connect("large-pub", keepalive=60, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=5, port=port)
+    sock.sendall(publish_packet)
+    mosq_test.expect_packet(sock, "puback", puback_packet)
+    sock.close()
+
+def do_test():
+    rc = 1
+    payload_a = "0123456789abcdef"*8192
+    payload_b = "fedcba9876543210"*4096
+
+    props = mqtt5_props.gen_string_pair_prop(mqtt5_props.PROP_USER_PROPERTY, "key", "value")
+    publish_a_packet = mosq_test.gen_publish("large/a", qos=1, mid=1, payload=payload_a, retain=True, proto_ver=5, properties=props)
+    puback_a_packet = mosq_test.gen_puback(1, proto_ver=5, reason_code=mqtt5_rc.MQTT_RC_NO_MATCHING_SUBSCRIBERS)
+    check_a_packet = mosq_test.gen_publish("large/a", qos=0, payload=payload_a, retain=True, proto_ver=5, properties=props)
+
+    publish_b_packet = mosq_test.gen_publish("large/b", qos=1, mid=1, payload=payload_b, retain=True, proto_ver=4)
+    puback_b_packet = mosq_test.gen_puback(1, proto_ver=4)
+    check_b_packet = mosq_test.gen_publish("large/b", qos=0, payload=payload_b, retain=True, proto_ver=5)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    persistence_file = os.path.basename(__file__).replace('.py', '.db')
+    journal_file = persistence_file + ".journal"
+    for f in [persistence_file, journal_file]:
+        try:
+            os.remove(f)
+        except OSError:
+            pass
+    write_config(conf_file, port, persistence_file)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        publish(port, publish_a_packet, puback_a_packet, 5)
+        check_retained(port, "large/a", check_a_packet)
+
+        # Restore from the journal only
+        broker.send_signal(signal.SIGKILL)
+        broker.wait()
+        broker.communicate()
+        broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+        check_retained(port, "large/a", check_a_packet)
+        publish(port, publish_b_packet, puback_b_packet, 4)
+
+        # Restore from the database saved at shutdown
+        broker.terminate()
+        broker.wait()
+        broker.communicate()
+        broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+        check_retained(port, "large/a", check_a_packet)
+        check_retained(port, "large/b", check_b_packet)
+
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        for f in [persistence_file, journal_file]:
+            try:
+                os.remove(f)
+            except OSError:
+                pass
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+
+# Test whether a wildcard subscription matching many retained messages
+# receives all of them. The broker sends these a batch at a time as the client
+# has room for them, so for QoS 1 no more than max_inflight_messages may be
+# outstanding at once.
+
+from mosq_test_helper import *
+
+RETAINED_COUNT = 1000
+MAX_INFLIGHT = 10
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("max_inflight_messages %d\n" % (MAX_INFLIGHT))
+
+def recv_exact(sock, length):
+    data = b""
+    while len(data) < length:
+        chunk = sock.recv(length - len(data))
+        if len(chunk) == 0:
+            print("FAIL: Connection closed.")
+            raise mosq_test.TestError
+        data += chunk
+    return data
+
+def read_publish(sock):
+    cmd, = struct.unpack("!B", recv_exact(sock, 1))
+    if cmd & 0xF0 != 0x30:
+        print("FAIL: Expected PUBLISH, got command 0x%02X." % (cmd))
+        raise mosq_test.TestError
+
+    rl = 0
+    multiplier = 1
+    while True:
+        byte, = struct.unpack("!B", recv_exact(sock, 1))
+        rl += (byte & 127)*multiplier
+        multiplier *= 128
+        if byte & 128 == 0:
+            break
+
+    packet = recv_exact(sock, rl)
+    slen, = struct.unpack("!H", packet[0:2])
+    topic = packet[2:2+slen].decode('utf-8')
+    qos = (cmd & 0x06) >> 1
+    if qos > 0:
+        mid, = struct.unpack("!H", packet[2+slen:4+slen])
+        payload = packet[4+slen:].decode('utf-8')
+    else:
+        mid = 0
+        payload = packet[2+slen:].decode('utf-8')
+
+    if cmd & 0x01 == 0 or payload != "message " + topic:
+        print("FAIL: Incorrect retained message on %s." % (topic))
+        raise mosq_test.TestError
+    return (topic, qos, mid)
+
+def check_all_received(received, expected):
+    if received != expected:
+        print("FAIL: Received %d of %d retained messages." % (len(received), len(expected)))
+        raise mosq_test.TestError
+
+def do_test():
+    rc = 1
+
+    pub_connect_packet = mosq_test.gen_connect("stream-pub")
+    connack_packet = mosq_test.gen_connack(rc=0)
+
+    sub0_connect_packet = mosq_test.gen_connect("stream-sub0")
+    subscribe0_packet = mosq_test.gen_subscribe(1, "stream/#", 0)
+    suback0_packet = mosq_test.gen_suback(1, 0)
+
+    sub1_connect_packet = mosq_test.gen_connect("stream-sub1")
+    subscribe1_packet = mosq_test.gen_subscribe(1, "stream/#", 1)
+    suback1_packet = mosq_test.gen_suback(1, 1)
+
+    expected = set()
+    for i in range(RETAINED_COUNT):
+        expected.add("stream/%d" % (i))
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+    # Not verbose, the log would fill the pipe before anything reads it.
+    cmd = ['../../src/mosquitto', '-c', conf_file]
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), cmd=cmd, port=port)
+
+    try:
+        pub = mosq_test.do_client_connect(pub_connect_packet, connack_packet, timeout=20, port=port)
+        pubacks = b""
+        for i in range(RETAINED_COUNT):
+            topic = "stream/%d" % (i)
+            pub.send(mosq_test.gen_publish(topic, qos=1, mid=i+1, payload="message " + topic, retain=True))
+            pubacks += mosq_test.gen_puback(i+1)
+        if recv_exact(pub, len(pubacks)) != pubacks:
+            print("FAIL: Incorrect PUBACKs.")
+            raise mosq_test.TestError
+        pub.close()
+
+        # QoS 0, all messages as fast as the client can read them.
+        sock = mosq_test.do_client_connect(sub0_connect_packet, connack_packet, timeout=20, port=port)
+        mosq_test.do_send_receive(sock, subscribe0_packet, suback0_packet, "suback0")
+        received = set()
+        for i in range(RETAINED_COUNT):
+            (topic, qos, mid) = read_publish(sock)
+            received.add(topic)
+        check_all_received(received, expected)
+        mosq_test.do_ping(sock)
+        sock.close()
+
+        # QoS 1, no more than the inflight limit until acknowledged.
+        sock = mosq_test.do_client_connect(sub1_connect_packet, connack_packet, timeout=20, port=port)
+        mosq_test.do_send_receive(sock, subscribe1_packet, suback1_packet, "suback1")
+        received = set()
+        mids = []
+        for i in range(MAX_INFLIGHT):
+            (topic, qos, mid) = read_publish(sock)
+            received.add(topic)
+            mids.append(mid)
+
+        sock.settimeout(0.5)
+        try:
+            data = sock.recv(1)
+            if len(data) > 0:
+                print("FAIL: Inflight limit exceeded.")
+                raise mosq_test.TestError
+        except socket.timeout:
+            pass
+        sock.settimeout(20)
+
+        for mid in mids:
+            sock.send(mosq_test.gen_puback(mid))
+        while len(received) < RETAINED_COUNT:
+            (topic, qos, mid) = read_publish(sock)
+            if qos != 1:
+                print("FAIL: Incorrect QoS.")
+                raise mosq_test.TestError
+            received.add(topic)
+            sock.send(mosq_test.gen_puback(mid))
+        check_all_received(received, expected)
+        mosq_test.do_ping(sock)
+        sock.close()
+
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
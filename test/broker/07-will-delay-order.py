@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+
+# Test whether delayed wills are sent in order of when they are due, rather
+# than in order of their delay interval. The first client has the longer
+# delay but its will is due first.
+# MQTT 5
+
+from mosq_test_helper import *
+
+def do_test():
+    rc = 1
+    keepalive = 60
+
+    mid = 1
+    connect_packet = mosq_test.gen_connect("will-order-test", keepalive=keepalive, proto_ver=5)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=5)
+
+    props = mqtt5_props.gen_uint32_prop(mqtt5_props.PROP_WILL_DELAY_INTERVAL, 4)
+    connect1_packet = mosq_test.gen_connect("will-order-helper1", keepalive=keepalive, proto_ver=5, will_topic="will/test", will_payload=b"will 1", will_properties=props)
+
+    props = mqtt5_props.gen_uint32_prop(mqtt5_props.PROP_WILL_DELAY_INTERVAL, 3)
+    connect2_packet = mosq_test.gen_connect("will-order-helper2", keepalive=keepalive, proto_ver=5, will_topic="will/test", will_payload=b"will 2", will_properties=props)
+
+    subscribe_packet = mosq_test.gen_subscribe(mid, "will/test", 0, proto_ver=5)
+    suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=5)
+
+    publish1_packet = mosq_test.gen_publish("will/test", qos=0, payload="will 1", proto_ver=5)
+    publish2_packet = mosq_test.gen_publish("will/test", qos=0, payload="will 2", proto_ver=5)
+
+    port = mosq_test.get_port()
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=30, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+        # Will 1 is due 4s from now, will 2 is due 3s after a 3s wait.
+        sock1 = mosq_test.do_client_connect(connect1_packet, connack_packet, timeout=30, port=port)
+        sock1.close()
+        time.sleep(3)
+        sock2 = mosq_test.do_client_connect(connect2_packet, connack_packet, timeout=30, port=port)
+        sock2.close()
+
+        mosq_test.expect_packet(sock, "publish1", publish1_packet)
+        mosq_test.expect_packet(sock, "publish2", publish2_packet)
+        rc = 0
+
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+do_test()
+exit(0)
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+
+# Check that cached ACL check results are discarded when the ACLs are
+# reloaded, so a connected client loses access straight away.
+
+from mosq_test_helper import *
+import signal
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("acl_cache_size 8\n")
+        f.write("acl_file %s\n" % (filename.replace('.conf', '.acl')))
+
+def write_acl(filename, en):
+    with open(filename, 'w') as f:
+        f.write('user username\n')
+        f.write('topic readwrite topic/one\n')
+        if en:
+            f.write('topic readwrite topic/two\n')
+
+def publish(sock, mid, topic, expect_deny):
+    publish_packet = mosq_test.gen_publish(topic, qos=1, mid=mid, payload="message")
+    puback_packet = mosq_test.gen_puback(mid)
+    publish_recv_packet = mosq_test.gen_publish(topic, qos=0, payload="message")
+
+    sock.send(publish_packet)
+    if expect_deny:
+        mosq_test.expect_packet(sock, "puback", puback_packet)
+        mosq_test.do_ping(sock)
+    else:
+        mosq_test.receive_unordered(sock, puback_packet, publish_recv_packet, "puback/publish_receive")
+
+def do_test():
+    rc = 1
+
+    connect_packet = mosq_test.gen_connect("acl-check", username="username")
+    connack_packet = mosq_test.gen_connack(rc=0)
+
+    subscribe_packet = mosq_test.gen_subscribe(1, "topic/#", 0)
+    suback_packet = mosq_test.gen_suback(1, 0)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+    acl_file = os.path.basename(__file__).replace('.py', '.acl')
+    write_acl(acl_file, True)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+        publish(sock, 1, "topic/one", expect_deny=False)
+        publish(sock, 2, "topic/two", expect_deny=False)
+        publish(sock, 3, "topic/two", expect_deny=False)
+
+        # Reload ACLs with topic/two now disabled
+        write_acl(acl_file, False)
+        broker.send_signal(signal.SIGHUP)
+        time.sleep(0.5)
+
+        publish(sock, 4, "topic/one", expect_deny=False)
+        publish(sock, 5, "topic/two", expect_deny=True)
+
+        sock.close()
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(acl_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
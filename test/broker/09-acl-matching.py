@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+
+# Check that topic and pattern ACLs match topics correctly, with wildcards,
+# denials, and %c/%u substitution, including for client ids that contain a
+# '/'.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("acl_file %s\n" % (filename.replace('.conf', '.acl')))
+
+def write_acl(filename):
+    with open(filename, 'w') as f:
+        f.write('topic readwrite global/#\n')
+        f.write('topic deny      global/private/#\n')
+        f.write('topic read      readonly/+/data\n')
+        f.write('topic readwrite +/shared\n')
+        f.write('\n')
+        f.write('user username\n')
+        f.write('topic readwrite username/#\n')
+        f.write('topic deny      username/+/secret\n')
+        f.write('\n')
+        f.write('pattern readwrite clients/%c/#\n')
+        f.write('pattern deny      clients/%c/blocked\n')
+        f.write('pattern readwrite users/%u/inbox\n')
+        f.write('pattern readwrite device-%c/status\n')
+
+def single_test(port, client_id, username, topic, expect_deny):
+    connect_packet = mosq_test.gen_connect(client_id, keepalive=60, username=username)
+    connack_packet = mosq_test.gen_connack(rc=0)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid=mid, topic=topic, qos=1)
+    suback_packet = mosq_test.gen_suback(mid=mid, qos=1)
+
+    mid = 2
+    publish1s_packet = mosq_test.gen_publish(topic=topic, mid=mid, qos=1, payload="message")
+    puback1s_packet = mosq_test.gen_puback(mid)
+
+    mid = 1
+    publish1r_packet = mosq_test.gen_publish(topic=topic, mid=mid, qos=1, payload="message")
+
+    sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+    mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+    sock.send(publish1s_packet)
+    if expect_deny:
+        mosq_test.expect_packet(sock, "puback", puback1s_packet)
+        mosq_test.do_ping(sock)
+    else:
+        mosq_test.receive_unordered(sock, puback1s_packet, publish1r_packet, "puback / publish1r")
+    sock.close()
+
+def do_test():
+    rc = 1
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    acl_file = os.path.basename(__file__).replace('.py', '.acl')
+    write_config(conf_file, port)
+    write_acl(acl_file)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        # Anonymous topic ACLs
+        single_test(port, "acl-check", None, "global", expect_deny=False)
+        single_test(port, "acl-check", None, "global/a/b", expect_deny=False)
+        single_test(port, "acl-check", None, "global/private", expect_deny=True)
+        single_test(port, "acl-check", None, "global/private/a", expect_deny=True)
+        single_test(port, "acl-check", None, "readonly/a/data", expect_deny=True)
+        single_test(port, "acl-check", None, "a/shared", expect_deny=False)
+        single_test(port, "acl-check", None, "/shared", expect_deny=False)
+        single_test(port, "acl-check", None, "a/b/shared", expect_deny=True)
+        single_test(port, "acl-check", None, "$SYS/shared", expect_deny=True)
+
+        # User topic ACLs
+        single_test(port, "acl-check", "username", "username/a", expect_deny=False)
+        single_test(port, "acl-check", "username", "username/a/secret", expect_deny=True)
+        single_test(port, "acl-check", "username", "username/a/b/secret", expect_deny=False)
+        single_test(port, "acl-check", "username", "global/a", expect_deny=True)
+
+        # Pattern ACLs
+        single_test(port, "acl-check", None, "clients/acl-check", expect_deny=False)
+        single_test(port, "acl-check", None, "clients/acl-check/a", expect_deny=False)
+        single_test(port, "acl-check", None, "clients/acl-check/blocked", expect_deny=True)
+        single_test(port, "acl-check", None, "clients/other/a", expect_deny=True)
+        single_test(port, "acl-check", None, "users/acl-check/inbox", expect_deny=True)
+        single_test(port, "acl-check", None, "device-acl-check/status", expect_deny=False)
+        single_test(port, "acl-check", None, "device-other/status", expect_deny=True)
+        single_test(port, "acl-check", "username", "users/username/inbox", expect_deny=False)
+        single_test(port, "acl-check", "username", "users/other/inbox", expect_deny=True)
+
+        # Client ids and usernames that span more than one topic level
+        single_test(port, "site/7", None, "clients/site/7/a", expect_deny=False)
+        single_test(port, "site/7", None, "clients/site/7/blocked", expect_deny=True)
+        single_test(port, "site/7", None, "clients/site/a", expect_deny=True)
+        single_test(port, "acl-check", "group/user", "users/group/user/inbox", expect_deny=False)
+
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(acl_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
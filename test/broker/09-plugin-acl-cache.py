@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+# Test whether ACL check results are cached when acl_cache_size is set, that
+# the cache is discarded when a plugin calls mosquitto_acl_cache_invalidate(),
+# and that callbacks passed to mosquitto_acl_cache_disable() are never cached.
+# The plugin denies messages with a payload of "deny", and retained messages,
+# so results must not be reused for a different retain flag.
+
+from mosq_test_helper import *
+
+def write_config(filename, port, no_cache):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("acl_cache_size 8\n")
+        f.write("auth_plugin c/auth_plugin_acl_cache.so\n")
+        f.write("auth_opt_no_cache %s\n" % (no_cache))
+
+def publish(sock, mid, topic, payload, expect_deny, retain=False):
+    publish_packet = mosq_test.gen_publish(topic, qos=1, mid=mid, payload=payload, retain=retain)
+    puback_packet = mosq_test.gen_puback(mid)
+    publish_recv_packet = mosq_test.gen_publish(topic, qos=0, payload=payload)
+
+    sock.send(publish_packet)
+    if expect_deny:
+        mosq_test.expect_packet(sock, "puback", puback_packet)
+        mosq_test.do_ping(sock)
+    else:
+        mosq_test.receive_unordered(sock, puback_packet, publish_recv_packet, "puback/publish_receive")
+
+def do_test(no_cache):
+    rc = 1
+
+    connect_packet = mosq_test.gen_connect("acl-cache-test")
+    connack_packet = mosq_test.gen_connack(rc=0)
+
+    subscribe_packet = mosq_test.gen_subscribe(1, "cache/topic", 0)
+    suback_packet = mosq_test.gen_suback(1, 0)
+
+    invalidate_packet = mosq_test.gen_publish("invalidate", qos=1, mid=10, payload="")
+    invalidate_puback_packet = mosq_test.gen_puback(10)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port, no_cache)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=20, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+        publish(sock, 1, "cache/topic", "allow", expect_deny=False)
+        if no_cache == "true":
+            publish(sock, 2, "cache/topic", "deny", expect_deny=True)
+        else:
+            # The result for the first message is reused.
+            publish(sock, 2, "cache/topic", "deny", expect_deny=False)
+            publish(sock, 5, "cache/topic", "allow", expect_deny=True, retain=True)
+
+            mosq_test.do_send_receive(sock, invalidate_packet, invalidate_puback_packet, "invalidate puback")
+            publish(sock, 3, "cache/topic", "deny", expect_deny=True)
+            publish(sock, 4, "cache/topic", "allow", expect_deny=True)
+
+        sock.close()
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+do_test("false")
+do_test("true")
+exit(0)
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+
+# Test whether auth_cache_ttl lets a client that reconnects skip the password
+# hash, that the wrong password is still refused, that a client answered from
+# the cache isn't refused by max_pending_auth, and that a changed password
+# file takes effect on reload. Answers from the cache are counted from the
+# broker's debug log.
+
+from mosq_test_helper import *
+import base64
+import hashlib
+import signal
+
+SLOW_ITERATIONS = 500000
+
+def pw_line(username, password, iterations):
+    salt = os.urandom(12)
+    pw_hash = hashlib.pbkdf2_hmac('sha512', password.encode('utf-8'), salt, iterations)
+    return "%s:$7$%d$%s$%s\n" % (username, iterations,
+            base64.b64encode(salt).decode('utf-8'),
+            base64.b64encode(pw_hash).decode('utf-8'))
+
+def write_config(filename, port, pw_file):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous false\n")
+        f.write("password_file %s\n" % (pw_file))
+        f.write("auth_cache_ttl 600\n")
+        f.write("auth_worker_threads 1\n")
+        f.write("max_pending_auth 1\n")
+        f.write("log_type all\n")
+
+def write_pwfile(filename, password):
+    with open(filename, 'w') as f:
+        f.write(pw_line("cached", password, SLOW_ITERATIONS))
+        f.write(pw_line("other", "good", SLOW_ITERATIONS))
+
+def do_connect(port, username, password, connack_rc):
+    connect_packet = mosq_test.gen_connect("auth-cache-%s" % (username), username=username, password=password)
+    connack_packet = mosq_test.gen_connack(rc=connack_rc)
+    sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port, timeout=60)
+    sock.close()
+
+def do_test():
+    rc = 1
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    pw_file = os.path.basename(__file__).replace('.py', '.pwfile')
+    write_config(conf_file, port, pw_file)
+    write_pwfile(pw_file, "good")
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        # Only the second of these is answered from the cache.
+        do_connect(port, "cached", "good", 0)
+        do_connect(port, "cached", "good", 0)
+        do_connect(port, "cached", "bad", 5)
+
+        # The check for "other" takes the only max_pending_auth place, but
+        # "cached" is answered from the cache so doesn't need one.
+        other_packet = mosq_test.gen_connect("auth-cache-other", username="other", password="good")
+        other_sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        other_sock.settimeout(60)
+        other_sock.connect(("localhost", port))
+        other_sock.send(other_packet)
+        time.sleep(0.1)
+        do_connect(port, "cached", "good", 0)
+        mosq_test.expect_packet(other_sock, "connack", mosq_test.gen_connack(rc=0))
+        other_sock.close()
+
+        # The old password must no longer work after a reload, and neither
+        # check is answered from the cache.
+        write_pwfile(pw_file, "new")
+        broker.send_signal(signal.SIGHUP)
+        time.sleep(0.5)
+        do_connect(port, "cached", "good", 5)
+        do_connect(port, "cached", "new", 0)
+
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(pw_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        hits = stde.decode('utf-8').count("Password for cached accepted from cache.")
+        if rc == 0 and hits != 2:
+            print("FAIL: %d passwords accepted from cache, expected 2." % (hits))
+            rc = 1
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
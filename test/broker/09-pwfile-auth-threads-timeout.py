@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+
+# Test whether a client whose password check is queued behind a slow one on
+# the only auth worker thread is disconnected once it exceeds 1.5x its
+# keepalive, rather than waiting for its check, that its check no longer
+# counts towards max_pending_auth, and that the slow check still completes.
+
+from mosq_test_helper import *
+import base64
+import hashlib
+
+ITERATIONS = 10000
+SLOW_ITERATIONS = 2000000
+
+def pw_line(username, password, iterations):
+    salt = os.urandom(12)
+    pw_hash = hashlib.pbkdf2_hmac('sha512', password.encode('utf-8'), salt, iterations)
+    return "%s:$7$%d$%s$%s\n" % (username, iterations,
+            base64.b64encode(salt).decode('utf-8'),
+            base64.b64encode(pw_hash).decode('utf-8'))
+
+def write_config(filename, port, pw_file):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous false\n")
+        f.write("password_file %s\n" % (pw_file))
+        f.write("auth_worker_threads 1\n")
+        f.write("max_pending_auth 2\n")
+
+def write_pwfile(filename):
+    with open(filename, 'w') as f:
+        f.write(pw_line("test", "good", ITERATIONS))
+        f.write(pw_line("slow", "good", SLOW_ITERATIONS))
+
+def client_socket(port, timeout):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.settimeout(timeout)
+    sock.connect(("localhost", port))
+    return sock
+
+def do_test():
+    rc = 1
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    pw_file = os.path.basename(__file__).replace('.py', '.pwfile')
+    write_config(conf_file, port, pw_file)
+    write_pwfile(pw_file)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    slow_packet = mosq_test.gen_connect("auth-timeout-slow", username="slow", password="good")
+    queued_packet = mosq_test.gen_connect("auth-timeout-queued", keepalive=1, username="slow", password="good")
+    next_packet = mosq_test.gen_connect("auth-timeout-next", username="test", password="good")
+
+    try:
+        slow_sock = client_socket(port, 60)
+        slow_sock.send(slow_packet)
+        time.sleep(0.1)
+
+        # The check for this client can't start until the slow one is
+        # complete, which takes longer than its keepalive allows.
+        queued_sock = client_socket(port, 60)
+        queued_sock.send(queued_packet)
+        try:
+            data = queued_sock.recv(1)
+        except ConnectionResetError:
+            data = b""
+        if len(data) != 0:
+            print("FAIL: Queued client received data rather than being disconnected.")
+            raise mosq_test.TestError
+        queued_sock.close()
+
+        # There is room in the queue again, so this client isn't refused.
+        next_sock = client_socket(port, 60)
+        next_sock.send(next_packet)
+
+        mosq_test.expect_packet(slow_sock, "connack", mosq_test.gen_connack(rc=0))
+        slow_sock.close()
+        mosq_test.expect_packet(next_sock, "connack", mosq_test.gen_connack(rc=0))
+        next_sock.close()
+
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(pw_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+
+# Test whether passwords checked on worker threads with auth_worker_threads
+# give the correct CONNACK, that packets sent straight after the CONNECT are
+# handled once the client is connected, that a client closing its connection
+# while its password is checked is handled, and that clients beyond
+# max_pending_auth are refused.
+
+from mosq_test_helper import *
+import base64
+import hashlib
+
+ITERATIONS = 10000
+SLOW_ITERATIONS = 2000000
+
+def pw_line(username, password, iterations):
+    salt = os.urandom(12)
+    pw_hash = hashlib.pbkdf2_hmac('sha512', password.encode('utf-8'), salt, iterations)
+    return "%s:$7$%d$%s$%s\n" % (username, iterations,
+            base64.b64encode(salt).decode('utf-8'),
+            base64.b64encode(pw_hash).decode('utf-8'))
+
+def write_config(filename, port, pw_file):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous false\n")
+        f.write("password_file %s\n" % (pw_file))
+        f.write("auth_worker_threads 2\n")
+        f.write("max_pending_auth 1\n")
+
+def write_pwfile(filename):
+    with open(filename, 'w') as f:
+        f.write(pw_line("test", "good", ITERATIONS))
+        f.write(pw_line("slow", "good", SLOW_ITERATIONS))
+
+def client_socket(port, timeout=10):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.settimeout(timeout)
+    sock.connect(("localhost", port))
+    return sock
+
+def do_connect(port, username, password, connack_rc):
+    connect_packet = mosq_test.gen_connect("auth-threads-%s" % (username), username=username, password=password)
+    connack_packet = mosq_test.gen_connack(rc=connack_rc)
+    sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+    sock.close()
+
+def do_pipelined(port):
+    # SUBSCRIBE and PINGREQ are sent with the CONNECT, so arrive while the
+    # password is being checked.
+    connect_packet = mosq_test.gen_connect("auth-threads-pipelined", username="test", password="good")
+    connack_packet = mosq_test.gen_connack(rc=0)
+    subscribe_packet = mosq_test.gen_subscribe(1, "auth/threads", 0)
+    suback_packet = mosq_test.gen_suback(1, 0)
+    pingreq_packet = mosq_test.gen_pingreq()
+    pingresp_packet = mosq_test.gen_pingresp()
+
+    sock = client_socket(port)
+    sock.send(connect_packet + subscribe_packet + pingreq_packet)
+    mosq_test.expect_packet(sock, "connack", connack_packet)
+    mosq_test.expect_packet(sock, "suback", suback_packet)
+    mosq_test.expect_packet(sock, "pingresp", pingresp_packet)
+    sock.close()
+
+def do_early_close(port):
+    # The clients go away before their password checks finish. Those beyond
+    # max_pending_auth are refused straight away.
+    connect_packet = mosq_test.gen_connect("auth-threads-early", username="test", password="good")
+    for i in range(5):
+        sock = client_socket(port)
+        sock.send(connect_packet)
+        sock.close()
+    # Let the check that was started finish, so it doesn't count towards
+    # max_pending_auth for the next client.
+    time.sleep(0.5)
+
+def do_busy(port):
+    # The slow check takes the only max_pending_auth place, so the second
+    # client is refused.
+    slow_packet = mosq_test.gen_connect("auth-threads-slow", username="slow", password="good")
+    connect_packet = mosq_test.gen_connect("auth-threads-busy", username="test", password="good")
+    connack_ok_packet = mosq_test.gen_connack(rc=0)
+    connack_busy_packet = mosq_test.gen_connack(rc=3)
+
+    slow_sock = client_socket(port, timeout=60)
+    slow_sock.send(slow_packet)
+    time.sleep(0.1)
+    sock = mosq_test.do_client_connect(connect_packet, connack_busy_packet, port=port)
+    sock.close()
+    mosq_test.expect_packet(slow_sock, "connack", connack_ok_packet)
+    slow_sock.close()
+
+def do_test():
+    rc = 1
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    pw_file = os.path.basename(__file__).replace('.py', '.pwfile')
+    write_config(conf_file, port, pw_file)
+    write_pwfile(pw_file)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        do_connect(port, "test", "good", 0)
+        do_connect(port, "test", "bad", 5)
+        do_connect(port, "missing", "good", 5)
+        do_pipelined(port)
+        do_early_close(port)
+        do_connect(port, "test", "good", 0)
+        do_busy(port)
+        do_connect(port, "test", "good", 0)
+
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(pw_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test()
+exit(0)
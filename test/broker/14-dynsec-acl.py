@@ -1,6 +1,10 @@
 #!/usr/bin/env python3
 
-# Test ACL for allow/deny. This does not consider ACL priority and the ACLs do not overlap.
+# Test ACL for allow/deny. The first part does not consider ACL priority and
+# the ACLs do not overlap. The second part checks publish ACLs that conflict
+# across client and group roles of different priorities, that publish checks
+# see changes made by later commands, and that an invalid ACL topic filter is
+# still matched.
 
 from mosq_test_helper import *
 import json
@@ -9,7 +13,7 @@ import shutil
 def write_config(filename, port):
     with open(filename, 'w') as f:
         f.write("listener %d\n" % (port))
-        f.write("allow_anonymous false\n")
+        f.write("allow_anonymous true\n")
         f.write("plugin ../../plugins/dynamic-security/mosquitto_dynamic_security.so\n")
         f.write("plugin_opt_config_file %d/dynamic-security.json\n" % (port))
 
@@ -22,6 +26,25 @@ def command_check(sock, command_payload, expected_response):
         print(response)
         raise ValueError(response)
 
+def publish_check(port, username, topic, allowed, error_string):
+    if username is None:
+        connect_packet = mosq_test.gen_connect("acl-check", keepalive=10, proto_ver=5)
+    else:
+        connect_packet = mosq_test.gen_connect("acl-check", keepalive=10, username=username, password="password", proto_ver=5)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=5)
+
+    mid = 1
+    publish_packet = mosq_test.gen_publish(mid=mid, topic=topic, qos=1, payload="message", proto_ver=5)
+    if allowed:
+        puback_packet = mosq_test.gen_puback(mid, reason_code=mqtt5_rc.MQTT_RC_NO_MATCHING_SUBSCRIBERS, proto_ver=5)
+    else:
+        puback_packet = mosq_test.gen_puback(mid, reason_code=mqtt5_rc.MQTT_RC_NOT_AUTHORIZED, proto_ver=5)
+
+    csock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=5, port=port, connack_error="connack %s" % (error_string))
+    mosq_test.do_send_receive(csock, publish_packet, puback_packet, error_string)
+    csock.send(mosq_test.gen_disconnect(proto_ver=5))
+    csock.close()
+
 
 
 port = mosq_test.get_port()
@@ -76,6 +99,107 @@ delete_role_command = {"commands":[
     ]}
 delete_role_response = {'responses': [{'command': 'deleteRole'}]}
 
+# Roles and groups are added lowest priority first, so the checks below only
+# pass if priority rather than the order of adding decides.
+priority_command = {"commands":[
+    { "command": "createClient", "username": "user_two", "password": "password" },
+    { "command": "createRole", "rolename": "client-low", "acls": [
+        { "acltype": "publishClientSend", "topic": "conflict/client/#", "allow": True }
+        ]},
+    { "command": "createRole", "rolename": "client-high", "acls": [
+        { "acltype": "publishClientSend", "topic": "conflict/client/high", "allow": False }
+        ]},
+    { "command": "createRole", "rolename": "group-low", "acls": [
+        { "acltype": "publishClientSend", "topic": "conflict/group/#", "allow": True },
+        { "acltype": "publishClientSend", "topic": "conflict/low", "allow": True }
+        ]},
+    { "command": "createRole", "rolename": "group-high", "acls": [
+        { "acltype": "publishClientSend", "topic": "conflict/#", "allow": False },
+        { "acltype": "publishClientSend", "topic": "conflict/group/allow", "priority": 5, "allow": True }
+        ]},
+    { "command": "addClientRole", "username": "user_two", "rolename": "client-low", "priority": 1 },
+    { "command": "addClientRole", "username": "user_two", "rolename": "client-high", "priority": 10 },
+    { "command": "createGroup", "groupname": "priority-group" },
+    { "command": "addGroupRole", "groupname": "priority-group", "rolename": "group-low", "priority": 1 },
+    { "command": "addGroupRole", "groupname": "priority-group", "rolename": "group-high", "priority": 10 },
+    { "command": "addGroupClient", "groupname": "priority-group", "username": "user_two" }
+    ]}
+priority_response = {'responses': [
+    {'command': 'createClient'},
+    {'command': 'createRole'}, {'command': 'createRole'},
+    {'command': 'createRole'}, {'command': 'createRole'},
+    {'command': 'addClientRole'}, {'command': 'addClientRole'},
+    {'command': 'createGroup'},
+    {'command': 'addGroupRole'}, {'command': 'addGroupRole'},
+    {'command': 'addGroupClient'}
+    ]}
+
+modify_role_command = {"commands":[
+    { "command": "modifyRole", "rolename": "group-high", "acls": [
+        { "acltype": "publishClientSend", "topic": "conflict/group/allow", "priority": 5, "allow": True }
+        ]}
+    ]}
+modify_role_response = {'responses': [{'command': 'modifyRole'}]}
+
+extra_group_command = {"commands":[
+    { "command": "createRole", "rolename": "extra-role", "acls": [
+        { "acltype": "publishClientSend", "topic": "extra/topic", "allow": True }
+        ]},
+    { "command": "createGroup", "groupname": "extra-group" },
+    { "command": "addGroupRole", "groupname": "extra-group", "rolename": "extra-role" }
+    ]}
+extra_group_response = {'responses': [
+    {'command': 'createRole'}, {'command': 'createGroup'}, {'command': 'addGroupRole'}
+    ]}
+
+add_group_client_command = {"commands":[
+    { "command": "addGroupClient", "groupname": "extra-group", "username": "user_two" }
+    ]}
+add_group_client_response = {'responses': [{'command': 'addGroupClient'}]}
+
+remove_client_role_command = {"commands":[
+    { "command": "removeClientRole", "username": "user_two", "rolename": "client-high" }
+    ]}
+remove_client_role_response = {'responses': [{'command': 'removeClientRole'}]}
+
+anon_groups_command = {"commands":[
+    { "command": "createRole", "rolename": "anon-a", "acls": [
+        { "acltype": "publishClientSend", "topic": "anon/a", "allow": True }
+        ]},
+    { "command": "createRole", "rolename": "anon-b", "acls": [
+        { "acltype": "publishClientSend", "topic": "anon/b", "allow": True }
+        ]},
+    { "command": "createGroup", "groupname": "anon-a" },
+    { "command": "createGroup", "groupname": "anon-b" },
+    { "command": "addGroupRole", "groupname": "anon-a", "rolename": "anon-a" },
+    { "command": "addGroupRole", "groupname": "anon-b", "rolename": "anon-b" },
+    { "command": "setAnonymousGroup", "groupname": "anon-a" }
+    ]}
+anon_groups_response = {'responses': [
+    {'command': 'createRole'}, {'command': 'createRole'},
+    {'command': 'createGroup'}, {'command': 'createGroup'},
+    {'command': 'addGroupRole'}, {'command': 'addGroupRole'},
+    {'command': 'setAnonymousGroup'}
+    ]}
+
+set_anon_group_command = {"commands":[
+    { "command": "setAnonymousGroup", "groupname": "anon-b" }
+    ]}
+set_anon_group_response = {'responses': [{'command': 'setAnonymousGroup'}]}
+
+# "fallback/+/#x" isn't a valid topic filter, so can't be added with
+# addRoleACL, but createRole doesn't check it. mosquitto_topic_matches_sub()
+# matches it against "fallback/x" before reaching the invalid part, and it
+# must still be treated that way.
+invalid_filter_command = {"commands":[
+    { "command": "createRole", "rolename": "fallback", "acls": [
+        { "acltype": "publishClientSend", "topic": "fallback/+/#x", "priority": 5, "allow": False },
+        { "acltype": "publishClientSend", "topic": "fallback/#", "allow": True }
+        ]},
+    { "command": "addClientRole", "username": "user_two", "rolename": "fallback" }
+    ]}
+invalid_filter_response = {'responses': [{'command': 'createRole'}, {'command': 'addClientRole'}]}
+
 rc = 1
 keepalive = 10
 connect_packet_admin = mosq_test.gen_connect("ctrl-test", keepalive=keepalive, username="admin", password="admin")
@@ -287,6 +411,40 @@ try:
 
     csock.close()
 
+    # Conflicting ACLs. Client roles are checked before group roles, whatever
+    # their priority, then higher priority roles and ACLs first.
+    command_check(sock, priority_command, priority_response)
+    publish_check(port, "user_two", "conflict/client/topic", True, "priority client low")
+    publish_check(port, "user_two", "conflict/client/high", False, "priority client high")
+    publish_check(port, "user_two", "conflict/group/allow", True, "priority group acl")
+    publish_check(port, "user_two", "conflict/group/other", False, "priority group high")
+    publish_check(port, "user_two", "conflict/low", False, "priority group low")
+
+    # Each of these commands must be seen by the next check for the client.
+    command_check(sock, modify_role_command, modify_role_response)
+    publish_check(port, "user_two", "conflict/group/other", True, "modifyRole group")
+    publish_check(port, "user_two", "conflict/low", True, "modifyRole low")
+
+    command_check(sock, extra_group_command, extra_group_response)
+    publish_check(port, "user_two", "extra/topic", False, "addGroupClient before")
+    command_check(sock, add_group_client_command, add_group_client_response)
+    publish_check(port, "user_two", "extra/topic", True, "addGroupClient after")
+
+    command_check(sock, remove_client_role_command, remove_client_role_response)
+    publish_check(port, "user_two", "conflict/client/high", True, "removeClientRole")
+
+    command_check(sock, anon_groups_command, anon_groups_response)
+    publish_check(port, None, "anon/a", True, "anon a 1")
+    publish_check(port, None, "anon/b", False, "anon b 1")
+    command_check(sock, set_anon_group_command, set_anon_group_response)
+    publish_check(port, None, "anon/a", False, "anon a 2")
+    publish_check(port, None, "anon/b", True, "anon b 2")
+
+    # Invalid ACL topic filter
+    command_check(sock, invalid_filter_command, invalid_filter_response)
+    publish_check(port, "user_two", "fallback/x", False, "invalid filter match")
+    publish_check(port, "user_two", "fallback/x/y", True, "invalid filter no match")
+
     rc = 0
 
     sock.close()
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+
+# Test when the dynamic security config file is saved. Several commands in one
+# $CONTROL message must give a single save containing all of the changes. With
+# plugin_opt_config_save_interval set, a change made within the interval of
+# the last save must only appear after the interval, and a change still
+# waiting when the broker stops must be saved on shutdown.
+
+from mosq_test_helper import *
+import json
+import shutil
+
+SAVE_INTERVAL = 2
+
+def write_config(filename, port, save_interval):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous false\n")
+        f.write("plugin ../../plugins/dynamic-security/mosquitto_dynamic_security.so\n")
+        f.write("plugin_opt_config_file %d/dynamic-security.json\n" % (port))
+        if save_interval > 0:
+            f.write("plugin_opt_config_save_interval %d\n" % (save_interval))
+
+def command_check(sock, command_payload, expected_response):
+    command_packet = mosq_test.gen_publish(topic="$CONTROL/dynamic-security/v1", qos=0, payload=json.dumps(command_payload))
+    sock.send(command_packet)
+    response = json.loads(mosq_test.read_publish(sock))
+    if response != expected_response:
+        print(expected_response)
+        print(response)
+        raise ValueError(response)
+
+def saved_config(port):
+    # A save may be in progress, so retry if the file is incomplete.
+    for i in range(0, 10):
+        try:
+            with open("%d/dynamic-security.json" % (port), 'r') as f:
+                return json.load(f)
+        except json.JSONDecodeError:
+            time.sleep(0.1)
+    raise mosq_test.TestError
+
+def saved_usernames(port):
+    return [c['username'] for c in saved_config(port)['clients']]
+
+def save_count(stde):
+    return stde.decode('utf-8').count("dynsec: Saved config file")
+
+def create_client_command(username):
+    return {"commands":[{ "command": "createClient", "username": username, "password": "password" }]}
+
+create_client_response = {'responses': [{'command': 'createClient'}]}
+
+batch_command = {"commands":[
+    { "command": "createClient", "username": "user_one", "password": "password" },
+    { "command": "createClient", "username": "user_two", "password": "password" },
+    { "command": "createGroup", "groupname": "group_one" },
+    { "command": "createRole", "rolename": "role_one" },
+    { "command": "addGroupRole", "groupname": "group_one", "rolename": "role_one" },
+    { "command": "addGroupClient", "groupname": "group_one", "username": "user_one" },
+    { "command": "addClientRole", "username": "user_two", "rolename": "role_one" },
+    { "command": "setDefaultACLAccess", "acls":[{ "acltype": "publishClientSend", "allow": True }] }
+    ]}
+batch_response = {'responses': [
+    {'command': 'createClient'}, {'command': 'createClient'},
+    {'command': 'createGroup'}, {'command': 'createRole'},
+    {'command': 'addGroupRole'}, {'command': 'addGroupClient'},
+    {'command': 'addClientRole'}, {'command': 'setDefaultACLAccess'}
+    ]}
+
+connect_packet = mosq_test.gen_connect("ctrl-test", keepalive=10, username="admin", password="admin")
+connack_packet = mosq_test.gen_connack(rc=0)
+
+mid = 2
+subscribe_packet = mosq_test.gen_subscribe(mid, "$CONTROL/dynamic-security/#", 1)
+suback_packet = mosq_test.gen_suback(mid, 1)
+
+
+def check_batch(config):
+    users = {c['username']: c for c in config['clients']}
+    if 'user_one' not in users or 'user_two' not in users:
+        print("FAIL: Clients missing from saved config.")
+        raise mosq_test.TestError
+    if users['user_two']['roles'] != [{'rolename': 'role_one'}]:
+        print("FAIL: Client role missing from saved config.")
+        raise mosq_test.TestError
+    groups = {g['groupname']: g for g in config['groups']}
+    if 'group_one' not in groups or groups['group_one']['roles'] != [{'rolename': 'role_one'}]:
+        print("FAIL: Group missing from saved config.")
+        raise mosq_test.TestError
+    if groups['group_one']['clients'] != [{'username': 'user_one'}]:
+        print("FAIL: Group membership missing from saved config.")
+        raise mosq_test.TestError
+    if config['defaultACLAccess']['publishClientSend'] != True:
+        print("FAIL: Default ACL access missing from saved config.")
+        raise mosq_test.TestError
+
+
+def do_test(save_interval):
+    rc = 1
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port, save_interval)
+
+    try:
+        os.mkdir(str(port))
+        shutil.copyfile("dynamic-security-init.json", "%d/dynamic-security.json" % (port))
+    except FileExistsError:
+        pass
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=5, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+        if save_interval == 0:
+            # All changes are in the file as soon as the response arrives.
+            command_check(sock, batch_command, batch_response)
+            check_batch(saved_config(port))
+        else:
+            # The first change is saved straight away.
+            command_check(sock, create_client_command("user_one"), create_client_response)
+            if "user_one" not in saved_usernames(port):
+                print("FAIL: First change not saved.")
+                raise mosq_test.TestError
+
+            # The next is held until the interval has passed.
+            command_check(sock, create_client_command("user_two"), create_client_response)
+            start = time.time()
+            if "user_two" in saved_usernames(port):
+                print("FAIL: Change saved within the save interval.")
+                raise mosq_test.TestError
+            while "user_two" not in saved_usernames(port):
+                if time.time() - start > save_interval + 3:
+                    print("FAIL: Change not saved after the save interval.")
+                    raise mosq_test.TestError
+                time.sleep(0.1)
+
+            # This change is still waiting when the broker stops.
+            command_check(sock, create_client_command("user_three"), create_client_response)
+            if "user_three" in saved_usernames(port):
+                print("FAIL: Change saved within the save interval.")
+                raise mosq_test.TestError
+
+        sock.close()
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc == 0:
+            if save_interval == 0 and save_count(stde) != 1:
+                print("FAIL: Config saved %d times for one message." % (save_count(stde)))
+                rc = 1
+            elif save_interval > 0 and "user_three" not in saved_usernames(port):
+                print("FAIL: Change not saved on shutdown.")
+                rc = 1
+        os.remove(conf_file)
+        try:
+            os.remove(f"{port}/dynamic-security.json")
+        except FileNotFoundError:
+            pass
+        os.rmdir(f"{port}")
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+do_test(0)
+do_test(SAVE_INTERVAL)
+exit(0)
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mosquitto.h>
+#include <mosquitto_broker.h>
+#include <mosquitto_plugin.h>
+
+static int acl_check(int event, void *event_data, void *user_data);
+static int handle_message(int event, void *event_data, void *user_data);
+
+static mosquitto_plugin_id_t *plg_id;
+
+
+int mosquitto_plugin_version(int supported_version_count, const int *supported_versions)
+{
+	return 5;
+}
+
+int mosquitto_plugin_init(mosquitto_plugin_id_t *identifier, void **user_data, struct mosquitto_opt *auth_opts, int auth_opt_count)
+{
+	int i;
+
+	plg_id = identifier;
+
+	mosquitto_callback_register(plg_id, MOSQ_EVT_ACL_CHECK, acl_check, NULL, NULL);
+	mosquitto_callback_register(plg_id, MOSQ_EVT_MESSAGE, handle_message, NULL, NULL);
+
+	for(i=0; i<auth_opt_count; i++){
+		if(!strcmp(auth_opts[i].key, "no_cache") && !strcmp(auth_opts[i].value, "true")){
+			mosquitto_acl_cache_disable(plg_id, acl_check);
+		}
+	}
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_plugin_cleanup(void *user_data, struct mosquitto_opt *auth_opts, int auth_opt_count)
+{
+	mosquitto_callback_unregister(plg_id, MOSQ_EVT_ACL_CHECK, acl_check, NULL);
+	mosquitto_callback_unregister(plg_id, MOSQ_EVT_MESSAGE, handle_message, NULL);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+/* Deny any message with a payload of "deny", and any retained message. */
+static int acl_check(int event, void *event_data, void *user_data)
+{
+	struct mosquitto_evt_acl_check *ed = event_data;
+
+	if(ed->access == MOSQ_ACL_WRITE
+			&& ed->payloadlen == strlen("deny")
+			&& !memcmp(ed->payload, "deny", strlen("deny"))){
+
+		return MOSQ_ERR_ACL_DENIED;
+	}
+	if(ed->access == MOSQ_ACL_WRITE && ed->retain){
+		return MOSQ_ERR_ACL_DENIED;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+static int handle_message(int event, void *event_data, void *user_data)
+{
+	struct mosquitto_evt_message *ed = event_data;
+
+	if(!strcmp(ed->topic, "invalidate")){
+		mosquitto_acl_cache_invalidate(NULL);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
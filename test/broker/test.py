@@ -9,11 +9,13 @@ tests = [
     (1, './01-connect-bad-packet.py'),
     (1, './01-connect-disconnect-v5.py'),
     (1, './01-connect-duplicate.py'),
+    (1, './01-connect-idle-timeout.py'),
     (1, './01-connect-invalid-id-0.py'),
     (1, './01-connect-invalid-id-missing.py'),
     (1, './01-connect-invalid-id-utf8.py'),
     (1, './01-connect-invalid-protonum.py'),
     (1, './01-connect-invalid-reserved.py'),
+    (1, './01-connect-keepalive.py'),
     (1, './01-connect-success.py'),
     (1, './01-connect-uname-invalid-utf8.py'),
     (1, './01-connect-uname-no-flag.py'),
@@ -26,6 +28,8 @@ tests = [
 
     (1, './02-shared-qos0-v5.py'),
     (1, './02-subhier-crash.py'),
+    (1, './02-subpub-cache.py'),
+    (1, './02-subpub-overlapping.py'),
     (1, './02-subpub-qos0-long-topic.py'),
     (1, './02-subpub-qos0-retain-as-publish.py'),
     (1, './02-subpub-qos0-send-retain.py'),
@@ -39,6 +43,7 @@ tests = [
     (1, './02-subpub-qos1-message-expiry-will.py'),
     (1, './02-subpub-qos1-message-expiry.py'),
     (1, './02-subpub-qos1-nolocal.py'),
+    (1, './02-subpub-qos1-receive-maximum-out-of-order.py'),
     (1, './02-subpub-qos1.py'),
     (1, './02-subpub-qos2-1322.py'),
     (1, './02-subpub-qos2-bad-puback-1.py'),
@@ -73,6 +78,9 @@ tests = [
     (1, './03-publish-dollar.py'),
     (1, './03-publish-invalid-utf8.py'),
     (1, './03-publish-long-topic.py'),
+    (1, './03-publish-memory-pools.py'),
+    (1, './03-publish-qos1-batched.py'),
+    (1, './03-publish-fanout-shared-payload.py'),
     (1, './03-publish-qos1-max-inflight-expire.py'),
     (1, './03-publish-qos1-max-inflight.py'),
     (1, './03-publish-qos1-no-subscribers-v5.py'),
@@ -83,11 +91,16 @@ tests = [
 
     (1, './04-retain-check-source-persist.py'),
     (1, './04-retain-check-source.py'),
+    (1, './04-retain-evict.py'),
+    (1, './04-retain-persist-background-save.py'),
+    (1, './04-retain-persist-journal.py'),
+    (1, './04-retain-persist-large-payload.py'),
     (1, './04-retain-qos0-clear.py'),
     (1, './04-retain-qos0-fresh.py'),
     (1, './04-retain-qos0-repeated.py'),
     (1, './04-retain-qos0.py'),
     (1, './04-retain-qos1-qos0.py'),
+    (1, './04-retain-stream-large.py'),
     (1, './04-retain-upgrade-outgoing-qos.py'),
     (2, './04-retain-check-source-persist-diff-port.py'),
 
@@ -110,6 +123,7 @@ tests = [
     (3, './06-bridge-per-listener-settings.py'),
     (2, './06-bridge-reconnect-local-out.py'),
 
+    (1, './07-will-delay-order.py'),
     (1, './07-will-delay-reconnect.py'),
     (1, './07-will-delay-recover.py'),
     (1, './07-will-delay-session-expiry.py'),
@@ -140,14 +154,17 @@ tests = [
     (3, './08-tls-psk-bridge.py'),
 
     (1, './09-acl-access-variants.py'),
+    (1, './09-acl-cache-reload.py'),
     (1, './09-acl-change.py'),
     (1, './09-acl-empty-file.py'),
+    (1, './09-acl-matching.py'),
     (1, './09-auth-bad-method.py'),
     (1, './09-extended-auth-change-username.py'),
     (1, './09-extended-auth-multistep-reauth.py'),
     (1, './09-extended-auth-multistep.py'),
     (1, './09-extended-auth-single.py'),
     (1, './09-extended-auth-unsupported.py'),
+    (1, './09-plugin-acl-cache.py'),
     (1, './09-plugin-auth-acl-pub.py'),
     (1, './09-plugin-auth-acl-sub-denied.py'),
     (1, './09-plugin-auth-acl-sub.py'),
@@ -160,6 +177,9 @@ tests = [
     (1, './09-plugin-auth-v2-unpwd-fail.py'),
     (1, './09-plugin-auth-v2-unpwd-success.py'),
     (1, './09-plugin-publish.py'),
+    (1, './09-pwfile-auth-cache.py'),
+    (1, './09-pwfile-auth-threads-timeout.py'),
+    (1, './09-pwfile-auth-threads.py'),
     (1, './09-pwfile-parse-invalid.py'),
 
     (2, './10-listener-mount-point.py'),
@@ -194,6 +214,7 @@ tests = [
     (1, './14-dynsec-auth.py'),
     (1, './14-dynsec-client.py'),
     (1, './14-dynsec-client-invalid.py'),
+    (1, './14-dynsec-config-save.py'),
     (1, './14-dynsec-default-access.py'),
     (1, './14-dynsec-disable-client.py'),
     (1, './14-dynsec-group.py'),
@@ -0,0 +1,142 @@
+/* Benchmark for session expiry and will delay scheduling.
+ *
+ * Models a load balancer failover, where a large number of persistent
+ * clients with wills disconnect at once. Each client is given a random
+ * session expiry interval and will delay interval, and is added to both
+ * schedules. Half of the clients then reconnect, removing them from the
+ * schedules, and time is advanced until every remaining session has
+ * expired.
+ *
+ * Usage: ./expiry_bench [clients]
+ *
+ * To compare two versions of the broker, build and run this against each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+
+#define MAX_INTERVAL 3600
+
+struct mosquitto_db db;
+int g_clients_expired = 0;
+
+static unsigned long wills_sent = 0;
+
+
+/* ========================================================================
+ * Stubs
+ * ======================================================================== */
+
+int log__printf(struct mosquitto *mosq, unsigned int priority, const char *fmt, ...)
+{
+	UNUSED(mosq);
+	UNUSED(priority);
+	UNUSED(fmt);
+	return 0;
+}
+
+void context__disconnect(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+void context__send_will(struct mosquitto *context)
+{
+	if(context->will){
+		wills_sent++;
+		context->will = NULL;
+	}
+}
+
+void context__add_to_disused(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+
+/* ========================================================================
+ * Benchmark
+ * ======================================================================== */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec/1e9;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct mosquitto__config config;
+	struct mosquitto *contexts;
+	struct mosquitto_message_all will;
+	int client_count = 200000;
+	int i;
+	time_t start_s;
+	double t_start, t_end;
+
+	if(argc > 1){
+		client_count = atoi(argv[1]);
+	}
+	if(client_count < 1){
+		client_count = 1;
+	}
+
+	memset(&db, 0, sizeof(db));
+	memset(&config, 0, sizeof(config));
+	db.config = &config;
+	db.now_real_s = start_s = 1000000;
+
+	contexts = calloc((size_t)client_count, sizeof(struct mosquitto));
+	if(!contexts) return 1;
+
+	srand(1);
+	for(i=0; i<client_count; i++){
+		contexts[i].session_expiry_interval = (uint32_t)(60 + rand() % (MAX_INTERVAL-60));
+		contexts[i].will_delay_interval = (uint32_t)(rand() % 60);
+		contexts[i].will = &will;
+	}
+
+	t_start = now();
+	for(i=0; i<client_count; i++){
+		if(session_expiry__add(&contexts[i]) || will_delay__add(&contexts[i])){
+			fprintf(stderr, "Error adding client %d\n", i);
+			return 1;
+		}
+	}
+	t_end = now();
+	printf("Clients:              %d\n", client_count);
+	printf("Add time:             %.3f s\n", t_end - t_start);
+
+	t_start = now();
+	for(i=0; i<client_count; i+=2){
+		session_expiry__remove(&contexts[i]);
+		will_delay__remove(&contexts[i]);
+	}
+	t_end = now();
+	printf("Remove time:          %.3f s (%d clients)\n", t_end - t_start, (client_count+1)/2);
+
+	t_start = now();
+	while(db.now_real_s <= start_s + MAX_INTERVAL + 1){
+		db.now_real_s++;
+		will_delay__check();
+		session_expiry__check();
+	}
+	t_end = now();
+	printf("Check time:           %.3f s (%d seconds)\n", t_end - t_start, MAX_INTERVAL+1);
+	printf("Wills sent:           %lu\n", wills_sent);
+	printf("Sessions expired:     %d\n", g_clients_expired);
+
+	session_expiry__remove_all();
+	will_delay__send_all();
+	free(contexts);
+
+	return 0;
+}
@@ -0,0 +1,416 @@
+/* Benchmark for restoring the persistence database at startup.
+ *
+ * Generates a database file shaped like a large deployment - many persistent
+ * clients, each with a few subscriptions and a queue of messages waiting for
+ * them, plus some retained messages - then reports how long it takes to
+ * restore it.
+ *
+ * Usage: ./persist_bench [messages [clients [file]]]
+ *
+ * If file is given it is kept afterwards, and reused if it already exists.
+ *
+ * To compare two versions of the broker, build and run this against each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <arpa/inet.h>
+#endif
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "persist.h"
+
+#define SUBS_PER_CLIENT 5
+#define RETAINED_PER_CLIENT 1
+#define PAYLOAD_LEN 100
+
+struct mosquitto_db db;
+unsigned long g_msgs_dropped = 0;
+
+
+/* ========================================================================
+ * Stubs
+ * ======================================================================== */
+
+int log__printf(struct mosquitto *mosq, unsigned int priority, const char *fmt, ...)
+{
+	UNUSED(mosq);
+	UNUSED(priority);
+	UNUSED(fmt);
+	return 0;
+}
+
+struct mosquitto *context__init(mosq_sock_t sock)
+{
+	struct mosquitto *context;
+
+	context = mosquitto__calloc(1, sizeof(struct mosquitto));
+	if(context){
+		context->sock = sock;
+		context->msgs_in.inflight_maximum = 20;
+		context->msgs_in.inflight_quota = 20;
+		context->msgs_out.inflight_maximum = 20;
+		context->msgs_out.inflight_quota = 20;
+	}
+	return context;
+}
+
+void context__cleanup(struct mosquitto *context, bool force_free)
+{
+	UNUSED(context);
+	UNUSED(force_free);
+}
+
+int mosquitto_acl_check(struct mosquitto *context, const char *topic, uint32_t payloadlen, void* payload, uint8_t qos, bool retain, int access)
+{
+	UNUSED(context);
+	UNUSED(topic);
+	UNUSED(payloadlen);
+	UNUSED(payload);
+	UNUSED(qos);
+	UNUSED(retain);
+	UNUSED(access);
+	return MOSQ_ERR_SUCCESS;
+}
+
+int acl__find_acls(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_SUCCESS;
+}
+
+int net__socket_close(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+	return MOSQ_ERR_SUCCESS;
+}
+
+int send__pingreq(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+	return MOSQ_ERR_SUCCESS;
+}
+
+int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval, struct mosquitto_msg_store *store)
+{
+	UNUSED(mosq);
+	UNUSED(mid);
+	UNUSED(topic);
+	UNUSED(payloadlen);
+	UNUSED(payload);
+	UNUSED(qos);
+	UNUSED(retain);
+	UNUSED(dup);
+	UNUSED(cmsg_props);
+	UNUSED(store_props);
+	UNUSED(expiry_interval);
+	UNUSED(store);
+	return MOSQ_ERR_SUCCESS;
+}
+
+int send__pubcomp(struct mosquitto *mosq, uint16_t mid, const mosquitto_property *properties)
+{
+	UNUSED(mosq);
+	UNUSED(mid);
+	UNUSED(properties);
+	return MOSQ_ERR_SUCCESS;
+}
+
+int send__pubrec(struct mosquitto *mosq, uint16_t mid, uint8_t reason_code, const mosquitto_property *properties)
+{
+	UNUSED(mosq);
+	UNUSED(mid);
+	UNUSED(reason_code);
+	UNUSED(properties);
+	return MOSQ_ERR_SUCCESS;
+}
+
+int send__pubrel(struct mosquitto *mosq, uint16_t mid, const mosquitto_property *properties)
+{
+	UNUSED(mosq);
+	UNUSED(mid);
+	UNUSED(properties);
+	return MOSQ_ERR_SUCCESS;
+}
+
+char *persist__journal_filename(const char *suffix)
+{
+	UNUSED(suffix);
+	return NULL;
+}
+
+int persist__journal_open(uint64_t generation, long valid_length, bool save_needed)
+{
+	UNUSED(generation);
+	UNUSED(valid_length);
+	UNUSED(save_needed);
+	return MOSQ_ERR_SUCCESS;
+}
+
+void persist__journal_retain(const char *topic, struct mosquitto_msg_store *stored)
+{
+	UNUSED(topic);
+	UNUSED(stored);
+}
+
+void persist__journal_msg_add(struct mosquitto *context, struct mosquitto_client_msg *msg)
+{
+	UNUSED(context);
+	UNUSED(msg);
+}
+
+void persist__journal_msg_update(struct mosquitto *context, struct mosquitto_client_msg *msg)
+{
+	UNUSED(context);
+	UNUSED(msg);
+}
+
+void persist__journal_msg_delete(struct mosquitto *context, struct mosquitto_client_msg *msg)
+{
+	UNUSED(context);
+	UNUSED(msg);
+}
+
+bool persist__background_running(void)
+{
+	return false;
+}
+
+
+/* ========================================================================
+ * Database generation
+ * ======================================================================== */
+
+static const char *measurements[SUBS_PER_CLIENT] = {
+	"temperature", "humidity", "pressure", "battery", "status"
+};
+
+
+static int generate(const char *filename, int msg_total, int client_count)
+{
+	FILE *fptr;
+	struct PF_cfg cfg_chunk;
+	struct P_msg_store store_chunk;
+	struct P_client client_chunk;
+	struct P_client_msg cmsg_chunk;
+	struct P_sub sub_chunk;
+	struct P_retain retain_chunk;
+	uint32_t i32temp;
+	char client_id[50];
+	char topic[200];
+	char payload[PAYLOAD_LEN];
+	int i, j, msgs_per_client;
+	dbid_t db_id;
+
+	fptr = fopen(filename, "wb");
+	if(!fptr) return 1;
+
+	fwrite(magic, 1, 15, fptr);
+	i32temp = 0;
+	fwrite(&i32temp, 1, sizeof(uint32_t), fptr);
+	i32temp = htonl(MOSQ_DB_VERSION);
+	fwrite(&i32temp, 1, sizeof(uint32_t), fptr);
+
+	memset(&cfg_chunk, 0, sizeof(cfg_chunk));
+	cfg_chunk.last_db_id = (dbid_t)(msg_total + client_count*RETAINED_PER_CLIENT);
+	cfg_chunk.dbid_size = sizeof(dbid_t);
+	persist__chunk_cfg_write_v6(fptr, &cfg_chunk);
+
+	memset(payload, 'x', sizeof(payload));
+	msgs_per_client = msg_total / client_count;
+
+	/* Messages are saved newest first, because that is the order the
+	 * broker keeps them in. The first messages are queued for clients, the
+	 * rest are retained. */
+	for(db_id = cfg_chunk.last_db_id; db_id > 0; db_id--){
+		memset(&store_chunk, 0, sizeof(store_chunk));
+		i = (int)((db_id-1) % (dbid_t)client_count);
+		if(db_id <= (dbid_t)msg_total){
+			snprintf(topic, sizeof(topic), "site/%d/device-%d/%s", i % 100, i, measurements[db_id % SUBS_PER_CLIENT]);
+			store_chunk.F.qos = 1;
+		}else{
+			snprintf(topic, sizeof(topic), "site/%d/device-%d/config", i % 100, i);
+			store_chunk.F.qos = 1;
+			store_chunk.F.retain = 1;
+		}
+		snprintf(client_id, sizeof(client_id), "publisher-%d", i % 100);
+		store_chunk.F.store_id = db_id;
+		store_chunk.F.payloadlen = PAYLOAD_LEN;
+		store_chunk.F.source_mid = (uint16_t)db_id;
+		store_chunk.F.source_id_len = (uint16_t)strlen(client_id);
+		store_chunk.F.topic_len = (uint16_t)strlen(topic);
+		store_chunk.source.id = client_id;
+		store_chunk.topic = topic;
+		store_chunk.payload = payload;
+		if(persist__chunk_message_store_write_v6(fptr, &store_chunk)) goto error;
+	}
+
+	for(i=0; i<client_count; i++){
+		snprintf(client_id, sizeof(client_id), "client-%d", i);
+
+		memset(&client_chunk, 0, sizeof(client_chunk));
+		client_chunk.F.session_expiry_interval = UINT32_MAX;
+		client_chunk.F.id_len = (uint16_t)strlen(client_id);
+		client_chunk.client_id = client_id;
+		if(persist__chunk_client_write_v6(fptr, &client_chunk, DB_CHUNK_CLIENT)) goto error;
+
+		for(j=0; j<msgs_per_client; j++){
+			memset(&cmsg_chunk, 0, sizeof(cmsg_chunk));
+			cmsg_chunk.F.store_id = (dbid_t)(j*client_count + i + 1);
+			cmsg_chunk.F.mid = (uint16_t)(j+1);
+			cmsg_chunk.F.id_len = client_chunk.F.id_len;
+			cmsg_chunk.F.qos = 1;
+			cmsg_chunk.F.direction = mosq_md_out;
+			cmsg_chunk.F.state = mosq_ms_queued;
+			cmsg_chunk.client_id = client_id;
+			if(persist__chunk_client_msg_write_v6(fptr, &cmsg_chunk, DB_CHUNK_CLIENT_MSG)) goto error;
+		}
+	}
+
+	/* Subscriptions are saved by walking the subscription tree, so all of
+	 * the subscriptions for a topic are together. */
+	for(j=0; j<SUBS_PER_CLIENT; j++){
+		for(i=0; i<client_count; i++){
+			snprintf(client_id, sizeof(client_id), "client-%d", i);
+			snprintf(topic, sizeof(topic), "site/%d/device-%d/%s", i % 100, i, measurements[j]);
+
+			memset(&sub_chunk, 0, sizeof(sub_chunk));
+			sub_chunk.F.id_len = (uint16_t)strlen(client_id);
+			sub_chunk.F.topic_len = (uint16_t)strlen(topic);
+			sub_chunk.F.qos = 1;
+			sub_chunk.client_id = client_id;
+			sub_chunk.topic = topic;
+			if(persist__chunk_sub_write_v6(fptr, &sub_chunk, DB_CHUNK_SUB)) goto error;
+		}
+	}
+
+	for(db_id = (dbid_t)msg_total + 1; db_id <= cfg_chunk.last_db_id; db_id++){
+		memset(&retain_chunk, 0, sizeof(retain_chunk));
+		retain_chunk.F.store_id = db_id;
+		if(persist__chunk_retain_write_v6(fptr, &retain_chunk)) goto error;
+	}
+
+	fclose(fptr);
+	return 0;
+error:
+	fclose(fptr);
+	return 1;
+}
+
+
+/* ========================================================================
+ * Benchmark
+ * ======================================================================== */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec/1e9;
+}
+
+
+static long rss_kb(void)
+{
+	FILE *fptr;
+	char line[256];
+	long rss = 0;
+
+	fptr = fopen("/proc/self/status", "r");
+	if(!fptr) return 0;
+	while(fgets(line, sizeof(line), fptr)){
+		if(!strncmp(line, "VmRSS:", 6)){
+			rss = atol(&line[6]);
+			break;
+		}
+	}
+	fclose(fptr);
+	return rss;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct mosquitto__config config;
+	struct mosquitto *context, *ctxt_tmp;
+	char filename[] = "persist_bench.test-db";
+	char *path = filename;
+	int msg_total = 1000000;
+	int client_count = 100000;
+	unsigned long restored_msgs = 0;
+	bool keep = false;
+	long rss_start, rss_end;
+	double t_start, t_end;
+	FILE *fptr;
+	int rc;
+
+	if(argc > 1){
+		msg_total = atoi(argv[1]);
+	}
+	if(argc > 2){
+		client_count = atoi(argv[2]);
+	}
+	if(argc > 3){
+		path = argv[3];
+		keep = true;
+	}
+	if(client_count < 1){
+		client_count = 1;
+	}
+	if(msg_total < client_count){
+		msg_total = client_count;
+	}
+
+	fptr = keep?fopen(path, "rb"):NULL;
+	if(fptr){
+		fclose(fptr);
+		printf("Using existing database file %s\n", path);
+	}else{
+		t_start = now();
+		if(generate(path, msg_total, client_count)){
+			fprintf(stderr, "Error generating %s\n", path);
+			return 1;
+		}
+		t_end = now();
+		printf("Generated database:   %d messages, %d clients in %.3f s\n", msg_total, client_count, t_end - t_start);
+	}
+
+	memset(&db, 0, sizeof(db));
+	memset(&config, 0, sizeof(config));
+	db.config = &config;
+	config.persistence = true;
+	config.persistence_filepath = path;
+
+	db.subs = sub__add_hier_entry(NULL, "", 0);
+	retain__init();
+
+	rss_start = rss_kb();
+	t_start = now();
+	rc = persist__restore();
+	t_end = now();
+	rss_end = rss_kb();
+
+	if(rc){
+		fprintf(stderr, "Error restoring %s\n", path);
+		return 1;
+	}
+	HASH_ITER(hh_id, db.contexts_by_id, context, ctxt_tmp){
+		restored_msgs += (unsigned long)context->msgs_out.msg_count;
+	}
+
+	printf("Restore time:         %.3f s\n", t_end - t_start);
+	printf("Restored:             %lu messages, %u clients, %d stored messages\n",
+			restored_msgs, HASH_CNT(hh_id, db.contexts_by_id), db.msg_store_count);
+	printf("Restore RSS:          %ld kB\n", rss_end - rss_start);
+
+	if(!keep){
+		unlink(path);
+	}
+	return 0;
+}
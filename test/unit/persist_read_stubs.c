@@ -8,6 +8,7 @@
 #include <net_mosq.h>
 #include <send_mosq.h>
 #include <time_mosq.h>
+#include <utlist.h>
 
 extern char *last_sub;
 extern int last_qos;
@@ -30,22 +31,20 @@ struct mosquitto *context__init(mosq_sock_t sock)
 
 void db__msg_store_free(struct mosquitto_msg_store *store)
 {
-	int i;
-
 	mosquitto__free(store->source_id);
 	mosquitto__free(store->source_username);
-	if(store->dest_ids){
-		for(i=0; i<store->dest_id_count; i++){
-			mosquitto__free(store->dest_ids[i]);
-		}
-		mosquitto__free(store->dest_ids);
-	}
 	mosquitto__free(store->topic);
 	mosquitto_property_free_all(&store->properties);
 	mosquitto__free(store->payload);
 	mosquitto__free(store);
 }
 
+void db__msg_store_payload_free(struct mosquitto_msg_store *store)
+{
+	mosquitto__free(store->payload);
+	store->payload = NULL;
+}
+
 int db__message_store(const struct mosquitto *source, struct mosquitto_msg_store *stored, uint32_t message_expiry_interval, dbid_t store_id, enum mosquitto_msg_origin origin)
 {
     int rc = MOSQ_ERR_SUCCESS;
@@ -77,8 +76,7 @@ int db__message_store(const struct mosquitto *source, struct mosquitto_msg_store
         stored->message_expiry_time = 0;
     }
 
-    stored->dest_ids = NULL;
-    stored->dest_id_count = 0;
+    stored->delivered = false;
     db.msg_store_count++;
     db.msg_store_bytes += stored->payloadlen;
 
@@ -150,3 +148,65 @@ void db__msg_store_ref_inc(struct mosquitto_msg_store *store)
 	store->ref_count++;
 }
 
+
+void db__message_add_to_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+	DL_APPEND(msg_data->inflight, msg);
+}
+
+void db__message_add_to_queued(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+	DL_APPEND(msg_data->queued, msg);
+}
+
+void db__message_remove_from_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+	DL_DELETE(msg_data->inflight, msg);
+}
+
+void db__message_remove_from_queued(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+	DL_DELETE(msg_data->queued, msg);
+}
+
+void db__msg_store_compact(void)
+{
+}
+
+bool db__ready_for_flight(struct mosquitto_msg_data *msgs, int qos)
+{
+	return true;
+}
+
+int db__message_write_inflight_out_latest(struct mosquitto *context)
+{
+	return MOSQ_ERR_SUCCESS;
+}
+
+bool persist__background_running(void)
+{
+	return false;
+}
+
+int sub__remove(struct mosquitto *context, const char *sub, struct mosquitto__subhier *root, uint8_t *reason)
+{
+	return MOSQ_ERR_SUCCESS;
+}
+
+void context__cleanup(struct mosquitto *context, bool force_free)
+{
+}
+
+char *persist__journal_filename(const char *suffix)
+{
+	return NULL;
+}
+
+int persist__journal_open(uint64_t generation, long valid_length, bool save_needed)
+{
+	return MOSQ_ERR_SUCCESS;
+}
+
+void persist__journal_retain(const char *topic, struct mosquitto_msg_store *stored)
+{
+}
@@ -49,7 +49,7 @@ int acl__find_acls(struct mosquitto *context)
 }
 
 
-int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval, struct mosquitto_msg_store *store)
 {
 	return MOSQ_ERR_SUCCESS;
 }
@@ -68,3 +68,7 @@ int send__pubrel(struct mosquitto *mosq, uint16_t mid, const mosquitto_property
 {
 	return MOSQ_ERR_SUCCESS;
 }
+
+void context__cleanup(struct mosquitto *context, bool force_free)
+{
+}
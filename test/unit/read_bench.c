@@ -0,0 +1,300 @@
+/* Benchmark for reading from a single fast publisher.
+ *
+ * Starts the broker once for each max_packets_per_read value given, then
+ * connects a single client which streams QoS 0 PUBLISH messages as fast as
+ * the socket will take them, followed by a PINGREQ. The time taken for the
+ * PINGRESP to arrive, and the CPU time used by the broker, are reported. A
+ * max_packets_per_read of 1 gives the behaviour from before the option was
+ * added, of one read per wakeup.
+ *
+ * Usage: ./read_bench [messages [payload size [max_packets_per_read ...]]]
+ *
+ * The broker must already have been built in ../../src. It listens on port
+ * 1888 on the loopback interface.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define BROKER_PATH "../../src/mosquitto"
+#define BENCH_PORT 1888
+#define CONFIG_FILE "read_bench.conf"
+#define TOPIC "bench/read"
+#define CHUNK_MESSAGES 256
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec/1e9;
+}
+
+
+/* User plus system CPU time used by a process, in seconds. */
+static double process_cpu(pid_t pid)
+{
+	char path[50];
+	char buf[1024];
+	char *p;
+	FILE *fptr;
+	unsigned long utime, stime;
+	size_t len;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	fptr = fopen(path, "r");
+	if(!fptr) return 0.0;
+	len = fread(buf, 1, sizeof(buf)-1, fptr);
+	fclose(fptr);
+	buf[len] = '\0';
+
+	/* Skip the command name, which may contain spaces. */
+	p = strrchr(buf, ')');
+	if(!p) return 0.0;
+	if(sscanf(p+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2){
+		return 0.0;
+	}
+	return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+
+static size_t encode_length(uint8_t *buf, uint32_t length)
+{
+	size_t i = 0;
+	uint8_t byte;
+
+	do{
+		byte = length % 128;
+		length /= 128;
+		if(length > 0){
+			byte |= 0x80;
+		}
+		buf[i++] = byte;
+	}while(length > 0);
+	return i;
+}
+
+
+static int send_all(int sock, const uint8_t *buf, size_t len)
+{
+	ssize_t rc;
+
+	while(len > 0){
+		rc = send(sock, buf, len, 0);
+		if(rc < 0){
+			if(errno == EINTR) continue;
+			return 1;
+		}
+		buf += rc;
+		len -= (size_t)rc;
+	}
+	return 0;
+}
+
+
+static int recv_exact(int sock, uint8_t *buf, size_t len)
+{
+	ssize_t rc;
+
+	while(len > 0){
+		rc = recv(sock, buf, len, 0);
+		if(rc <= 0){
+			if(rc < 0 && errno == EINTR) continue;
+			return 1;
+		}
+		buf += rc;
+		len -= (size_t)rc;
+	}
+	return 0;
+}
+
+
+static pid_t broker_start(int max_packets_per_read)
+{
+	FILE *fptr;
+	pid_t pid;
+
+	fptr = fopen(CONFIG_FILE, "w");
+	if(!fptr) return -1;
+	fprintf(fptr, "listener %d 127.0.0.1\n", BENCH_PORT);
+	fprintf(fptr, "allow_anonymous true\n");
+	fprintf(fptr, "log_dest none\n");
+	fprintf(fptr, "max_packets_per_read %d\n", max_packets_per_read);
+	fclose(fptr);
+
+	pid = fork();
+	if(pid == 0){
+		execl(BROKER_PATH, BROKER_PATH, "-c", CONFIG_FILE, (char *)NULL);
+		_exit(1);
+	}
+	return pid;
+}
+
+
+static int client_connect(void)
+{
+	struct sockaddr_in addr;
+	uint8_t connect_packet[] = {
+		0x10, 21,
+		0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 60,
+		0, 9, 'r', 'e', 'a', 'd', 'b', 'e', 'n', 'c', 'h'
+	};
+	uint8_t connack[4];
+	int sock;
+	int i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(BENCH_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	/* Give the broker time to start listening. */
+	for(i=0; i<50; i++){
+		sock = socket(AF_INET, SOCK_STREAM, 0);
+		if(sock < 0) return -1;
+		if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0){
+			break;
+		}
+		close(sock);
+		sock = -1;
+		usleep(100000);
+	}
+	if(sock < 0) return -1;
+
+	if(send_all(sock, connect_packet, sizeof(connect_packet))
+			|| recv_exact(sock, connack, sizeof(connack))
+			|| connack[0] != 0x20 || connack[3] != 0){
+
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+
+static int run(int max_packets_per_read, int message_count, int payload_size)
+{
+	uint8_t *chunk, *p;
+	uint8_t header[5];
+	uint8_t pingreq[2] = {0xC0, 0};
+	uint8_t pingresp[2];
+	size_t header_len, packet_len;
+	uint32_t remaining_length;
+	double t_start, t_end, cpu_start, cpu_end;
+	pid_t pid;
+	int sock;
+	int i, sent, count;
+	int rc = 1;
+
+	remaining_length = (uint32_t)(2 + strlen(TOPIC) + (size_t)payload_size);
+	header[0] = 0x30;
+	header_len = 1 + encode_length(&header[1], remaining_length);
+	packet_len = header_len + remaining_length;
+
+	/* Every message is the same, so build a chunk of them once. */
+	chunk = malloc(packet_len * CHUNK_MESSAGES);
+	if(!chunk) return 1;
+	p = chunk;
+	for(i=0; i<CHUNK_MESSAGES; i++){
+		memcpy(p, header, header_len);
+		p += header_len;
+		p[0] = 0;
+		p[1] = (uint8_t)strlen(TOPIC);
+		memcpy(&p[2], TOPIC, strlen(TOPIC));
+		p += 2 + strlen(TOPIC);
+		memset(p, 'x', (size_t)payload_size);
+		p += payload_size;
+	}
+
+	pid = broker_start(max_packets_per_read);
+	if(pid < 0){
+		free(chunk);
+		return 1;
+	}
+	sock = client_connect();
+	if(sock < 0){
+		fprintf(stderr, "Error connecting to broker.\n");
+		goto cleanup;
+	}
+
+	cpu_start = process_cpu(pid);
+	t_start = now();
+	for(sent=0; sent<message_count; sent+=count){
+		count = message_count - sent;
+		if(count > CHUNK_MESSAGES) count = CHUNK_MESSAGES;
+		if(send_all(sock, chunk, packet_len * (size_t)count)){
+			fprintf(stderr, "Error sending.\n");
+			goto cleanup;
+		}
+	}
+	/* The broker handles packets in order, so the PINGRESP means every
+	 * message has been processed. */
+	if(send_all(sock, pingreq, sizeof(pingreq))
+			|| recv_exact(sock, pingresp, sizeof(pingresp))
+			|| pingresp[0] != 0xD0){
+
+		fprintf(stderr, "Error waiting for PINGRESP.\n");
+		goto cleanup;
+	}
+	t_end = now();
+	cpu_end = process_cpu(pid);
+
+	printf("max_packets_per_read %-6d %10.0f msg/s   %6.2f us broker CPU/msg\n",
+			max_packets_per_read,
+			message_count / (t_end - t_start),
+			(cpu_end - cpu_start) * 1e6 / message_count);
+	rc = 0;
+
+cleanup:
+	if(sock >= 0) close(sock);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	unlink(CONFIG_FILE);
+	free(chunk);
+	return rc;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int message_count = 2000000;
+	int payload_size = 100;
+	int default_budgets[] = {1, 1000};
+	int i;
+
+	if(argc > 1){
+		message_count = atoi(argv[1]);
+	}
+	if(argc > 2){
+		payload_size = atoi(argv[2]);
+	}
+	if(message_count < 1 || payload_size < 0){
+		fprintf(stderr, "Usage: %s [messages [payload size [max_packets_per_read ...]]]\n", argv[0]);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%d messages, %d byte payload\n", message_count, payload_size);
+	if(argc > 3){
+		for(i=3; i<argc; i++){
+			if(run(atoi(argv[i]), message_count, payload_size)) return 1;
+		}
+	}else{
+		for(i=0; i<(int)(sizeof(default_budgets)/sizeof(default_budgets[0])); i++){
+			if(run(default_budgets[i], message_count, payload_size)) return 1;
+		}
+	}
+	return 0;
+}
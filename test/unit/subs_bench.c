@@ -0,0 +1,253 @@
+/* Benchmark for subscription matching.
+ *
+ * Builds a subscription tree shaped like a typical deployment - many devices
+ * each subscribing to their own topics, plus a smaller number of wildcard
+ * subscriptions - then reports the memory used by the tree and how quickly
+ * published topics can be matched against it.
+ *
+ * Usage: ./subs_bench [subscriptions [publishes [cache_size [hot_clients]]]]
+ *
+ * cache_size sets subscription_cache_size. hot_clients limits publishes to
+ * the topics of that many clients, to model a working set of hot topics.
+ *
+ * To compare two versions of the broker, build and run this against each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "util_mosq.h"
+
+#define SUBS_PER_CLIENT 10
+#define SITES 100
+
+struct mosquitto_db db;
+
+static unsigned long deliveries = 0;
+
+
+/* ========================================================================
+ * Stubs
+ * ======================================================================== */
+
+int log__printf(struct mosquitto *mosq, unsigned int priority, const char *fmt, ...)
+{
+	UNUSED(mosq);
+	UNUSED(priority);
+	UNUSED(fmt);
+	return 0;
+}
+
+int mosquitto_acl_check(struct mosquitto *context, const char *topic, uint32_t payloadlen, void* payload, uint8_t qos, bool retain, int access)
+{
+	UNUSED(context);
+	UNUSED(topic);
+	UNUSED(payloadlen);
+	UNUSED(payload);
+	UNUSED(qos);
+	UNUSED(retain);
+	UNUSED(access);
+	return MOSQ_ERR_SUCCESS;
+}
+
+uint16_t mosquitto__mid_generate(struct mosquitto *mosq)
+{
+	UNUSED(mosq);
+	return 1;
+}
+
+int mosquitto_property_add_varint(mosquitto_property **proplist, int identifier, uint32_t value)
+{
+	UNUSED(proplist);
+	UNUSED(identifier);
+	UNUSED(value);
+	return MOSQ_ERR_SUCCESS;
+}
+
+int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_msg_direction dir, uint8_t qos, bool retain, struct mosquitto_msg_store *stored, mosquitto_property *properties, bool update)
+{
+	UNUSED(context);
+	UNUSED(mid);
+	UNUSED(dir);
+	UNUSED(qos);
+	UNUSED(retain);
+	UNUSED(stored);
+	UNUSED(properties);
+	UNUSED(update);
+	deliveries++;
+	return MOSQ_ERR_SUCCESS;
+}
+
+void db__msg_store_ref_inc(struct mosquitto_msg_store *store)
+{
+	store->ref_count++;
+}
+
+void db__msg_store_ref_dec(struct mosquitto_msg_store **store)
+{
+	(*store)->ref_count--;
+}
+
+int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **split_topics)
+{
+	UNUSED(topic);
+	UNUSED(stored);
+	UNUSED(split_topics);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* ========================================================================
+ * Benchmark
+ * ======================================================================== */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec/1e9;
+}
+
+
+static long rss_kb(void)
+{
+	FILE *fptr;
+	char line[256];
+	long rss = 0;
+
+	fptr = fopen("/proc/self/status", "r");
+	if(!fptr) return 0;
+	while(fgets(line, sizeof(line), fptr)){
+		if(!strncmp(line, "VmRSS:", 6)){
+			rss = atol(&line[6]);
+			break;
+		}
+	}
+	fclose(fptr);
+	return rss;
+}
+
+
+static const char *measurements[SUBS_PER_CLIENT] = {
+	"temperature", "humidity", "pressure", "battery", "status",
+	"firmware", "config", "command", "alarm", "location"
+};
+
+
+int main(int argc, char *argv[])
+{
+	struct mosquitto__config config;
+	struct mosquitto *contexts;
+	struct mosquitto_msg_store stored, *stored_ptr;
+	char topic[200];
+	int sub_total = 1000000;
+	int pub_total = 1000000;
+	int client_count;
+	int hot_clients;
+	int i, j;
+	long rss_start, rss_end;
+	double t_start, t_end;
+
+	if(argc > 1){
+		sub_total = atoi(argv[1]);
+	}
+	if(argc > 2){
+		pub_total = atoi(argv[2]);
+	}
+	client_count = sub_total / SUBS_PER_CLIENT;
+	if(client_count < 1){
+		client_count = 1;
+	}
+	hot_clients = client_count;
+	if(argc > 4){
+		hot_clients = atoi(argv[4]);
+		if(hot_clients < 1 || hot_clients > client_count){
+			hot_clients = client_count;
+		}
+	}
+
+	memset(&db, 0, sizeof(db));
+	memset(&config, 0, sizeof(config));
+	memset(&stored, 0, sizeof(stored));
+	db.config = &config;
+	if(argc > 3){
+		config.subscription_cache_size = atoi(argv[3]);
+	}
+
+	contexts = calloc((size_t)client_count, sizeof(struct mosquitto));
+	if(!contexts) return 1;
+	for(i=0; i<client_count; i++){
+		snprintf(topic, sizeof(topic), "client-%d", i);
+		contexts[i].id = strdup(topic);
+		contexts[i].protocol = mosq_p_mqtt311;
+	}
+
+	rss_start = rss_kb();
+	t_start = now();
+
+	db.subs = sub__add_hier_entry(NULL, "", 0);
+	for(i=0; i<client_count; i++){
+		/* Each client subscribes to its own device topics, with every
+		 * hundredth client watching a whole site with wildcards instead. */
+		for(j=0; j<SUBS_PER_CLIENT; j++){
+			if(i % 100 == 0){
+				if(j == 0){
+					snprintf(topic, sizeof(topic), "site/%d/#", (i/100) % SITES);
+				}else{
+					snprintf(topic, sizeof(topic), "site/%d/+/%s", (i/100) % SITES, measurements[j]);
+				}
+			}else{
+				snprintf(topic, sizeof(topic), "site/%d/device-%d/%s", i % SITES, i, measurements[j]);
+			}
+			if(sub__add(&contexts[i], topic, 0, 0, 0, &db.subs) != MOSQ_ERR_SUCCESS){
+				fprintf(stderr, "Error adding subscription %s\n", topic);
+				return 1;
+			}
+		}
+	}
+
+	t_end = now();
+	rss_end = rss_kb();
+
+	printf("Subscriptions:        %d (%d clients)\n", client_count*SUBS_PER_CLIENT, client_count);
+	printf("Add time:             %.3f s\n", t_end - t_start);
+	printf("Tree RSS:             %ld kB (%.1f bytes/subscription)\n",
+			rss_end - rss_start, (double)(rss_end - rss_start)*1024.0/(client_count*SUBS_PER_CLIENT));
+
+	srand(1);
+	t_start = now();
+	for(i=0; i<pub_total; i++){
+		j = rand() % hot_clients;
+		snprintf(topic, sizeof(topic), "site/%d/device-%d/%s", j % SITES, j, measurements[rand() % SUBS_PER_CLIENT]);
+		stored_ptr = &stored;
+		sub__messages_queue("publisher", topic, 0, 0, &stored_ptr);
+	}
+	t_end = now();
+
+	printf("Publishes:            %d\n", pub_total);
+	printf("Deliveries:           %lu\n", deliveries);
+	printf("Match rate:           %.0f publishes/s\n", pub_total/(t_end - t_start));
+	if(config.subscription_cache_size > 0){
+		printf("Cache hits/misses:    %llu/%llu\n",
+				(unsigned long long)db.subscription_cache_hits,
+				(unsigned long long)db.subscription_cache_misses);
+	}
+
+	t_start = now();
+	for(i=0; i<client_count; i++){
+		sub__clean_session(&contexts[i]);
+		free(contexts[i].id);
+	}
+	t_end = now();
+	printf("Remove time:          %.3f s\n", t_end - t_start);
+
+	sub__tree_clean(&db.subs);
+	free(contexts);
+
+	return 0;
+}
@@ -68,7 +68,7 @@ int acl__find_acls(struct mosquitto *context)
 #endif
 
 
-int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval, struct mosquitto_msg_store *store)
 {
 	return MOSQ_ERR_SUCCESS;
 }
@@ -115,6 +115,18 @@ int persist__restore(void)
 	return MOSQ_ERR_SUCCESS;
 }
 
+void persist__journal_msg_add(struct mosquitto *context, struct mosquitto_client_msg *msg)
+{
+}
+
+void persist__journal_msg_update(struct mosquitto *context, struct mosquitto_client_msg *msg)
+{
+}
+
+void persist__journal_msg_delete(struct mosquitto *context, struct mosquitto_client_msg *msg)
+{
+}
+
 void mosquitto_property_free_all(mosquitto_property **properties)
 {
 }
@@ -128,6 +140,10 @@ void retain__clean(struct mosquitto__retainhier **retainhier)
 {
 }
 
+void retain__evict_cleanup(void)
+{
+}
+
 int retain__queue(struct mosquitto *context, const char *sub, uint8_t sub_qos, uint32_t subscription_identifier)
 {
 	return MOSQ_ERR_SUCCESS;
@@ -25,13 +25,18 @@ static void hier_quick_check(struct mosquitto__subhier **sub, struct mosquitto *
 		if(context){
 			CU_ASSERT_PTR_NOT_NULL((*sub)->subs);
 			if((*sub)->subs){
-				CU_ASSERT_PTR_EQUAL((*sub)->subs->context, context);
-				CU_ASSERT_PTR_NULL((*sub)->subs->next);
+				CU_ASSERT_PTR_EQUAL((*sub)->subs[0].context, context);
+				CU_ASSERT_EQUAL((*sub)->sub_count, 1);
 			}
 		}else{
 			CU_ASSERT_PTR_NULL((*sub)->subs);
 		}
-		(*sub) = (*sub)->children;
+		if((*sub)->child_count){
+			CU_ASSERT_EQUAL((*sub)->child_count, 1);
+			(*sub) = (*sub)->children[0];
+		}else{
+			(*sub) = NULL;
+		}
 	}
 }
 